@@ -0,0 +1,754 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+
+#include "hal_host.h"
+#include "driver.h"
+#include "pulse.h"
+#include "usonic.h"
+#include "actuation.h"
+#include "edge_ring.h"
+#include "snapshot.h"
+#include "odometry.h"
+#include "kinematics.h"
+#include "mailbox.h"
+#include "control.h"
+
+#define BENCH_SECONDS       600         /* virtual time of the drive */
+#define BENCH_ROUNDS        1000000     /* conversions per benchmark of actuation.c */
+#define BENCH_EDGES         20000000    /* edges through the ring of the stress test */
+#define EDGE_CHECK          0xa5a5a5a5  /* low word of an edge = high word ^ EDGE_CHECK */
+#define BENCH_PUBLISHES     20000000    /* versions through the snapshot of the stress test */
+#define SNAPSHOT_READERS    2
+#define SNAPSHOT_WORDS      64          /* about the size of car_state_t */
+#define BENCH_GUARD_TRIPS   1000        /* echoes of an obstacle in front of the driving car */
+#define GUARD_ECHO_CM       (GUARD_DIST_MIN / 2)
+#define BENCH_BURSTS        1000        /* bursts of commands at the mailbox */
+#define BURST_EVENTS        (MAILBOX_EVENTS + MAILBOX_EVENTS / 2)   /* more than fit */
+#define BURST_PERIOD_US     (1000000 / CONTROL_RATE_HZ)             /* of the loop, and between bursts */
+#define BURST_EVENT         1           /* numbered, may be dropped */
+#define BURST_STOP          2           /* ends every burst, latched when the ring is full */
+#define JITTER_SECONDS      10          /* wall time of every phase of the jitter test */
+#define JITTER_LOAD_THREADS 4           /* clients polling the status, in the place of the web server */
+#define JITTER_STATUS_KEYS  80          /* numbers in a status, about those of /car_status */
+
+/*
+ *  The driver, pulse and usonic stack on the host HAL, driven by a fixed
+ *  command script. Reports how much faster than real time the firmware
+ *  runs and the cost of the conversions of actuation.c and of a pose
+ *  update of odometry.c on the host.
+ *  Then BENCH_GUARD_TRIPS echoes of an obstacle right in front of the car
+ *  time the collision guard from the falling edge of the echo to the
+ *  write of the brake pins.
+ *
+ *  bench ring [edges] instead hammers the edge ring of pulse.c from two
+ *  threads - one in the place of the isr, one in the place of the pulse
+ *  task - and checks that no time comes torn, out of order or lost.
+ *
+ *  bench snapshot [publishes] does the same to the state snapshot of the
+ *  control loop - one writer, SNAPSHOT_READERS readers, and a checksum in
+ *  every version that a torn copy fails.
+ *
+ *  bench burst [bursts] throws BURST_EVENTS commands at once at the
+ *  mailbox of the control loop, more than it holds, at a random time of
+ *  every loop period. A thread in the place of the control loop takes
+ *  them every BURST_PERIOD_US. Every burst ends with a stop. Reports the
+ *  latency from the post to the pickup and the events dropped, and checks
+ *  that none come out of order and that no burst goes without its stop.
+ *
+ *  bench jitter [seconds] runs a loop at CONTROL_RATE_HZ on the wall clock,
+ *  a tick publishes a state snapshot and updates an odometry. It is timed
+ *  by control.c like the driver task - idle, then with JITTER_LOAD_THREADS
+ *  threads that read the snapshot and print it as JSON as fast as they
+ *  can, once with the loop at a normal priority and once at a real-time
+ *  one.
+ */
+
+typedef struct {
+    edge_ring_t     ring;
+    uint32_t        edges;
+    uint32_t        pushes;             /* retries of the first half too */
+    _Atomic bool    done;
+    uint32_t        popped;
+    uint32_t        torn;
+    uint32_t        disorder;
+} ring_stress_t;
+
+typedef struct {
+    uint32_t        version;
+    uint32_t        word[SNAPSHOT_WORDS];
+    uint32_t        checksum;
+} snapshot_data_t;
+
+typedef struct {
+    snapshot_t      snapshot;
+    uint32_t        publishes;
+    _Atomic bool    done;
+    uint32_t        reads[SNAPSHOT_READERS];
+    uint32_t        torn[SNAPSHOT_READERS];
+    uint32_t        disorder[SNAPSHOT_READERS];
+} snapshot_stress_t;
+
+typedef struct {
+    snapshot_stress_t  *stress;
+    int                 reader;
+} snapshot_reader_t;
+
+typedef struct {
+    mailbox_t       mailbox;
+    uint32_t        bursts;
+    _Atomic bool    done;
+    uint32_t        posted;
+    uint32_t        refused;            /* post returned false */
+    uint32_t        taken;
+    uint32_t        disorder;
+    uint32_t        stops;              /* taken, from the ring or latched */
+    uint32_t        stops_latched;
+    uint32_t        stops_lost;         /* a burst not followed by a stop */
+    uint32_t       *latency_us;         /* of every event taken */
+} burst_stress_t;
+
+typedef struct {
+    snapshot_t      state;              /* car_state_t, as the control loop publishes it */
+    _Atomic bool    done;
+    _Atomic uint32_t statuses;          /* printed by the load threads */
+} jitter_bench_t;
+
+typedef struct {
+    const char     *name;
+    uint32_t        load_threads;
+    bool            realtime;           /* the loop at SCHED_FIFO */
+} jitter_phase_t;
+
+typedef struct {
+    uint32_t        echo;               /* hal_cycles() at the edge, 0 - braked */
+    uint32_t        ns[BENCH_GUARD_TRIPS];
+    uint32_t        trips;
+} guard_bench_t;
+
+static guard_bench_t guard_bench;
+
+static double wall_time() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the first brake pin the guard drives high after the echo */
+static void guard_pin_hook(int pin, uint32_t level, void *arg) {
+
+    guard_bench_t *bench = (guard_bench_t*)arg;
+
+    if (bench->echo == 0 || !level || (pin != LEFT_MOTOR_GPIO_1 && pin != LEFT_MOTOR_GPIO_2)) return;
+
+    bench->ns[bench->trips++] = hal_cycles() - bench->echo;
+    bench->echo = 0;
+}
+
+/* ns per odometry_update() - wheel distances of a drive at 1 m/s, every steering angle in turn */
+static double odometry_bench(uint32_t rounds) {
+
+    kinematics_t kinematics;
+    odometry_t odometry;
+    float curvature[KINEMATICS_ANGLES];
+    double start;
+
+    kinematics_init(&kinematics, WHEEL_BASE, TRACK_WIDTH, STEERING_RATIO);
+    for (int i = 0; i < KINEMATICS_ANGLES; i++) curvature[i] = kinematics_curvature(&kinematics, STEERING_ANGLE_MIN + i);
+
+    odometry_init(&odometry, TRACK_WIDTH);
+
+    start = wall_time();
+
+    for (uint32_t round = 0; round < rounds; round++) {
+        odometry_update(&odometry, 20.0f + (round & 3), 20.0f + (round >> 2 & 3),
+                        curvature[round % KINEMATICS_ANGLES]);
+    }
+
+    return (wall_time() - start) * 1e9 / rounds;
+}
+
+static int compare_u32(const void *a, const void *b) {
+
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* driving forward, an echo GUARD_ECHO_CM away - what the car sees of a wall it is about to hit */
+static void guard(uint32_t trips) {
+
+    car_state_t state;
+    uint32_t p50, p99;
+
+    memset(&guard_bench, 0, sizeof(guard_bench_t));
+    hal_host_pin_hook(guard_pin_hook, &guard_bench);
+
+    for (uint32_t trip = 0; trip < trips && guard_bench.trips < BENCH_GUARD_TRIPS; trip++) {
+        set_speed_car(200);
+        forward_start_car();
+        /* the control loop arms the guard */
+        vTaskDelay(100/portTICK_PERIOD_MS);
+        hal_host_pin_input(ECHO_GPIO, 1);
+        hal_delay_us(GUARD_ECHO_CM * 58);
+        guard_bench.echo = hal_cycles();
+        hal_host_pin_input(ECHO_GPIO, 0);
+        guard_bench.echo = 0;
+        vTaskDelay(100/portTICK_PERIOD_MS);
+        stop_car();
+    }
+
+    hal_host_pin_hook(NULL, NULL);
+
+    get_state_car(&state);
+
+    printf("latency us last / max: command %u / %u, steering %u / %u, guard %u / %u\n",
+           state.cmd_latency_us, state.cmd_latency_max_us, state.steering_latency_us, state.steering_latency_max_us,
+           state.guard_latency_us, state.guard_latency_max_us);
+
+    if (guard_bench.trips == 0) {
+        printf("guard echo -> brake: no trips of %u\n", trips);
+        return;
+    }
+
+    qsort(guard_bench.ns, guard_bench.trips, sizeof(uint32_t), compare_u32);
+    p50 = guard_bench.ns[guard_bench.trips / 2];
+    p99 = guard_bench.ns[guard_bench.trips * 99 / 100];
+
+    printf("guard echo -> brake ns p50 %u, p99 %u, max %u, trips %u of %u\n",
+           p50, p99, guard_bench.ns[guard_bench.trips - 1], guard_bench.trips, trips);
+}
+
+static void drive(void *param) {
+
+    uint32_t seconds = *(uint32_t*)param;
+    car_state_t state;
+    double start, wall;
+
+    init_usonic();
+    init_driver();
+    init_pulse();
+
+    start = wall_time();
+
+    for (uint32_t second = 0; second < seconds; second++) {
+        switch (second % 10) {
+            case 0:
+                forward_start_car();
+                break;
+            case 2:
+                set_speed_car(200);
+                break;
+            case 3:
+                turn_left_car();
+                break;
+            case 5:
+                turn_stop_car();
+                set_speed_car(80);
+                break;
+            case 6:
+                forward_stop_car();
+                back_start_car();
+                break;
+            case 8:
+                stop_car();
+                break;
+        }
+        vTaskDelay(1000/portTICK_PERIOD_MS);
+    }
+
+    wall = wall_time() - start;
+
+    get_state_car(&state);
+
+    printf("%u s of virtual time in %.3f s, %.0f x real time\n", seconds, wall, seconds / wall);
+    printf("%.0f control ticks/s, %.2f us per tick\n",
+           seconds * CONTROL_RATE_HZ / wall, wall * 1e6 / (seconds * CONTROL_RATE_HZ));
+    printf("loop jitter on the virtual clock avg %u us, max %u us, late %u of %u, overruns %u, missed %u\n",
+           state.loop_jitter_avg_us, state.loop_jitter_max_us, state.loop_jitter_late, state.loop_samples,
+           state.loop_overruns, state.loop_missed);
+
+    guard(BENCH_GUARD_TRIPS);
+}
+
+/*
+ *  The isr - every edge is its number in the high word and a check in the
+ *  low one. The first half waits for room, so the ring runs full and wraps
+ *  all the time, the second half does not wait and overflows.
+ */
+static void *ring_producer(void *param) {
+
+    ring_stress_t *stress = (ring_stress_t*)param;
+    uint64_t time;
+
+    for (uint32_t edge = 1; edge <= stress->edges; edge++) {
+        time = ((uint64_t)edge << 32) | (edge ^ EDGE_CHECK);
+        stress->pushes++;
+        if (edge <= stress->edges / 2) {
+            while (!edge_ring_push(&(stress->ring), time)) {
+                stress->pushes++;
+                sched_yield();
+            }
+        } else {
+            edge_ring_push(&(stress->ring), time);
+        }
+    }
+
+    atomic_store(&(stress->done), true);
+
+    return NULL;
+}
+
+/* the pulse task */
+static void *ring_consumer(void *param) {
+
+    ring_stress_t *stress = (ring_stress_t*)param;
+    uint64_t time;
+    uint32_t edge, last = 0;
+    bool done;
+
+    do {
+        done = atomic_load(&(stress->done));
+        while (edge_ring_pop(&(stress->ring), &time)) {
+            edge = time >> 32;
+            if ((uint32_t)time != (edge ^ EDGE_CHECK)) stress->torn++;
+            if (edge <= last) stress->disorder++;
+            last = edge;
+            stress->popped++;
+        }
+        sched_yield();
+    } while (!done);
+
+    return NULL;
+}
+
+static uint32_t snapshot_checksum(const snapshot_data_t *data) {
+
+    uint32_t sum = data->version;
+
+    for (int i = 0; i < SNAPSHOT_WORDS; i++) sum = (sum << 5 | sum >> 27) ^ data->word[i];
+
+    return sum;
+}
+
+/* the control loop - every version different in every word */
+static void *snapshot_writer(void *param) {
+
+    snapshot_stress_t *stress = (snapshot_stress_t*)param;
+    snapshot_data_t data;
+
+    for (uint32_t version = 1; version <= stress->publishes; version++) {
+        data.version = version;
+        for (int i = 0; i < SNAPSHOT_WORDS; i++) data.word[i] = version * 2654435761u + i;
+        data.checksum = snapshot_checksum(&data);
+        snapshot_publish(&(stress->snapshot), &data);
+    }
+
+    atomic_store(&(stress->done), true);
+
+    return NULL;
+}
+
+/* the web server and the autopilot */
+static void *snapshot_reader(void *param) {
+
+    snapshot_reader_t *reader = (snapshot_reader_t*)param;
+    snapshot_stress_t *stress = reader->stress;
+    snapshot_data_t data;
+    uint32_t last = 0;
+    bool done;
+
+    do {
+        done = atomic_load(&(stress->done));
+        snapshot_read(&(stress->snapshot), &data);
+        if (data.version && data.checksum != snapshot_checksum(&data)) stress->torn[reader->reader]++;
+        if (data.version < last) stress->disorder[reader->reader]++;
+        last = data.version;
+        stress->reads[reader->reader]++;
+    } while (!done);
+
+    return NULL;
+}
+
+static int snapshot_stress(uint32_t publishes) {
+
+    snapshot_stress_t stress;
+    snapshot_reader_t readers[SNAPSHOT_READERS];
+    pthread_t writer, reader[SNAPSHOT_READERS];
+    uint32_t reads = 0, torn = 0, disorder = 0;
+    double start, wall;
+
+    memset(&stress, 0, sizeof(snapshot_stress_t));
+    if (!snapshot_init(&(stress.snapshot), sizeof(snapshot_data_t))) {
+        printf("FAILED, no memory\n");
+        return 1;
+    }
+    stress.publishes = publishes;
+    atomic_init(&(stress.done), false);
+
+    start = wall_time();
+
+    for (int i = 0; i < SNAPSHOT_READERS; i++) {
+        readers[i].stress = &stress;
+        readers[i].reader = i;
+        pthread_create(&(reader[i]), NULL, snapshot_reader, &(readers[i]));
+    }
+    pthread_create(&writer, NULL, snapshot_writer, &stress);
+    pthread_join(writer, NULL);
+    for (int i = 0; i < SNAPSHOT_READERS; i++) pthread_join(reader[i], NULL);
+
+    wall = wall_time() - start;
+
+    for (int i = 0; i < SNAPSHOT_READERS; i++) {
+        reads += stress.reads[i];
+        torn += stress.torn[i];
+        disorder += stress.disorder[i];
+    }
+
+    printf("%u publishes in %.3f s, %.1f ns per publish\n", publishes, wall, wall * 1e9 / publishes);
+    printf("reads %u by %d readers, retries %u\n", reads, SNAPSHOT_READERS, atomic_load(&(stress.snapshot.retries)));
+    printf("torn %u, out of order %u\n", torn, disorder);
+
+    snapshot_free(&(stress.snapshot));
+
+    if (torn || disorder) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("OK\n");
+
+    return 0;
+}
+
+static uint32_t time_us() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(struct timespec *deadline, uint32_t us) {
+
+    deadline->tv_nsec += us * 1000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_nsec -= 1000000000;
+        deadline->tv_sec++;
+    }
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+}
+
+/* the web server - a burst at a random time of every period, the events numbered */
+static void *burst_producer(void *param) {
+
+    burst_stress_t *stress = (burst_stress_t*)param;
+    struct timespec deadline;
+    uint32_t offset;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    for (uint32_t burst = 0; burst < stress->bursts; burst++) {
+        offset = rand() % BURST_PERIOD_US;
+        sleep_until(&deadline, offset);
+        for (int i = 0; i < BURST_EVENTS; i++) {
+            if (!mailbox_post_event(&(stress->mailbox), BURST_EVENT, stress->posted, time_us())) stress->refused++;
+            stress->posted++;
+        }
+        mailbox_post_latched(&(stress->mailbox), BURST_STOP, 0, time_us());
+        sleep_until(&deadline, BURST_PERIOD_US - offset);
+    }
+
+    atomic_store(&(stress->done), true);
+
+    return NULL;
+}
+
+/* the control loop - takes what is in the mailbox once a period */
+static void *burst_consumer(void *param) {
+
+    burst_stress_t *stress = (burst_stress_t*)param;
+    struct timespec deadline;
+    mailbox_event_t event;
+    uint32_t now, burst = 0, time;
+    int16_t last = -1;
+    bool done, stopped = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    do {
+        done = atomic_load(&(stress->done));
+        sleep_until(&deadline, BURST_PERIOD_US);
+        while (mailbox_get_event(&(stress->mailbox), &event)) {
+            if (event.event == BURST_STOP) {
+                stress->stops++;
+                stopped = true;
+                continue;
+            }
+            now = time_us();
+            mailbox_actuated(&(stress->mailbox), event.time, now);
+            if (stress->taken && (int16_t)(event.value - last) <= 0) stress->disorder++;
+            last = event.value;
+            stress->latency_us[stress->taken++] = now - event.time;
+            /* the first event of the next burst - the last one must have been stopped */
+            if ((uint16_t)event.value / BURST_EVENTS != burst) {
+                if (!stopped) stress->stops_lost++;
+                burst = (uint16_t)event.value / BURST_EVENTS;
+            }
+            stopped = false;
+        }
+        if (mailbox_get_latched(&(stress->mailbox), &time) & BURST_STOP) {
+            stress->stops++;
+            stress->stops_latched++;
+            stopped = true;
+        }
+    } while (!done);
+
+    if (!stopped) stress->stops_lost++;
+
+    return NULL;
+}
+
+static int burst_stress(uint32_t bursts) {
+
+    burst_stress_t stress;
+    pthread_t producer, consumer;
+    uint32_t dropped;
+
+    memset(&stress, 0, sizeof(burst_stress_t));
+    mailbox_init(&(stress.mailbox));
+    stress.bursts = bursts;
+    atomic_init(&(stress.done), false);
+    stress.latency_us = malloc(bursts * BURST_EVENTS * sizeof(uint32_t));
+    if (stress.latency_us == NULL) {
+        printf("FAILED, no memory\n");
+        return 1;
+    }
+
+    pthread_create(&consumer, NULL, burst_consumer, &stress);
+    pthread_create(&producer, NULL, burst_producer, &stress);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    dropped = atomic_load(&(stress.mailbox.dropped));
+
+    printf("%u bursts of %d events, a mailbox of %d, taken every %d us\n",
+           bursts, BURST_EVENTS, MAILBOX_EVENTS, BURST_PERIOD_US);
+    printf("posted %u, taken %u, dropped %u\n", stress.posted, stress.taken, dropped);
+
+    if (stress.taken) {
+        qsort(stress.latency_us, stress.taken, sizeof(uint32_t), compare_u32);
+        printf("post -> pickup us p50 %u, p99 %u, max %u, avg %u\n",
+               stress.latency_us[stress.taken / 2], stress.latency_us[stress.taken * 99 / 100],
+               stress.latency_us[stress.taken - 1], mailbox_latency_avg(&(stress.mailbox)));
+    }
+
+    printf("out of order %u\n", stress.disorder);
+    printf("stops taken %u, %u of them latched, bursts without a stop %u\n",
+           stress.stops, stress.stops_latched, stress.stops_lost);
+
+    free(stress.latency_us);
+
+    if (stress.disorder || stress.stops_lost || dropped != stress.refused || stress.taken + dropped != stress.posted) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("OK\n");
+
+    return 0;
+}
+
+/* a /car_status request - the snapshot as JSON */
+static void *jitter_load(void *param) {
+
+    jitter_bench_t *bench = (jitter_bench_t*)param;
+    car_state_t state;
+    cJSON *root;
+    char key[16], *str;
+
+    while (!atomic_load(&(bench->done))) {
+        snapshot_read(&(bench->state), &state);
+        root = cJSON_CreateObject();
+        for (int i = 0; i < JITTER_STATUS_KEYS; i++) {
+            sprintf(key, "key_%d", i);
+            cJSON_AddNumberToObject(root, key, state.pose.x + i);
+        }
+        str = cJSON_PrintUnformatted(root);
+        free(str);
+        cJSON_Delete(root);
+        atomic_fetch_add(&(bench->statuses), 1);
+    }
+
+    return NULL;
+}
+
+/* seconds of the control loop on the wall clock, with load threads or not */
+static void jitter_phase(jitter_bench_t *bench, const jitter_phase_t *phase, uint32_t seconds) {
+
+    pthread_t load[JITTER_LOAD_THREADS];
+    struct sched_param param = {0};
+    control_loop_t loop;
+    odometry_t odometry;
+    car_state_t state;
+    struct timespec deadline;
+    uint64_t now;
+    int ret = 0;
+
+    memset(&state, 0, sizeof(car_state_t));
+    odometry_init(&odometry, TRACK_WIDTH);
+    atomic_store(&(bench->done), false);
+    atomic_store(&(bench->statuses), 0);
+
+    /* the load threads first, they would inherit the priority */
+    for (uint32_t i = 0; i < phase->load_threads; i++) pthread_create(&load[i], NULL, jitter_load, bench);
+
+    if (phase->realtime) {
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+
+    control_loop_init(&loop, CONTROL_RATE_HZ, wall_time() * 1e6);
+
+    for (uint32_t tick = 0; tick < seconds * CONTROL_RATE_HZ; tick++) {
+        /* the timer of the driver fires on the deadline of the loop, also after a missed period */
+        deadline.tv_sec = loop.deadline_us / 1000000;
+        deadline.tv_nsec = loop.deadline_us % 1000000 * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        now = wall_time() * 1e6;
+        control_loop_tick(&loop, now);
+        odometry_update(&odometry, 20.0f, 21.0f, 0.001f);
+        state.pose.x = odometry.x;
+        state.pose.y = odometry.y;
+        state.loop_samples = loop.samples;
+        snapshot_publish(&(bench->state), &state);
+        control_loop_done(&loop, wall_time() * 1e6);
+    }
+
+    atomic_store(&(bench->done), true);
+    for (uint32_t i = 0; i < phase->load_threads; i++) pthread_join(load[i], NULL);
+
+    if (phase->realtime) {
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    }
+
+    printf("  %-10s %6u  %9u  %9u  %8u  %6u  %7u  %8u\n", phase->name, phase->load_threads,
+           control_loop_jitter_avg(&loop), loop.jitter_max_us, loop.jitter_late, loop.missed, loop.exec_max_us,
+           atomic_load(&(bench->statuses)) / seconds);
+    if (ret) printf("  %-10s no real-time priority - %s, the numbers are those of a normal one\n",
+                    phase->name, strerror(ret));
+}
+
+static int jitter_bench(uint32_t seconds) {
+
+    jitter_bench_t bench;
+    const jitter_phase_t phases[] = {
+            { "idle",     0,                   false },
+            { "load",     JITTER_LOAD_THREADS, false },
+            { "load, rt", JITTER_LOAD_THREADS, true },
+    };
+
+    if (!snapshot_init(&(bench.state), sizeof(car_state_t))) {
+        printf("FAILED, no memory\n");
+        return 1;
+    }
+
+    printf("control loop at %d Hz on the wall clock, %u s a phase, late over %d us\n",
+           CONTROL_RATE_HZ, seconds, CONTROL_JITTER_LATE);
+    printf("  phase      loaders  jitter avg  jitter max  late  missed  exec max  statuses/s\n");
+
+    for (int i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) jitter_phase(&bench, &phases[i], seconds);
+
+    snapshot_free(&(bench.state));
+
+    return 0;
+}
+
+static int ring_stress(uint32_t edges) {
+
+    ring_stress_t stress;
+    edge_ring_stats_t stats;
+    pthread_t producer, consumer;
+    double start, wall;
+
+    memset(&stress, 0, sizeof(ring_stress_t));
+    edge_ring_init(&(stress.ring));
+    stress.edges = edges;
+    atomic_init(&(stress.done), false);
+
+    start = wall_time();
+
+    pthread_create(&consumer, NULL, ring_consumer, &stress);
+    pthread_create(&producer, NULL, ring_producer, &stress);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    wall = wall_time() - start;
+
+    edge_ring_get_stats(&(stress.ring), &stats);
+
+    printf("%u edges in %.3f s, %.1f ns per edge\n", edges, wall, wall * 1e9 / edges);
+    printf("pushes %u, popped %u, overflows %u\n", stats.edges, stress.popped, stats.overflows);
+    printf("torn %u, out of order %u\n", stress.torn, stress.disorder);
+
+    if (stress.torn || stress.disorder || stats.edges != stress.pushes ||
+        stress.popped + stats.overflows != stress.pushes) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("OK\n");
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    uint32_t seconds = BENCH_SECONDS;
+    act_benchmark_t bench;
+
+    if (argc > 1 && strcmp(argv[1], "ring") == 0) {
+        return ring_stress(argc > 2 ? atoi(argv[2]) : BENCH_EDGES);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "snapshot") == 0) {
+        return snapshot_stress(argc > 2 ? atoi(argv[2]) : BENCH_PUBLISHES);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "burst") == 0) {
+        return burst_stress(argc > 2 ? atoi(argv[2]) : BENCH_BURSTS);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "jitter") == 0) {
+        return jitter_bench(argc > 2 ? atoi(argv[2]) : JITTER_SECONDS);
+    }
+
+    if (argc > 1) seconds = atoi(argv[1]);
+
+    esp_log_level_set("*", getenv("BENCH_LOG") ? ESP_LOG_INFO : ESP_LOG_WARN);
+
+    hal_host_run(drive, &seconds);
+
+    act_benchmark(&bench, hal_cycles, BENCH_ROUNDS);
+
+    printf("ns per conversion, legacy / table:\n");
+    printf("  angle -> us    %.2f / %.2f\n", bench.angle_legacy, bench.angle_table);
+    printf("  speed -> duty  %.2f / %.2f\n", bench.speed_legacy, bench.speed_table);
+    printf("  duty -> speed  %.2f / %.2f\n", bench.duty_legacy, bench.duty_fixed);
+    printf("ns per odometry_update() %.2f\n", odometry_bench(BENCH_ROUNDS));
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include "esp_log.h"
+
+#include "hal.h"
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    log_level = level;
+}
+
+/* ms of the virtual clock */
+uint32_t esp_log_timestamp() {
+    return hal_time_us() / 1000;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+
+    va_list args;
+
+    if (level > log_level) return;
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+
+    switch (code) {
+        case ESP_OK:                return "ESP_OK";
+        case ESP_FAIL:              return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+        default:                    return "UNKNOWN ERROR";
+    }
+}
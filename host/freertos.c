@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "hal_host.h"
+
+#define HOST_STACK_SIZE     (256*1024)  /* printf of floats needs more than the car */
+#define HOST_TICK_US        (1000000 / configTICK_RATE_HZ)
+
+/*
+ *  Cooperative scheduler for the FreeRTOS API on the host.
+ *
+ *  Every task is a ucontext. The highest priority ready task runs until it
+ *  blocks or readies a task of a higher priority, equal priorities take
+ *  turns. When no task is ready the virtual clock jumps to the next timer
+ *  or timeout. Timeouts end on a tick like on the car. Nothing depends on
+ *  the real time, so every run is the same.
+ */
+typedef enum {
+    task_ready = 0,
+    task_blocked,
+    task_deleted
+} task_state_t;
+
+struct host_task {
+    ucontext_t          ctx;
+    void               *stack;
+    TaskFunction_t      code;
+    void               *param;
+    UBaseType_t         priority;
+    char                name[configMAX_TASK_NAME_LEN];
+    task_state_t        state;
+    uint64_t            ready_seq;      /* turn among equal priorities  */
+    uint64_t            wake_us;        /* blocked until, UINT64_MAX - no timeout */
+    bool                timed_out;
+    bool                wait_notify;
+    struct host_queue  *wait_queue;
+    uint32_t            notify;
+    struct host_task   *next;
+};
+
+struct host_queue {
+    uint8_t            *buff;
+    UBaseType_t         length;
+    UBaseType_t         item_size;
+    UBaseType_t         head;
+    UBaseType_t         count;
+};
+
+static const char *TAG = "robot_car_freertos";
+
+static ucontext_t scheduler_ctx;
+static struct host_task *tasks = NULL;
+static struct host_task *current = NULL;
+static uint64_t ready_seq = 0;
+static bool main_done = false;
+
+/*--------------------------------------Scheduler-----------------------------------------------*/
+
+static void make_ready(struct host_task *task) {
+
+    if (task->state != task_blocked) return;
+
+    task->state = task_ready;
+    task->ready_seq = ready_seq++;
+    task->wait_notify = false;
+    task->wait_queue = NULL;
+}
+
+/* back to the scheduler, the task stays ready and goes behind its equals */
+static void yield() {
+
+    current->ready_seq = ready_seq++;
+    swapcontext(&(current->ctx), &scheduler_ctx);
+}
+
+/* a task of a higher priority got ready - it runs first, like on the car */
+static void preempt(struct host_task *task) {
+
+    if (current && task->state == task_ready && task->priority > current->priority) yield();
+}
+
+/* false on timeout */
+static bool block(uint64_t wake_us) {
+
+    if (current == NULL) {
+        ESP_LOGE(TAG, "Blocking call outside a task. (%s:%u)", __FILE__, __LINE__);
+        abort();
+    }
+
+    current->state = task_blocked;
+    current->wake_us = wake_us;
+    current->timed_out = false;
+
+    swapcontext(&(current->ctx), &scheduler_ctx);
+
+    return !current->timed_out;
+}
+
+/* the tick when a wait of ticks ends */
+static uint64_t deadline(TickType_t ticks) {
+
+    if (ticks == portMAX_DELAY) return UINT64_MAX;
+
+    return (hal_time_us() / HOST_TICK_US + ticks) * HOST_TICK_US;
+}
+
+static struct host_task *next_ready() {
+
+    struct host_task *best = NULL;
+
+    for (struct host_task *task = tasks; task; task = task->next) {
+        if (task->state != task_ready) continue;
+        if (best == NULL || task->priority > best->priority ||
+            (task->priority == best->priority && task->ready_seq < best->ready_seq)) {
+            best = task;
+        }
+    }
+
+    return best;
+}
+
+static void reap() {
+
+    struct host_task **last = &tasks, *task;
+
+    while (*last) {
+        task = *last;
+        if (task->state == task_deleted && task != current) {
+            *last = task->next;
+            free(task->stack);
+            free(task);
+        } else {
+            last = &(task->next);
+        }
+    }
+}
+
+/* moves the clock to the next timer or timeout and runs it */
+static bool advance() {
+
+    uint64_t next = hal_host_timer_next();
+    uint64_t now;
+
+    for (struct host_task *task = tasks; task; task = task->next) {
+        if (task->state == task_blocked && task->wake_us < next) next = task->wake_us;
+    }
+
+    if (next == UINT64_MAX) return false;
+
+    hal_host_set_time(next);
+    hal_host_timer_run();
+
+    now = hal_time_us();
+
+    for (struct host_task *task = tasks; task; task = task->next) {
+        if (task->state == task_blocked && task->wake_us <= now) {
+            make_ready(task);
+            task->timed_out = true;
+        }
+    }
+
+    return true;
+}
+
+static void main_task_entry(void *param) {
+
+    void **args = (void**)param;
+
+    ((TaskFunction_t)args[0])(args[1]);
+}
+
+static void task_entry() {
+
+    current->code(current->param);
+
+    /* a FreeRTOS task never returns, only the main task does */
+    if (current->code == main_task_entry) main_done = true;
+    vTaskDelete(NULL);
+}
+
+void hal_host_run(TaskFunction_t main_task, void *param) {
+
+    struct host_task *task;
+    void *args[2] = { (void*)main_task, param };
+
+    main_done = false;
+
+    if (xTaskCreate(main_task_entry, "main", 4096, args, 1, NULL) != pdPASS) return;
+
+    while (!main_done) {
+        task = next_ready();
+        if (task) {
+            current = task;
+            swapcontext(&scheduler_ctx, &(task->ctx));
+            current = NULL;
+            reap();
+        } else if (!advance()) {
+            ESP_LOGE(TAG, "All tasks wait forever. (%s:%u)", __FILE__, __LINE__);
+            return;
+        }
+    }
+}
+
+/*--------------------------------------Tasks---------------------------------------------------*/
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth,
+                       void *param, UBaseType_t priority, TaskHandle_t *handle) {
+
+    struct host_task *task, **last;
+
+    if (handle) *handle = NULL;
+
+    task = malloc(sizeof(struct host_task));
+    if (task == NULL) return pdFAIL;
+
+    memset(task, 0, sizeof(struct host_task));
+
+    task->stack = malloc(HOST_STACK_SIZE);
+    if (task->stack == NULL) {
+        free(task);
+        return pdFAIL;
+    }
+
+    task->code = code;
+    task->param = param;
+    task->priority = priority;
+    strncpy(task->name, name, configMAX_TASK_NAME_LEN-1);
+    task->state = task_ready;
+    task->ready_seq = ready_seq++;
+
+    getcontext(&(task->ctx));
+    task->ctx.uc_stack.ss_sp = task->stack;
+    task->ctx.uc_stack.ss_size = HOST_STACK_SIZE;
+    task->ctx.uc_link = NULL;
+    makecontext(&(task->ctx), task_entry, 0);
+
+    for (last = &tasks; *last; last = &((*last)->next));
+    *last = task;
+
+    if (handle) *handle = task;
+
+    preempt(task);
+
+    return pdPASS;
+}
+
+/* one core on the host */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth,
+                                   void *param, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    return xTaskCreate(code, name, stack_depth, param, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+
+    if (task == NULL) task = current;
+    if (task == NULL) return;
+
+    task->state = task_deleted;
+
+    if (task == current) {
+        swapcontext(&(current->ctx), &scheduler_ctx);
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+
+    if (ticks == 0) {
+        if (current) yield();
+        return;
+    }
+
+    block(deadline(ticks));
+}
+
+TickType_t xTaskGetTickCount() {
+    return hal_time_us() / HOST_TICK_US;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return current;
+}
+
+static void notify(TaskHandle_t task) {
+
+    task->notify++;
+
+    if (task->wait_notify) make_ready(task);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+
+    notify(task);
+    preempt(task);
+
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+
+    notify(task);
+
+    if (woken && task->state == task_ready && (current == NULL || task->priority > current->priority)) {
+        *woken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+
+    uint64_t wake_us = deadline(ticks);
+    uint32_t value;
+
+    while (current->notify == 0) {
+        if (ticks == 0 || hal_time_us() >= wake_us) return 0;
+        current->wait_notify = true;
+        if (!block(wake_us)) return 0;
+    }
+
+    value = current->notify;
+    current->notify = clear ? 0 : value - 1;
+
+    return value;
+}
+
+/*--------------------------------------Queues--------------------------------------------------*/
+
+/* every task waiting on the queue checks it again */
+static struct host_task *wake_queue(QueueHandle_t queue) {
+
+    struct host_task *best = NULL;
+
+    for (struct host_task *task = tasks; task; task = task->next) {
+        if (task->state == task_blocked && task->wait_queue == queue) {
+            make_ready(task);
+            if (best == NULL || task->priority > best->priority) best = task;
+        }
+    }
+
+    return best;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+
+    QueueHandle_t queue;
+
+    if (length == 0) return NULL;
+
+    queue = malloc(sizeof(struct host_queue));
+    if (queue == NULL) return NULL;
+
+    memset(queue, 0, sizeof(struct host_queue));
+    queue->length = length;
+    queue->item_size = item_size;
+
+    if (item_size) {
+        queue->buff = malloc(length * item_size);
+        if (queue->buff == NULL) {
+            free(queue);
+            return NULL;
+        }
+    }
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+
+    if (queue == NULL) return;
+
+    free(queue->buff);
+    free(queue);
+}
+
+static void queue_put(QueueHandle_t queue, const void *item) {
+
+    if (queue->item_size) {
+        memcpy(queue->buff + ((queue->head + queue->count) % queue->length) * queue->item_size,
+               item, queue->item_size);
+    }
+
+    queue->count++;
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+
+    struct host_task *task;
+
+    if (queue->count >= queue->length) return pdFAIL;
+
+    queue_put(queue, item);
+
+    task = wake_queue(queue);
+
+    if (task && woken && (current == NULL || task->priority > current->priority)) *woken = pdTRUE;
+
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+
+    uint64_t wake_us = deadline(ticks);
+    struct host_task *task;
+
+    while (queue->count >= queue->length) {
+        if (ticks == 0 || hal_time_us() >= wake_us) return pdFAIL;
+        current->wait_queue = queue;
+        if (!block(wake_us)) return pdFAIL;
+    }
+
+    queue_put(queue, item);
+
+    task = wake_queue(queue);
+    if (task) preempt(task);
+
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    return queue_send(queue, item, woken);
+}
+
+/* for queues of one item */
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item) {
+
+    struct host_task *task;
+
+    queue->count = 0;
+    queue->head = 0;
+    queue_put(queue, item);
+
+    task = wake_queue(queue);
+    if (task) preempt(task);
+
+    return pdPASS;
+}
+
+BaseType_t xQueueOverwriteFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+
+    queue->count = 0;
+    queue->head = 0;
+
+    return queue_send(queue, item, woken);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+
+    uint64_t wake_us = deadline(ticks);
+    struct host_task *task;
+
+    while (queue->count == 0) {
+        if (ticks == 0 || hal_time_us() >= wake_us) return pdFALSE;
+        current->wait_queue = queue;
+        if (!block(wake_us)) return pdFALSE;
+    }
+
+    if (queue->item_size && item) {
+        memcpy(item, queue->buff + queue->head * queue->item_size, queue->item_size);
+    }
+
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    /* a sender may wait for the room */
+    task = wake_queue(queue);
+    if (task) preempt(task);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    return queue->count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+
+    queue->count = 0;
+    queue->head = 0;
+
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+
+    if (sem) sem->count = 1;
+
+    return sem;
+}
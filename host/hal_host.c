@@ -0,0 +1,680 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "esp_log.h"
+
+#include "hal_host.h"
+
+#define HOST_PINS       40
+#define HOST_PWM_UNITS  2
+#define HOST_PWM_TIMERS 3
+#define HOST_COUNTERS   8
+#define HOST_CAPTURES   3
+
+typedef struct {
+    uint32_t    level;
+    bool        output;
+    hal_isr_t   isr;
+    void       *arg;
+} host_pin_t;
+
+typedef struct {
+    int         pin;
+    bool        running;
+    bool        low;                    /* forced low by hal_pwm_low() */
+    float       duty;                   /* percent */
+} host_pwm_gen_t;
+
+typedef struct {
+    uint32_t        frequency;
+    uint32_t        resolution;
+    host_pwm_gen_t  gen[2];
+} host_pwm_timer_t;
+
+typedef struct {
+    bool        used;
+    bool        running;
+    int         pin;
+    int         pin_b;                  /* -1 - counts the rising edges of pin */
+    int16_t     limit;
+    int16_t     count;
+    int8_t      direction;              /* of the last limit */
+    uint8_t     phase;                  /* quadrature, 0 - 3 while A leads B */
+    hal_isr_t   isr;
+    void       *arg;
+} host_counter_t;
+
+typedef struct {
+    int                 pin;
+    hal_capture_isr_t   handler;
+    void               *arg;
+} host_capture_t;
+
+typedef struct host_timer {
+    hal_isr_t           callback;
+    void               *arg;
+    const char         *name;
+    bool                armed;
+    uint64_t            due;
+    uint64_t            period;         /* 0 - one shot */
+    struct host_timer  *next;
+} host_timer_t;
+
+static const char *TAG = "robot_car_hal_host";
+
+static uint64_t time_us = 0;
+static host_pin_t pins[HOST_PINS];
+static host_pwm_timer_t pwms[HOST_PWM_UNITS][HOST_PWM_TIMERS];
+static host_counter_t counters[HOST_COUNTERS];
+static bool counter_service = false;
+static host_capture_t captures[HOST_CAPTURES];
+static host_timer_t *timers = NULL;
+static hal_host_pin_hook_t pin_hook = NULL;
+static void *pin_hook_arg = NULL;
+
+/*--------------------------------------Clock---------------------------------------------------*/
+
+uint64_t hal_time_us() {
+    return time_us;
+}
+
+/* a busy wait - the clock moves, nothing else runs meanwhile */
+void hal_delay_us(uint32_t us) {
+    time_us += us;
+}
+
+/* real time, for benchmarks only */
+uint32_t hal_cycles() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void hal_host_set_time(uint64_t now) {
+    if (now > time_us) time_us = now;
+}
+
+/*--------------------------------------Pins----------------------------------------------------*/
+
+static bool check_pin(int pin) {
+
+    if (pin < 0 || pin >= HOST_PINS) {
+        ESP_LOGE(TAG, "No GPIO%d. (%s:%u)", pin, __FILE__, __LINE__);
+        return false;
+    }
+
+    return true;
+}
+
+esp_err_t hal_pin_output(int pin) {
+
+    if (!check_pin(pin)) return ESP_ERR_INVALID_ARG;
+
+    pins[pin].output = true;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_pin_input(int pin) {
+
+    if (!check_pin(pin)) return ESP_ERR_INVALID_ARG;
+
+    pins[pin].output = false;
+
+    return ESP_OK;
+}
+
+void hal_pin_reset(int pin) {
+
+    if (!check_pin(pin)) return;
+
+    pins[pin].output = false;
+    pins[pin].level = 0;
+}
+
+void hal_pin_set(int pin, uint32_t level) {
+
+    if (!check_pin(pin) || !pins[pin].output) return;
+
+    pins[pin].level = level ? 1 : 0;
+
+    if (pin_hook) pin_hook(pin, pins[pin].level, pin_hook_arg);
+}
+
+int hal_pin_get(int pin) {
+
+    if (!check_pin(pin)) return 0;
+
+    return pins[pin].level;
+}
+
+void hal_pin_set_mask(uint32_t mask) {
+
+    for (int pin = 0; pin < 32; pin++) {
+        if (mask & (1UL << pin)) hal_pin_set(pin, 1);
+    }
+}
+
+esp_err_t hal_pin_isr_add(int pin, hal_isr_t handler, void *arg) {
+
+    if (!check_pin(pin)) return ESP_ERR_INVALID_ARG;
+
+    pins[pin].isr = handler;
+    pins[pin].arg = arg;
+
+    return ESP_OK;
+}
+
+void hal_pin_isr_remove(int pin) {
+
+    if (!check_pin(pin)) return;
+
+    pins[pin].isr = NULL;
+    pins[pin].arg = NULL;
+}
+
+/* the levels of A and B as a step of 00 10 11 01, one on - up, one back - down */
+static uint8_t quadrature_phase(const host_counter_t *counter) {
+
+    static const uint8_t phase[4] = { 0, 3, 1, 2 };
+
+    return phase[(pins[counter->pin].level << 1) | pins[counter->pin_b].level];
+}
+
+static void counter_quadrature(host_counter_t *counter) {
+
+    uint8_t phase = quadrature_phase(counter);
+
+    switch ((phase - counter->phase) & 3) {
+        case 1:
+            counter->count++;
+            break;
+        case 3:
+            counter->count--;
+            break;
+        default:
+            /* no step or a lost one */
+            break;
+    }
+
+    counter->phase = phase;
+}
+
+void hal_host_pin_input(int pin, uint32_t level) {
+    hal_host_pin_input_at(pin, level, 0);
+}
+
+void hal_host_pin_input_at(int pin, uint32_t level, float ago_us) {
+
+    uint32_t ticks;
+
+    level = level ? 1 : 0;
+
+    if (!check_pin(pin) || pins[pin].output || pins[pin].level == level) return;
+
+    pins[pin].level = level;
+
+    /* the counters count the rising edges down to -limit, the quadrature ones every edge */
+    for (int unit = 0; unit < HOST_COUNTERS; unit++) {
+        host_counter_t *counter = &(counters[unit]);
+        if (!counter->used || !counter->running) continue;
+        if (counter->pin_b < 0) {
+            if (!level || counter->pin != pin) continue;
+            counter->count--;
+        } else {
+            if (counter->pin != pin && counter->pin_b != pin) continue;
+            counter_quadrature(counter);
+        }
+        if (counter->count >= counter->limit || counter->count <= -counter->limit) {
+            counter->direction = counter->count > 0 ? 1 : -1;
+            counter->count = 0;
+            if (counter_service && counter->isr) counter->isr(counter->arg);
+        }
+    }
+
+    /* the captures latch the time of the edge itself */
+    for (int channel = 0; channel < HOST_CAPTURES; channel++) {
+        host_capture_t *capture = &(captures[channel]);
+        if (!level || !capture->handler || capture->pin != pin) continue;
+        ticks = (uint64_t)llround((time_us - (double)ago_us) * (HAL_CAPTURE_HZ / 1000000));
+        capture->handler(ticks, capture->arg);
+    }
+
+    if (pins[pin].isr) pins[pin].isr(pins[pin].arg);
+}
+
+void hal_host_pin_hook(hal_host_pin_hook_t hook, void *arg) {
+    pin_hook = hook;
+    pin_hook_arg = arg;
+}
+
+/*--------------------------------------PWM-----------------------------------------------------*/
+
+static host_pwm_timer_t *pwm_timer(const hal_pwm_t *pwm) {
+
+    if (pwm->unit >= HOST_PWM_UNITS || pwm->timer >= HOST_PWM_TIMERS || pwm->gen > 1) {
+        ESP_LOGE(TAG, "No MCPWM%u timer %u gen %u. (%s:%u)", pwm->unit, pwm->timer, pwm->gen, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    return &(pwms[pwm->unit][pwm->timer]);
+}
+
+esp_err_t hal_pwm_init(const hal_pwm_t *pwm, uint32_t frequency) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+
+    if (timer == NULL || !check_pin(pwm->gpio_num)) return ESP_ERR_INVALID_ARG;
+
+    timer->frequency = frequency;
+    if (timer->resolution == 0) timer->resolution = MOTOR_PWM_RESOLUTION;
+    timer->gen[pwm->gen].pin = pwm->gpio_num;
+    timer->gen[pwm->gen].running = true;
+    timer->gen[pwm->gen].low = false;
+    timer->gen[pwm->gen].duty = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_pwm_set_us(const hal_pwm_t *pwm, uint32_t us) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+
+    if (timer == NULL) return ESP_ERR_INVALID_ARG;
+
+    return hal_pwm_set_duty(pwm, us * (timer->frequency / 10000.0));
+}
+
+/* quantized to the steps of the timer clock, like the hardware does */
+esp_err_t hal_pwm_set_duty(const hal_pwm_t *pwm, float duty) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+    float steps;
+
+    if (timer == NULL || timer->frequency == 0) return ESP_ERR_INVALID_ARG;
+
+    if (duty < 0) duty = 0;
+    if (duty > 100) duty = 100;
+
+    steps = (float)timer->resolution / timer->frequency;
+    timer->gen[pwm->gen].duty = roundf(duty * steps / 100) * 100 / steps;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_pwm_set_frequency(const hal_pwm_t *pwm, uint32_t frequency) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+
+    if (timer == NULL || frequency == 0) return ESP_ERR_INVALID_ARG;
+
+    timer->frequency = frequency;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_pwm_set_resolution(const hal_pwm_t *pwm, uint32_t resolution) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+
+    if (timer == NULL || resolution == 0) return ESP_ERR_INVALID_ARG;
+
+    timer->resolution = resolution;
+
+    return ESP_OK;
+}
+
+void hal_pwm_on(const hal_pwm_t *pwm) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+
+    if (timer) timer->gen[pwm->gen].low = false;
+}
+
+void hal_pwm_low(const hal_pwm_t *pwm) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+
+    if (timer) timer->gen[pwm->gen].low = true;
+}
+
+/* both generators of the timer */
+void hal_pwm_stop(const hal_pwm_t *pwm) {
+
+    host_pwm_timer_t *timer = pwm_timer(pwm);
+
+    if (timer) {
+        timer->gen[0].running = false;
+        timer->gen[1].running = false;
+    }
+}
+
+static host_pwm_gen_t *pwm_gen(int pin, host_pwm_timer_t **timer) {
+
+    for (int unit = 0; unit < HOST_PWM_UNITS; unit++) {
+        for (int t = 0; t < HOST_PWM_TIMERS; t++) {
+            for (int gen = 0; gen < 2; gen++) {
+                if (pwms[unit][t].gen[gen].running && pwms[unit][t].gen[gen].pin == pin) {
+                    *timer = &(pwms[unit][t]);
+                    return &(pwms[unit][t].gen[gen]);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+float hal_host_pwm_duty(int pin) {
+
+    host_pwm_timer_t *timer;
+    host_pwm_gen_t *gen = pwm_gen(pin, &timer);
+
+    if (gen == NULL || gen->low) return 0;
+
+    return gen->duty / 100;
+}
+
+uint32_t hal_host_pwm_frequency(int pin) {
+
+    host_pwm_timer_t *timer;
+    host_pwm_gen_t *gen = pwm_gen(pin, &timer);
+
+    if (gen == NULL) return 0;
+
+    return timer->frequency;
+}
+
+/*--------------------------------------Pulse counters------------------------------------------*/
+
+static host_counter_t *counter_unit(uint8_t unit) {
+
+    if (unit >= HOST_COUNTERS) {
+        ESP_LOGE(TAG, "No PCNT unit %u. (%s:%u)", unit, __FILE__, __LINE__);
+        return NULL;
+    }
+
+    return &(counters[unit]);
+}
+
+esp_err_t hal_counter_init(uint8_t unit, int pin, int16_t limit, uint16_t filter) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    if (counter == NULL || !check_pin(pin) || limit <= 0) return ESP_ERR_INVALID_ARG;
+
+    memset(counter, 0, sizeof(host_counter_t));
+    counter->used = true;
+    counter->pin = pin;
+    counter->pin_b = -1;
+    counter->limit = limit;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_counter_init_quadrature(uint8_t unit, int pin_a, int pin_b, int16_t limit, uint16_t filter) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    if (counter == NULL || !check_pin(pin_a) || !check_pin(pin_b) || limit <= 0) return ESP_ERR_INVALID_ARG;
+
+    memset(counter, 0, sizeof(host_counter_t));
+    counter->used = true;
+    counter->pin = pin_a;
+    counter->pin_b = pin_b;
+    counter->limit = limit;
+    counter->phase = quadrature_phase(counter);
+
+    return ESP_OK;
+}
+
+int8_t hal_counter_direction(uint8_t unit) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    return counter ? counter->direction : 0;
+}
+
+esp_err_t hal_counter_isr_install() {
+
+    if (counter_service) return ESP_ERR_INVALID_STATE;
+
+    counter_service = true;
+
+    return ESP_OK;
+}
+
+void hal_counter_isr_uninstall() {
+    counter_service = false;
+}
+
+esp_err_t hal_counter_isr_add(uint8_t unit, hal_isr_t handler, void *arg) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    if (counter == NULL || !counter_service) return ESP_ERR_INVALID_STATE;
+
+    counter->isr = handler;
+    counter->arg = arg;
+
+    return ESP_OK;
+}
+
+void hal_counter_isr_remove(uint8_t unit) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    if (counter) {
+        counter->isr = NULL;
+        counter->arg = NULL;
+    }
+}
+
+void hal_counter_start(uint8_t unit) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    if (counter) counter->running = true;
+}
+
+void hal_counter_clear(uint8_t unit) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    if (counter) counter->count = 0;
+}
+
+int16_t hal_counter_get(uint8_t unit) {
+
+    host_counter_t *counter = counter_unit(unit);
+
+    return counter ? counter->count : 0;
+}
+
+/*--------------------------------------Captures------------------------------------------------*/
+
+esp_err_t hal_capture_init(uint8_t channel, int pin, hal_capture_isr_t handler, void *arg) {
+
+    if (channel >= HOST_CAPTURES || !check_pin(pin) || handler == NULL) return ESP_ERR_INVALID_ARG;
+
+    captures[channel].pin = pin;
+    captures[channel].handler = handler;
+    captures[channel].arg = arg;
+
+    return ESP_OK;
+}
+
+void hal_capture_deinit(uint8_t channel) {
+
+    if (channel < HOST_CAPTURES) memset(&(captures[channel]), 0, sizeof(host_capture_t));
+}
+
+/*--------------------------------------Timers--------------------------------------------------*/
+
+esp_err_t hal_timer_create(hal_timer_t *timer, hal_isr_t callback, void *arg, const char *name) {
+
+    host_timer_t *t, **last;
+
+    t = malloc(sizeof(host_timer_t));
+
+    if (t == NULL) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(t, 0, sizeof(host_timer_t));
+    t->callback = callback;
+    t->arg = arg;
+    t->name = name;
+
+    /* in order of creation, it decides between timers due at the same time */
+    for (last = &timers; *last; last = &((*last)->next));
+    *last = t;
+
+    *timer = t;
+
+    return ESP_OK;
+}
+
+static esp_err_t start_timer(hal_timer_t timer, uint64_t timeout_us, uint64_t period_us) {
+
+    host_timer_t *t = (host_timer_t*)timer;
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+    if (t->armed) return ESP_ERR_INVALID_STATE;
+
+    t->armed = true;
+    t->due = time_us + timeout_us;
+    t->period = period_us;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_timer_start_periodic(hal_timer_t timer, uint64_t period_us) {
+
+    if (period_us == 0) return ESP_ERR_INVALID_ARG;
+
+    return start_timer(timer, period_us, period_us);
+}
+
+esp_err_t hal_timer_start_once(hal_timer_t timer, uint64_t timeout_us) {
+    return start_timer(timer, timeout_us, 0);
+}
+
+esp_err_t hal_timer_stop(hal_timer_t timer) {
+
+    host_timer_t *t = (host_timer_t*)timer;
+
+    if (t == NULL || !t->armed) return ESP_ERR_INVALID_STATE;
+
+    t->armed = false;
+
+    return ESP_OK;
+}
+
+esp_err_t hal_timer_delete(hal_timer_t timer) {
+
+    host_timer_t *t = (host_timer_t*)timer, **last;
+
+    if (t == NULL) return ESP_ERR_INVALID_ARG;
+    if (t->armed) return ESP_ERR_INVALID_STATE;
+
+    for (last = &timers; *last && *last != t; last = &((*last)->next));
+    if (*last) *last = t->next;
+
+    free(t);
+
+    return ESP_OK;
+}
+
+/* due time of the next timer, UINT64_MAX if none is armed */
+uint64_t hal_host_timer_next() {
+
+    uint64_t next = UINT64_MAX;
+
+    for (host_timer_t *t = timers; t; t = t->next) {
+        if (t->armed && t->due < next) next = t->due;
+    }
+
+    return next;
+}
+
+/* every callback due by now, the earliest first */
+void hal_host_timer_run() {
+
+    host_timer_t *t, *first;
+
+    while (1) {
+        first = NULL;
+        for (t = timers; t; t = t->next) {
+            if (t->armed && t->due <= time_us && (first == NULL || t->due < first->due)) first = t;
+        }
+        if (first == NULL) return;
+
+        if (first->period) {
+            first->due += first->period;
+        } else {
+            first->armed = false;
+        }
+
+        first->callback(first->arg);
+    }
+}
+
+/*--------------------------------------Store---------------------------------------------------*/
+
+/* a file per key next to the spiffs files, like the NVS of the car it survives a run */
+static void store_path(char *path, size_t size, const char *key) {
+    snprintf(path, size, "%s/nvs_%s", MOUNT_POINT_SPIFFS, key);
+}
+
+esp_err_t hal_store_get(const char *key, void *data, size_t size) {
+
+    char path[128];
+    FILE *file;
+    size_t length;
+    char extra;
+
+    store_path(path, sizeof(path), key);
+
+    file = fopen(path, "rb");
+    if (file == NULL) return ESP_ERR_NOT_FOUND;
+
+    length = fread(data, 1, size, file);
+    if (fread(&extra, 1, 1, file) == 1) length = 0;
+    fclose(file);
+
+    return length == size ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t hal_store_set(const char *key, const void *data, size_t size) {
+
+    char path[128];
+    FILE *file;
+    size_t length;
+
+    store_path(path, sizeof(path), key);
+
+    file = fopen(path, "wb");
+    if (file == NULL) return ESP_FAIL;
+
+    length = fwrite(data, 1, size, file);
+    fclose(file);
+
+    return length == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t hal_store_erase(const char *key) {
+
+    char path[128];
+
+    store_path(path, sizeof(path), key);
+    remove(path);
+
+    return ESP_OK;
+}
@@ -0,0 +1,6 @@
+#ifndef HOST_INCLUDE_ESP_ATTR_H_
+#define HOST_INCLUDE_ESP_ATTR_H_
+
+#define IRAM_ATTR
+
+#endif /* HOST_INCLUDE_ESP_ATTR_H_ */
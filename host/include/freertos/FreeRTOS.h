@@ -0,0 +1,36 @@
+#ifndef HOST_INCLUDE_FREERTOS_FREERTOS_H_
+#define HOST_INCLUDE_FREERTOS_FREERTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "esp_err.h"
+#include "esp_attr.h"
+
+/*
+ *  The part of the FreeRTOS API used by the car, on the host scheduler of
+ *  host/freertos.c. Same tick rate as the sdkconfig of the car.
+ */
+#define configTICK_RATE_HZ          100
+#define configMAX_TASK_NAME_LEN     16
+
+typedef int32_t     BaseType_t;
+typedef uint32_t    UBaseType_t;
+typedef uint32_t    TickType_t;
+
+#define pdFALSE                     ((BaseType_t)0)
+#define pdTRUE                      ((BaseType_t)1)
+#define pdFAIL                      pdFALSE
+#define pdPASS                      pdTRUE
+
+#define portMAX_DELAY               ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS          ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)           ((TickType_t)((uint64_t)(ms) * configTICK_RATE_HZ / 1000))
+
+/* an isr never switches by itself on the host, the scheduler runs after it */
+#define portYIELD_FROM_ISR(...)     do {} while (0)
+
+#define tskNO_AFFINITY              ((BaseType_t)0x7fffffff)
+
+#endif /* HOST_INCLUDE_FREERTOS_FREERTOS_H_ */
@@ -0,0 +1,17 @@
+#ifndef HOST_INCLUDE_FREERTOS_SEMPHR_H_
+#define HOST_INCLUDE_FREERTOS_SEMPHR_H_
+
+#include "freertos/queue.h"
+
+/* semaphores are queues of empty items, like in FreeRTOS */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+
+#define vSemaphoreDelete(sem)               vQueueDelete(sem)
+#define xSemaphoreTake(sem, ticks)          xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem)                 xQueueSend(sem, NULL, 0)
+#define xSemaphoreGiveFromISR(sem, woken)   xQueueSendFromISR(sem, NULL, woken)
+
+#endif /* HOST_INCLUDE_FREERTOS_SEMPHR_H_ */
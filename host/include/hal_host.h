@@ -0,0 +1,43 @@
+#ifndef HOST_INCLUDE_HAL_HOST_H_
+#define HOST_INCLUDE_HAL_HOST_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "hal.h"
+
+/*
+ *  Host side of the HAL - what the car would see of the world.
+ *
+ *  Time is virtual: it only moves when every task is blocked (to the next
+ *  timer or timeout) or when a task busy-waits with hal_delay_us(). The
+ *  tasks run one at a time on the scheduler of freertos.c, the highest
+ *  priority first, so a run is the same every time.
+ */
+
+typedef void (*hal_host_pin_hook_t)(int pin, uint32_t level, void *arg);
+
+/*
+ *  Runs main_task as the "main" task (priority 1, like app_main) until it
+ *  returns. The other tasks live on and run again in the next call.
+ */
+void hal_host_run(TaskFunction_t main_task, void *param);
+
+/* the world drives an input - the isr of the pin and its counter see the edge */
+void hal_host_pin_input(int pin, uint32_t level);
+/* the same for an edge ago_us before now - what a capture of the pin latches */
+void hal_host_pin_input_at(int pin, uint32_t level, float ago_us);
+
+/* called on every write of an output */
+void hal_host_pin_hook(hal_host_pin_hook_t hook, void *arg);
+
+/* output of the PWM on pin, 0 - 1 of the period, 0 while stopped or low */
+float hal_host_pwm_duty(int pin);
+uint32_t hal_host_pwm_frequency(int pin);
+
+/* used by the scheduler */
+uint64_t hal_host_timer_next();
+void hal_host_timer_run();
+void hal_host_set_time(uint64_t time_us);
+
+#endif /* HOST_INCLUDE_HAL_HOST_H_ */
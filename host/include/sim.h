@@ -0,0 +1,95 @@
+#ifndef HOST_INCLUDE_SIM_H_
+#define HOST_INCLUDE_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#include "config.h"
+
+/*
+ *  Physics of the car on the host HAL.
+ *
+ *  Every SIM_STEP_US of virtual time a hal timer reads what the firmware
+ *  drives - the duty and the legs of both bridges, the servo pulse - and
+ *  moves the world on:
+ *
+ *      DC motor    - L di/dt = V - R i - K w, the bridge voltage averaged over
+ *                    the PWM period, open (no current) while the duty is 0
+ *      gearbox     - torque and back EMF through the gear ratio, Coulomb and
+ *                    viscous friction on the wheel. The right motor is a bit
+ *                    weaker and its gearbox stiffer - another deadband
+ *      tires       - traction from the slip of each rear wheel, limited by grip
+ *      body        - mass on the rear wheels, yaw from the front wheels like
+ *                    the Ackermann model of kinematics.c
+ *      encoders    - PULSE_PER_TURN square wave periods per wheel turn on
+ *                    INPUT_LEFT and INPUT_RIGHT, channel B a quarter period
+ *                    behind on INPUT_LEFT_B and INPUT_RIGHT_B
+ *      stand       - a lifted car has no traction, the wheels turn free
+ *      jam         - a locked wheel does not turn, its tire slides and its
+ *                    motor draws the stall current
+ *      servo       - slews to the angle of its pulse width, holds without one
+ *      HC-SR04     - the falling edge of TRIG_GPIO starts the echo on ECHO_GPIO,
+ *                    as long as the way to the nearest obstacle in the beam
+ *
+ *  The car drives in a rectangular room with box obstacles. Touching one
+ *  stops the car and counts a collision. Everything runs on the virtual
+ *  clock, so a run is the same every time.
+ */
+
+#define SIM_STEP_US         100         /* integration step of the physics */
+#define SIM_OBSTACLES       16
+
+/* axis aligned box in mm, x and y of the lower left corner */
+typedef struct {
+    float       x;
+    float       y;
+    float       width;
+    float       height;
+} sim_box_t;
+
+/* the origin in the lower left corner of the room */
+typedef struct {
+    float       width;                  /* mm along x               */
+    float       height;                 /* mm along y               */
+    uint8_t     obstacles;
+    sim_box_t   obstacle[SIM_OBSTACLES];
+} sim_world_t;
+
+typedef struct {
+    float       x;                      /* mm, middle of the rear axle  */
+    float       y;
+    float       heading;                /* rad from x, to the left > 0  */
+    float       speed;                  /* mm/s along the heading       */
+    float       yaw_rate;               /* rad/s                        */
+    float       rps_left;               /* wheel turns per second       */
+    float       rps_right;
+    float       current_left;           /* A of the motors              */
+    float       current_right;
+    float       servo_angle;            /* degrees of the servo         */
+    float       range;                  /* mm from the sensor to the nearest obstacle in the beam */
+    float       distance;               /* path length in mm            */
+    uint32_t    pulses_left;
+    uint32_t    pulses_right;
+    int32_t     ticks_left;             /* edges of A and B, < 0 back   */
+    int32_t     ticks_right;
+    uint32_t    echoes;
+    uint32_t    collisions;
+    bool        contact;                /* pushing against an obstacle  */
+} sim_state_t;
+
+/* before init_usonic(), init_driver() and init_pulse() */
+esp_err_t sim_init(const sim_world_t *world);
+void sim_deinit();
+void sim_set_world(const sim_world_t *world);
+/* the car at rest at the pose, distance and counters start over */
+void sim_place(float x, float y, float heading);
+/* on a stand the wheels turn free and the car stays */
+void sim_lift(bool lifted);
+/* a shove - the car rolls on at speed mm/s, the wheels with it */
+void sim_push(float speed);
+/* a locked wheel stops at once and stays, until unlocked */
+void sim_lock_wheels(bool left, bool right);
+void sim_get_state(sim_state_t *state);
+
+#endif /* HOST_INCLUDE_SIM_H_ */
@@ -0,0 +1,516 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "esp_log.h"
+
+#include "hal_host.h"
+#include "sim.h"
+
+#define SIM_VBAT            6.0f        /* V at the bridge outputs          */
+#define SIM_MOTOR_R         6.0f        /* ohm of the winding               */
+#define SIM_MOTOR_L         0.0005f     /* H of the winding                 */
+#define SIM_MOTOR_K         0.0051f     /* V s/rad and N m/A of the motor   */
+#define SIM_MOTOR_MISMATCH  0.05f       /* the right motor is that much weaker */
+#define SIM_GEAR_RATIO      48.0f
+#define SIM_GEAR_EFFICIENCY 0.7f
+#define SIM_WHEEL_INERTIA   0.0002f     /* kg m^2 of wheel and rotor at the wheel */
+#define SIM_WHEEL_FRICTION  0.012f      /* N m of the gearbox at the wheel  */
+#define SIM_FRICTION_MISMATCH 0.5f      /* the right gearbox is that much stiffer - a wider deadband */
+#define SIM_WHEEL_DAMPING   0.0002f     /* N m s/rad                        */
+#define SIM_MASS            0.9f        /* kg of the car                    */
+#define SIM_REAR_LOAD       0.6f        /* part of the weight on the rear axle */
+#define SIM_ROLLING         0.03f       /* rolling resistance coefficient   */
+#define SIM_TIRE_STIFFNESS  300.0f      /* N per m/s of slip                */
+#define SIM_TIRE_GRIP       0.8f        /* friction coefficient on the floor */
+#define SIM_GRAVITY         9.81f
+#define SIM_SERVO_RATE      600.0f      /* degrees/s - 0.1 s per 60 degrees */
+#define SIM_FRONT           (WHEEL_BASE + 40)   /* mm from the rear axle to the bumper */
+#define SIM_REAR            40          /* mm behind the rear axle          */
+#define SIM_WIDTH           (TRACK_WIDTH + 30)
+#define SIM_ECHO_DELAY_US   450         /* trigger to the rise of the echo  */
+#define SIM_ECHO_NONE_US    38000       /* echo without a reflection        */
+#define SIM_SOUND_MM_US     0.343f
+#define SIM_RANGE_MAX       4000        /* mm                               */
+#define SIM_BEAM            15          /* half angle of the beam in degrees */
+#define SIM_BEAM_RAYS       5
+
+typedef struct {
+    int         gpio_pwm;
+    int         gpio_plus;
+    int         gpio_minus;
+    int         gpio_encoder;
+    int         gpio_encoder_b;
+    float       k;                      /* motor constant               */
+    float       friction;               /* N m of the gearbox           */
+    float       current;                /* A                            */
+    float       omega;                  /* rad/s of the wheel           */
+    double      angle;                  /* rad of the wheel             */
+    uint32_t    level;                  /* of the encoder               */
+    uint32_t    level_b;                /* of its channel B, a quarter behind */
+    uint32_t    pulses;
+    bool        locked;                 /* jammed, does not turn        */
+} sim_wheel_t;
+
+typedef struct {
+    sim_world_t world;
+    hal_timer_t step_timer;
+    hal_timer_t echo_timer;
+    float       decay;                  /* of the current in one step   */
+    sim_wheel_t wheel_left;
+    sim_wheel_t wheel_right;
+    float       x;                      /* mm                           */
+    float       y;
+    float       heading;
+    float       speed;                  /* m/s                          */
+    float       yaw_rate;
+    float       servo_angle;
+    float       distance;
+    bool        trig;
+    bool        echo_busy;
+    uint32_t    echo_us;
+    uint32_t    echoes;
+    uint32_t    collisions;
+    bool        contact;
+    bool        lifted;                 /* on a stand, the wheels turn free */
+} sim_t;
+
+static const char *TAG = "robot_car_sim";
+
+static sim_t *sim = NULL;
+
+/*--------------------------------------World---------------------------------------------------*/
+
+static bool inside_box(const sim_box_t *box, float x, float y) {
+    return x > box->x && x < box->x + box->width && y > box->y && y < box->y + box->height;
+}
+
+/* way along the ray until it leaves the room or enters an obstacle */
+static float ray_cast(float x, float y, float dx, float dy) {
+
+    float range = INFINITY, near, far, t1, t2;
+
+    if (dx > 0) range = fminf(range, (sim->world.width - x) / dx);
+    if (dx < 0) range = fminf(range, -x / dx);
+    if (dy > 0) range = fminf(range, (sim->world.height - y) / dy);
+    if (dy < 0) range = fminf(range, -y / dy);
+
+    for (uint8_t i = 0; i < sim->world.obstacles; i++) {
+        const sim_box_t *box = &(sim->world.obstacle[i]);
+
+        near = -INFINITY;
+        far = INFINITY;
+
+        if (dx != 0) {
+            t1 = (box->x - x) / dx;
+            t2 = (box->x + box->width - x) / dx;
+            near = fmaxf(near, fminf(t1, t2));
+            far = fminf(far, fmaxf(t1, t2));
+        } else if (x < box->x || x > box->x + box->width) {
+            continue;
+        }
+
+        if (dy != 0) {
+            t1 = (box->y - y) / dy;
+            t2 = (box->y + box->height - y) / dy;
+            near = fmaxf(near, fminf(t1, t2));
+            far = fminf(far, fmaxf(t1, t2));
+        } else if (y < box->y || y > box->y + box->height) {
+            continue;
+        }
+
+        if (near <= far && near >= 0 && near < range) range = near;
+    }
+
+    return range;
+}
+
+/* nearest obstacle in the beam of the sensor on the bumper */
+static float sonar_range() {
+
+    float x, y, angle, range = INFINITY;
+
+    x = sim->x + SIM_FRONT * cosf(sim->heading);
+    y = sim->y + SIM_FRONT * sinf(sim->heading);
+
+    for (int i = 0; i < SIM_BEAM_RAYS; i++) {
+        angle = sim->heading + (-SIM_BEAM + 2.0f * SIM_BEAM * i / (SIM_BEAM_RAYS - 1)) * (float)M_PI / 180;
+        range = fminf(range, ray_cast(x, y, cosf(angle), sinf(angle)));
+    }
+
+    return range;
+}
+
+/* the footprint of the car at the pose against the walls and the obstacles */
+static bool collides(float x, float y, float heading) {
+
+    const float corner[4][2] = {
+            { SIM_FRONT,  SIM_WIDTH / 2.0f }, { SIM_FRONT, -SIM_WIDTH / 2.0f },
+            { -SIM_REAR, -SIM_WIDTH / 2.0f }, { -SIM_REAR,  SIM_WIDTH / 2.0f }
+    };
+    float c = cosf(heading), s = sinf(heading), px, py, lx, ly;
+
+    for (int i = 0; i < 4; i++) {
+        px = x + corner[i][0] * c - corner[i][1] * s;
+        py = y + corner[i][0] * s + corner[i][1] * c;
+
+        if (px < 0 || py < 0 || px > sim->world.width || py > sim->world.height) return true;
+
+        for (uint8_t j = 0; j < sim->world.obstacles; j++) {
+            if (inside_box(&(sim->world.obstacle[j]), px, py)) return true;
+        }
+    }
+
+    /* small obstacles fit between the corners */
+    for (uint8_t j = 0; j < sim->world.obstacles; j++) {
+        const sim_box_t *box = &(sim->world.obstacle[j]);
+        for (int i = 0; i < 4; i++) {
+            px = box->x + ((i & 1) ? box->width : 0) - x;
+            py = box->y + ((i & 2) ? box->height : 0) - y;
+            lx = px * c + py * s;
+            ly = -px * s + py * c;
+            if (lx > -SIM_REAR && lx < SIM_FRONT && fabsf(ly) < SIM_WIDTH / 2.0f) return true;
+        }
+    }
+
+    return false;
+}
+
+/*--------------------------------------Car-----------------------------------------------------*/
+
+/* Coulomb friction stops a slow wheel or body without turning it around */
+static float friction(float velocity, float step) {
+
+    if (velocity > step) return velocity - step;
+    if (velocity < -step) return velocity + step;
+
+    return 0;
+}
+
+/*
+ *  One channel of the encoder, offset in half periods behind A. True when
+ *  its level changed in the step, with the time since the edge.
+ */
+static bool encoder_channel(const sim_wheel_t *wheel, double offset, uint32_t *level, float dt, double *ago) {
+
+    double edge = floor(wheel->angle * PULSE_PER_TURN / M_PI - offset);
+    uint32_t now = (uint32_t)(int64_t)edge & 1;
+
+    if (now == *level) return false;
+
+    *level = now;
+
+    /* when in the step the wheel passed the edge */
+    if (wheel->omega > 0) *ago = (wheel->angle - (edge + offset) * M_PI / PULSE_PER_TURN) / wheel->omega;
+    else if (wheel->omega < 0) *ago = (wheel->angle - (edge + 1 + offset) * M_PI / PULSE_PER_TURN) / wheel->omega;
+    else *ago = 0;
+    if (*ago < 0) *ago = 0;
+    if (*ago > dt) *ago = dt;
+
+    return true;
+}
+
+/* traction force of the wheel in N, ground - speed of its contact patch in m/s */
+static float wheel_step(sim_wheel_t *wheel, float ground, float dt) {
+
+    const float radius = WHEEL_DIAMETER / 2000.0f;
+    const float grip = SIM_TIRE_GRIP * SIM_MASS * SIM_REAR_LOAD * SIM_GRAVITY / 2;
+
+    float duty, voltage, steady, force, torque;
+    double ago;
+
+    duty = hal_host_pwm_duty(wheel->gpio_pwm);
+
+    if (duty > 0) {
+        voltage = duty * SIM_VBAT * (hal_pin_get(wheel->gpio_plus) - hal_pin_get(wheel->gpio_minus));
+        steady = (voltage - wheel->k * SIM_GEAR_RATIO * wheel->omega) / SIM_MOTOR_R;
+        wheel->current = steady + (wheel->current - steady) * sim->decay;
+    } else {
+        /* the bridge is open */
+        wheel->current = 0;
+    }
+
+    force = SIM_TIRE_STIFFNESS * (wheel->omega * radius - ground);
+    if (force > grip) force = grip;
+    if (force < -grip) force = -grip;
+    if (sim->lifted) force = 0;
+
+    if (wheel->locked) {
+        /* the tire slides, the motor draws the stall current */
+        wheel->omega = 0;
+        return force;
+    }
+
+    torque = wheel->current * wheel->k * SIM_GEAR_RATIO * SIM_GEAR_EFFICIENCY
+           - force * radius - SIM_WHEEL_DAMPING * wheel->omega;
+
+    wheel->omega = friction(wheel->omega + torque / SIM_WHEEL_INERTIA * dt,
+                            wheel->friction / SIM_WHEEL_INERTIA * dt);
+    wheel->angle += wheel->omega * dt;
+
+    /* PULSE_PER_TURN periods per turn, in either direction */
+    if (encoder_channel(wheel, 0, &(wheel->level), dt, &ago)) {
+        if (wheel->level) wheel->pulses++;
+        hal_host_pin_input_at(wheel->gpio_encoder, wheel->level, ago * 1e6);
+    }
+    if (encoder_channel(wheel, 0.5, &(wheel->level_b), dt, &ago)) {
+        hal_host_pin_input_at(wheel->gpio_encoder_b, wheel->level_b, ago * 1e6);
+    }
+
+    return force;
+}
+
+static void servo_step(float dt) {
+
+    float duty, target, step;
+
+    duty = hal_host_pwm_duty(SERVO_PWM_GPIO);
+
+    /* no pulse - the servo holds */
+    if (duty <= 0) return;
+
+    target = (duty * 1000000 / hal_host_pwm_frequency(SERVO_PWM_GPIO) - SERVO_MIN_US)
+           * (ANGLE_MAX - ANGLE_MIN) / (SERVO_MAX_US - SERVO_MIN_US) + ANGLE_MIN;
+
+    step = SIM_SERVO_RATE * dt;
+
+    if (target > sim->servo_angle + step) sim->servo_angle += step;
+    else if (target < sim->servo_angle - step) sim->servo_angle -= step;
+    else sim->servo_angle = target;
+}
+
+static void sim_step_callback(void *arg) {
+
+    const float dt = SIM_STEP_US / 1000000.0f;
+    const float half_track = TRACK_WIDTH / 2000.0f;
+
+    float delta, force, speed, heading, x, y;
+
+    servo_step(dt);
+
+    delta = (STEERING_STRAIGHT - sim->servo_angle) * STEERING_RATIO * (float)M_PI / 180;
+    sim->yaw_rate = sim->speed * tanf(delta) / (WHEEL_BASE / 1000.0f);
+
+    force = wheel_step(&(sim->wheel_left), sim->speed - sim->yaw_rate * half_track, dt)
+          + wheel_step(&(sim->wheel_right), sim->speed + sim->yaw_rate * half_track, dt);
+
+    speed = friction(sim->speed + force / SIM_MASS * dt, SIM_ROLLING * SIM_GRAVITY * dt);
+
+    heading = sim->heading + sim->yaw_rate * dt;
+    x = sim->x + speed * 1000 * dt * cosf((sim->heading + heading) / 2);
+    y = sim->y + speed * 1000 * dt * sinf((sim->heading + heading) / 2);
+
+    if (collides(x, y, heading)) {
+        if (!sim->contact) {
+            sim->collisions++;
+            ESP_LOGW(TAG, "Collision at %.0f, %.0f mm with %.0f mm/s", sim->x, sim->y, sim->speed * 1000);
+        }
+        sim->contact = true;
+        sim->speed = 0;
+        sim->yaw_rate = 0;
+        return;
+    }
+
+    sim->contact = false;
+    sim->speed = speed;
+    sim->heading = heading;
+    sim->x = x;
+    sim->y = y;
+    sim->distance += fabsf(speed) * 1000 * dt;
+}
+
+/*--------------------------------------HC-SR04-------------------------------------------------*/
+
+/* the trigger went low - the echo starts after the burst */
+static void sim_pin_hook(int pin, uint32_t level, void *arg) {
+
+    float range;
+
+    if (pin != TRIG_GPIO) return;
+
+    if (level) {
+        sim->trig = true;
+        return;
+    }
+
+    if (!sim->trig || sim->echo_busy) return;
+
+    sim->trig = false;
+
+    range = sonar_range();
+    if (range > SIM_RANGE_MAX) {
+        sim->echo_us = SIM_ECHO_NONE_US;
+    } else {
+        sim->echo_us = (uint32_t)(2 * range / SIM_SOUND_MM_US + 0.5f);
+    }
+
+    sim->echo_busy = true;
+    hal_timer_start_once(sim->echo_timer, SIM_ECHO_DELAY_US);
+}
+
+static void sim_echo_callback(void *arg) {
+
+    if (!hal_pin_get(ECHO_GPIO)) {
+        hal_host_pin_input(ECHO_GPIO, HIGH);
+        hal_timer_start_once(sim->echo_timer, sim->echo_us);
+        return;
+    }
+
+    hal_host_pin_input(ECHO_GPIO, LOW);
+    sim->echo_busy = false;
+    sim->echoes++;
+}
+
+/*--------------------------------------API-----------------------------------------------------*/
+
+static void init_wheel(sim_wheel_t *wheel, int gpio_pwm, int gpio_plus, int gpio_minus, int gpio_encoder, int gpio_encoder_b,
+                       float k, float friction) {
+
+    memset(wheel, 0, sizeof(sim_wheel_t));
+    wheel->gpio_pwm = gpio_pwm;
+    wheel->gpio_plus = gpio_plus;
+    wheel->gpio_minus = gpio_minus;
+    wheel->gpio_encoder = gpio_encoder;
+    wheel->gpio_encoder_b = gpio_encoder_b;
+    wheel->k = k;
+    wheel->friction = friction;
+
+    /* at angle 0 A is low and B high */
+    wheel->level_b = 1;
+    hal_host_pin_input(gpio_encoder_b, wheel->level_b);
+}
+
+esp_err_t sim_init(const sim_world_t *world) {
+
+    esp_err_t ret;
+
+    if (sim) {
+        ESP_LOGE(TAG, "Simulation already started. (%s:%u)", __FILE__, __LINE__);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sim = malloc(sizeof(sim_t));
+
+    if (sim == NULL) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(sim, 0, sizeof(sim_t));
+    sim->world = *world;
+    sim->decay = expf(-SIM_MOTOR_R / SIM_MOTOR_L * SIM_STEP_US / 1000000);
+    sim->x = world->width / 2;
+    sim->y = world->height / 2;
+    sim->servo_angle = STEERING_STRAIGHT;
+    init_wheel(&(sim->wheel_left), LEFT_SPD_PWM_GPIO, LEFT_MOTOR_GPIO_1, LEFT_MOTOR_GPIO_2, INPUT_LEFT, INPUT_LEFT_B,
+               SIM_MOTOR_K, SIM_WHEEL_FRICTION);
+    init_wheel(&(sim->wheel_right), RIGHT_SPD_PWM_GPIO, RIGHT_MOTOR_GPIO_1, RIGHT_MOTOR_GPIO_2, INPUT_RIGHT, INPUT_RIGHT_B,
+               SIM_MOTOR_K * (1 + SIM_MOTOR_MISMATCH), SIM_WHEEL_FRICTION * (1 + SIM_FRICTION_MISMATCH));
+
+    ret = hal_timer_create(&(sim->echo_timer), sim_echo_callback, NULL, "sim_echo");
+    if (ret == ESP_OK) ret = hal_timer_create(&(sim->step_timer), sim_step_callback, NULL, "sim_step");
+    if (ret == ESP_OK) ret = hal_timer_start_periodic(sim->step_timer, SIM_STEP_US);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Simulation timers not started. (%s:%u)", __FILE__, __LINE__);
+        sim_deinit();
+        return ret;
+    }
+
+    hal_host_pin_hook(sim_pin_hook, NULL);
+
+    ESP_LOGI(TAG, "Simulation of a %.0f x %.0f mm room with %u obstacles",
+             world->width, world->height, world->obstacles);
+
+    return ESP_OK;
+}
+
+void sim_deinit() {
+
+    if (sim == NULL) return;
+
+    hal_host_pin_hook(NULL, NULL);
+
+    if (sim->step_timer) {
+        hal_timer_stop(sim->step_timer);
+        hal_timer_delete(sim->step_timer);
+    }
+    if (sim->echo_timer) {
+        hal_timer_stop(sim->echo_timer);
+        hal_timer_delete(sim->echo_timer);
+    }
+
+    free(sim);
+    sim = NULL;
+}
+
+void sim_set_world(const sim_world_t *world) {
+
+    if (sim) sim->world = *world;
+}
+
+void sim_place(float x, float y, float heading) {
+
+    if (sim == NULL) return;
+
+    sim->x = x;
+    sim->y = y;
+    sim->heading = heading;
+    sim->speed = 0;
+    sim->yaw_rate = 0;
+    sim->distance = 0;
+    sim->wheel_left.omega = 0;
+    sim->wheel_left.current = 0;
+    sim->wheel_left.pulses = 0;
+    sim->wheel_right.omega = 0;
+    sim->wheel_right.current = 0;
+    sim->wheel_right.pulses = 0;
+    sim->echoes = 0;
+    sim->collisions = 0;
+    sim->contact = false;
+}
+
+void sim_lift(bool lifted) {
+
+    if (sim) sim->lifted = lifted;
+}
+
+void sim_push(float speed) {
+
+    if (sim) sim->speed = speed / 1000;
+}
+
+void sim_lock_wheels(bool left, bool right) {
+
+    if (sim == NULL) return;
+
+    sim->wheel_left.locked = left;
+    sim->wheel_right.locked = right;
+}
+
+void sim_get_state(sim_state_t *state) {
+
+    memset(state, 0, sizeof(sim_state_t));
+
+    if (sim == NULL) return;
+
+    state->x = sim->x;
+    state->y = sim->y;
+    state->heading = sim->heading;
+    state->speed = sim->speed * 1000;
+    state->yaw_rate = sim->yaw_rate;
+    state->rps_left = sim->wheel_left.omega / (2 * (float)M_PI);
+    state->rps_right = sim->wheel_right.omega / (2 * (float)M_PI);
+    state->current_left = sim->wheel_left.current;
+    state->current_right = sim->wheel_right.current;
+    state->servo_angle = sim->servo_angle;
+    state->range = sonar_range();
+    state->distance = sim->distance;
+    state->pulses_left = sim->wheel_left.pulses;
+    state->pulses_right = sim->wheel_right.pulses;
+    state->ticks_left = (int32_t)floor(sim->wheel_left.angle * 2 * PULSE_PER_TURN / M_PI);
+    state->ticks_right = (int32_t)floor(sim->wheel_right.angle * 2 * PULSE_PER_TURN / M_PI);
+    state->echoes = sim->echoes;
+    state->collisions = sim->collisions;
+    state->contact = sim->contact;
+}
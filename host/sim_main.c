@@ -0,0 +1,1009 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+
+#include "hal_host.h"
+#include "sim.h"
+#include "utils.h"
+#include "driver.h"
+#include "pulse.h"
+#include "usonic.h"
+#include "autopilot.h"
+#include "mission.h"
+#include "kinematics.h"
+#include "stall.h"
+
+#define SIM_SAMPLE_MS       10          /* sample period of the scenarios   */
+#define SIM_AUTO_SECONDS    300         /* drive of the autopilot scenario  */
+
+/* bounds of the scenarios, a run outside of one fails */
+#define BOUND_OVERSHOOT     15          /* % of the target speed                    */
+#define BOUND_RISE_MS       2500        /* to 90 % of the target speed              */
+#define BOUND_SPEED_ERROR   8           /* % off the target in the last second      */
+#define BOUND_RAMP_RMS      0.3         /* rps of the wheels off the profile on the ramp */
+#define BOUND_RAMP_MAX      (WHEEL_RPS_MIN + 0.1)
+#define BOUND_RADIUS        5           /* % of the turn radius off the model       */
+#define BOUND_POSE_MM       40          /* odometry off the true pose               */
+#define BOUND_HEADING_DEG   5
+#define BOUND_PATH          1           /* % of the path off the odometry           */
+#define BOUND_PATH_MM       100         /* end of a turn off the kinematic model    */
+#define BOUND_GAP_MM        50          /* left to the wall after a guard stop      */
+#define BOUND_STOP_MS       15000       /* from the start to the guard stop         */
+#define BOUND_MOVING        90          /* % of the time the autopilot drives       */
+#define BOUND_REPLAY_MM     20          /* end pose of a replay off the recorded one */
+#define BOUND_REPLAY_DEG    1
+#define BOUND_REPLAY_US     1000        /* a step of the replay late, mean and max */
+#define BOUND_STALL_MS      100         /* stall found later than its timeout       */
+#define BOUND_STALL_STOP_MS 50          /* car stopped later than the stall found   */
+#define BOUND_MISMATCH      6           /* % left - right in a start once calibrated */
+#define BOUND_CAPTURE       5           /* % rms error of the speed of the capture  */
+#define BOUND_TICKS         5           /* counted off the true ticks in a phase    */
+#define BOUND_WRONG_WAY     10          /* samples of a phase with a wheel the wrong way */
+#define BOUND_VELOCITY      1           /* % rms error of the estimate              */
+#define BOUND_VELOCITY_STOP (VELOCITY_STOP_MS + 50) /* ms to a stop of the estimate */
+#define BOUND_WHEEL_MM_S    1           /* mean error of the wheel speed            */
+#define BOUND_DISTANCE_MM   5           /* per wheel off the true turns             */
+#define BOUND_SCRIPT_MM     50          /* odometry off the true pose at the end of a script */
+#define BOUND_SCRIPT_DEG    5
+
+/*
+ *  Regression scenarios of the firmware on the simulated car - make -C host,
+ *  then host/build/sim [speed|turn|guard|auto|mission|stall|calibrate|capture|quadrature|velocity|odometer|odometry ...], all without
+ *  arguments. The firmware is started once, the car is put back in place
+ *  before every scenario.
+ *
+ *  Every scenario checks its results against the BOUND_ settings. A result
+ *  outside of one is printed as FAILED and the sim exits with 1.
+ */
+
+typedef struct {
+    const char *name;
+    void      (*run)();
+} scenario_t;
+
+/* an empty hall - nothing in reach of the sensor */
+static const sim_world_t hall = {
+        .width = 100000,
+        .height = 100000,
+};
+
+/* 6 m corridor to the wall */
+static const sim_world_t corridor = {
+        .width = 6000,
+        .height = 2000,
+};
+
+static const sim_world_t room = {
+        .width = 5000,
+        .height = 4000,
+        .obstacles = 4,
+        .obstacle = {
+                { 1500, 1200,  400,  400 },
+                { 3200, 2400,  600,  300 },
+                { 2400,    0,  200, 1000 },
+                {  600, 3000,  300,  300 },
+        },
+};
+
+static uint32_t checks, failures;
+
+static double wall_time() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_ms(uint32_t ms) {
+    vTaskDelay(ms/portTICK_PERIOD_MS);
+}
+
+/* stops the car and waits for it to stand still */
+static void rest() {
+
+    sim_state_t sim_state;
+
+    stop_car();
+    turn_stop_car();
+
+    for (int i = 0; i < 500; i++) {
+        sleep_ms(SIM_SAMPLE_MS);
+        sim_get_state(&sim_state);
+        if (sim_state.speed == 0 && sim_state.rps_left == 0 && sim_state.rps_right == 0) break;
+    }
+}
+
+static void start(const sim_world_t *world, float x, float y, float heading) {
+
+    rest();
+    sim_set_world(world);
+    sim_place(x, y, heading);
+    reset_pose_car();
+    /* the speed sensors forget the last drive */
+    sleep_ms(COUNT_TIMEOUT + 100);
+}
+
+/* a result of a scenario within its bound, else FAILED */
+static bool check(bool ok, const char *what, float value, float bound) {
+
+    checks++;
+
+    if (ok) return true;
+
+    failures++;
+    printf("  FAILED %s %.2f, bound %.2f\n", what, value, bound);
+
+    return false;
+}
+
+static bool check_max(const char *what, float value, float bound) {
+    return check(value <= bound, what, value, bound);
+}
+
+static bool check_min(const char *what, float value, float bound) {
+    return check(value >= bound, what, value, bound);
+}
+
+/* wheel speed the commanded duty should give, the feed-forward map of the driver */
+static float target_rps(int16_t duty) {
+    return WHEEL_RPS_MIN + (float)(duty - VAL_SPEED_MIN) * (WHEEL_RPS_MAX - WHEEL_RPS_MIN)
+                                                         / (VAL_SPEED_MAX - VAL_SPEED_MIN);
+}
+
+/*--------------------------------------Scenarios-----------------------------------------------*/
+
+/*
+ *  Step response of the wheel speed controller from standstill. On the ramp
+ *  the wheels follow the setpoint of the motion profile - "ramp" is their
+ *  rms and max difference to it in rps. The profile starts at VAL_SPEED_MIN,
+ *  WHEEL_RPS_MIN ahead of the standing wheels, so that is about the max.
+ */
+static void scenario_speed() {
+
+    const int16_t speeds[] = { 60, 160, 255 };
+    car_state_t state;
+    sim_state_t sim_state;
+    float target, peak, error_left, error_right, setpoint, ramp, ramp_sum, ramp_max;
+    int rise_ms, samples, ramp_samples;
+
+    printf("speed: step response of the wheel speed controller\n");
+    printf("  speed  target rps  rise ms  overshoot %%  error left %%  error right %%  ramp rms rps  ramp max rps\n");
+
+    for (size_t i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+        start(&hall, hall.width / 2, hall.height / 2, 0);
+
+        set_speed_car(speeds[i]);
+        forward_start_car();
+
+        target = 0;
+        peak = 0;
+        rise_ms = -1;
+        error_left = error_right = 0;
+        samples = 0;
+        ramp_sum = ramp_max = 0;
+        ramp_samples = 0;
+
+        for (int ms = SIM_SAMPLE_MS; ms <= 4000; ms += SIM_SAMPLE_MS) {
+            sleep_ms(SIM_SAMPLE_MS);
+            get_state_car(&state);
+            sim_get_state(&sim_state);
+
+            target = target_rps(state.new_speed_left);
+            peak = fmaxf(peak, fmaxf(sim_state.rps_left, sim_state.rps_right));
+
+            /* the ramped duty is the setpoint of the profile */
+            if (state.speed_left != state.new_speed_left) {
+                setpoint = target_rps(state.speed_left);
+                for (int wheel = 0; wheel < 2; wheel++) {
+                    ramp = (wheel ? sim_state.rps_right : sim_state.rps_left) - setpoint;
+                    ramp_sum += ramp * ramp;
+                    ramp_max = fmaxf(ramp_max, fabsf(ramp));
+                    ramp_samples++;
+                }
+            }
+            if (rise_ms < 0 && fminf(sim_state.rps_left, sim_state.rps_right) >= 0.9f * target) rise_ms = ms;
+
+            /* the last second */
+            if (ms > 3000) {
+                error_left += sim_state.rps_left - target;
+                error_right += sim_state.rps_right - target;
+                samples++;
+            }
+        }
+
+        ramp = ramp_samples ? sqrtf(ramp_sum / ramp_samples) : 0;
+
+        printf("  %5d  %10.2f  %7d  %11.1f  %12.1f  %13.1f  %12.2f  %12.2f\n", speeds[i], target, rise_ms,
+               100 * (peak - target) / target,
+               100 * error_left / samples / target, 100 * error_right / samples / target, ramp, ramp_max);
+
+        check(rise_ms >= 0 && rise_ms <= BOUND_RISE_MS, "rise ms", rise_ms, BOUND_RISE_MS);
+        check_max("overshoot %", 100 * (peak - target) / target, BOUND_OVERSHOOT);
+        check_max("error left %", fabsf(100 * error_left / samples / target), BOUND_SPEED_ERROR);
+        check_max("error right %", fabsf(100 * error_right / samples / target), BOUND_SPEED_ERROR);
+        check_max("ramp rms rps", ramp, BOUND_RAMP_RMS);
+        check_max("ramp max rps", ramp_max, BOUND_RAMP_MAX);
+    }
+}
+
+/*
+ *  A steady left turn - the radius against the kinematic model, the pose
+ *  against the odometry. The path error is how far the car ends from a
+ *  car on the model - the same path length, the curvature of the servo
+ *  angle of the moment. The inner wheel is slowed by the Ackermann ratio
+ *  or, to compare, by the old SPEED_TURN_STEP per STEERING_STEP.
+ */
+static void turn(const kinematics_t *kinematics, bool ackermann) {
+
+    car_state_t state;
+    car_pose_t pose;
+    sim_state_t sim_state;
+    float curvature = 0, odometer, x, y, model, error, heading, path;
+    float model_x = 0, model_y = 0, model_heading = 0, distance = 0, step;
+    int samples = 0;
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+    set_turn_ackermann_car(ackermann);
+
+    /* the odometer keeps counting over a pose reset */
+    get_pose_car(&pose);
+    odometer = pose.distance;
+
+    set_speed_car(120);
+    forward_start_car();
+
+    for (int ms = 0; ms < 9600; ms += SIM_SAMPLE_MS) {
+        /* held for six steps of TURN_HOLD_MS */
+        if (ms == 1000) turn_left_car();
+        if (ms == 1280) turn_stop_car();
+        sleep_ms(SIM_SAMPLE_MS);
+        sim_get_state(&sim_state);
+        step = sim_state.distance - distance;
+        distance = sim_state.distance;
+        model_x += step * cosf(model_heading + step * kinematics_curvature(kinematics, lroundf(sim_state.servo_angle)) / 2);
+        model_y += step * sinf(model_heading + step * kinematics_curvature(kinematics, lroundf(sim_state.servo_angle)) / 2);
+        model_heading += step * kinematics_curvature(kinematics, lroundf(sim_state.servo_angle));
+        if (ms >= 3600 && sim_state.speed > 0) {
+            curvature += sim_state.yaw_rate / sim_state.speed;
+            samples++;
+        }
+    }
+
+    get_state_car(&state);
+    get_pose_car(&pose);
+    sim_get_state(&sim_state);
+
+    set_turn_ackermann_car(true);
+
+    /* the true pose from the start, the heading was 0 there */
+    x = sim_state.x - hall.width / 2;
+    y = sim_state.y - hall.height / 2;
+
+    curvature /= samples;
+    model = kinematics_curvature(kinematics, state.steering_position);
+    error = hypotf(pose.x - x, pose.y - y);
+    heading = remainderf(pose.heading - sim_state.heading, 2 * (float)M_PI) * 180 / (float)M_PI;
+    path = hypotf(model_x - x, model_y - y);
+
+    printf("  %s: wheels L/R %d / %d us\n", ackermann ? "ackermann" : "SPEED_TURN_STEP",
+           state.new_speed_left, state.new_speed_right);
+    printf("    steering %d, radius %.0f mm, model %.0f mm\n", state.steering_position, 1 / curvature, 1 / model);
+    printf("    path %.0f mm, odometry %.0f mm, path error %.0f mm\n", sim_state.distance, pose.distance - odometer, path);
+    printf("    pose error %.0f mm, heading error %.1f deg (sd %.0f mm, %.1f deg)\n", error, heading,
+           sqrtf(pose.var_x + pose.var_y), sqrtf(pose.var_heading) * 180 / (float)M_PI);
+
+    /* the old split is only there to compare */
+    if (!ackermann) return;
+
+    check_max("radius off the model %", fabsf(100 * (model / curvature - 1)), BOUND_RADIUS);
+    check_max("path off the odometry %", fabsf(100 * (pose.distance - odometer) / sim_state.distance - 100), BOUND_PATH);
+    check_max("pose error mm", error, BOUND_POSE_MM);
+    check_max("heading error deg", fabsf(heading), BOUND_HEADING_DEG);
+    check_max("path error mm", path, BOUND_PATH_MM);
+}
+
+static void scenario_turn() {
+
+    kinematics_t kinematics;
+
+    printf("turn: steady left turn at speed 120\n");
+
+    kinematics_init(&kinematics, WHEEL_BASE, TRACK_WIDTH, STEERING_RATIO);
+
+    turn(&kinematics, true);
+    turn(&kinematics, false);
+}
+
+/* straight at the wall - where the guard stops the car in every brake mode */
+static void scenario_guard() {
+
+    const char *modes[] = { "coast", "short", "reverse" };
+    const int16_t speeds[] = { 120, 255 };
+    car_state_t state;
+    sim_state_t sim_state;
+    uint32_t trips;
+    float top;
+    int ms;
+
+    printf("guard: straight at a wall 6 m ahead\n");
+    printf("  brake    speed  top mm/s  trips  gap mm  stop ms  collisions\n");
+
+    for (int mode = brake_coast; mode <= brake_reverse; mode++) {
+        for (size_t i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+            start(&corridor, 300, corridor.height / 2, 0);
+
+            get_state_car(&state);
+            trips = state.guard_trips;
+
+            set_brake_car(mode);
+            set_speed_car(speeds[i]);
+            forward_start_car();
+
+            top = 0;
+            for (ms = 0; ms < 15000; ms += SIM_SAMPLE_MS) {
+                sleep_ms(SIM_SAMPLE_MS);
+                get_state_car(&state);
+                sim_get_state(&sim_state);
+                top = fmaxf(top, sim_state.speed);
+                if (state.guard_trips != trips && sim_state.speed == 0) break;
+            }
+
+            printf("  %-7s  %5d  %8.0f  %5u  %6.0f  %7d  %10u\n", modes[mode], speeds[i], top,
+                   state.guard_trips - trips, sim_state.range, ms, sim_state.collisions);
+
+            check(state.guard_trips - trips == 1, "guard trips", state.guard_trips - trips, 1);
+            check_min("gap mm", sim_state.range, BOUND_GAP_MM);
+            check_max("stop ms", ms, BOUND_STOP_MS - SIM_SAMPLE_MS);
+            check_max("collisions", sim_state.collisions, 0);
+        }
+    }
+
+    set_brake_car(BRAKE_MODE);
+}
+
+/* the autopilot alone in a furnished room */
+static void scenario_auto() {
+
+    sim_state_t sim_state;
+    uint32_t moving = 0, contact = 0;
+
+    printf("auto: %d s of the autopilot in a %.0f x %.0f mm room\n", SIM_AUTO_SECONDS, room.width, room.height);
+
+    start(&room, 500, 500, (float)M_PI / 4);
+
+    automatic_car(true);
+
+    for (int ms = 0; ms < SIM_AUTO_SECONDS * 1000; ms += SIM_SAMPLE_MS) {
+        sleep_ms(SIM_SAMPLE_MS);
+        sim_get_state(&sim_state);
+        if (sim_state.speed != 0) moving += SIM_SAMPLE_MS;
+        if (sim_state.contact) contact += SIM_SAMPLE_MS;
+    }
+
+    automatic_car(false);
+
+    printf("  path %.0f mm, moving %.1f s, average %.0f mm/s\n", sim_state.distance, moving / 1000.0,
+           moving ? sim_state.distance * 1000 / moving : 0);
+    printf("  collisions %u, in contact %.1f s, echoes %u\n", sim_state.collisions, contact / 1000.0,
+           sim_state.echoes);
+
+    check_min("moving %", moving / (SIM_AUTO_SECONDS * 10.0f), BOUND_MOVING);
+    check_max("collisions", sim_state.collisions, 0);
+    check_max("in contact s", contact / 1000.0f, 0);
+}
+
+/* the right wheel jams at full drive - how fast the car stops, and no stall on a free run */
+static void scenario_stall() {
+
+    const int16_t speeds[] = { 60, 160, 255 };
+    car_state_t state;
+    sim_state_t sim_state;
+    uint32_t stalls, free_stalls, timeout_ms;
+    float current;
+    int found_ms, stop_ms, ms;
+
+    printf("stall: the right wheel locks after 2 s of driving\n");
+    printf("  speed  timeout ms  found ms  stopped ms  peak A  free run stalls\n");
+
+    for (size_t i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+        start(&hall, hall.width / 2, hall.height / 2, 0);
+
+        get_state_car(&state);
+        stalls = state.stall_left + state.stall_right;
+
+        set_speed_car(speeds[i]);
+        forward_start_car();
+        sleep_ms(2000);
+
+        get_state_car(&state);
+        free_stalls = state.stall_left + state.stall_right - stalls;
+        stalls = state.stall_right;
+        timeout_ms = stall_timeout_us(target_rps(state.speed_right)) / 1000;
+
+        sim_lock_wheels(false, true);
+
+        found_ms = stop_ms = -1;
+        current = 0;
+        for (ms = SIM_SAMPLE_MS; ms <= 3000; ms += SIM_SAMPLE_MS) {
+            sleep_ms(SIM_SAMPLE_MS);
+            get_state_car(&state);
+            sim_get_state(&sim_state);
+            current = fmaxf(current, fabsf(sim_state.current_right));
+            if (found_ms < 0 && state.stall_right != stalls) found_ms = ms;
+            if (found_ms >= 0 && state.stop) {
+                stop_ms = ms;
+                break;
+            }
+        }
+
+        sim_lock_wheels(false, false);
+
+        printf("  %5d  %10u  %8d  %10d  %6.2f  %15u\n", speeds[i],
+               timeout_ms, found_ms, stop_ms, current, free_stalls);
+
+        check(found_ms >= 0 && found_ms <= timeout_ms + BOUND_STALL_MS, "found ms", found_ms, timeout_ms + BOUND_STALL_MS);
+        check(stop_ms >= 0 && stop_ms - found_ms <= BOUND_STALL_STOP_MS, "stopped ms", stop_ms, found_ms + BOUND_STALL_STOP_MS);
+        check_max("free run stalls", free_stalls, 0);
+    }
+}
+
+/* mean difference of the wheel speeds in % of their target in the first second of a start on a stand */
+static float start_mismatch(int16_t speed) {
+
+    car_state_t state;
+    sim_state_t sim_state;
+    float mismatch = 0;
+    int samples = 0;
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+    sim_lift(true);
+
+    set_speed_car(speed);
+    forward_start_car();
+
+    for (int ms = SIM_SAMPLE_MS; ms <= 1000; ms += SIM_SAMPLE_MS) {
+        sleep_ms(SIM_SAMPLE_MS);
+        get_state_car(&state);
+        sim_get_state(&sim_state);
+        /* the target of the ramped duty */
+        mismatch += fabsf(sim_state.rps_left - sim_state.rps_right) / target_rps(state.speed_left);
+        samples++;
+    }
+
+    rest();
+    sim_lift(false);
+
+    return mismatch * 100 / samples;
+}
+
+/* starts on the nominal map, the sweep, the same starts on the curves of the motors - all on a stand */
+static void scenario_calibrate() {
+
+    const int16_t speeds[] = { 30, 120, 255 };
+    car_state_t state;
+    float nominal[3], calibrated;
+    int ms;
+
+    printf("calibrate: sweep of both motors on a stand\n");
+
+    clear_calibration_car();
+    for (size_t i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+        nominal[i] = start_mismatch(speeds[i]);
+    }
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+    sim_lift(true);
+    calibrate_car();
+
+    for (ms = 0; ms < 60000; ms += 100) {
+        sleep_ms(100);
+        get_state_car(&state);
+        if (!state.calibrating) break;
+    }
+
+    sim_lift(false);
+
+    printf("  sweep %.1f s, calibrated %s\n", ms / 1000.0, state.calibrated ? "yes" : "no");
+
+    if (state.calibrated) {
+        printf("  left - right in the first second of a start, %% of the target\n");
+        printf("  speed  nominal  calibrated\n");
+        for (size_t i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+            calibrated = start_mismatch(speeds[i]);
+            printf("  %5d  %7.1f  %10.1f\n", speeds[i], nominal[i], calibrated);
+            check_max("calibrated mismatch %", calibrated, fminf(nominal[i], BOUND_MISMATCH));
+        }
+    } else {
+        check(false, "calibrated", 0, 1);
+    }
+
+    /* the other scenarios run on the nominal map */
+    clear_calibration_car();
+    sleep_ms(100);
+}
+
+/*
+ *  Signed ticks and wheel speeds of the quadrature encoders against the
+ *  true turns of the wheels - driven both ways, reversed at speed and
+ *  pushed both ways with the motors off. "wrong way" counts the samples
+ *  where a turning wheel is reported to turn the other way.
+ */
+static void scenario_quadrature() {
+
+    const char *phases[] = { "forward", "reverse", "push back", "push fwd" };
+    car_state_t state;
+    sim_state_t sim_state;
+    int32_t true_left, true_right, ticks_left, ticks_right;
+    uint32_t wrong;
+
+    printf("quadrature: signed ticks and speed across direction changes\n");
+    printf("  phase      true ticks L/R  counted L/R    wheel rps L/R  true rps L/R   wrong way\n");
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+
+    for (int phase = 0; phase < 4; phase++) {
+        get_state_car(&state);
+        sim_get_state(&sim_state);
+        true_left = sim_state.ticks_left;
+        true_right = sim_state.ticks_right;
+        ticks_left = state.ticks_left;
+        ticks_right = state.ticks_right;
+
+        switch (phase) {
+            case 0:
+                set_speed_car(120);
+                forward_start_car();
+                break;
+            case 1:
+                /* at once, the wheels still roll forward */
+                stop_car();
+                back_start_car();
+                break;
+            case 2:
+                stop_car();
+                sleep_ms(1500);
+                break;
+        }
+
+        wrong = 0;
+        for (int ms = 0; ms < 2000; ms += SIM_SAMPLE_MS) {
+            /* a hand keeps the car rolling */
+            if (phase == 2) sim_push(-200);
+            if (phase == 3) sim_push(200);
+            sleep_ms(SIM_SAMPLE_MS);
+            get_state_car(&state);
+            sim_get_state(&sim_state);
+            if (fabsf(sim_state.rps_left) > 0.2f && state.wheel_rps_left * sim_state.rps_left < 0) wrong++;
+            if (fabsf(sim_state.rps_right) > 0.2f && state.wheel_rps_right * sim_state.rps_right < 0) wrong++;
+        }
+
+        get_state_car(&state);
+        sim_get_state(&sim_state);
+
+        printf("  %-9s  %6d %6d  %6d %6d  %6.2f %6.2f  %6.2f %6.2f  %9u\n", phases[phase],
+               sim_state.ticks_left - true_left, sim_state.ticks_right - true_right,
+               state.ticks_left - ticks_left, state.ticks_right - ticks_right,
+               state.wheel_rps_left, state.wheel_rps_right, sim_state.rps_left, sim_state.rps_right, wrong);
+
+        check_max("ticks left off", abs((state.ticks_left - ticks_left) - (sim_state.ticks_left - true_left)), BOUND_TICKS);
+        check_max("ticks right off", abs((state.ticks_right - ticks_right) - (sim_state.ticks_right - true_right)), BOUND_TICKS);
+        /* some right at the reversal, until the first ticks the other way are in */
+        check_max("wrong way", wrong, BOUND_WRONG_WAY);
+    }
+}
+
+/*
+ *  Speed from the time of every turn against the one of every pulse, at a
+ *  crawl and at full speed, against the true speed of the wheels. The time
+ *  of a turn comes in 1 us of the isr, the one of a pulse in 12.5 ns of the
+ *  capture. On the car the isr also adds its latency, the host has none.
+ */
+static void scenario_capture() {
+
+    const int16_t speeds[] = { 1, 255 };
+    const char *modes[] = { "turn", "capture" };
+    pulse_stats_t left, right;
+    sim_state_t sim_state;
+    uint64_t speed_left, speed_right;
+    uint32_t updates, wakeups, samples;
+    float error, rps;
+
+    printf("capture: wheel speed per turn and per pulse, 4 s of steady driving\n");
+    printf("  mode     speed  rps   updates/s  wakeups/s  rms error %%\n");
+
+    for (size_t i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+        for (int capture = 0; capture < 2; capture++) {
+            set_pulse_capture(capture);
+            start(&hall, hall.width / 2, hall.height / 2, 0);
+
+            set_speed_car(speeds[i]);
+            forward_start_car();
+            sleep_ms(3000);
+
+            get_pulse_stats(&left, &right);
+            updates = left.updates + right.updates;
+            wakeups = left.wakeups;
+
+            error = rps = 0;
+            for (samples = 0; samples < 4000 / SIM_SAMPLE_MS; samples++) {
+                sleep_ms(SIM_SAMPLE_MS);
+                get_speed_time(&speed_left, &speed_right);
+                sim_get_state(&sim_state);
+                error += powf((speed_left ? 1e6f / speed_left : 0) / sim_state.rps_left - 1, 2);
+                error += powf((speed_right ? 1e6f / speed_right : 0) / sim_state.rps_right - 1, 2);
+                rps += sim_state.rps_left + sim_state.rps_right;
+            }
+
+            get_pulse_stats(&left, &right);
+            updates = left.updates + right.updates - updates;
+            wakeups = left.wakeups - wakeups;
+            rps /= 2 * samples;
+
+            /* wakeups of the one pulse task for both wheels */
+            printf("  %-7s  %5d  %4.2f  %9.1f  %9.1f  %11.2f\n", modes[capture], speeds[i], rps,
+                   updates / 2 / 4.0f, wakeups / 4.0f, 100 * sqrtf(error / (2 * samples)));
+
+            /* the time of a turn is what the capture is measured against */
+            if (capture) check_max("capture rms error %", 100 * sqrtf(error / (2 * samples)), BOUND_CAPTURE);
+        }
+    }
+
+    set_pulse_capture(PULSE_CAPTURE);
+}
+
+/*
+ *  Speed of the pulse task against the estimate of the control loop, in
+ *  steady driving and when both wheels lock. The pulse task holds its last
+ *  speed until COUNT_TIMEOUT, the estimate drops as the pulses stay away.
+ */
+static void scenario_velocity() {
+
+    const int16_t speeds[] = { 1, 60, 255 };
+    car_state_t state;
+    sim_state_t sim_state;
+    uint64_t speed_left, speed_right;
+    uint32_t samples;
+    float error_old, error_new, rps;
+    int stop_old, stop_new;
+
+    printf("velocity: rms error over 3 s of steady driving, then time to a stop of both wheels\n");
+    printf("  speed  rps   pulse task %%  estimate %%  stop pulse task ms  stop estimate ms\n");
+
+    for (size_t i = 0; i < sizeof(speeds)/sizeof(speeds[0]); i++) {
+        start(&hall, hall.width / 2, hall.height / 2, 0);
+
+        set_speed_car(speeds[i]);
+        forward_start_car();
+        sleep_ms(3000);
+
+        error_old = error_new = rps = 0;
+        for (samples = 0; samples < 3000 / SIM_SAMPLE_MS; samples++) {
+            sleep_ms(SIM_SAMPLE_MS);
+            get_speed_time(&speed_left, &speed_right);
+            get_state_car(&state);
+            sim_get_state(&sim_state);
+            error_old += powf((speed_left ? 1e6f / speed_left : 0) / sim_state.rps_left - 1, 2);
+            error_old += powf((speed_right ? 1e6f / speed_right : 0) / sim_state.rps_right - 1, 2);
+            error_new += powf(state.wheel_rps_left / sim_state.rps_left - 1, 2);
+            error_new += powf(state.wheel_rps_right / sim_state.rps_right - 1, 2);
+            rps += sim_state.rps_left + sim_state.rps_right;
+        }
+
+        sim_lock_wheels(true, true);
+
+        stop_old = stop_new = -1;
+        for (int ms = SIM_SAMPLE_MS; ms <= 2 * COUNT_TIMEOUT; ms += SIM_SAMPLE_MS) {
+            sleep_ms(SIM_SAMPLE_MS);
+            get_speed_time(&speed_left, &speed_right);
+            get_state_car(&state);
+            if (stop_old < 0 && speed_left == 0 && speed_right == 0) stop_old = ms;
+            if (stop_new < 0 && state.wheel_rps_left == 0 && state.wheel_rps_right == 0) stop_new = ms;
+            if (stop_old >= 0 && stop_new >= 0) break;
+        }
+
+        sim_lock_wheels(false, false);
+
+        printf("  %5d  %4.2f  %12.2f  %10.2f  %18d  %16d\n", speeds[i], rps / (2 * samples),
+               100 * sqrtf(error_old / (2 * samples)), 100 * sqrtf(error_new / (2 * samples)), stop_old, stop_new);
+
+        check_max("estimate %", 100 * sqrtf(error_new / (2 * samples)), BOUND_VELOCITY);
+        check(stop_new >= 0 && stop_new <= BOUND_VELOCITY_STOP, "stop estimate ms", stop_new, BOUND_VELOCITY_STOP);
+    }
+}
+
+/*
+ *  Wheel speed in mm/s and the distance of every wheel against the true
+ *  turns of the wheels, then the odometer in the store - not written while
+ *  the car drives, written once it stands.
+ */
+static void scenario_odometer() {
+
+    car_state_t state;
+    sim_state_t sim_state;
+    double odometer, stored, stored_driving, stored_stop;
+    float distance_left, distance_right, error, mm_s;
+    int32_t true_left, true_right;
+    int samples = 0;
+
+    printf("odometer: 25 s at speed 160, then a stop\n");
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+
+    get_state_car(&state);
+    sim_get_state(&sim_state);
+    odometer = state.odometer;
+    distance_left = state.distance_left;
+    distance_right = state.distance_right;
+    true_left = sim_state.ticks_left;
+    true_right = sim_state.ticks_right;
+    if (hal_store_get("odometer", &stored, sizeof(double)) != ESP_OK) stored = 0;
+
+    set_speed_car(160);
+    forward_start_car();
+    sleep_ms(3000);
+
+    error = mm_s = 0;
+    for (int ms = 0; ms < 22000; ms += SIM_SAMPLE_MS) {
+        sleep_ms(SIM_SAMPLE_MS);
+        get_state_car(&state);
+        sim_get_state(&sim_state);
+        error += fabsf(state.wheel_mm_s_left - sim_state.rps_left * (float)M_PI * WHEEL_DIAMETER);
+        error += fabsf(state.wheel_mm_s_right - sim_state.rps_right * (float)M_PI * WHEEL_DIAMETER);
+        mm_s += state.wheel_mm_s_left + state.wheel_mm_s_right;
+        samples += 2;
+    }
+
+    if (hal_store_get("odometer", &stored_driving, sizeof(double)) != ESP_OK) stored_driving = 0;
+
+    rest();
+    sleep_ms(500);
+
+    get_state_car(&state);
+    sim_get_state(&sim_state);
+    if (hal_store_get("odometer", &stored_stop, sizeof(double)) != ESP_OK) stored_stop = 0;
+
+    printf("  wheel %.0f mm/s, mean error %.2f mm/s\n", mm_s / samples, error / samples);
+    printf("  distance L/R %.0f %.0f mm, true %.0f %.0f mm\n",
+           state.distance_left - distance_left, state.distance_right - distance_right,
+           (sim_state.ticks_left - true_left) * (float)M_PI * WHEEL_DIAMETER / ENCODER_TICKS,
+           (sim_state.ticks_right - true_right) * (float)M_PI * WHEEL_DIAMETER / ENCODER_TICKS);
+    printf("  odometer +%.0f mm, stored while driving +%.0f mm, after the stop %s\n",
+           state.odometer - odometer, stored_driving - stored,
+           stored_stop == state.odometer ? "stored" : "NOT stored");
+
+    check_max("wheel error mm/s", error / samples, BOUND_WHEEL_MM_S);
+    check_max("distance left off mm", fabsf(state.distance_left - distance_left
+              - (sim_state.ticks_left - true_left) * (float)M_PI * WHEEL_DIAMETER / ENCODER_TICKS), BOUND_DISTANCE_MM);
+    check_max("distance right off mm", fabsf(state.distance_right - distance_right
+              - (sim_state.ticks_right - true_right) * (float)M_PI * WHEEL_DIAMETER / ENCODER_TICKS), BOUND_DISTANCE_MM);
+    check_max("stored while driving mm", stored_driving - stored, 0);
+    check(stored_stop == state.odometer, "stored after the stop", stored_stop, state.odometer);
+}
+
+/* a left and a right circle at full lock */
+static void figure_eight_script() {
+
+    set_speed_car(120);
+    forward_start_car();
+    sleep_ms(500);
+    /* six steps left, then twelve right */
+    turn_left_car();
+    sleep_ms(280);
+    turn_stop_car();
+    sleep_ms(4820);
+    turn_right_car();
+    sleep_ms(580);
+    turn_stop_car();
+    sleep_ms(4920);
+}
+
+/* out, back past the start and out again - the wheels reverse twice */
+static void straight_reverse_script() {
+
+    set_speed_car(160);
+    forward_start_car();
+    sleep_ms(2500);
+    /* at once, the wheels still roll forward */
+    stop_car();
+    back_start_car();
+    sleep_ms(4000);
+    stop_car();
+    forward_start_car();
+    sleep_ms(2500);
+}
+
+/* the pose of the odometry against the true one once the car stands after a script */
+static void odometry_script(const char *name, void (*script)()) {
+
+    car_pose_t pose;
+    sim_state_t sim_state;
+    float x, y, error, heading;
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+
+    script();
+    rest();
+
+    get_pose_car(&pose);
+    sim_get_state(&sim_state);
+
+    /* the true pose from the start, the heading was 0 there */
+    x = sim_state.x - hall.width / 2;
+    y = sim_state.y - hall.height / 2;
+    error = hypotf(pose.x - x, pose.y - y);
+    heading = remainderf(pose.heading - sim_state.heading, 2 * (float)M_PI) * 180 / (float)M_PI;
+
+    printf("  %-16s  %6.0f  %5.0f %5.0f  %5.0f %5.0f  %8.1f  %9.1f\n", name, sim_state.distance,
+           x, y, pose.x, pose.y, error, heading);
+
+    check_max("pose error mm", error, BOUND_SCRIPT_MM);
+    check_max("heading error deg", fabsf(heading), BOUND_SCRIPT_DEG);
+}
+
+/* dead reckoning over whole drives, the end pose against the true one */
+static void scenario_odometry() {
+
+    printf("odometry: end pose after scripted drives\n");
+    printf("  script            path mm  true x y mm   odometry x y  error mm  error deg\n");
+
+    odometry_script("figure eight", figure_eight_script);
+    odometry_script("straight reverse", straight_reverse_script);
+}
+
+static void mission_script() {
+
+    set_speed_car(180);
+    forward_start_car();
+    sleep_ms(1500);
+    /* two steps left, three right */
+    turn_left_car();
+    sleep_ms(80);
+    turn_stop_car();
+    sleep_ms(1420);
+    set_speed_car(90);
+    sleep_ms(1000);
+    turn_right_car();
+    sleep_ms(130);
+    turn_stop_car();
+    sleep_ms(1870);
+    forward_stop_car();
+    back_start_car();
+    sleep_ms(1000);
+    stop_car();
+}
+
+/* a recorded drive and its replay should end in the same place */
+static void scenario_mission() {
+
+    sim_state_t recorded, played;
+    float apart, heading, error_avg, error_max;
+    cJSON *status;
+
+    printf("mission: record a drive, then replay it\n");
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+    if (record_mission("sim") != ESP_OK) {
+        printf("  recording failed\n");
+        check(false, "recording", 0, 1);
+        return;
+    }
+    mission_script();
+    sleep_ms(1000);
+    stop_mission();
+    sim_get_state(&recorded);
+
+    start(&hall, hall.width / 2, hall.height / 2, 0);
+    if (play_mission("sim") != ESP_OK) {
+        printf("  replay failed\n");
+        check(false, "replay", 0, 1);
+        return;
+    }
+    sleep_ms(10000);
+    stop_mission();
+    sim_get_state(&played);
+
+    status = cJSON_CreateObject();
+    get_status_mission(status);
+    error_avg = cJSON_GetNumberValue(cJSON_GetObjectItem(status, "mission_error_avg"));
+    error_max = cJSON_GetNumberValue(cJSON_GetObjectItem(status, "mission_error_max"));
+    cJSON_Delete(status);
+
+    apart = hypotf(played.x - recorded.x, played.y - recorded.y);
+    heading = remainderf(played.heading - recorded.heading, 2 * (float)M_PI) * 180 / (float)M_PI;
+
+    printf("  path recorded %.0f mm, replayed %.0f mm\n", recorded.distance, played.distance);
+    printf("  end pose apart %.1f mm, heading %.2f deg\n", apart, heading);
+    printf("  steps late avg %.0f us, max %.0f us\n", error_avg, error_max);
+
+    check_max("end pose apart mm", apart, BOUND_REPLAY_MM);
+    check_max("end heading apart deg", fabsf(heading), BOUND_REPLAY_DEG);
+    check_max("replay late avg us", error_avg, BOUND_REPLAY_US);
+    check_max("replay late max us", error_max, BOUND_REPLAY_US);
+}
+
+static const scenario_t scenarios[] = {
+        { "speed",      scenario_speed },
+        { "turn",       scenario_turn },
+        { "guard",      scenario_guard },
+        { "auto",       scenario_auto },
+        { "mission",    scenario_mission },
+        { "stall",      scenario_stall },
+        { "calibrate",  scenario_calibrate },
+        { "capture",    scenario_capture },
+        { "quadrature", scenario_quadrature },
+        { "velocity",   scenario_velocity },
+        { "odometer",   scenario_odometer },
+        { "odometry",   scenario_odometry },
+};
+
+#define SCENARIOS   (sizeof(scenarios)/sizeof(scenarios[0]))
+
+typedef struct {
+    int     count;
+    char  **names;
+} sim_args_t;
+
+static void simulate(void *param) {
+
+    sim_args_t *args = (sim_args_t*)param;
+    uint64_t start_us;
+    double start, wall, seconds;
+
+    init_spiffs();
+    if (sim_init(&hall) != ESP_OK) {
+        failures++;
+        return;
+    }
+    init_usonic();
+    init_driver();
+    init_pulse();
+    init_autopilot();
+    init_mission();
+
+    start_us = hal_time_us();
+    start = wall_time();
+
+    for (size_t i = 0; i < SCENARIOS; i++) {
+        bool selected = args->count == 0;
+        for (int j = 0; j < args->count; j++) {
+            if (strcmp(args->names[j], scenarios[i].name) == 0) selected = true;
+        }
+        if (selected) scenarios[i].run();
+    }
+
+    wall = wall_time() - start;
+    seconds = (hal_time_us() - start_us) / 1e6;
+
+    printf("%.0f s of virtual time in %.3f s, %.0f x real time\n", seconds, wall, seconds / wall);
+    printf("%u of %u bounds exceeded - %s\n", failures, checks, failures ? "FAILED" : "OK");
+}
+
+int main(int argc, char *argv[]) {
+
+    sim_args_t args = { argc - 1, argv + 1 };
+
+    for (int i = 0; i < args.count; i++) {
+        bool known = false;
+        for (size_t j = 0; j < SCENARIOS; j++) {
+            if (strcmp(args.names[i], scenarios[j].name) == 0) known = true;
+        }
+        if (!known) {
+            fprintf(stderr, "usage: %s [speed|turn|guard|auto|mission|stall|calibrate|capture|quadrature|velocity|odometer|odometry ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    esp_log_level_set("*", getenv("SIM_LOG") ? ESP_LOG_INFO : ESP_LOG_ERROR);
+
+    hal_host_run(simulate, &args);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,36 @@
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include "esp_log.h"
+
+#include "utils.h"
+
+/* SPIFFS of the car is a plain directory on the host */
+
+static const char *TAG = "robot_car_utils";
+
+static bool spiffs;
+
+bool get_status_spiffs() {
+    return spiffs;
+}
+
+void init_spiffs() {
+
+    ESP_LOGI(TAG, "Initialize SPIFFS");
+
+    spiffs = (mkdir(MOUNT_POINT_SPIFFS, 0755) == 0 || access(MOUNT_POINT_SPIFFS, W_OK) == 0);
+
+    if (!spiffs) {
+        ESP_LOGE(TAG, "Directory %s not available. (%s:%u)", MOUNT_POINT_SPIFFS, __FILE__, __LINE__);
+    }
+}
+
+size_t get_fs_free_space() {
+
+    struct statvfs fs;
+
+    if (!spiffs || statvfs(MOUNT_POINT_SPIFFS, &fs) != 0) return 0;
+
+    return fs.f_bavail * fs.f_frsize;
+}
@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "actuation.h"
+
+#if ANGLE_MAX >= ACT_TABLE_SIZE || SPEED_MAX >= ACT_TABLE_SIZE
+#error "ACT_TABLE_SIZE is too small for ANGLE_MAX or SPEED_MAX"
+#endif
+
+const uint16_t act_angle_us[ACT_TABLE_SIZE] = { ACT_T256(ACT_ANGLE_US, 0) };
+const uint16_t act_speed_duty[ACT_TABLE_SIZE] = { ACT_T256(ACT_SPEED_DUTY, 0) };
+
+/* the conversions as they were before the tables, kept for the benchmark only */
+static uint32_t legacy_angle_to_us(uint32_t angle, uint32_t min_us, uint32_t max_us) {
+    uint32_t us = ((max_us - min_us) / ANGLE_MAX) * angle + min_us;
+    return us;
+}
+
+static long legacy_map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+/* the ranges go through volatile so the compiler can not fold the legacy arithmetic */
+static volatile uint32_t bench_min_us = SERVO_MIN_US;
+static volatile uint32_t bench_max_us = SERVO_MAX_US;
+static volatile long bench_val_max = VAL_SPEED_MAX;
+static volatile uint32_t bench_sink;
+
+/*
+ *  clock returns a free running tick counter - the CPU cycle counter on the
+ *  car, any monotonic counter on a host. The loop overhead is measured
+ *  with an empty conversion and subtracted.
+ */
+void act_benchmark(act_benchmark_t *bench, uint32_t (*clock)(void), uint32_t rounds) {
+
+    uint32_t start, overhead, i;
+    uint32_t min_us = bench_min_us, max_us = bench_max_us;
+    long val_max = bench_val_max;
+
+    memset(bench, 0, sizeof(act_benchmark_t));
+
+    if (rounds == 0) return;
+
+    start = clock();
+    for (i = 0; i < rounds; i++) bench_sink = i & 0xfff;
+    overhead = clock() - start;
+
+#define ACT_BENCH(field, expr)                                          \
+    start = clock();                                                    \
+    for (i = 0; i < rounds; i++) bench_sink = (expr);                   \
+    bench->field = (float)(int32_t)(clock() - start - overhead) / rounds;
+
+    ACT_BENCH(angle_legacy, legacy_angle_to_us(i & 0x7f, min_us, max_us));
+    ACT_BENCH(angle_table,  act_angle_to_us(i & 0x7f));
+    ACT_BENCH(speed_legacy, legacy_map(i & 0xff, SPEED_MIN, SPEED_MAX, VAL_SPEED_MIN, val_max));
+    ACT_BENCH(speed_table,  act_speed_to_duty(i & 0xff));
+    ACT_BENCH(duty_legacy,  legacy_map(VAL_SPEED_MIN + (i & 0xfff), VAL_SPEED_MIN, val_max, SPEED_MIN, SPEED_MAX));
+    ACT_BENCH(duty_fixed,   act_duty_to_speed(VAL_SPEED_MIN + (i & 0xfff)));
+
+#undef ACT_BENCH
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+
+#include "hal.h"
+#include "autopilot.h"
+#include "driver.h"
+#include "usonic.h"
+#include "planner.h"
+#include "tasks.h"
+
+#define AUTO_IDLE_MS    100             /* poll of the automatic mode while off */
+
+typedef struct {
+    planner_t       planner;
+    bool            active;
+    uint32_t        decisions;          /* commands sent to the driver          */
+    uint32_t        latency_us;         /* from the end of the echo to command  */
+    uint32_t        latency_max_us;
+    TaskHandle_t    handler_autopilot_task;
+} autopilot_t;
+
+static const char *TAG = "robot_car_autopilot";
+static autopilot_t *autopilot = NULL;
+
+/*
+ *  Runs while the car is in automatic mode. Every new echo of the sensor
+ *  goes through the planner, a changed command goes to the driver at once.
+ */
+static void autopilot_task(void *pvParameter) {
+
+    autopilot_t *pilot = (autopilot_t*)pvParameter;
+
+    car_state_t state;
+    plan_cmd_t cmd;
+    int16_t distance;
+    uint64_t time;
+    uint32_t latency;
+    bool changed;
+
+    while(1) {
+
+        if (get_state_car(&state) != ESP_OK || !state.automatic) {
+            if (pilot->active) {
+                ESP_LOGI(TAG, "Autopilot off");
+                pilot->active = false;
+            }
+            vTaskDelay(AUTO_IDLE_MS/portTICK_PERIOD_MS);
+            continue;
+        }
+
+        if (!pilot->active) {
+            ESP_LOGI(TAG, "Autopilot on");
+            planner_init(&(pilot->planner));
+            pilot->active = true;
+        }
+
+        distance = wait_distance(&time, AUTO_ECHO_TIMEOUT);
+
+        changed = planner_step(&(pilot->planner), distance, time, &cmd);
+
+        /* the collision guard may have stopped the car behind our back */
+        if (!changed && cmd.direction != 0 && !(cmd.direction > 0 ? state.forward : state.back)) {
+            changed = true;
+        }
+
+        if (changed) {
+            pilot_car(cmd.direction, cmd.speed, cmd.steering);
+            latency = hal_time_us() - time;
+            pilot->latency_us = latency;
+            if (latency > pilot->latency_max_us) pilot->latency_max_us = latency;
+            pilot->decisions++;
+            ESP_LOGI(TAG, "Distance %d cm, mode %d, direction %d, speed %d, steering %d",
+                     pilot->planner.distance, pilot->planner.mode, cmd.direction, cmd.speed, cmd.steering);
+        }
+    }
+}
+
+static autopilot_t *create_autopilot() {
+
+    autopilot_t *pilot = NULL;
+
+    pilot = malloc(sizeof(autopilot_t));
+
+    if (pilot == NULL) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        return NULL;
+    }
+
+    memset(pilot, 0, sizeof(autopilot_t));
+    planner_init(&(pilot->planner));
+
+    create_task(task_autopilot, &autopilot_task, NULL, pilot, &(pilot->handler_autopilot_task));
+    if (!pilot->handler_autopilot_task) {
+        ESP_LOGE(TAG, "Create autopilot task failed. (%s:%u)", __FILE__, __LINE__);
+        free(pilot);
+        return NULL;
+    }
+
+    ESP_LOGI(TAG, "Autopilot created");
+
+    return pilot;
+}
+
+static void delete_autopilot(autopilot_t *pilot) {
+
+    if (pilot) {
+        vTaskDelete(pilot->handler_autopilot_task);
+        free(pilot);
+        ESP_LOGI(TAG, "Autopilot deleted.");
+    } else {
+        ESP_LOGE(TAG, "No autopilot was created, nothing deleted.");
+    }
+}
+
+esp_err_t init_autopilot() {
+
+    esp_err_t ret = ESP_FAIL;
+    autopilot_t *pilot;
+
+    ESP_LOGI(TAG, "Initialize autopilot");
+
+    if (autopilot) {
+        ESP_LOGE(TAG, "Autopilot already exist");
+        return ret;
+    }
+
+    pilot = create_autopilot();
+
+    if (pilot == NULL) {
+        ESP_LOGE(TAG, "Create autopilot failed. (%s:%u)", __FILE__, __LINE__);
+        ESP_LOGE(TAG, "Could not init autopilot. (%s:%u)", __FILE__, __LINE__);
+        return ret;
+    }
+
+    autopilot = pilot;
+
+    return ESP_OK;
+}
+
+void deinit_autopilot() {
+
+    if (autopilot) {
+        ESP_LOGI(TAG, "Deinitialize autopilot");
+        delete_autopilot(autopilot);
+        autopilot = NULL;
+    } else {
+        ESP_LOGE(TAG, "Autopilot was not initialized");
+    }
+}
+
+/* adds the autopilot keys to the status of the car */
+esp_err_t get_status_autopilot(cJSON *root) {
+
+    if (autopilot == NULL) {
+        ESP_LOGE(TAG, "No autopilot created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    cJSON_AddNumberToObject(root, "auto_distance", autopilot->planner.distance);
+    cJSON_AddNumberToObject(root, "auto_mode", autopilot->planner.mode);
+    cJSON_AddNumberToObject(root, "auto_decisions", autopilot->decisions);
+    cJSON_AddNumberToObject(root, "auto_latency", autopilot->latency_us);
+    cJSON_AddNumberToObject(root, "auto_latency_max", autopilot->latency_max_us);
+
+    return ESP_OK;
+}
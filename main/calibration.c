@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "calibration.h"
+
+static void meter_reset(cal_meter_t *meter, uint32_t pulses) {
+
+    memset(meter, 0, sizeof(cal_meter_t));
+    meter->pulses = pulses;
+}
+
+/* the time of a change is only known to a control tick, so speed is taken between changes */
+static void meter_update(cal_meter_t *meter, uint32_t pulses, uint64_t now_us) {
+
+    if (pulses == meter->pulses) return;
+
+    if (!meter->started) {
+        meter->started = true;
+        meter->first = pulses;
+        meter->first_us = now_us;
+    }
+
+    meter->last = pulses;
+    meter->last_us = now_us;
+    meter->pulses = pulses;
+}
+
+static float meter_rps(const cal_meter_t *meter) {
+
+    if (!meter->started || meter->last == meter->first || meter->last_us == meter->first_us) return 0;
+
+    return (float)(meter->last - meter->first) / PULSE_PER_WHEEL * 1000000 / (meter->last_us - meter->first_us);
+}
+
+/* monotonic, and the duty where the wheel starts to turn */
+static void curve_finish(cal_curve_t *curve) {
+
+    int i;
+    float slope;
+
+    curve->rps[0] = 0;
+
+    for (i = 1; i < CAL_POINTS; i++) {
+        if (curve->rps[i] < curve->rps[i-1]) curve->rps[i] = curve->rps[i-1];
+    }
+
+    for (i = 1; i < CAL_POINTS && curve->rps[i] == 0; i++);
+
+    curve->deadband_us = 0;
+
+    if (i == CAL_POINTS) {
+        curve->deadband_us = VAL_SPEED_MAX;
+        return;
+    }
+
+    /* the slope above the first turning point, it is steeper than the step into the deadband */
+    if (i + 1 < CAL_POINTS && curve->rps[i+1] > curve->rps[i]) {
+        slope = (curve->rps[i+1] - curve->rps[i]) / (CAL_DUTY(i+1) - CAL_DUTY(i));
+        curve->deadband_us = CAL_DUTY(i) - curve->rps[i] / slope;
+    }
+
+    if (curve->deadband_us < CAL_DUTY(i-1)) curve->deadband_us = CAL_DUTY(i-1);
+}
+
+void cal_sweep_start(cal_sweep_t *sweep, uint64_t now_us) {
+
+    memset(sweep, 0, sizeof(cal_sweep_t));
+
+    sweep->running = true;
+    sweep->point = 1;
+    sweep->phase_us = now_us;
+    sweep->table.magic = CAL_MAGIC;
+}
+
+int32_t cal_sweep_step(cal_sweep_t *sweep, uint64_t now_us, uint32_t pulses_left, uint32_t pulses_right) {
+
+    if (!sweep->running) return -1;
+
+    if (!sweep->measuring) {
+        if (now_us - sweep->phase_us >= CAL_SETTLE_MS * 1000) {
+            sweep->measuring = true;
+            sweep->phase_us = now_us;
+            meter_reset(&(sweep->meter_left), pulses_left);
+            meter_reset(&(sweep->meter_right), pulses_right);
+        }
+        return CAL_DUTY(sweep->point);
+    }
+
+    meter_update(&(sweep->meter_left), pulses_left, now_us);
+    meter_update(&(sweep->meter_right), pulses_right, now_us);
+
+    if (now_us - sweep->phase_us < CAL_MEASURE_MS * 1000) return CAL_DUTY(sweep->point);
+
+    sweep->table.left.rps[sweep->point] = meter_rps(&(sweep->meter_left));
+    sweep->table.right.rps[sweep->point] = meter_rps(&(sweep->meter_right));
+
+    sweep->measuring = false;
+    sweep->phase_us = now_us;
+
+    if (++sweep->point < CAL_POINTS) return CAL_DUTY(sweep->point);
+
+    curve_finish(&(sweep->table.left));
+    curve_finish(&(sweep->table.right));
+    sweep->running = false;
+
+    return -1;
+}
+
+bool cal_table_valid(const cal_table_t *table) {
+
+    return table->magic == CAL_MAGIC
+        && table->left.rps[CAL_POINTS-1] >= WHEEL_RPS_MIN
+        && table->right.rps[CAL_POINTS-1] >= WHEEL_RPS_MIN;
+}
+
+int16_t cal_duty(const cal_curve_t *curve, float rps) {
+
+    float duty_low, rps_low;
+
+    if (rps <= 0) return 0;
+
+    duty_low = curve->deadband_us;
+    rps_low = 0;
+
+    for (int i = 1; i < CAL_POINTS; i++) {
+        if (curve->rps[i] <= rps_low) continue;
+        if (curve->rps[i] >= rps) {
+            return duty_low + (rps - rps_low) * (CAL_DUTY(i) - duty_low) / (curve->rps[i] - rps_low) + 0.5f;
+        }
+        duty_low = CAL_DUTY(i);
+        rps_low = curve->rps[i];
+    }
+
+    return VAL_SPEED_MAX;
+}
@@ -0,0 +1,79 @@
+#include <string.h>
+
+#include "control.h"
+
+void control_loop_init(control_loop_t *loop, uint32_t rate_hz, uint64_t now_us) {
+
+    memset(loop, 0, sizeof(control_loop_t));
+
+    if (rate_hz == 0) rate_hz = 1;
+
+    loop->rate_hz = rate_hz;
+    loop->period_us = 1000000 / rate_hz;
+    loop->deadline_us = now_us + loop->period_us;
+    loop->tick_start_us = now_us;
+}
+
+/*
+ *  Called at the start of every tick with the current time.
+ *
+ *  Returns the number of periods elapsed since the previous tick - 1 when the
+ *  loop is on time, more when ticks were missed (every missed one is counted
+ *  in missed). Its jitter is the whole time it is late, not the rest of a
+ *  period. A tick that arrives early (timer drift) returns 1 too and
+ *  only shows up as jitter.
+ */
+uint32_t control_loop_tick(control_loop_t *loop, uint64_t now_us) {
+
+    uint32_t periods = 1;
+    uint64_t late;
+
+    if (now_us >= loop->deadline_us) {
+        late = now_us - loop->deadline_us;
+        periods += late / loop->period_us;
+        /* the whole lateness - the periods it spans are counted in missed as well */
+        loop->jitter_us = late > UINT32_MAX ? UINT32_MAX : late;
+        loop->missed += periods - 1;
+    } else {
+        loop->jitter_us = loop->deadline_us - now_us;
+    }
+
+    if (loop->jitter_us > loop->jitter_max_us) loop->jitter_max_us = loop->jitter_us;
+    loop->jitter_sum_us += loop->jitter_us;
+    if (loop->jitter_us > CONTROL_JITTER_LATE) loop->jitter_late++;
+
+    loop->deadline_us += (uint64_t)periods * loop->period_us;
+    loop->tick_start_us = now_us;
+    loop->ticks++;
+    loop->samples++;
+
+    return periods;
+}
+
+/* Called at the end of the tick's work. A tick longer than the period is an overrun. */
+void control_loop_done(control_loop_t *loop, uint64_t now_us) {
+
+    loop->exec_us = now_us - loop->tick_start_us;
+
+    if (loop->exec_us > loop->exec_max_us) loop->exec_max_us = loop->exec_us;
+    if (loop->exec_us > loop->period_us) loop->overruns++;
+}
+
+uint32_t control_loop_jitter_avg(const control_loop_t *loop) {
+
+    if (loop->samples == 0) return 0;
+
+    return loop->jitter_sum_us / loop->samples;
+}
+
+/* statistics start over, the deadlines and the tick count go on */
+void control_loop_reset_stats(control_loop_t *loop) {
+
+    loop->overruns = 0;
+    loop->missed = 0;
+    loop->jitter_max_us = 0;
+    loop->jitter_sum_us = 0;
+    loop->jitter_late = 0;
+    loop->samples = 0;
+    loop->exec_max_us = 0;
+}
@@ -1,26 +1,43 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
 #include "cJSON.h"
-#include "driver/mcpwm.h"
-#include "soc/mcpwm_periph.h"
 
+#include "hal.h"
 #include "driver.h"
 #include "pulse.h"
+#include "control.h"
+#include "pid.h"
+#include "profile.h"
+#include "mailbox.h"
+#include "snapshot.h"
+#include "kinematics.h"
+#include "actuation.h"
+#include "odometry.h"
+#include "mission.h"
+#include "latency.h"
+#include "tasks.h"
+#include "stall.h"
+#include "calibration.h"
+#include "velocity.h"
 
 
 /*
  *      cmd_no command         - no command
  *
- *      cmd_turn_left command  - smooth left turn
+ *      cmd_turn_left command  - a step to the left, then another one every
+ *                               TURN_HOLD_MS until cmd_turn_stop
  *
- *      cmd_turn_right command - smooth right turn
+ *      cmd_turn_right command - the same to the right
  *
- *      cmd_turn_stop command  - stop further turning the steering wheel
+ *      cmd_turn_stop command  - the turn button is released, the steering
+ *                               stays where it is
  *
  *      cmd_speedup command    - smooth increase in speed
  *
@@ -36,6 +53,22 @@
  *                               if back - smooth increase in speed
  *                               if left or right - straight
  *
+ *      cmd_stop command       - stop the motors
+ *
+ *      cmd_auto command       - automatic mode on (value true) or off
+ *
+ *      cmd_pilot command      - automatic mode only, move forward (value 1),
+ *                               back (value -1) or stop (value 0)
+ *
+ *      cmd_odom_reset command - the car is at the origin of the pose
+ *
+ *      cmd_guard command      - the collision guard has braked the motors,
+ *                               stop them properly
+ *
+ *      cmd_brake command      - how the motors are stopped, value brake_mode_t
+ *
+ *      cmd_pwm command        - apply the requested PWM frequency and resolution
+ *
  */
 enum {
     cmd_no =         0b00000000,
@@ -46,7 +79,20 @@ enum {
     cmd_slowdown =   0b00010000,
     cmd_speedstop =  0b00100000,
     cmd_forward =    0b01000000,
-    cmd_back =       0b10000000
+    cmd_back =       0b10000000,
+    cmd_stop =       0b100000000,
+    cmd_auto =       0b1000000000,
+    cmd_pilot =      0b10000000000,
+    cmd_odom_reset = 0b100000000000,
+    cmd_guard =      0b1000000000000,
+    cmd_brake =      0b10000000000000,
+    cmd_pwm =        0b100000000000000
+};
+
+/* continuous setpoints of the command mailbox, the latest value wins */
+enum {
+    setpoint_speed = 0,
+    setpoint_steering
 };
 
 /*
@@ -58,46 +104,61 @@ enum {
  *
  *      car_back status    - reversing
  *
- *      car_auto           - automatic
+ *      car_auto           - automatic, together with one of the above
+ *                           when the autopilot drives
+ *
+ *      car_calibrate      - a calibration sweep drives the motors
  *
  */
 typedef enum {
     car_stop =    0b00000001,
     car_forward = 0b00000010,
     car_back =    0b00000100,
-    car_auto =    0b00001000
+    car_auto =    0b00001000,
+    car_calibrate = 0b00010000
 } car_status_t;
 
 typedef struct {
-    int                 gpio_num;
-    mcpwm_io_signals_t  io_signal;
-    mcpwm_unit_t        unit;
-    mcpwm_timer_t       timer;
-    mcpwm_generator_t   gen;
-    mcpwm_config_t      pwm_config;
-} mcpwm_t;
-
-typedef struct {
-    mcpwm_t         mcpwm;
+    hal_pwm_t       mcpwm;
     int16_t         current_position;
     int16_t         correction_center;
     int16_t         degree_min;
     int16_t         degree_max;
     uint32_t        duty_min_us;
     uint32_t        duty_max_us;
-    uint32_t        delay;
-    bool            exit_task;
+    uint32_t        delay;                  /* ms per degree                        */
+    int16_t         target_position;
+    uint64_t        command_time;           /* time of the last command in us       */
+    uint64_t        step_time;              /* time of the last step in us          */
+    uint32_t        latency_us;             /* from command to target position      */
+    uint32_t        latency_max_us;
+    QueueHandle_t   mailbox;                /* holds only the latest target         */
+    TaskHandle_t    handler_steering_task;
 } servomotor_t;
 
+typedef struct {
+    int16_t         degree;
+    uint64_t        time;
+} steering_cmd_t;
+
 typedef struct {
     int             gpio_motor_plus;
     uint8_t         value_motor_plus;
     int             gpio_motor_minus;
     uint8_t         value_motor_minus;
-    mcpwm_t         pwm_speed;
+    hal_pwm_t       pwm_speed;
     int16_t         value_speed;
     int16_t         new_value_speed;
-    int16_t         correction_speed;
+    int16_t         correction_speed;       /* output of the speed controller */
+    bool            braking;                /* PWM is brake_duty, not the speed */
+    int16_t         brake_duty;
+    pid_ctrl_t      pid;
+    profile_t       profile;                /* ramps value_speed to new_value_speed */
+    stall_t         stall;
+    velocity_t      velocity;               /* wheel speed, new every control tick */
+    const cal_curve_t *curve;               /* calibrated duty -> speed, NULL - the nominal map */
+    bool            sweeping;               /* PWM is sweep_duty of a calibration */
+    int16_t         sweep_duty;
 } motor_side_t;
 
 typedef struct {
@@ -107,316 +168,354 @@ typedef struct {
     uint32_t        duty_max_us;
     int16_t         turn;
     car_status_t status;
-    TaskHandle_t    handler_speed_correction_task;
+    kinematics_t    kinematics;             /* wheel speed ratio for every steering angle */
+    brake_mode_t    brake_mode;
+    uint64_t        brake_until;            /* end of the reverse pulse in us, 0 - none */
+    uint32_t        pwm_frequency;          /* Hz of the speed PWM                  */
+    uint32_t        pwm_resolution;         /* Hz of the PWM timer clock            */
+    cal_table_t     calibration;            /* the curves of the motors, if calibrated */
 } motors_t;
 
 typedef struct {
-    servomotor_t   *steering;
-    motors_t       *motors;
-    TaskHandle_t    handler_driver_task;
-    QueueHandle_t   queue_driver;
+    servomotor_t       *steering;
+    motors_t           *motors;
+    TaskHandle_t        handler_driver_task;
+    mailbox_t           mailbox;
+    snapshot_t          state;          /* car_state_t published every tick */
+    hal_timer_t         control_timer;
+    control_loop_t      loop;
+    uint32_t            pid_ticks;      /* ticks since the last speed controller run */
+    odometry_t          odometry;
+    uint32_t            odom_ticks;     /* ticks since the last pose update */
+    uint32_t            pulse_left;     /* pulse counts at the last pose update */
+    uint32_t            pulse_right;
+    int32_t             ticks_left;     /* quadrature ticks at the last pose update */
+    int32_t             ticks_right;
+    int8_t              odom_direction; /* wheels roll on in this direction after a stop */
+    int16_t             cmd_turn;       /* held turn button, cmd_turn_left or cmd_turn_right, cmd_no - none */
+    uint64_t            turn_time;      /* of its last step in us */
+    float               distance_left;  /* mm rolled since start, either way */
+    float               distance_right;
+    double              odometer;       /* mm over the life of the car  */
+    double              odometer_stored;    /* the one in NVS           */
+    _Atomic uint32_t    guard_threshold;    /* cm, 0 - off. Written by the control loop   */
+    _Atomic uint32_t    guard_trips;
+    volatile uint32_t   guard_latency_us;   /* written in the echo isr only */
+    volatile uint32_t   guard_latency_max_us;
+    _Atomic uint32_t    pwm_frequency;      /* requested by set_pwm_car()   */
+    _Atomic uint32_t    pwm_resolution;
+    _Atomic bool        loop_reset;         /* requested by reset_loop_car() */
+    _Atomic bool        turn_ackermann;     /* false - the old SPEED_TURN_STEP split, set_turn_ackermann_car() */
+    _Atomic uint32_t    cal_request;        /* cal_request_t of calibrate_car() and clear_calibration_car() */
+    cal_sweep_t         sweep;
 } driver_t;
 
+typedef enum {
+    cal_request_none = 0,
+    cal_request_start,
+    cal_request_clear
+} cal_request_t;
+
+/* the guard brakes by writing the direction pins all at once */
+_Static_assert(LEFT_MOTOR_GPIO_1 < 32 && LEFT_MOTOR_GPIO_2 < 32 && RIGHT_MOTOR_GPIO_1 < 32 && RIGHT_MOTOR_GPIO_2 < 32,
+               "motor direction pins must be GPIO0-31");
+#define GUARD_PIN_MASK  ((1UL << LEFT_MOTOR_GPIO_1) | (1UL << LEFT_MOTOR_GPIO_2) | \
+                         (1UL << RIGHT_MOTOR_GPIO_1) | (1UL << RIGHT_MOTOR_GPIO_2))
+
+#define ODOM_MM_PER_PULSE   ((float)WHEEL_CIRCUMFERENCE / PULSE_PER_WHEEL)
+#define ODOMETER_STORE_KEY  "odometer"
+#define TURN_HOLD_MS        (STEERING_DELAY * portTICK_PERIOD_MS)  /* the receive timeout of the old driver task */
+
 static char *TAG = "robot_car_driver";
 
 driver_t *driver_car = NULL;
 
 /*--------------------------------------Private Zone--------------------------------------------*/
 
-long map(long x, long in_min, long in_max, long out_min, long out_max) {
-  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
-}
-
-static uint32_t angle_to_us(uint32_t angle, uint32_t min_us, uint32_t max_us) {
-    uint32_t us = ((max_us - min_us) / ANGLE_MAX) * angle + min_us;
-    return us;
-}
-
-static esp_err_t set_driver_pwm_us(mcpwm_t *mcpwm, uint32_t us) {
+static esp_err_t set_driver_pwm_us(hal_pwm_t *mcpwm, uint32_t us) {
 
-    return mcpwm_set_duty_in_us(mcpwm->unit, mcpwm->timer, mcpwm->gen, us);
+    return hal_pwm_set_us(mcpwm, us);
 
 }
 
-//static esp_err_t set_driver_pwm(mcpwm_t *mcpwm, float duty) {
+//static esp_err_t set_driver_pwm(hal_pwm_t *mcpwm, float duty) {
 //
-//    return mcpwm_set_duty(mcpwm->unit, mcpwm->timer, mcpwm->gen, duty);
+//    return hal_pwm_set_duty(mcpwm, duty);
 //
 //}
 
-static void steering_task(void *pvParameter) {
-    uint32_t us;
-    int16_t *degree = (int16_t*)pvParameter;
+/*
+ *  Moves the servo towards the target by the number of degrees allowed
+ *  since the previous step (one degree per delay ms).
+ *  Returns false once the target is reached.
+ */
+static bool steering_step(servomotor_t *servo, uint64_t now) {
 
-    driver_car->steering->exit_task = false;
+    int32_t degrees = 1;
+    uint32_t us;
 
-    mcpwm_set_duty_type(driver_car->steering->mcpwm.unit, driver_car->steering->mcpwm.timer, driver_car->steering->mcpwm.gen, MCPWM_DUTY_MODE_0);
+    if (servo->current_position == servo->target_position) {
+        latency_stamp(latency_turn, latency_servo);
+        return false;
+    }
 
-    if (driver_car->steering->current_position > *degree) {
-        for (int i = driver_car->steering->current_position; i >= *degree; i--) {
-            if (driver_car->steering->exit_task) {
-                driver_car->steering->current_position = i;
-                vTaskDelete(NULL);
-            }
-            us = angle_to_us(i+driver_car->steering->correction_center, driver_car->steering->duty_min_us, driver_car->steering->duty_max_us);
-            set_driver_pwm_us(&(driver_car->steering->mcpwm), us);
-            vTaskDelay(driver_car->steering->delay/portTICK_PERIOD_MS);
-        }
-    } else  if (driver_car->steering->current_position < *degree){
-        for (int i = driver_car->steering->current_position; i <= *degree; i++) {
-            if (driver_car->steering->exit_task) {
-                driver_car->steering->current_position = i;
-                vTaskDelete(NULL);
-            }
-            us = angle_to_us(i+driver_car->steering->correction_center, driver_car->steering->duty_min_us, driver_car->steering->duty_max_us);
-            set_driver_pwm_us(&(driver_car->steering->mcpwm), us);
-            vTaskDelay(driver_car->steering->delay/portTICK_PERIOD_MS);
-        }
+    if (servo->delay) {
+        degrees = (now - servo->step_time) / (servo->delay * 1000);
+        if (degrees == 0) return true;
     }
 
-    if (driver_car->steering->current_position != *degree) {
-        vTaskDelay(30/portTICK_PERIOD_MS);
-        driver_car->steering->current_position = *degree;
+    if (servo->current_position > servo->target_position) {
+        servo->current_position -= MIN(degrees, servo->current_position - servo->target_position);
+    } else {
+        servo->current_position += MIN(degrees, servo->target_position - servo->current_position);
     }
 
-    ESP_LOGI(TAG, "Steering position - %d", driver_car->steering->current_position);
+    us = act_angle_to_us(servo->current_position+servo->correction_center);
+    set_driver_pwm_us(&(servo->mcpwm), us);
+    latency_stamp(latency_turn, latency_pwm);
+    servo->step_time = now;
+
+    if (servo->current_position != servo->target_position) return true;
+
+    servo->latency_us = now - servo->command_time;
+    if (servo->latency_us > servo->latency_max_us) servo->latency_max_us = servo->latency_us;
+    latency_stamp(latency_turn, latency_servo);
 
-    mcpwm_set_signal_low(driver_car->steering->mcpwm.unit, driver_car->steering->mcpwm.timer, driver_car->steering->mcpwm.gen);
+    ESP_LOGI(TAG, "Steering position - %d, %u us from command", servo->current_position, servo->latency_us);
 
-    vTaskDelete(NULL);
+    return false;
 }
 
-static void set_steering(int16_t args) {
+/*
+ *  The only owner of the steering channel MCPWM0A.
+ *
+ *  Sleeps on the mailbox while idle. While moving it steps every tick and
+ *  picks up a new target at once, so a new command retargets mid-motion.
+ *  The PWM signal is released SERVO_HOLD_MS after the target is reached.
+ */
+static void steering_task(void *pvParameter) {
+
+    servomotor_t *servo = (servomotor_t*)pvParameter;
+    steering_cmd_t cmd;
+    TickType_t timeout = portMAX_DELAY;
+    bool powered = false;
+    bool moving = false;
+
+    while(1) {
+
+        if (xQueueReceive(servo->mailbox, &cmd, timeout) == pdTRUE) {
+            if (!moving) {
+                /* first step right away */
+                servo->step_time = cmd.time - servo->delay * 1000;
+            }
+            servo->target_position = cmd.degree;
+            servo->command_time = cmd.time;
+            if (!powered) {
+                hal_pwm_on(&(servo->mcpwm));
+                powered = true;
+            }
+        } else if (!moving && powered) {
+            /* hold time is over */
+            hal_pwm_low(&(servo->mcpwm));
+            powered = false;
+        }
+
+        if (powered) {
+            moving = steering_step(servo, hal_time_us());
+        }
 
-    static int16_t degree = 0;
+        if (moving) {
+            timeout = 1;
+        } else if (powered) {
+            timeout = pdMS_TO_TICKS(SERVO_HOLD_MS);
+            if (timeout == 0) timeout = 1;
+        } else {
+            timeout = portMAX_DELAY;
+        }
+    }
+}
 
-    driver_car->steering->exit_task = true;
-    vTaskDelay(10/portTICK_PERIOD_MS);
+/* hands the new target to steering_task, never blocks */
+static void set_steering(int16_t degree) {
 
-    degree = args;
+    steering_cmd_t cmd;
 
     if (degree < driver_car->steering->degree_min) degree = driver_car->steering->degree_min;
     if (degree > driver_car->steering->degree_max) degree = driver_car->steering->degree_max;
 
-    xTaskCreate(&steering_task, "steering_task", 2048, &(degree), 0, NULL);
+    cmd.degree = degree;
+    cmd.time = hal_time_us();
 
+    xQueueOverwrite(driver_car->steering->mailbox, &cmd);
 }
 
-static void set_motors(motors_t *motors) {
+/* feed-forward map: expected wheel speed in rev/s for a duty in us */
+static float duty_to_rps(int16_t duty) {
+
+    if (duty <= 0) return 0;
+
+    if (duty < VAL_SPEED_MIN) return WHEEL_RPS_MIN * duty / VAL_SPEED_MIN;
 
+    return WHEEL_RPS_MIN + (WHEEL_RPS_MAX - WHEEL_RPS_MIN) * (duty - VAL_SPEED_MIN) / (VAL_SPEED_MAX - VAL_SPEED_MIN);
+}
 
-    gpio_set_level(motors->motor_left.gpio_motor_plus, motors->motor_left.value_motor_plus);
-    gpio_set_level(motors->motor_left.gpio_motor_minus, motors->motor_left.value_motor_minus);
-    gpio_set_level(motors->motor_right.gpio_motor_plus, motors->motor_right.value_motor_plus);
-    gpio_set_level(motors->motor_right.gpio_motor_minus, motors->motor_right.value_motor_minus);
+/* inverse of duty_to_rps() */
+static int16_t rps_to_duty(float rps) {
 
+    if (rps <= 0) return 0;
 
-    set_driver_pwm_us(&(motors->motor_left.pwm_speed), motors->motor_left.value_speed);
-    set_driver_pwm_us(&(motors->motor_right.pwm_speed), motors->motor_right.value_speed);
+    if (rps < WHEEL_RPS_MIN) return rps * VAL_SPEED_MIN / WHEEL_RPS_MIN + 0.5;
 
+    return VAL_SPEED_MIN + (rps - WHEEL_RPS_MIN) * (VAL_SPEED_MAX - VAL_SPEED_MIN) / (WHEEL_RPS_MAX - WHEEL_RPS_MIN) + 0.5;
 }
 
-//static bool speed_correction_need(uint64_t left, uint64_t right) {
-//    float fleft, fright;
-//    uint64_t result;
-//
-//    if (left == right) return false;
-//
-//    fleft = left;
-//    fright = right;
-//
-//    if (left > right) {
-//        result = round(fabs(fright/fleft*100-100)*100);
-//    } else {
-//        result = round(fabs(fleft/fright*100-100)*100);
-//    }
-//
-//    printf("float result - %lld\n", result);
-//
-//    /* return true if more than 0.25% difference */
-//    if (result <= 25) return false;
-//
-//    return true;
-//}
+/* duty that turns this motor at the speed of value_speed - by its own curve once calibrated */
+static int16_t feed_forward_duty(const motor_side_t *motor) {
 
+    if (motor->curve == NULL || motor->value_speed <= 0) return motor->value_speed;
 
-static void speed_correction_task(void *pvParameter) {
-    uint64_t speed_left, speed_right, result;
-    float fleft, fright;
-    motors_t *motors = (motors_t*)pvParameter;
+    return cal_duty(motor->curve, duty_to_rps(motor->value_speed));
+}
 
-    while(1) {
+/*
+ *  Commanded duty plus the correction of the speed controller. Duties are
+ *  in us of the 200 Hz period, VAL_SPEED_MAX is always 100% - so they keep
+ *  their meaning at any PWM frequency.
+ */
+static esp_err_t set_motor_pwm(motor_side_t *motor) {
 
-        if (motors->turn == STEERING_STRAIGHT && !(motors->status & car_stop)) {
-
-            get_speed_time(&speed_left, &speed_right);
-
-            if (speed_left != 0 && speed_right != 0) {
-                fleft = speed_left;
-                fright = speed_right;
-                if (speed_left > speed_right) {
-                    /* percentage difference */
-                    result = round(fabs(fright/fleft*100-100)*100);
-                    /* true if more than 0.25% difference */
-                    if (result > 25) {
-                        if (motors->motor_right.correction_speed != 0) {
-                            motors->motor_right.correction_speed = 0;
-                            set_driver_pwm_us(&(motors->motor_right.pwm_speed), motors->motor_right.value_speed);
-                        } else {
-                            motors->motor_left.correction_speed +=10;
-                            set_driver_pwm_us(&(motors->motor_left.pwm_speed),
-                                                motors->motor_left.value_speed-(motors->motor_left.correction_speed));
-                        }
-                        printf("left_speed_time - %lld,  right_speed_time - %lld\n", speed_left, speed_right);
-                    }
-                } else if (speed_left < speed_right) {
-                    /* percentage difference */
-                    result = round(fabs(fleft/fright*100-100)*100);
-                    /* true if more than 0.25% difference */
-                    if (result > 25) {
-                        if (motors->motor_left.correction_speed != 0) {
-                            motors->motor_left.correction_speed = 0;
-                            set_driver_pwm_us(&(motors->motor_left.pwm_speed), motors->motor_left.value_speed);
-                        } else {
-                            motors->motor_right.correction_speed +=10;
-                            set_driver_pwm_us(&(motors->motor_right.pwm_speed),
-                                                motors->motor_right.value_speed-(motors->motor_right.correction_speed));
-
-                        }
-                        printf("left_speed_time - %lld,  right_speed_time - %lld\n", speed_left, speed_right);
-                    }
-                }
-//                if (speed_correction_need(speed_left, speed_right)) {
-//                }
-            }
+    int32_t us = feed_forward_duty(motor) + motor->correction_speed;
 
-        }
+    if (motor->braking) us = motor->brake_duty;
+    if (motor->sweeping) us = motor->sweep_duty;
+
+    if (us < 0) us = 0;
+    if (us > VAL_SPEED_MAX) us = VAL_SPEED_MAX;
+
+    /* the first write after the pickup ends the trace of a motor command */
+    latency_stamp(latency_forward, latency_pwm);
+    latency_stamp(latency_back, latency_pwm);
+    latency_stamp(latency_stop, latency_pwm);
+    latency_stamp(latency_speed, latency_pwm);
+
+    return hal_pwm_set_duty(&(motor->pwm_speed), us * 100.0 / VAL_SPEED_MAX);
+}
+
+/*
+ *  Both speed PWMs share one timer. A finer timer clock gives more duty
+ *  steps per period - 20 kHz on the default 1 MHz clock has only 50.
+ */
+static esp_err_t set_pwm_motors(motors_t *motors, uint32_t frequency, uint32_t resolution) {
+
+    esp_err_t ret;
+    hal_pwm_t *pwm = &(motors->motor_left.pwm_speed);
+
+    if (frequency < MOTOR_PWM_FREQUENCY_MIN || frequency > MOTOR_PWM_FREQUENCY_MAX) {
+        ESP_LOGE(TAG, "PWM frequency %u Hz out of range. (%s:%u)", frequency, __FILE__, __LINE__);
+        return ESP_ERR_INVALID_ARG;
+    }
 
+    ret = hal_pwm_set_resolution(pwm, resolution);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        if (resolution != MOTOR_PWM_RESOLUTION) {
+            ESP_LOGE(TAG, "PWM resolution is fixed before IDF 4.4. (%s:%u)", __FILE__, __LINE__);
+        }
+        resolution = MOTOR_PWM_RESOLUTION;
+    } else if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "PWM resolution %u Hz not set. (%s:%u)", resolution, __FILE__, __LINE__);
+        return ret;
+    }
 
-        vTaskDelay(50/portTICK_PERIOD_MS);
+    ret = hal_pwm_set_frequency(pwm, frequency);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "PWM frequency %u Hz not set. (%s:%u)", frequency, __FILE__, __LINE__);
+        return ret;
     }
+
+    motors->pwm_frequency = frequency;
+    motors->pwm_resolution = resolution;
+
+    ESP_LOGI(TAG, "Motors PWM %u Hz, %u steps", frequency, resolution / frequency);
+
+    /* the duty is a share of the period, write it again for the new one */
+    set_motor_pwm(&(motors->motor_left));
+    set_motor_pwm(&(motors->motor_right));
+
+    return ESP_OK;
 }
 
-static void driver_task(void *pvParameter) {
+static void set_motors(motors_t *motors) {
 
-    int16_t command = cmd_no;
-    int16_t cmd_speed = cmd_no;
 
-    while(1) {
+    hal_pin_set(motors->motor_left.gpio_motor_plus, motors->motor_left.value_motor_plus);
+    hal_pin_set(motors->motor_left.gpio_motor_minus, motors->motor_left.value_motor_minus);
+    hal_pin_set(motors->motor_right.gpio_motor_plus, motors->motor_right.value_motor_plus);
+    hal_pin_set(motors->motor_right.gpio_motor_minus, motors->motor_right.value_motor_minus);
 
-        xQueueReceive(driver_car->queue_driver, &command, (TickType_t)driver_car->steering->delay);
 
-        if (command & cmd_speedstop) {
-            cmd_speed = command = cmd_no;
-            ESP_LOGI(TAG, "Speed of left motor - %d", driver_car->motors->motor_left.new_value_speed);
-            ESP_LOGI(TAG, "Speed of right motor - %d", driver_car->motors->motor_right.new_value_speed);
-        }
+    set_motor_pwm(&(motors->motor_left));
+    set_motor_pwm(&(motors->motor_right));
 
-        if (command & (cmd_speedup|cmd_slowdown)) {
-            cmd_speed = command;
-        }
+}
 
-        if (cmd_speed & cmd_speedup) {
-            if (driver_car->motors->motor_left.value_speed+SPEEDUP_STEP > driver_car->motors->duty_max_us) {
-                driver_car->motors->motor_left.new_value_speed = driver_car->motors->duty_max_us;
-            } else {
-                driver_car->motors->motor_left.new_value_speed += SPEEDUP_STEP;
-            }
+/* the timed pulses into the speed estimate of every wheel, every control tick */
+static void velocity_step(motors_t *motors, uint64_t now, float dt) {
 
-            if (driver_car->motors->motor_right.value_speed+SPEEDUP_STEP > driver_car->motors->duty_max_us) {
-                driver_car->motors->motor_right.new_value_speed = driver_car->motors->duty_max_us;
-            } else {
-                driver_car->motors->motor_right.new_value_speed += SPEEDUP_STEP;
-            }
-        }
+    pulse_edge_t left, right;
 
-        if (cmd_speed & cmd_slowdown) {
-            if (driver_car->motors->motor_left.value_speed-SPEEDUP_STEP < driver_car->motors->duty_min_us) {
-                driver_car->motors->motor_left.new_value_speed = driver_car->motors->duty_min_us;
-            } else {
-                driver_car->motors->motor_left.new_value_speed -= SPEEDUP_STEP;
-            }
+    get_pulse_edge(&left, &right);
 
-            if (driver_car->motors->motor_right.value_speed-SPEEDUP_STEP < driver_car->motors->duty_min_us) {
-                driver_car->motors->motor_right.new_value_speed = driver_car->motors->duty_min_us;
-            } else {
-                driver_car->motors->motor_right.new_value_speed -= SPEEDUP_STEP;
-            }
-        }
+    velocity_update(&(motors->motor_left.velocity), left.pulses, left.time_us, left.period_us, now, dt);
+    velocity_update(&(motors->motor_right.velocity), right.pulses, right.time_us, right.period_us, now, dt);
+}
 
-        if (command & cmd_turn_left) {
-            if (driver_car->motors->turn <= STEERING_STRAIGHT) {
-                if (driver_car->motors->turn != STEERING_ANGLE_MIN) {
-                    driver_car->motors->turn -= STEERING_STEP;
-                    driver_car->motors->motor_left.value_speed -= SPEED_TURN_STEP;
-                    if (driver_car->motors->motor_left.value_speed < 0) driver_car->motors->motor_left.value_speed = 0;
-                    driver_car->motors->motor_left.new_value_speed = driver_car->motors->motor_left.value_speed;
-                    ESP_LOGI(TAG, "Speed of left motor - %d", driver_car->motors->motor_left.value_speed);
-                }
-            } else if (driver_car->motors->turn > STEERING_STRAIGHT) {
-                driver_car->motors->turn -= STEERING_STEP;
-                driver_car->motors->motor_right.value_speed += SPEED_TURN_STEP;
-                if (driver_car->motors->motor_right.value_speed > driver_car->motors->duty_max_us) driver_car->motors->motor_right.value_speed = driver_car->motors->duty_max_us;
-                driver_car->motors->motor_right.new_value_speed = driver_car->motors->motor_right.value_speed;
-                ESP_LOGI(TAG, "Speed of right motor - %d", driver_car->motors->motor_right.value_speed);
-            }
-            set_steering(driver_car->motors->turn);
-            set_motors(driver_car->motors);
-        } else if (command & cmd_turn_right) {
-            if (driver_car->motors->turn >= STEERING_STRAIGHT) {
-                if (driver_car->motors->turn != STEERING_ANGLE_MAX) {
-                    driver_car->motors->turn += STEERING_STEP;
-                    driver_car->motors->motor_right.value_speed -= SPEED_TURN_STEP;
-                    if (driver_car->motors->motor_right.value_speed < 0) driver_car->motors->motor_right.value_speed = 0;
-                    driver_car->motors->motor_right.new_value_speed = driver_car->motors->motor_right.value_speed;
-                    ESP_LOGI(TAG, "Speed of right motor - %d", driver_car->motors->motor_right.value_speed);
-                }
-            } else if (driver_car->motors->turn < STEERING_STRAIGHT) {
-                driver_car->motors->turn += STEERING_STEP;
-                driver_car->motors->motor_left.value_speed += SPEED_TURN_STEP;
-                if (driver_car->motors->motor_left.value_speed > driver_car->motors->duty_max_us) driver_car->motors->motor_left.value_speed = driver_car->motors->duty_max_us;
-                driver_car->motors->motor_left.new_value_speed = driver_car->motors->motor_left.value_speed;
-                ESP_LOGI(TAG, "Speed of left motor - %d", driver_car->motors->motor_left.value_speed);
-            }
-            set_steering(driver_car->motors->turn);
-            set_motors(driver_car->motors);
-        }
+/*
+ *  The way of the wheel against the way it is driven - -1 while it still
+ *  turns the old way after a reversal or is pushed against the motor. 1
+ *  without ENCODER_QUADRATURE, the wheels are taken to turn as driven.
+ */
+static float wheel_sign(motors_t *motors, int8_t direction) {
 
+    int8_t driven = (motors->status & car_back) ? -1 : 1;
 
+    return direction ? direction * driven : 1;
+}
 
-        if (driver_car->motors->motor_left.new_value_speed > driver_car->motors->motor_left.value_speed) {
-            driver_car->motors->motor_left.value_speed += SPEEDUP_STEP;
-            if (driver_car->motors->motor_left.value_speed > driver_car->motors->motor_left.new_value_speed) {
-                driver_car->motors->motor_left.value_speed = driver_car->motors->motor_left.new_value_speed;
-            }
-            set_driver_pwm_us(&(driver_car->motors->motor_left.pwm_speed), driver_car->motors->motor_left.value_speed);
-        }
+static void speed_control_motor(motor_side_t *motor, float sign, float dt) {
 
-        if (driver_car->motors->motor_left.new_value_speed < driver_car->motors->motor_left.value_speed) {
-            driver_car->motors->motor_left.value_speed -= SPEEDUP_STEP;
-            if (driver_car->motors->motor_left.value_speed < driver_car->motors->motor_left.new_value_speed) {
-                driver_car->motors->motor_left.value_speed = driver_car->motors->motor_left.new_value_speed;
-            }
-            set_driver_pwm_us(&(driver_car->motors->motor_left.pwm_speed), driver_car->motors->motor_left.value_speed);
-        }
+    float target, output;
+    int16_t feed_forward = feed_forward_duty(motor);
 
-        if (driver_car->motors->motor_right.new_value_speed > driver_car->motors->motor_right.value_speed) {
-            driver_car->motors->motor_right.value_speed += SPEEDUP_STEP;
-            if (driver_car->motors->motor_right.value_speed > driver_car->motors->motor_right.new_value_speed) {
-                driver_car->motors->motor_right.value_speed = driver_car->motors->motor_right.new_value_speed;
-            }
-            set_driver_pwm_us(&(driver_car->motors->motor_right.pwm_speed), driver_car->motors->motor_right.value_speed);
-        }
+    target = duty_to_rps(motor->value_speed);
+    output = pid_update(&(motor->pid), target, sign * motor->velocity.rps, feed_forward, dt);
 
-        if (driver_car->motors->motor_right.new_value_speed < driver_car->motors->motor_right.value_speed) {
-            driver_car->motors->motor_right.value_speed -= SPEEDUP_STEP;
-            if (driver_car->motors->motor_right.value_speed < driver_car->motors->motor_right.new_value_speed) {
-                driver_car->motors->motor_right.value_speed = driver_car->motors->motor_right.new_value_speed;
-            }
-            set_driver_pwm_us(&(driver_car->motors->motor_right.pwm_speed), driver_car->motors->motor_right.value_speed);
-        }
+    motor->correction_speed = output - feed_forward;
+    set_motor_pwm(motor);
+}
+
+/*
+ *  Per-wheel speed controller. Every wheel tracks the speed that its own
+ *  commanded duty should give - in every steering state, the inner wheel
+ *  of a turn simply has a lower target.
+ */
+static void speed_control(motors_t *motors, float dt) {
 
+    int8_t direction_left, direction_right;
+
+    if (!(motors->status & (car_forward|car_back))) {
+        if (motors->motor_left.pid.started || motors->motor_right.pid.started) {
+            pid_reset(&(motors->motor_left.pid));
+            pid_reset(&(motors->motor_right.pid));
+            motors->motor_left.correction_speed = 0;
+            motors->motor_right.correction_speed = 0;
+        }
+        return;
     }
+
+    get_wheel_direction(&direction_left, &direction_right);
+
+    speed_control_motor(&(motors->motor_left), wheel_sign(motors, direction_left), dt);
+    speed_control_motor(&(motors->motor_right), wheel_sign(motors, direction_right), dt);
 }
 
 /* ============================================================================================= */
@@ -430,7 +529,9 @@ static servomotor_t *create_steering_servo() {
     if (servo == NULL) {
         ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
     } else {
+        memset(servo, 0, sizeof(servomotor_t));
         servo->current_position =           STEERING_STRAIGHT;
+        servo->target_position =            STEERING_STRAIGHT;
         servo->correction_center =          STEERING_CENTER;
         servo->delay =                      STEERING_DELAY;
         servo->degree_min =                 STEERING_ANGLE_MIN;
@@ -438,23 +539,35 @@ static servomotor_t *create_steering_servo() {
         servo->duty_min_us =                SERVO_MIN_US;
         servo->duty_max_us =                SERVO_MAX_US;
         servo->mcpwm.gpio_num =             SERVO_PWM_GPIO;
-        servo->mcpwm.unit =                 MCPWM_UNIT_0;
-        servo->mcpwm.timer =                MCPWM_TIMER_0;
-        servo->mcpwm.gen =                  MCPWM_GEN_A;
-        servo->mcpwm.io_signal =            MCPWM0A;//(servo->mcpwm.timer) * 2 + servo->mcpwm.gen;
-        servo->mcpwm.pwm_config.frequency = 50;     //frequency = 50Hz, i.e. for every servo motor time period should be 20ms
-        servo->mcpwm.pwm_config.cmpr_a =    0;         //duty cycle of PWMxA = 0
-        servo->mcpwm.pwm_config.cmpr_b =    0;         //duty cycle of PWMxb = 0
-        servo->mcpwm.pwm_config.counter_mode = MCPWM_UP_COUNTER;
-        servo->mcpwm.pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
-
-        mcpwm_gpio_init(servo->mcpwm.unit, servo->mcpwm.io_signal, servo->mcpwm.gpio_num);
-        mcpwm_init(servo->mcpwm.unit, servo->mcpwm.timer, &(servo->mcpwm.pwm_config));    //Configure PWM0A & PWM0B with above settings
+        servo->mcpwm.unit =                 0;      /* MCPWM0A */
+        servo->mcpwm.timer =                0;
+        servo->mcpwm.gen =                  0;
+
+        hal_pwm_init(&(servo->mcpwm), 50);          //frequency = 50Hz, i.e. for every servo motor time period should be 20ms
 
         vTaskDelay(500/portTICK_PERIOD_MS);
-        set_driver_pwm_us(&(servo->mcpwm), angle_to_us(servo->current_position+servo->correction_center, servo->duty_min_us, servo->duty_max_us));
+        set_driver_pwm_us(&(servo->mcpwm), act_angle_to_us(servo->current_position+servo->correction_center));
         vTaskDelay(1000/portTICK_PERIOD_MS);
-        mcpwm_set_signal_low(servo->mcpwm.unit, servo->mcpwm.timer, servo->mcpwm.gen);
+        hal_pwm_low(&(servo->mcpwm));
+
+        servo->mailbox = xQueueCreate(1, sizeof(steering_cmd_t));
+        if (!servo->mailbox) {
+            ESP_LOGE(TAG, "Create steering mailbox failed. (%s:%u)", __FILE__, __LINE__);
+            hal_pwm_stop(&(servo->mcpwm));
+            hal_pin_reset(servo->mcpwm.gpio_num);
+            free(servo);
+            return NULL;
+        }
+
+        create_task(task_steering, &steering_task, NULL, servo, &(servo->handler_steering_task));
+        if (!servo->handler_steering_task) {
+            ESP_LOGE(TAG, "Create steering task failed. (%s:%u)", __FILE__, __LINE__);
+            vQueueDelete(servo->mailbox);
+            hal_pwm_stop(&(servo->mcpwm));
+            hal_pin_reset(servo->mcpwm.gpio_num);
+            free(servo);
+            return NULL;
+        }
 
         ESP_LOGI(TAG, "Servo steering device created");
     }
@@ -468,8 +581,10 @@ static esp_err_t delete_steering_servo(servomotor_t *steering) {
     esp_err_t ret = ESP_FAIL;
 
     if (steering) {
-        mcpwm_stop(steering->mcpwm.unit, steering->mcpwm.timer);
-        gpio_reset_pin(steering->mcpwm.gpio_num);
+        vTaskDelete(steering->handler_steering_task);
+        vQueueDelete(steering->mailbox);
+        hal_pwm_stop(&(steering->mcpwm));
+        hal_pin_reset(steering->mcpwm.gpio_num);
         free(steering);
         steering = NULL;
         ESP_LOGI(TAG, "Servo device steering deleted.");
@@ -509,42 +624,55 @@ static motors_t *create_motors() {
     motors->motor_right.new_value_speed =     VAL_SPEED_MIN;
 
     motors->motor_left.pwm_speed.gpio_num =   LEFT_SPD_PWM_GPIO;
-    motors->motor_left.pwm_speed.unit =       MCPWM_UNIT_0;
-    motors->motor_left.pwm_speed.timer =      MCPWM_TIMER_1;
-    motors->motor_left.pwm_speed.gen =        MCPWM_GEN_A;
-    motors->motor_left.pwm_speed.io_signal =  MCPWM1A;
-    motors->motor_left.pwm_speed.pwm_config.frequency = 200;    /* frequency = 200Hz       */
-    motors->motor_left.pwm_speed.pwm_config.cmpr_a = 0;         /* duty cycle of PWMxA = 0 */
-    motors->motor_left.pwm_speed.pwm_config.cmpr_b = 0;         /* duty cycle of PWMxb = 0 */
-    motors->motor_left.pwm_speed.pwm_config.counter_mode = MCPWM_UP_COUNTER;
-    motors->motor_left.pwm_speed.pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
-
-    mcpwm_gpio_init(motors->motor_left.pwm_speed.unit, motors->motor_left.pwm_speed.io_signal, motors->motor_left.pwm_speed.gpio_num);
-    mcpwm_init(motors->motor_left.pwm_speed.unit, motors->motor_left.pwm_speed.timer, &(motors->motor_left.pwm_speed.pwm_config));
+    motors->motor_left.pwm_speed.unit =       0;      /* MCPWM1A */
+    motors->motor_left.pwm_speed.timer =      1;
+    motors->motor_left.pwm_speed.gen =        0;
+    motors->brake_mode =                      BRAKE_MODE;
+    motors->pwm_frequency =                   MOTOR_PWM_FREQUENCY;
+    motors->pwm_resolution =                  MOTOR_PWM_RESOLUTION;
+
+    hal_pwm_init(&(motors->motor_left.pwm_speed), MOTOR_PWM_FREQUENCY);
 
     motors->motor_right.pwm_speed.gpio_num =  RIGHT_SPD_PWM_GPIO;
-    motors->motor_right.pwm_speed.unit =      MCPWM_UNIT_0;
-    motors->motor_right.pwm_speed.timer =     MCPWM_TIMER_1;
-    motors->motor_right.pwm_speed.gen =       MCPWM_GEN_B;
-    motors->motor_right.pwm_speed.io_signal = MCPWM1B;
-    motors->motor_right.pwm_speed.pwm_config.frequency = 200;   /* frequency = 1000Hz      */
-    motors->motor_right.pwm_speed.pwm_config.cmpr_a = 0;        /* duty cycle of PWMxA = 0 */
-    motors->motor_right.pwm_speed.pwm_config.cmpr_b = 0;        /* duty cycle of PWMxb = 0 */
-    motors->motor_right.pwm_speed.pwm_config.counter_mode = MCPWM_UP_COUNTER;
-    motors->motor_right.pwm_speed.pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
+    motors->motor_right.pwm_speed.unit =      0;      /* MCPWM1B */
+    motors->motor_right.pwm_speed.timer =     1;
+    motors->motor_right.pwm_speed.gen =       1;
 
-    mcpwm_gpio_init(motors->motor_right.pwm_speed.unit, motors->motor_right.pwm_speed.io_signal, motors->motor_right.pwm_speed.gpio_num);
-    mcpwm_init(motors->motor_right.pwm_speed.unit, motors->motor_right.pwm_speed.timer, &(motors->motor_right.pwm_speed.pwm_config));
+    hal_pwm_init(&(motors->motor_right.pwm_speed), MOTOR_PWM_FREQUENCY);
 
+    set_pwm_motors(motors, motors->pwm_frequency, motors->pwm_resolution);
 
-    gpio_set_direction(motors->motor_left.gpio_motor_plus, GPIO_MODE_OUTPUT);
-    gpio_set_direction(motors->motor_left.gpio_motor_minus, GPIO_MODE_OUTPUT);
-    gpio_set_direction(motors->motor_right.gpio_motor_plus, GPIO_MODE_OUTPUT);
-    gpio_set_direction(motors->motor_right.gpio_motor_minus, GPIO_MODE_OUTPUT);
+
+    hal_pin_output(motors->motor_left.gpio_motor_plus);
+    hal_pin_output(motors->motor_left.gpio_motor_minus);
+    hal_pin_output(motors->motor_right.gpio_motor_plus);
+    hal_pin_output(motors->motor_right.gpio_motor_minus);
 
     set_motors(motors);
 
-    xTaskCreate(&speed_correction_task, "speed_correction_task", 2048, motors, 3, &(motors->handler_speed_correction_task));
+    kinematics_init(&(motors->kinematics), WHEEL_BASE, TRACK_WIDTH, STEERING_RATIO);
+
+    profile_init(&(motors->motor_left.profile), SPEED_ACCEL_MAX, SPEED_JERK_MAX, VAL_SPEED_MIN);
+    profile_init(&(motors->motor_right.profile), SPEED_ACCEL_MAX, SPEED_JERK_MAX, VAL_SPEED_MIN);
+
+    ESP_LOGI(TAG, "Speed ramp %d -> %d us takes %d ms", VAL_SPEED_MIN, VAL_SPEED_MAX,
+             (int)(profile_duration(VAL_SPEED_MAX - VAL_SPEED_MIN, SPEED_ACCEL_MAX, SPEED_JERK_MAX) * 1000));
+
+    /* the controller output is the whole duty - feed-forward plus correction */
+    pid_init(&(motors->motor_left.pid), SPEED_PID_KP, SPEED_PID_KI, SPEED_PID_KD, 0, VAL_SPEED_MAX);
+    pid_init(&(motors->motor_right.pid), SPEED_PID_KP, SPEED_PID_KI, SPEED_PID_KD, 0, VAL_SPEED_MAX);
+    stall_init(&(motors->motor_left.stall));
+    stall_init(&(motors->motor_right.stall));
+    velocity_init(&(motors->motor_left.velocity));
+    velocity_init(&(motors->motor_right.velocity));
+
+    if (hal_store_get(CAL_STORE_KEY, &(motors->calibration), sizeof(cal_table_t)) == ESP_OK
+            && cal_table_valid(&(motors->calibration))) {
+        motors->motor_left.curve = &(motors->calibration.left);
+        motors->motor_right.curve = &(motors->calibration.right);
+        ESP_LOGI(TAG, "Motors calibrated, deadband left %.0f us, right %.0f us",
+                 motors->calibration.left.deadband_us, motors->calibration.right.deadband_us);
+    }
 
     ESP_LOGI(TAG, "Motors device created");
 
@@ -555,23 +683,20 @@ static motors_t *create_motors() {
 static void delete_motors(motors_t *motors) {
 
     if (motors) {
-        if (motors->handler_speed_correction_task) {
-            vTaskDelete(motors->handler_speed_correction_task);
-        }
         motors->motor_left.value_motor_plus = LOW;
         motors->motor_left.value_motor_minus = LOW;
         motors->motor_right.value_motor_plus = LOW;
         motors->motor_right.value_motor_minus = LOW;
         set_motors(motors);
-        mcpwm_stop(motors->motor_left.pwm_speed.unit, motors->motor_left.pwm_speed.timer);
-        mcpwm_stop(motors->motor_right.pwm_speed.unit, motors->motor_right.pwm_speed.timer);
+        hal_pwm_stop(&(motors->motor_left.pwm_speed));
+        hal_pwm_stop(&(motors->motor_right.pwm_speed));
         vTaskDelay(100/portTICK_PERIOD_MS);
-        gpio_reset_pin(motors->motor_left.gpio_motor_plus);
-        gpio_reset_pin(motors->motor_left.gpio_motor_minus);
-        gpio_reset_pin(motors->motor_left.pwm_speed.gpio_num);
-        gpio_reset_pin(motors->motor_right.gpio_motor_plus);
-        gpio_reset_pin(motors->motor_right.gpio_motor_minus);
-        gpio_reset_pin(motors->motor_right.pwm_speed.gpio_num);
+        hal_pin_reset(motors->motor_left.gpio_motor_plus);
+        hal_pin_reset(motors->motor_left.gpio_motor_minus);
+        hal_pin_reset(motors->motor_left.pwm_speed.gpio_num);
+        hal_pin_reset(motors->motor_right.gpio_motor_plus);
+        hal_pin_reset(motors->motor_right.gpio_motor_minus);
+        hal_pin_reset(motors->motor_right.pwm_speed.gpio_num);
         vTaskDelay(100/portTICK_PERIOD_MS);
         free(motors);
         motors = NULL;
@@ -585,39 +710,176 @@ static void delete_motors(motors_t *motors) {
 
 /* ============================================================================================= */
 
-static void straight_motors(motors_t *motors) {
+/* brings the ramp to rest as soon as the jerk limit allows */
+static void stop_ramp_motor(motor_side_t *motor) {
 
-    uint8_t delay = driver_car->steering->delay;
+    float stop = profile_stop_point(&(motor->profile));
+    /* the inner wheel of a turn may run below duty_min_us */
+    int16_t min = MIN((int16_t)driver_car->motors->duty_min_us, motor->new_value_speed);
 
-    if (motors->turn == STEERING_STRAIGHT) return;
+    if (stop < min) stop = min;
+    if (stop > driver_car->motors->duty_max_us) stop = driver_car->motors->duty_max_us;
+
+    motor->new_value_speed = stop + 0.5;
+}
+
+/*
+ *  The outer wheel of a turn runs at value_speed, the inner one slower by
+ *  the Ackermann ratio of the current steering angle - so the turn radius
+ *  stays the same at any speed. The ratio is one of wheel speeds, it is
+ *  applied through the feed-forward map and not to the duty itself.
+ *
+ *  Without turn_ackermann the inner duty is cut by SPEED_TURN_STEP per
+ *  STEERING_STEP, as before the kinematics - only to compare the two.
+ */
+static void set_speed_turn(motors_t *motors, int16_t value_speed) {
+
+    float left, right, rps;
+    int16_t inner;
 
-    if (delay != 0) {
-        driver_car->steering->delay = delay*2;
+    if (!atomic_load_explicit(&(driver_car->turn_ackermann), memory_order_relaxed)) {
+        inner = value_speed - SPEED_TURN_STEP * abs(motors->turn - STEERING_STRAIGHT) / STEERING_STEP;
+        if (inner < 0) inner = 0;
+        motors->motor_left.new_value_speed = motors->turn < STEERING_STRAIGHT ? inner : value_speed;
+        motors->motor_right.new_value_speed = motors->turn > STEERING_STRAIGHT ? inner : value_speed;
+        return;
     }
 
-    if (motors->turn < STEERING_STRAIGHT) {
-        motors->motor_left.new_value_speed = motors->motor_right.value_speed;
-    } else if (motors->turn > STEERING_STRAIGHT) {
-        motors->motor_right.new_value_speed = motors->motor_left.value_speed;
+    kinematics_wheel_ratio(&(motors->kinematics), motors->turn, &left, &right);
+
+    rps = duty_to_rps(value_speed);
+
+    motors->motor_left.new_value_speed = rps_to_duty(rps * left);
+    motors->motor_right.new_value_speed = rps_to_duty(rps * right);
+}
+
+/* target duty of the outer wheel */
+static int16_t outer_speed(motors_t *motors) {
+
+    return MAX(motors->motor_left.new_value_speed, motors->motor_right.new_value_speed);
+}
+
+static void driver_command(int16_t command) {
+
+    motors_t *motors = driver_car->motors;
+
+    /* speed commands only move the target, motion profiles do the ramp */
+    if (command & cmd_speedstop) {
+        stop_ramp_motor(&(motors->motor_left));
+        stop_ramp_motor(&(motors->motor_right));
+        ESP_LOGI(TAG, "Speed of left motor - %d", motors->motor_left.new_value_speed);
+        ESP_LOGI(TAG, "Speed of right motor - %d", motors->motor_right.new_value_speed);
+    } else if (command & cmd_speedup) {
+        set_speed_turn(motors, motors->duty_max_us);
+    } else if (command & cmd_slowdown) {
+        set_speed_turn(motors, motors->duty_min_us);
     }
 
-    motors->turn = STEERING_STRAIGHT;
-    set_steering(motors->turn);
+    if (command & cmd_turn_left) {
+        if (motors->turn != STEERING_ANGLE_MIN) {
+            motors->turn -= STEERING_STEP;
+            set_speed_turn(motors, outer_speed(motors));
+            ESP_LOGI(TAG, "Speed of left motor - %d, right motor - %d",
+                     motors->motor_left.new_value_speed, motors->motor_right.new_value_speed);
+        }
+        set_steering(motors->turn);
+    } else if (command & cmd_turn_right) {
+        if (motors->turn != STEERING_ANGLE_MAX) {
+            motors->turn += STEERING_STEP;
+            set_speed_turn(motors, outer_speed(motors));
+            ESP_LOGI(TAG, "Speed of left motor - %d, right motor - %d",
+                     motors->motor_left.new_value_speed, motors->motor_right.new_value_speed);
+        }
+        set_steering(motors->turn);
+    }
+}
+
+static void ramp_motor(motor_side_t *motor, float dt) {
+
+    int16_t value = profile_update(&(motor->profile), motor->new_value_speed, dt) + 0.5;
 
-    for (uint8_t i = 0; driver_car->steering->current_position != motors->turn && i++ < 100; i++ ) {
-        vTaskDelay(10/portTICK_PERIOD_MS);
+    if (value != motor->value_speed) {
+        motor->value_speed = value;
+        set_motor_pwm(motor);
+    }
+}
+
+/*
+ *  coast   - both legs low, no PWM, the motor runs free
+ *  short   - both legs high at 100%, the motor is shorted and brakes
+ *  reverse - the legs swapped at 100% for up to BRAKE_REVERSE_MS (scaled by
+ *            the speed), then short - the control loop ends the pulse
+ */
+static void brake_motor(motor_side_t *motor, brake_mode_t mode) {
+
+    uint8_t plus;
+
+    switch (mode) {
+        case brake_reverse:
+            plus = motor->value_motor_plus;
+            motor->value_motor_plus = motor->value_motor_minus;
+            motor->value_motor_minus = plus;
+            motor->brake_duty = VAL_SPEED_MAX;
+            break;
+        case brake_short:
+            motor->value_motor_plus = HIGH;
+            motor->value_motor_minus = HIGH;
+            motor->brake_duty = VAL_SPEED_MAX;
+            break;
+        case brake_coast:
+        default:
+            motor->value_motor_plus = LOW;
+            motor->value_motor_minus = LOW;
+            motor->brake_duty = 0;
+            break;
     }
 
-    if (delay != 0) {
-        driver_car->steering->delay = delay;
+    motor->braking = true;
+}
+
+static void brake_motors(motors_t *motors, brake_mode_t mode) {
+
+    uint32_t pulse_ms;
+
+    motors->brake_until = 0;
+
+    if (mode == brake_reverse) {
+        pulse_ms = BRAKE_REVERSE_MS * MAX(motors->motor_left.value_speed, motors->motor_right.value_speed) / VAL_SPEED_MAX;
+        /* standing or already braking - nothing to reverse */
+        if (!(motors->status & (car_forward|car_back)) || pulse_ms == 0) {
+            mode = brake_short;
+        } else {
+            motors->brake_until = hal_time_us() + pulse_ms * 1000ULL;
+        }
     }
+
+    brake_motor(&(motors->motor_left), mode);
+    brake_motor(&(motors->motor_right), mode);
+}
+
+/* the pins are set for driving, the PWM is the speed again */
+static void release_brake_motors(motors_t *motors) {
+
+    motors->brake_until = 0;
+    motors->motor_left.braking = false;
+    motors->motor_right.braking = false;
+}
+
+/* never waits for the servo - it is retargeted and the control loop goes on */
+static void straight_motors(motors_t *motors) {
+
+    if (motors->turn == STEERING_STRAIGHT) return;
+
+    motors->turn = STEERING_STRAIGHT;
+    set_speed_turn(motors, outer_speed(motors));
+    set_steering(motors->turn);
 }
 
 static void forward_motors(motors_t *motors) {
-    int16_t speed = 0;
     bool speed_change = false;
 
     if (motors->status & car_stop) {
+        release_brake_motors(motors);
         motors->motor_left.value_motor_plus = HIGH;
         motors->motor_left.value_motor_minus = LOW;
         motors->motor_right.value_motor_plus = HIGH;
@@ -637,25 +899,19 @@ static void forward_motors(motors_t *motors) {
 
     if (speed_change) {
         if (motors->status & car_forward) {
-            speed = cmd_speedup;
-            if (xQueueSendToBack(driver_car->queue_driver, &speed, (TickType_t)10) != pdPASS) {
-                ESP_LOGE(TAG, "Not put to queue motors cmd \"cmd_speedup\", command failed. (%s:%u)", __FILE__, __LINE__);
-            }
+            driver_command(cmd_speedup);
         } else {
-            speed = cmd_slowdown;
-            if (xQueueSendToBack(driver_car->queue_driver, &speed, (TickType_t)10) != pdPASS) {
-                ESP_LOGE(TAG, "Not put to queue motors cmd \"cmd_slowdown\", command failed. (%s:%u)", __FILE__, __LINE__);
-            }
+            driver_command(cmd_slowdown);
         }
     }
 
 }
 
 static void back_motors(motors_t *motors) {
-    int16_t speed = 0;
     bool speed_change = false;
 
     if (motors->status & car_stop) {
+        release_brake_motors(motors);
         motors->motor_left.value_motor_plus = LOW;
         motors->motor_left.value_motor_minus = HIGH;
         motors->motor_right.value_motor_plus = LOW;
@@ -675,114 +931,727 @@ static void back_motors(motors_t *motors) {
 
     if (speed_change) {
         if (!(motors->status & car_forward)) {
-            speed = cmd_speedup;
-            if (xQueueSendToBack(driver_car->queue_driver, &speed, (TickType_t)50) != pdPASS) {
-                ESP_LOGE(TAG, "Not put to queue motors cmd \"cmd_speedup\", command failed. (%s:%u)", __FILE__, __LINE__);
-            }
+            driver_command(cmd_speedup);
         } else {
-            speed = cmd_slowdown;
-            if (xQueueSendToBack(driver_car->queue_driver, &speed, (TickType_t)50) != pdPASS) {
-                ESP_LOGE(TAG, "Not put to queue motors cmd \"cmd_slowdown\", command failed. (%s:%u)", __FILE__, __LINE__);
-            }
+            driver_command(cmd_slowdown);
         }
     }
 
 }
 
 static void stop_motors(motors_t *motors) {
-    motors->motor_left.value_motor_plus = LOW;
-    motors->motor_left.value_motor_minus = LOW;
-    motors->motor_right.value_motor_plus = LOW;
-    motors->motor_right.value_motor_minus = LOW;
+    brake_motors(motors, motors->brake_mode);
     motors->motor_left.new_value_speed = motors->motor_left.value_speed = VAL_SPEED_MIN;
     motors->motor_right.new_value_speed = motors->motor_right.value_speed = VAL_SPEED_MIN;
+    motors->motor_left.correction_speed = 0;
+    motors->motor_right.correction_speed = 0;
+    profile_reset(&(motors->motor_left.profile), VAL_SPEED_MIN);
+    profile_reset(&(motors->motor_right.profile), VAL_SPEED_MIN);
 
     set_motors(motors);
     motors->status = car_stop;
 
 }
 
-static void set_speed_left_motor(int16_t speed) {
-    driver_car->motors->motor_left.new_value_speed = speed;
+static void speed_motors(motors_t *motors, int16_t value_speed) {
+
+    if (motors->status & car_stop) return;
+
+    ESP_LOGI(TAG, "Setting speed in %d", value_speed);
+
+    set_speed_turn(motors, value_speed);
 }
 
-static void set_speed_right_motor(int16_t speed) {
-    driver_car->motors->motor_right.new_value_speed = speed;
+/* steps the steering (and the wheel speeds with it) until it reaches degree */
+static void steer_motors(motors_t *motors, int16_t degree) {
+
+    for (int i = 0; i < (STEERING_ANGLE_MAX - STEERING_ANGLE_MIN) / STEERING_STEP && motors->turn != degree; i++) {
+        if (degree < motors->turn) {
+            driver_command(cmd_turn_left);
+        } else {
+            driver_command(cmd_turn_right);
+        }
+    }
 }
 
-static void set_speed_motors(int16_t speed) {
+/* one step of a held turn button, the next one is due TURN_HOLD_MS later */
+static void turn_motors(motors_t *motors, int16_t command, uint64_t now) {
 
-    set_speed_left_motor(speed);
-    set_speed_right_motor(speed);
+    driver_command(command);
+    driver_car->turn_time = now;
 }
 
+static void auto_motors(motors_t *motors, bool automatic) {
 
-/*--------------------------------------Public Zone----------------------------------------------*/
+    if (automatic) {
+        ESP_LOGI(TAG, "Automatic mode on");
+        stop_motors(motors);
+        straight_motors(motors);
+        motors->status = car_auto | car_stop;
+    } else {
+        ESP_LOGI(TAG, "Automatic mode off");
+        stop_motors(motors);
+    }
+}
 
-esp_err_t init_driver() {
+/* the autopilot changes the direction - from rest, the speed setpoint follows */
+static void pilot_motors(motors_t *motors, int16_t direction) {
 
-    esp_err_t ret = ESP_FAIL;
-    driver_t *driver = NULL;
+    car_status_t status;
 
-    if (driver_car) {
-        ESP_LOGE(TAG, "Driver already exist");
-        return ret;
-    }
+    if (!(motors->status & car_auto)) return;
 
-    ESP_LOGI(TAG, "Initialize driver");
+    if (direction > 0) status = car_forward;
+    else if (direction < 0) status = car_back;
+    else status = car_stop;
 
-    driver = malloc(sizeof(driver_t));
+    if (motors->status & status) return;
 
-    if (driver == NULL) {
-        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
-        ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
-        return ret;
+    stop_motors(motors);
+
+    if (status != car_stop) {
+        release_brake_motors(motors);
+        motors->motor_left.value_motor_minus = LOW;
+        motors->motor_right.value_motor_minus = LOW;
+        motors->motor_left.value_motor_plus = LOW;
+        motors->motor_right.value_motor_plus = LOW;
     }
 
-    memset(driver, 0, sizeof(driver_t));
+    if (status == car_forward) {
+        motors->motor_left.value_motor_plus = HIGH;
+        motors->motor_right.value_motor_plus = HIGH;
+    } else if (status == car_back) {
+        motors->motor_left.value_motor_minus = HIGH;
+        motors->motor_right.value_motor_minus = HIGH;
+    }
 
-    driver->steering = create_steering_servo();
+    set_motors(motors);
+    motors->status = car_auto | status;
+}
 
-    if (driver->steering == NULL){
-        ESP_LOGE(TAG, "Create servo steering failed. (%s:%u)", __FILE__, __LINE__);
-        ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
-        free(driver);
-        return ret;
+/* the guard has already driven both direction pins high - a short brake, bring the state in line */
+static void guard_motors(motors_t *motors) {
+
+    ESP_LOGI(TAG, "Collision guard braked the car in %u us", driver_car->guard_latency_us);
+
+    if (motors->status & car_auto) {
+        pilot_motors(motors, 0);
+    } else {
+        stop_motors(motors);
     }
+}
 
-    driver->motors = create_motors();
+/*
+ *  The guard brakes when an obstacle is closer than the stopping distance
+ *  at the current speed, plus the age of an echo and a margin. Only when
+ *  moving forward - the sensor looks to the front.
+ */
+static void guard_update(motors_t *motors) {
 
-    if (driver->motors == NULL) {
-        ESP_LOGE(TAG, "Create motors device failed. (%s:%u)", __FILE__, __LINE__);
-        ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
-        delete_steering_servo(driver_car->steering);
-        free(driver);
-        return ret;
+    float mm_s, distance;
+
+    if (!(motors->status & car_forward)) {
+        atomic_store_explicit(&(driver_car->guard_threshold), 0, memory_order_relaxed);
+        return;
     }
 
-    driver->queue_driver = xQueueCreate(10, sizeof(int16_t));
-    if (!driver->queue_driver) {
-        ESP_LOGE(TAG, "Create driver queue failed. (%s:%u)", __FILE__, __LINE__);
+    mm_s = duty_to_rps(MAX(motors->motor_left.value_speed, motors->motor_right.value_speed)) * WHEEL_CIRCUMFERENCE;
+
+    distance = mm_s * GUARD_REACTION_MS / 1000 + mm_s * mm_s / (2 * GUARD_DECEL);
+
+    atomic_store_explicit(&(driver_car->guard_threshold), GUARD_DIST_MIN + (uint32_t)(distance / 10 + 0.5), memory_order_relaxed);
+}
+
+/*
+ *  A blocked wheel draws the stall current and the speed controller only
+ *  pushes its duty higher. Every tick both wheels are checked against the
+ *  speed of their duty, a stall stops the car like a guard trip.
+ */
+static void stall_step(motors_t *motors, uint64_t now) {
+
+    uint32_t left, right;
+    bool driven, stall_left, stall_right;
+
+    driven = motors->status & (car_forward|car_back);
+
+    get_pulse_count(&left, &right);
+
+    stall_left = stall_update(&(motors->motor_left.stall), left,
+                              driven && !motors->motor_left.braking ?
+                                      duty_to_rps(motors->motor_left.value_speed) : 0, now);
+    stall_right = stall_update(&(motors->motor_right.stall), right,
+                               driven && !motors->motor_right.braking ?
+                                       duty_to_rps(motors->motor_right.value_speed) : 0, now);
+
+    if (!(stall_left || stall_right)) return;
+
+    ESP_LOGI(TAG, "%s wheel stalled, motors stopped", stall_left ? (stall_right ? "Both" : "Left") : "Right");
+
+    if (motors->status & car_auto) {
+        pilot_motors(motors, 0);
+    } else {
+        stop_motors(motors);
+    }
+}
+
+/* the sweep owns both motors, forward, until it is over or the car is stopped */
+static void calibrate_start(motors_t *motors, uint64_t now) {
+
+    ESP_LOGI(TAG, "Motor calibration started");
+
+    stop_motors(motors);
+    release_brake_motors(motors);
+
+    motors->motor_left.value_motor_plus = HIGH;
+    motors->motor_left.value_motor_minus = LOW;
+    motors->motor_right.value_motor_plus = HIGH;
+    motors->motor_right.value_motor_minus = LOW;
+    motors->motor_left.sweeping = motors->motor_right.sweeping = true;
+    motors->motor_left.sweep_duty = motors->motor_right.sweep_duty = 0;
+
+    set_motors(motors);
+    cal_sweep_start(&(driver_car->sweep), now);
+    motors->status = car_calibrate;
+}
+
+static void calibrate_end(motors_t *motors) {
+
+    driver_car->sweep.running = false;
+    motors->motor_left.sweeping = motors->motor_right.sweeping = false;
+    stop_motors(motors);
+}
+
+static void calibrate_step(motors_t *motors, uint64_t now) {
+
+    uint32_t left, right;
+    int32_t duty;
+    cal_table_t *table = &(driver_car->sweep.table);
+
+    get_pulse_count(&left, &right);
+
+    duty = cal_sweep_step(&(driver_car->sweep), now, left, right);
+
+    if (duty >= 0) {
+        motors->motor_left.sweep_duty = motors->motor_right.sweep_duty = duty;
+        set_motor_pwm(&(motors->motor_left));
+        set_motor_pwm(&(motors->motor_right));
+        return;
+    }
+
+    calibrate_end(motors);
+
+    if (!cal_table_valid(table)) {
+        ESP_LOGE(TAG, "Calibration failed, the wheels did not turn. (%s:%u)", __FILE__, __LINE__);
+        return;
+    }
+
+    motors->calibration = *table;
+    motors->motor_left.curve = &(motors->calibration.left);
+    motors->motor_right.curve = &(motors->calibration.right);
+
+    ESP_LOGI(TAG, "Motor calibration done, deadband left %.0f us, right %.0f us",
+             table->left.deadband_us, table->right.deadband_us);
+
+    /* the car stands, the flash write may cost a tick */
+    if (hal_store_set(CAL_STORE_KEY, table, sizeof(cal_table_t)) != ESP_OK) {
+        ESP_LOGE(TAG, "Calibration not saved. (%s:%u)", __FILE__, __LINE__);
+    }
+}
+
+static void calibrate_request(motors_t *motors, uint64_t now) {
+
+    switch (atomic_exchange(&(driver_car->cal_request), cal_request_none)) {
+        case cal_request_start:
+            calibrate_start(motors, now);
+            break;
+        case cal_request_clear:
+            if (motors->status & car_calibrate) calibrate_end(motors);
+            motors->motor_left.curve = NULL;
+            motors->motor_right.curve = NULL;
+            hal_store_erase(CAL_STORE_KEY);
+            ESP_LOGI(TAG, "Motor calibration cleared");
+            break;
+        default:
+            break;
+    }
+}
+
+/* forward_stop and back_stop post the same event, the running trace takes it */
+static void stamp_event_latency(int16_t event, latency_stage_t stage) {
+
+    switch (event) {
+        case cmd_forward:
+            latency_stamp(latency_forward, stage);
+            break;
+        case cmd_back:
+            latency_stamp(latency_back, stage);
+            break;
+        case cmd_speedstop:
+            latency_stamp(latency_forward, stage);
+            latency_stamp(latency_back, stage);
+            break;
+        case cmd_stop:
+            latency_stamp(latency_stop, stage);
+            break;
+        case cmd_turn_left:
+        case cmd_turn_right:
+            latency_stamp(latency_turn, stage);
+            break;
+        case cmd_guard:
+            break;
+        default:
+            latency_stamp(latency_other, stage);
+            break;
+    }
+}
+
+static void driver_event(const mailbox_event_t *event) {
+
+    /* a sweep owns the motors - a stop ends it, the other motor commands are ignored */
+    if (driver_car->motors->status & car_calibrate) {
+        switch (event->event) {
+            case cmd_stop:
+                calibrate_end(driver_car->motors);
+                return;
+            case cmd_forward:
+            case cmd_back:
+            case cmd_auto:
+            case cmd_pilot:
+            case cmd_speedstop:
+                return;
+            default:
+                break;
+        }
+    }
+
+    switch (event->event) {
+        case cmd_forward:
+            forward_motors(driver_car->motors);
+            break;
+        case cmd_back:
+            back_motors(driver_car->motors);
+            break;
+        case cmd_stop:
+            driver_car->cmd_turn = cmd_no;
+            stop_motors(driver_car->motors);
+            break;
+        case cmd_auto:
+            driver_car->cmd_turn = cmd_no;
+            auto_motors(driver_car->motors, event->value);
+            break;
+        case cmd_turn_left:
+        case cmd_turn_right:
+            driver_car->cmd_turn = event->event;
+            turn_motors(driver_car->motors, event->event, hal_time_us());
+            break;
+        case cmd_turn_stop:
+            driver_car->cmd_turn = cmd_no;
+            break;
+        case cmd_pilot:
+            pilot_motors(driver_car->motors, event->value);
+            break;
+        case cmd_speedstop:
+            driver_command(cmd_speedstop);
+            break;
+        case cmd_guard:
+            driver_car->cmd_turn = cmd_no;
+            guard_motors(driver_car->motors);
+            break;
+        case cmd_brake:
+            ESP_LOGI(TAG, "Brake mode %d", event->value);
+            driver_car->motors->brake_mode = event->value;
+            break;
+        case cmd_pwm:
+            set_pwm_motors(driver_car->motors, driver_car->pwm_frequency, driver_car->pwm_resolution);
+            break;
+        case cmd_odom_reset:
+            odometry_reset(&(driver_car->odometry), 0, 0, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+/* pulses since the last count, which moves on - a count below it is a bad read and waits for the next */
+static int32_t pulse_delta(uint32_t pulses, uint32_t *last) {
+
+    int32_t delta = (int32_t)(pulses - *last);
+
+    if (delta < 0) return 0;
+
+    *last = pulses;
+
+    return delta;
+}
+
+/*
+ *  Pulse counters have no direction, it comes from the motors - or from
+ *  the signed ticks of quadrature encoders. The actual servo position, not
+ *  the commanded one, gives the curvature.
+ */
+static void odometry_step(motors_t *motors) {
+
+    uint32_t left, right;
+    int32_t ticks_left, ticks_right;
+    float curvature, distance_left, distance_right;
+
+    get_pulse_count(&left, &right);
+
+    if (motors->status & car_forward) driver_car->odom_direction = 1;
+    else if (motors->status & car_back) driver_car->odom_direction = -1;
+
+    if (ENCODER_QUADRATURE) {
+        get_tick_count(&ticks_left, &ticks_right);
+        distance_left = (ticks_left - driver_car->ticks_left) * ODOM_MM_PER_PULSE * PULSE_PER_TURN / ENCODER_TICKS;
+        distance_right = (ticks_right - driver_car->ticks_right) * ODOM_MM_PER_PULSE * PULSE_PER_TURN / ENCODER_TICKS;
+        driver_car->ticks_left = ticks_left;
+        driver_car->ticks_right = ticks_right;
+    } else {
+        distance_left = driver_car->odom_direction * (float)pulse_delta(left, &(driver_car->pulse_left)) * ODOM_MM_PER_PULSE;
+        distance_right = driver_car->odom_direction * (float)pulse_delta(right, &(driver_car->pulse_right)) * ODOM_MM_PER_PULSE;
+    }
+
+    curvature = kinematics_curvature(&(motors->kinematics), driver_car->steering->current_position);
+
+    odometry_update(&(driver_car->odometry), distance_left, distance_right, curvature);
+
+    driver_car->distance_left += fabsf(distance_left);
+    driver_car->distance_right += fabsf(distance_right);
+    driver_car->odometer += (fabsf(distance_left) + fabsf(distance_right)) / 2;
+}
+
+/*
+ *  The odometer goes into NVS only every ODOMETER_STORE_MM and only while
+ *  the car stands - few writes for the flash, none in the middle of a
+ *  drive. A power cut loses what was driven since.
+ */
+static void odometer_step(motors_t *motors) {
+
+    if (driver_car->odometer - driver_car->odometer_stored < ODOMETER_STORE_MM) return;
+    if (motors->status & (car_forward|car_back|car_auto)) return;
+    if (!motors->motor_left.velocity.standing || !motors->motor_right.velocity.standing) return;
+
+    /* the car stands, the flash write may cost a tick */
+    if (hal_store_set(ODOMETER_STORE_KEY, &(driver_car->odometer), sizeof(double)) != ESP_OK) {
+        ESP_LOGE(TAG, "Odometer not saved. (%s:%u)", __FILE__, __LINE__);
+    }
+
+    /* also after a failed write, not again every tick */
+    driver_car->odometer_stored = driver_car->odometer;
+}
+
+/* only the control loop writes the state, so it is copied without locks */
+static void publish_state() {
+
+    car_state_t state;
+    motors_t *motors = driver_car->motors;
+    int8_t direction_left, direction_right;
+
+    get_wheel_direction(&direction_left, &direction_right);
+    if (direction_left == 0) direction_left = driver_car->odom_direction;
+    if (direction_right == 0) direction_right = driver_car->odom_direction;
+
+    state.version = driver_car->loop.ticks;
+    state.forward = motors->status & car_forward;
+    state.back = motors->status & car_back;
+    state.automatic = motors->status & car_auto;
+    state.stop = !(state.forward || state.back || state.automatic);
+    state.turn = motors->turn;
+    state.steering_position = driver_car->steering->current_position;
+    state.new_speed_left = motors->motor_left.new_value_speed;
+    state.new_speed_right = motors->motor_right.new_value_speed;
+    state.speed_left = motors->motor_left.value_speed;
+    state.speed_right = motors->motor_right.value_speed;
+    state.correction_left = motors->motor_left.correction_speed;
+    state.correction_right = motors->motor_right.correction_speed;
+    state.loop_jitter_max_us = driver_car->loop.jitter_max_us;
+    state.loop_jitter_avg_us = control_loop_jitter_avg(&(driver_car->loop));
+    state.loop_jitter_late = driver_car->loop.jitter_late;
+    state.loop_samples = driver_car->loop.samples;
+    state.loop_overruns = driver_car->loop.overruns;
+    state.loop_missed = driver_car->loop.missed;
+    state.steering_latency_us = driver_car->steering->latency_us;
+    state.steering_latency_max_us = driver_car->steering->latency_max_us;
+    state.cmd_latency_us = mailbox_latency_avg(&(driver_car->mailbox));
+    state.cmd_latency_max_us = driver_car->mailbox.latency_max_us;
+    state.cmd_coalesced = driver_car->mailbox.coalesced;
+    state.cmd_dropped = driver_car->mailbox.dropped;
+    state.brake_mode = motors->brake_mode;
+    state.pwm_frequency = motors->pwm_frequency;
+    state.pwm_resolution = motors->pwm_resolution;
+    state.guard_threshold_cm = driver_car->guard_threshold;
+    state.guard_trips = driver_car->guard_trips;
+    state.stall_left = motors->motor_left.stall.stalls;
+    state.stall_right = motors->motor_right.stall.stalls;
+    state.stalled = motors->motor_left.stall.stalled || motors->motor_right.stall.stalled;
+    state.calibrating = motors->status & car_calibrate;
+    state.calibrated = motors->motor_left.curve && motors->motor_right.curve;
+    state.wheel_rps_left = direction_left * motors->motor_left.velocity.rps;
+    state.wheel_rps_right = direction_right * motors->motor_right.velocity.rps;
+    state.wheel_mm_s_left = state.wheel_rps_left * WHEEL_CIRCUMFERENCE;
+    state.wheel_mm_s_right = state.wheel_rps_right * WHEEL_CIRCUMFERENCE;
+    state.distance_left = driver_car->distance_left;
+    state.distance_right = driver_car->distance_right;
+    state.odometer = driver_car->odometer;
+    state.ticks_left = driver_car->ticks_left;
+    state.ticks_right = driver_car->ticks_right;
+    state.guard_latency_us = driver_car->guard_latency_us;
+    state.guard_latency_max_us = driver_car->guard_latency_max_us;
+    state.pose.x = driver_car->odometry.x;
+    state.pose.y = driver_car->odometry.y;
+    state.pose.heading = driver_car->odometry.heading;
+    state.pose.var_x = driver_car->odometry.cov[0][0];
+    state.pose.var_y = driver_car->odometry.cov[1][1];
+    state.pose.var_heading = driver_car->odometry.cov[2][2];
+    state.pose.distance = driver_car->odometry.distance;
+
+    snapshot_publish(&(driver_car->state), &state);
+}
+
+/*
+ *  One tick of the control loop: drains the command mailbox and then moves
+ *  the speed of both motors along their motion profiles. The profiles are
+ *  driven by the elapsed time, so ramps take the same time whatever the
+ *  command traffic is. The wheel speed controller runs every
+ *  SPEED_PID_PERIOD_MS, the odometry every ODOM_PERIOD_MS.
+ */
+static void driver_control_step(uint64_t now) {
+
+    mailbox_event_t event;
+    int16_t value;
+    uint32_t time, latched;
+    uint32_t periods;
+    float dt;
+    motors_t *motors = driver_car->motors;
+
+    if (atomic_exchange(&(driver_car->loop_reset), false)) control_loop_reset_stats(&(driver_car->loop));
+
+    periods = control_loop_tick(&(driver_car->loop), now);
+    dt = (float)periods / CONTROL_RATE_HZ;
+
+    calibrate_request(motors, now);
+
+    /* events in order, then the latest of each setpoint */
+    while (mailbox_get_event(&(driver_car->mailbox), &event)) {
+        stamp_event_latency(event.event, latency_pickup);
+        driver_event(&event);
+        mailbox_actuated(&(driver_car->mailbox), event.time, hal_time_us());
+    }
+
+    /* a stop or a guard that found the ring full - after all that was in it */
+    latched = mailbox_get_latched(&(driver_car->mailbox), &(event.time));
+    event.value = 0;
+    while (latched) {
+        event.event = latched & -latched;
+        latched &= ~event.event;
+        stamp_event_latency(event.event, latency_pickup);
+        driver_event(&event);
+        mailbox_actuated(&(driver_car->mailbox), event.time, hal_time_us());
+    }
+
+    if (mailbox_get_setpoint(&(driver_car->mailbox), setpoint_steering, &value, &time)) {
+        latency_stamp(latency_turn, latency_pickup);
+        steer_motors(motors, value);
+        mailbox_actuated(&(driver_car->mailbox), time, hal_time_us());
+    }
+
+    if (mailbox_get_setpoint(&(driver_car->mailbox), setpoint_speed, &value, &time)) {
+        latency_stamp(latency_speed, latency_pickup);
+        speed_motors(motors, value);
+        mailbox_actuated(&(driver_car->mailbox), time, hal_time_us());
+    }
+
+    /* the turn button is still held */
+    if (driver_car->cmd_turn && now - driver_car->turn_time >= TURN_HOLD_MS * 1000) {
+        turn_motors(motors, driver_car->cmd_turn, now);
+    }
+
+    /* end of a reverse pulse */
+    if (motors->brake_until && now >= motors->brake_until) {
+        brake_motors(motors, brake_short);
+        set_motors(motors);
+    }
+
+    if (motors->status & car_calibrate) calibrate_step(motors, now);
+
+    ramp_motor(&(motors->motor_left), dt);
+    ramp_motor(&(motors->motor_right), dt);
+
+    guard_update(motors);
+    stall_step(motors, now);
+    velocity_step(motors, now, dt);
+
+    driver_car->pid_ticks += periods;
+    if (driver_car->pid_ticks * 1000 >= SPEED_PID_PERIOD_MS * CONTROL_RATE_HZ) {
+        speed_control(motors, (float)driver_car->pid_ticks / CONTROL_RATE_HZ);
+        driver_car->pid_ticks = 0;
+    }
+
+    driver_car->odom_ticks += periods;
+    if (driver_car->odom_ticks * 1000 >= ODOM_PERIOD_MS * CONTROL_RATE_HZ) {
+        odometry_step(motors);
+        odometer_step(motors);
+        driver_car->odom_ticks = 0;
+    }
+
+    publish_state();
+
+    control_loop_done(&(driver_car->loop), hal_time_us());
+}
+
+static void driver_task(void *pvParameter) {
+
+    while(1) {
+        /* woken by control_timer_callback() every control period */
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        driver_control_step(hal_time_us());
+    }
+}
+
+static void control_timer_callback(void *arg) {
+
+    TaskHandle_t handler = (TaskHandle_t)arg;
+
+    xTaskNotifyGive(handler);
+}
+
+/* never blocks - a full mailbox drops the event, counts it and returns ESP_ERR_NO_MEM */
+static esp_err_t post_event(int16_t event, int16_t value, const char *name) {
+
+    if (!mailbox_post_event(&(driver_car->mailbox), event, value, hal_time_us())) {
+        ESP_LOGE(TAG, "Mailbox full, driver cmd \"%s\" dropped. (%s:%u)", name, __FILE__, __LINE__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    stamp_event_latency(event, latency_queue);
+
+    return ESP_OK;
+}
+
+#if ACT_BENCHMARK_ROUNDS
+static uint32_t cpu_cycles() {
+    return hal_cycles();
+}
+
+static void actuation_benchmark() {
+
+    act_benchmark_t bench;
+
+    act_benchmark(&bench, cpu_cycles, ACT_BENCHMARK_ROUNDS);
+
+    ESP_LOGI(TAG, "CPU cycles per conversion, legacy / table:");
+    ESP_LOGI(TAG, "  angle -> us    %.1f / %.1f", bench.angle_legacy, bench.angle_table);
+    ESP_LOGI(TAG, "  speed -> duty  %.1f / %.1f", bench.speed_legacy, bench.speed_table);
+    ESP_LOGI(TAG, "  duty -> speed  %.1f / %.1f", bench.duty_legacy, bench.duty_fixed);
+}
+#endif
+
+/*--------------------------------------Public Zone----------------------------------------------*/
+
+esp_err_t init_driver() {
+
+    esp_err_t ret = ESP_FAIL;
+    driver_t *driver = NULL;
+
+    if (driver_car) {
+        ESP_LOGE(TAG, "Driver already exist");
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Initialize driver");
+
+#if ACT_BENCHMARK_ROUNDS
+    actuation_benchmark();
+#endif
+
+    driver = malloc(sizeof(driver_t));
+
+    if (driver == NULL) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
+        return ret;
+    }
+
+    memset(driver, 0, sizeof(driver_t));
+
+    driver->steering = create_steering_servo();
+
+    if (driver->steering == NULL){
+        ESP_LOGE(TAG, "Create servo steering failed. (%s:%u)", __FILE__, __LINE__);
         ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
-        delete_steering_servo(driver_car->steering);
-        delete_motors(driver_car->motors);
         free(driver);
         return ret;
     }
 
-    xTaskCreate(&driver_task, "driver_task", 4096, NULL, 5, &(driver->handler_driver_task));
+    driver->motors = create_motors();
+
+    if (driver->motors == NULL) {
+        ESP_LOGE(TAG, "Create motors device failed. (%s:%u)", __FILE__, __LINE__);
+        ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
+        delete_steering_servo(driver->steering);
+        free(driver);
+        return ret;
+    }
+
+    mailbox_init(&(driver->mailbox));
+
+    atomic_init(&(driver->pwm_frequency), driver->motors->pwm_frequency);
+    atomic_init(&(driver->pwm_resolution), driver->motors->pwm_resolution);
+    atomic_init(&(driver->loop_reset), false);
+    atomic_init(&(driver->turn_ackermann), true);
+    atomic_init(&(driver->cal_request), cal_request_none);
+
+    odometry_init(&(driver->odometry), TRACK_WIDTH);
+    driver->odom_direction = 1;
+    get_pulse_count(&(driver->pulse_left), &(driver->pulse_right));
+    get_tick_count(&(driver->ticks_left), &(driver->ticks_right));
+
+    if (hal_store_get(ODOMETER_STORE_KEY, &(driver->odometer), sizeof(double)) != ESP_OK
+            || !(driver->odometer >= 0)) {
+        driver->odometer = 0;
+    }
+    driver->odometer_stored = driver->odometer;
+    ESP_LOGI(TAG, "Odometer %.1f m", driver->odometer / 1000);
+
+    if (!snapshot_init(&(driver->state), sizeof(car_state_t))) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
+        delete_steering_servo(driver->steering);
+        delete_motors(driver->motors);
+        free(driver);
+        return ret;
+    }
+
+    create_task(task_driver, &driver_task, NULL, NULL, &(driver->handler_driver_task));
     if (!driver->handler_driver_task) {
         ESP_LOGE(TAG, "Create driver task failed. (%s:%u)", __FILE__, __LINE__);
         ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
-        vQueueDelete(driver->queue_driver);
-        delete_steering_servo(driver_car->steering);
-        delete_motors(driver_car->motors);
+        snapshot_free(&(driver->state));
+        delete_steering_servo(driver->steering);
+        delete_motors(driver->motors);
+        free(driver);
+        return ret;
+    }
+
+    if (hal_timer_create(&(driver->control_timer), &control_timer_callback,
+                         driver->handler_driver_task, "control_timer") != ESP_OK) {
+        ESP_LOGE(TAG, "Create control timer failed. (%s:%u)", __FILE__, __LINE__);
+        ESP_LOGE(TAG, "Could not init driver. (%s:%u)", __FILE__, __LINE__);
+        vTaskDelete(driver->handler_driver_task);
+        snapshot_free(&(driver->state));
+        delete_steering_servo(driver->steering);
+        delete_motors(driver->motors);
         free(driver);
         return ret;
     }
 
     driver_car = driver;
 
+    control_loop_init(&(driver->loop), CONTROL_RATE_HZ, hal_time_us());
+    hal_timer_start_periodic(driver->control_timer, driver->loop.period_us);
+
+    ESP_LOGI(TAG, "Control loop started at %d Hz", CONTROL_RATE_HZ);
+
     return ESP_OK;
 }
 
@@ -790,14 +1659,20 @@ void deinit_driver() {
 
     if (driver_car) {
         ESP_LOGI(TAG, "Deinitialize driver");
+        hal_timer_stop(driver_car->control_timer);
+        hal_timer_delete(driver_car->control_timer);
+        /* before the motors go - a pending notify would run one more control step */
+        vTaskDelete(driver_car->handler_driver_task);
+        if (driver_car->odometer != driver_car->odometer_stored) {
+            hal_store_set(ODOMETER_STORE_KEY, &(driver_car->odometer), sizeof(double));
+        }
         if (driver_car->steering) {
             delete_steering_servo(driver_car->steering);
         }
         if (driver_car->motors) {
             delete_motors(driver_car->motors);
         }
-        vTaskDelete(driver_car->handler_driver_task);
-        vQueueDelete(driver_car->queue_driver);
+        snapshot_free(&(driver_car->state));
         free(driver_car);
         driver_car = NULL;
     } else {
@@ -809,178 +1684,202 @@ void deinit_driver() {
 
 /* ============================================================================================= */
 
-void automatic_car(bool automatic) {
+/* the mode as the control loop published it - the motors belong to the control loop */
+static bool automatic_state() {
+
+    car_state_t state;
+
+    snapshot_read(&(driver_car->state), &state);
+
+    return state.automatic;
+}
+
+esp_err_t automatic_car(bool automatic) {
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (automatic) {
-        ESP_LOGI(TAG, "Automatic mode on");
-        stop_motors(driver_car->motors);
-        straight_motors(driver_car->motors);
-        driver_car->motors->status = car_auto;
-    } else {
-        ESP_LOGI(TAG, "Automatic mode off");
-        stop_motors(driver_car->motors);
-    }
+    return post_event(cmd_auto, automatic, "auto");
 }
 
-void turn_left_car() {
+/* for the autopilot only - ignored unless automatic mode is on */
+void pilot_car(int8_t direction, int16_t speed, int16_t degree) {
+
+    uint64_t now;
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return;
+    }
+
+    if (!automatic_state()) return;
 
-    int16_t left = cmd_turn_left;
+    if (degree < STEERING_ANGLE_MIN) degree = STEERING_ANGLE_MIN;
+    if (degree > STEERING_ANGLE_MAX) degree = STEERING_ANGLE_MAX;
+
+    now = hal_time_us();
+
+    post_event(cmd_pilot, direction, "pilot");
+    mailbox_post_setpoint(&(driver_car->mailbox), setpoint_steering, degree, now);
+    mailbox_post_setpoint(&(driver_car->mailbox), setpoint_speed, act_speed_to_duty(speed), now);
+}
+
+esp_err_t turn_left_car() {
 
     ESP_LOGI(TAG, "Turn left start");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    if (xQueueSendToBack(driver_car->queue_driver, &left, (TickType_t)50) != pdPASS) {
-        ESP_LOGE(TAG, "Not put to queue driver cmd \"turn_left\", command failed. (%s:%u)", __FILE__, __LINE__);
-    }
-}
+    record_step_mission(mission_left, 0);
 
-void turn_right_car() {
+    return post_event(cmd_turn_left, 0, "turn_left");
+}
 
-    int16_t right = cmd_turn_right;
+esp_err_t turn_right_car() {
 
     ESP_LOGI(TAG, "Turn right start");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    if (xQueueSendToBack(driver_car->queue_driver, &right, (TickType_t)50) != pdPASS) {
-        ESP_LOGE(TAG, "Not put to queue driver cmd \"turn_right\", command failed. (%s:%u)", __FILE__, __LINE__);
-    }
-}
+    record_step_mission(mission_right, 0);
 
-void turn_stop_car() {
+    return post_event(cmd_turn_right, 0, "turn_right");
+}
 
-    int16_t stop = cmd_turn_stop;
+esp_err_t turn_stop_car() {
 
     ESP_LOGI(TAG, "Turn stop");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    if (xQueueSendToBack(driver_car->queue_driver, &stop, (TickType_t)50) != pdPASS) {
-        ESP_LOGE(TAG, "Not put to queue driver cmd \"turn_stop\", command failed. (%s:%u)", __FILE__, __LINE__);
-    }
+    record_step_mission(mission_turn_stop, 0);
+
+    return post_event(cmd_turn_stop, 0, "turn_stop");
 }
 
-void forward_start_car() {
+esp_err_t forward_start_car() {
 
     ESP_LOGI(TAG, "Forward start");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    forward_motors(driver_car->motors);
-}
+    record_step_mission(mission_forward_start, 0);
 
-void forward_stop_car() {
+    return post_event(cmd_forward, 0, "forward");
+}
 
-    int16_t stop = cmd_speedstop;
+esp_err_t forward_stop_car() {
 
     ESP_LOGI(TAG, "Forward stop");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    if (xQueueSendToBack(driver_car->queue_driver, &stop, (TickType_t)50) != pdPASS) {
-        ESP_LOGE(TAG, "Not put to queue driver cmd \"speed_stop\", command failed. (%s:%u)", __FILE__, __LINE__);
-    }
+    record_step_mission(mission_forward_stop, 0);
+
+    return post_event(cmd_speedstop, 0, "speed_stop");
 }
 
-void back_start_car() {
+esp_err_t back_start_car() {
 
     ESP_LOGI(TAG, "Back start");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    back_motors(driver_car->motors);
-}
+    record_step_mission(mission_back_start, 0);
 
-void back_stop_car() {
+    return post_event(cmd_back, 0, "back");
+}
 
-    int16_t stop = cmd_speedstop;
+esp_err_t back_stop_car() {
 
     ESP_LOGI(TAG, "Back stop");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    if (xQueueSendToBack(driver_car->queue_driver, &stop, (TickType_t)50) != pdPASS) {
-        ESP_LOGE(TAG, "Not put to queue driver cmd \"speed_stop\", command failed. (%s:%u)", __FILE__, __LINE__);
-    }
+    record_step_mission(mission_back_stop, 0);
+
+    return post_event(cmd_speedstop, 0, "speed_stop");
 }
 
-void stop_car() {
+esp_err_t stop_car() {
 
     ESP_LOGI(TAG, "Stop");
 
     if (driver_car == NULL) {
         ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
-        return;
+        return ESP_FAIL;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
-        return;
+        return ESP_OK;
     }
 
-    stop_motors(driver_car->motors);
+    record_step_mission(mission_stop, 0);
+
+    /* never dropped */
+    mailbox_post_latched(&(driver_car->mailbox), cmd_stop, 0, hal_time_us());
+    stamp_event_latency(cmd_stop, latency_queue);
+
+    return ESP_OK;
 }
 
 void set_speed_car(int16_t speed) {
@@ -991,38 +1890,210 @@ void set_speed_car(int16_t speed) {
         return;
     }
 
-    if (driver_car->motors->status & car_auto) {
+    if (automatic_state()) {
         ESP_LOGI(TAG, "Automatic mode is set!");
         return;
     }
 
-    if (driver_car->motors->status & car_stop ) return;
-
     if (speed < SPEED_MIN) speed = SPEED_MIN;
     if (speed > SPEED_MAX) speed = SPEED_MAX;
 
-    value_speed =  map(speed, SPEED_MIN, SPEED_MAX, VAL_SPEED_MIN, VAL_SPEED_MAX);
+    record_step_mission(mission_speed, speed);
 
-    ESP_LOGI(TAG, "Setting speed in %d", value_speed);
+    value_speed = act_speed_to_duty(speed);
 
-    if (driver_car->motors->turn == STEERING_STRAIGHT) {
-        set_speed_motors(value_speed);
-    } else {
-        if (driver_car->motors->turn < STEERING_STRAIGHT) {
-            set_speed_right_motor(value_speed);
-            value_speed -= SPEED_TURN_STEP*(STEERING_STRAIGHT - driver_car->motors->turn)/STEERING_STEP;
-            set_speed_left_motor(value_speed);
-        } else {
-            set_speed_left_motor(value_speed);
-            value_speed -= SPEED_TURN_STEP*(driver_car->motors->turn - STEERING_STRAIGHT)/STEERING_STEP;
-            set_speed_right_motor(value_speed);
-        }
+    mailbox_post_setpoint(&(driver_car->mailbox), setpoint_speed, value_speed, hal_time_us());
+    latency_stamp(latency_speed, latency_queue);
+}
+
+esp_err_t set_brake_car(brake_mode_t mode) {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if ((int)mode < brake_coast || mode > brake_reverse) {
+        ESP_LOGE(TAG, "Unknown brake mode %d. (%s:%d)", mode, __FILE__, __LINE__);
+        return ESP_ERR_INVALID_ARG;
     }
+
+    return post_event(cmd_brake, mode, "brake");
+}
+
+/* frequency of the speed PWM and the clock of its timer in Hz, 0 - keep */
+esp_err_t set_pwm_car(uint32_t frequency, uint32_t resolution) {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if (frequency) atomic_store(&(driver_car->pwm_frequency), frequency);
+    if (resolution) atomic_store(&(driver_car->pwm_resolution), resolution);
+
+    return post_event(cmd_pwm, 0, "pwm");
+}
+
+esp_err_t reset_pose_car() {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    return post_event(cmd_odom_reset, 0, "reset pose");
+}
+
+/* the split of the wheel speeds in a turn from the next speed or steering command on */
+void set_turn_ackermann_car(bool ackermann) {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return;
+    }
+
+    atomic_store(&(driver_car->turn_ackermann), ackermann);
+}
+
+/* the loop timing statistics start over with the next tick */
+void reset_loop_car() {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return;
+    }
+
+    atomic_store(&(driver_car->loop_reset), true);
+}
+
+/* sweeps both motors, the car on a stand or with room to drive straight for half a minute */
+void calibrate_car() {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return;
+    }
+
+    atomic_store(&(driver_car->cal_request), cal_request_start);
+}
+
+/* back to the nominal duty -> speed map, the stored curves are erased */
+void clear_calibration_car() {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return;
+    }
+
+    atomic_store(&(driver_car->cal_request), cal_request_clear);
+}
+
+/* the stored curves, duty in us -> rev/s per motor */
+esp_err_t get_calibration_car(cJSON *root) {
+
+    cal_table_t table;
+    int duty[CAL_POINTS];
+    cJSON *motor_root;
+
+    if (hal_store_get(CAL_STORE_KEY, &table, sizeof(cal_table_t)) != ESP_OK || !cal_table_valid(&table)) {
+        cJSON_AddFalseToObject(root, "calibrated");
+        return ESP_OK;
+    }
+
+    for (int i = 0; i < CAL_POINTS; i++) duty[i] = CAL_DUTY(i);
+
+    cJSON_AddTrueToObject(root, "calibrated");
+    cJSON_AddItemToObject(root, "duty", cJSON_CreateIntArray(duty, CAL_POINTS));
+
+    motor_root = cJSON_AddObjectToObject(root, "left");
+    if (motor_root == NULL) return ESP_FAIL;
+    cJSON_AddItemToObject(motor_root, "rps", cJSON_CreateFloatArray(table.left.rps, CAL_POINTS));
+    cJSON_AddNumberToObject(motor_root, "deadband", roundf(table.left.deadband_us));
+
+    motor_root = cJSON_AddObjectToObject(root, "right");
+    if (motor_root == NULL) return ESP_FAIL;
+    cJSON_AddItemToObject(motor_root, "rps", cJSON_CreateFloatArray(table.right.rps, CAL_POINTS));
+    cJSON_AddNumberToObject(motor_root, "deadband", roundf(table.right.deadband_us));
+
+    return ESP_OK;
+}
+
+esp_err_t get_pose_car(car_pose_t *pose) {
+
+    car_state_t state;
+
+    if (get_state_car(&state) != ESP_OK) return ESP_FAIL;
+
+    *pose = state.pose;
+
+    return ESP_OK;
+}
+
+/*
+ *  Called from the echo interrupt with every measured distance. Below the
+ *  threshold the direction pins of both motors go high in one register
+ *  write - a short brake at the current duty. The control loop is told by
+ *  an event and then stops the motors in the configured brake mode.
+ *  Neither the http server nor any task is in the path.
+ */
+void IRAM_ATTR guard_car_isr(int16_t distance, uint64_t echo_time) {
+
+    uint32_t threshold, latency;
+
+    if (driver_car == NULL) return;
+
+    threshold = atomic_load_explicit(&(driver_car->guard_threshold), memory_order_relaxed);
+
+    if (threshold == 0 || distance < 0 || (uint32_t)distance >= threshold) return;
+
+    hal_pin_set_mask(GUARD_PIN_MASK);
+
+    latency = hal_time_us() - echo_time;
+
+    /* once per approach, the control loop re-arms it */
+    atomic_store_explicit(&(driver_car->guard_threshold), 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(driver_car->guard_trips), 1, memory_order_relaxed);
+    driver_car->guard_latency_us = latency;
+    if (latency > driver_car->guard_latency_max_us) driver_car->guard_latency_max_us = latency;
+
+    mailbox_post_latched(&(driver_car->mailbox), cmd_guard, distance, echo_time);
+}
+
+esp_err_t get_state_car(car_state_t *state) {
+
+    if (driver_car == NULL) {
+        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    snapshot_read(&(driver_car->state), state);
+
+    return ESP_OK;
+}
+
+/* mean cycles of all encoder isrs of a wheel - the counter, the capture and the quadrature one */
+static uint32_t pulse_isr_cycles(const pulse_stats_t *stats) {
+
+    uint32_t runs = stats->turns.edges + stats->pulses.edges + stats->quadrature.edges;
+
+    if (runs == 0) return 0;
+
+    return ((uint64_t)stats->turns.isr_cycles_avg * stats->turns.edges +
+            (uint64_t)stats->pulses.isr_cycles_avg * stats->pulses.edges +
+            (uint64_t)stats->quadrature.isr_cycles_avg * stats->quadrature.edges) / runs;
+}
+
+static uint32_t pulse_isr_cycles_max(const pulse_stats_t *stats) {
+
+    return MAX(MAX(stats->turns.isr_cycles_max, stats->pulses.isr_cycles_max), stats->quadrature.isr_cycles_max);
 }
 
 esp_err_t get_status_car(cJSON **root) {
 
     int16_t left_speed, right_speed, speed;
+    car_state_t state;
+    pulse_stats_t pulse_left, pulse_right;
 
     const char *forward_key = "forward";
     const char *back_key =    "back";
@@ -1032,6 +2103,53 @@ esp_err_t get_status_car(cJSON **root) {
     const char *speed_key =   "speed";
     const char *speed_l_key = "speed_left";     /* only for control */
     const char *speed_r_key = "speed_right";    /* only for control */
+    const char *version_key = "version";
+    const char *jitter_key =  "loop_jitter_max";
+    const char *jitter_avg_key = "loop_jitter_avg";
+    const char *jitter_late_key = "loop_jitter_late";
+    const char *samples_key = "loop_samples";
+    const char *overrun_key = "loop_overruns";
+    const char *missed_key =  "loop_missed";
+    const char *steer_key =   "steering_latency";
+    const char *steer_max_key = "steering_latency_max";
+    const char *cmd_lat_key = "cmd_latency";
+    const char *cmd_lat_max_key = "cmd_latency_max";
+    const char *coalesced_key = "cmd_coalesced";
+    const char *dropped_key = "cmd_dropped";
+    const char *brake_key =   "brake_mode";
+    const char *pwm_key =     "pwm_frequency";
+    const char *pwm_res_key = "pwm_resolution";
+    const char *guard_key =   "guard_threshold";
+    const char *trips_key =   "guard_trips";
+    const char *guard_lat_key = "guard_latency";
+    const char *guard_lat_max_key = "guard_latency_max";
+    const char *stall_l_key = "stall_left";
+    const char *stall_r_key = "stall_right";
+    const char *stalled_key = "stalled";
+    const char *calibrating_key = "calibrating";
+    const char *calibrated_key = "calibrated";
+    const char *wheel_l_key = "wheel_rps_left";
+    const char *wheel_r_key = "wheel_rps_right";
+    const char *ticks_l_key = "ticks_left";
+    const char *ticks_r_key = "ticks_right";
+    const char *capture_key = "pulse_capture";
+    const char *pulse_over_key = "pulse_overflows";
+    const char *glitches_key = "pulse_glitches";
+    const char *pulse_isr_key = "pulse_isr_cycles";
+    const char *pulse_isr_max_key = "pulse_isr_cycles_max";
+    const char *pulse_wake_key = "pulse_wakeups";
+    const char *pose_x_key =  "pose_x";
+    const char *pose_y_key =  "pose_y";
+    const char *heading_key = "pose_heading";
+    const char *sd_x_key =    "pose_sd_x";
+    const char *sd_y_key =    "pose_sd_y";
+    const char *sd_heading_key = "pose_sd_heading";
+    const char *pose_distance_key = "pose_distance";
+    const char *mm_s_l_key = "wheel_mm_s_left";
+    const char *mm_s_r_key = "wheel_mm_s_right";
+    const char *distance_l_key = "distance_left";
+    const char *distance_r_key = "distance_right";
+    const char *odometer_total_key = "odometer";
 
 
     char *err = NULL;
@@ -1046,31 +2164,31 @@ esp_err_t get_status_car(cJSON **root) {
         return ESP_FAIL;
     }
 
-    if (driver_car == NULL) {
-        ESP_LOGE(TAG, "No driver device created. (%s:%d)", __FILE__, __LINE__);
+    if (get_state_car(&state) != ESP_OK) {
         return ESP_FAIL;
     } else {
-        left_speed =  map(driver_car->motors->motor_left.new_value_speed, VAL_SPEED_MIN, VAL_SPEED_MAX, SPEED_MIN, SPEED_MAX);
-        right_speed =  map(driver_car->motors->motor_right.new_value_speed, VAL_SPEED_MIN, VAL_SPEED_MAX, SPEED_MIN, SPEED_MAX);
+        left_speed = act_duty_to_speed(state.new_speed_left);
+        right_speed = act_duty_to_speed(state.new_speed_right);
 
         if (left_speed > right_speed) speed = left_speed;
         else speed = right_speed;
 
-        if (driver_car->motors->status & car_forward) {
+        if (state.automatic) {
+            cJSON_AddFalseToObject(status_root, forward_key);
+            cJSON_AddFalseToObject(status_root, back_key);
+            cJSON_AddFalseToObject(status_root, stop_key);
+            cJSON_AddTrueToObject(status_root, auto_key);
+            if (!(state.forward || state.back)) speed = left_speed = right_speed = 0;
+        } else if (state.forward) {
             cJSON_AddTrueToObject(status_root, forward_key);
             cJSON_AddFalseToObject(status_root, back_key);
             cJSON_AddFalseToObject(status_root, stop_key);
             cJSON_AddFalseToObject(status_root, auto_key);
-        } else if (driver_car->motors->status & car_back) {
+        } else if (state.back) {
             cJSON_AddFalseToObject(status_root, forward_key);
             cJSON_AddTrueToObject(status_root, back_key);
             cJSON_AddFalseToObject(status_root, stop_key);
             cJSON_AddFalseToObject(status_root, auto_key);
-        } else if (driver_car->motors->status & car_auto) {
-            cJSON_AddFalseToObject(status_root, forward_key);
-            cJSON_AddFalseToObject(status_root, back_key);
-            cJSON_AddFalseToObject(status_root, stop_key);
-            cJSON_AddTrueToObject(status_root, auto_key);
         } else {
             cJSON_AddFalseToObject(status_root, forward_key);
             cJSON_AddFalseToObject(status_root, back_key);
@@ -1083,7 +2201,66 @@ esp_err_t get_status_car(cJSON **root) {
         cJSON_AddNumberToObject(status_root, speed_key, speed);
         cJSON_AddNumberToObject(status_root, speed_l_key, left_speed);
         cJSON_AddNumberToObject(status_root, speed_r_key, right_speed);
-        cJSON_AddNumberToObject(status_root, turn_key, driver_car->motors->turn);
+        cJSON_AddNumberToObject(status_root, turn_key, state.turn);
+        cJSON_AddNumberToObject(status_root, version_key, state.version);
+        cJSON_AddNumberToObject(status_root, jitter_key, state.loop_jitter_max_us);
+        cJSON_AddNumberToObject(status_root, jitter_avg_key, state.loop_jitter_avg_us);
+        cJSON_AddNumberToObject(status_root, jitter_late_key, state.loop_jitter_late);
+        cJSON_AddNumberToObject(status_root, samples_key, state.loop_samples);
+        cJSON_AddNumberToObject(status_root, overrun_key, state.loop_overruns);
+        cJSON_AddNumberToObject(status_root, missed_key, state.loop_missed);
+        cJSON_AddNumberToObject(status_root, steer_key, state.steering_latency_us);
+        cJSON_AddNumberToObject(status_root, steer_max_key, state.steering_latency_max_us);
+        cJSON_AddNumberToObject(status_root, cmd_lat_key, state.cmd_latency_us);
+        cJSON_AddNumberToObject(status_root, cmd_lat_max_key, state.cmd_latency_max_us);
+        cJSON_AddNumberToObject(status_root, coalesced_key, state.cmd_coalesced);
+        cJSON_AddNumberToObject(status_root, dropped_key, state.cmd_dropped);
+        cJSON_AddNumberToObject(status_root, brake_key, state.brake_mode);
+        cJSON_AddNumberToObject(status_root, pwm_key, state.pwm_frequency);
+        cJSON_AddNumberToObject(status_root, pwm_res_key, state.pwm_resolution);
+        cJSON_AddNumberToObject(status_root, guard_key, state.guard_threshold_cm);
+        cJSON_AddNumberToObject(status_root, trips_key, state.guard_trips);
+        cJSON_AddNumberToObject(status_root, guard_lat_key, state.guard_latency_us);
+        cJSON_AddNumberToObject(status_root, guard_lat_max_key, state.guard_latency_max_us);
+        cJSON_AddNumberToObject(status_root, stall_l_key, state.stall_left);
+        cJSON_AddNumberToObject(status_root, stall_r_key, state.stall_right);
+        cJSON_AddBoolToObject(status_root, stalled_key, state.stalled);
+        cJSON_AddBoolToObject(status_root, calibrating_key, state.calibrating);
+        cJSON_AddBoolToObject(status_root, calibrated_key, state.calibrated);
+
+        cJSON_AddNumberToObject(status_root, wheel_l_key, roundf(state.wheel_rps_left * 100) / 100);
+        cJSON_AddNumberToObject(status_root, wheel_r_key, roundf(state.wheel_rps_right * 100) / 100);
+        cJSON_AddNumberToObject(status_root, ticks_l_key, state.ticks_left);
+        cJSON_AddNumberToObject(status_root, ticks_r_key, state.ticks_right);
+
+        get_pulse_stats(&pulse_left, &pulse_right);
+        cJSON_AddBoolToObject(status_root, capture_key, get_pulse_capture());
+        cJSON_AddNumberToObject(status_root, pulse_over_key,
+                                pulse_left.turns.overflows + pulse_right.turns.overflows +
+                                pulse_left.pulses.overflows + pulse_right.pulses.overflows);
+        cJSON_AddNumberToObject(status_root, glitches_key, pulse_left.glitches + pulse_right.glitches);
+        /* the busier of the two wheels */
+        cJSON_AddNumberToObject(status_root, pulse_isr_key,
+                                MAX(pulse_isr_cycles(&pulse_left), pulse_isr_cycles(&pulse_right)));
+        cJSON_AddNumberToObject(status_root, pulse_isr_max_key,
+                                MAX(pulse_isr_cycles_max(&pulse_left), pulse_isr_cycles_max(&pulse_right)));
+        cJSON_AddNumberToObject(status_root, pulse_wake_key, pulse_left.wakeups);
+
+        /* mm and degrees */
+        cJSON_AddNumberToObject(status_root, pose_x_key, roundf(state.pose.x));
+        cJSON_AddNumberToObject(status_root, pose_y_key, roundf(state.pose.y));
+        cJSON_AddNumberToObject(status_root, heading_key, roundf(state.pose.heading * 180 / M_PI));
+        cJSON_AddNumberToObject(status_root, sd_x_key, roundf(sqrtf(state.pose.var_x)));
+        cJSON_AddNumberToObject(status_root, sd_y_key, roundf(sqrtf(state.pose.var_y)));
+        cJSON_AddNumberToObject(status_root, sd_heading_key, roundf(sqrtf(state.pose.var_heading) * 180 / M_PI));
+        cJSON_AddNumberToObject(status_root, pose_distance_key, roundf(state.pose.distance));
+
+        /* mm and mm/s, the odometer over the life of the car */
+        cJSON_AddNumberToObject(status_root, mm_s_l_key, roundf(state.wheel_mm_s_left));
+        cJSON_AddNumberToObject(status_root, mm_s_r_key, roundf(state.wheel_mm_s_right));
+        cJSON_AddNumberToObject(status_root, distance_l_key, roundf(state.distance_left));
+        cJSON_AddNumberToObject(status_root, distance_r_key, roundf(state.distance_right));
+        cJSON_AddNumberToObject(status_root, odometer_total_key, round(state.odometer));
 
 //        char *str = str = cJSON_Print(status_root);
 //
@@ -0,0 +1,78 @@
+#include <string.h>
+#include "esp_attr.h"
+
+#include "edge_ring.h"
+
+void edge_ring_init(edge_ring_t *ring) {
+
+    memset(ring, 0, sizeof(edge_ring_t));
+
+    atomic_init(&(ring->head), 0);
+    atomic_init(&(ring->tail), 0);
+    atomic_init(&(ring->edges), 0);
+    atomic_init(&(ring->overflows), 0);
+    atomic_init(&(ring->isr_cycles), 0);
+    atomic_init(&(ring->isr_cycles_max), 0);
+}
+
+/* producer only - the slot first, then head releases it to the consumer */
+bool IRAM_ATTR edge_ring_push(edge_ring_t *ring, uint64_t time) {
+
+    uint32_t head, tail;
+
+    head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+    tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+
+    atomic_store_explicit(&(ring->edges), atomic_load_explicit(&(ring->edges), memory_order_relaxed) + 1,
+                          memory_order_release);
+
+    if (head - tail >= EDGE_RING_SIZE) {
+        atomic_store_explicit(&(ring->overflows), atomic_load_explicit(&(ring->overflows), memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return false;
+    }
+
+    ring->time[head & (EDGE_RING_SIZE-1)] = time;
+
+    atomic_store_explicit(&(ring->head), head + 1, memory_order_release);
+
+    return true;
+}
+
+/* producer only */
+void IRAM_ATTR edge_ring_isr_time(edge_ring_t *ring, uint32_t cycles) {
+
+    atomic_store_explicit(&(ring->isr_cycles), atomic_load_explicit(&(ring->isr_cycles), memory_order_relaxed) + cycles,
+                          memory_order_relaxed);
+
+    if (cycles > atomic_load_explicit(&(ring->isr_cycles_max), memory_order_relaxed)) {
+        atomic_store_explicit(&(ring->isr_cycles_max), cycles, memory_order_relaxed);
+    }
+}
+
+/* consumer only - the slot first, then tail gives it back to the producer */
+bool edge_ring_pop(edge_ring_t *ring, uint64_t *time) {
+
+    uint32_t head, tail;
+
+    tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+    head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+
+    if (tail == head) return false;
+
+    *time = ring->time[tail & (EDGE_RING_SIZE-1)];
+
+    atomic_store_explicit(&(ring->tail), tail + 1, memory_order_release);
+
+    return true;
+}
+
+/* any task, every counter on its own */
+void edge_ring_get_stats(edge_ring_t *ring, edge_ring_stats_t *stats) {
+
+    stats->edges = atomic_load_explicit(&(ring->edges), memory_order_relaxed);
+    stats->overflows = atomic_load_explicit(&(ring->overflows), memory_order_relaxed);
+    stats->isr_cycles_avg = stats->edges ?
+            atomic_load_explicit(&(ring->isr_cycles), memory_order_relaxed) / stats->edges : 0;
+    stats->isr_cycles_max = atomic_load_explicit(&(ring->isr_cycles_max), memory_order_relaxed);
+}
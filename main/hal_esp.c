@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_idf_version.h"
+#include "driver/gpio.h"
+#include "driver/mcpwm.h"
+#include "driver/pcnt.h"
+#include "soc/mcpwm_periph.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+#include "xtensa/hal.h"
+#include "freertos/FreeRTOS.h"
+#include "nvs.h"
+
+#include "hal.h"
+
+static const char *TAG = "robot_car_hal";
+
+/*--------------------------------------Clock---------------------------------------------------*/
+
+uint64_t IRAM_ATTR hal_time_us() {
+    return esp_timer_get_time();
+}
+
+void hal_delay_us(uint32_t us) {
+    ets_delay_us(us);
+}
+
+uint32_t IRAM_ATTR hal_cycles() {
+    return xthal_get_ccount();
+}
+
+/*--------------------------------------Pins----------------------------------------------------*/
+
+esp_err_t hal_pin_output(int pin) {
+    return gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+}
+
+esp_err_t hal_pin_input(int pin) {
+    return gpio_set_direction(pin, GPIO_MODE_INPUT);
+}
+
+void hal_pin_reset(int pin) {
+    gpio_reset_pin(pin);
+}
+
+void IRAM_ATTR hal_pin_set(int pin, uint32_t level) {
+    gpio_set_level(pin, level);
+}
+
+int IRAM_ATTR hal_pin_get(int pin) {
+    return gpio_get_level(pin);
+}
+
+/* one register write, safe in an isr */
+void IRAM_ATTR hal_pin_set_mask(uint32_t mask) {
+    REG_WRITE(GPIO_OUT_W1TS_REG, mask);
+}
+
+/* both edges */
+esp_err_t hal_pin_isr_add(int pin, hal_isr_t handler, void *arg) {
+
+    esp_err_t ret;
+
+    gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "GPIO isr service not installed. (%s:%u)", __FILE__, __LINE__);
+        return ret;
+    }
+
+    return gpio_isr_handler_add(pin, handler, arg);
+}
+
+void hal_pin_isr_remove(int pin) {
+    gpio_isr_handler_remove(pin);
+}
+
+/*--------------------------------------PWM-----------------------------------------------------*/
+
+esp_err_t hal_pwm_init(const hal_pwm_t *pwm, uint32_t frequency) {
+
+    esp_err_t ret;
+    mcpwm_config_t pwm_config;
+
+    memset(&pwm_config, 0, sizeof(mcpwm_config_t));
+    pwm_config.frequency = frequency;
+    pwm_config.cmpr_a = 0;
+    pwm_config.cmpr_b = 0;
+    pwm_config.counter_mode = MCPWM_UP_COUNTER;
+    pwm_config.duty_mode = MCPWM_DUTY_MODE_0;
+
+    /* MCPWM0A, MCPWM0B, MCPWM1A ... */
+    ret = mcpwm_gpio_init(pwm->unit, MCPWM0A + pwm->timer * 2 + pwm->gen, pwm->gpio_num);
+    if (ret != ESP_OK) return ret;
+
+    return mcpwm_init(pwm->unit, pwm->timer, &pwm_config);
+}
+
+esp_err_t hal_pwm_set_us(const hal_pwm_t *pwm, uint32_t us) {
+    return mcpwm_set_duty_in_us(pwm->unit, pwm->timer, pwm->gen, us);
+}
+
+esp_err_t hal_pwm_set_duty(const hal_pwm_t *pwm, float duty) {
+    return mcpwm_set_duty(pwm->unit, pwm->timer, pwm->gen, duty);
+}
+
+esp_err_t hal_pwm_set_frequency(const hal_pwm_t *pwm, uint32_t frequency) {
+    return mcpwm_set_frequency(pwm->unit, pwm->timer, frequency);
+}
+
+/* ESP_ERR_NOT_SUPPORTED - the timer clock is fixed before IDF 4.4 */
+esp_err_t hal_pwm_set_resolution(const hal_pwm_t *pwm, uint32_t resolution) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+    return mcpwm_timer_set_resolution(pwm->unit, pwm->timer, resolution);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/* the output follows the duty again */
+void hal_pwm_on(const hal_pwm_t *pwm) {
+    mcpwm_set_duty_type(pwm->unit, pwm->timer, pwm->gen, MCPWM_DUTY_MODE_0);
+}
+
+void hal_pwm_low(const hal_pwm_t *pwm) {
+    mcpwm_set_signal_low(pwm->unit, pwm->timer, pwm->gen);
+}
+
+void hal_pwm_stop(const hal_pwm_t *pwm) {
+    mcpwm_stop(pwm->unit, pwm->timer);
+}
+
+/*--------------------------------------Pulse counters------------------------------------------*/
+
+esp_err_t hal_counter_init(uint8_t unit, int pin, int16_t limit, uint16_t filter) {
+
+    esp_err_t ret;
+    pcnt_config_t pcnt_config;
+
+    memset(&pcnt_config, 0, sizeof(pcnt_config_t));
+    pcnt_config.pulse_gpio_num = pin;
+    pcnt_config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    pcnt_config.channel = PCNT_CHANNEL_0;
+    pcnt_config.unit = unit;
+    // What to do on the positive / negative edge of pulse input?
+    pcnt_config.pos_mode = PCNT_COUNT_INC;          // Count up on the positive edge
+    pcnt_config.neg_mode = PCNT_COUNT_DIS;          // Keep the counter value on the negative edge
+    pcnt_config.lctrl_mode = PCNT_MODE_REVERSE;     // Reverse counting direction if low
+    pcnt_config.hctrl_mode = PCNT_MODE_KEEP;        // Keep the primary counter mode if high
+    pcnt_config.counter_l_lim = -limit;
+
+    ret = pcnt_unit_config(&pcnt_config);
+    if (ret != ESP_OK) return ret;
+
+    /* Configure and enable the input filter */
+    pcnt_set_filter_value(unit, filter);
+    pcnt_filter_enable(unit);
+
+    pcnt_event_enable(unit, PCNT_EVT_L_LIM);
+
+    /* Initialize PCNT's counter */
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+
+    return ESP_OK;
+}
+
+/* both channels of the unit, the one of A counts its edges and the one of B the others */
+esp_err_t hal_counter_init_quadrature(uint8_t unit, int pin_a, int pin_b, int16_t limit, uint16_t filter) {
+
+    esp_err_t ret;
+    pcnt_config_t pcnt_config;
+
+    memset(&pcnt_config, 0, sizeof(pcnt_config_t));
+    pcnt_config.pulse_gpio_num = pin_a;
+    pcnt_config.ctrl_gpio_num = pin_b;
+    pcnt_config.channel = PCNT_CHANNEL_0;
+    pcnt_config.unit = unit;
+    pcnt_config.pos_mode = PCNT_COUNT_DEC;          // A rises while B is high - backwards
+    pcnt_config.neg_mode = PCNT_COUNT_INC;
+    pcnt_config.lctrl_mode = PCNT_MODE_REVERSE;     // B low - the other way
+    pcnt_config.hctrl_mode = PCNT_MODE_KEEP;
+    pcnt_config.counter_h_lim = limit;
+    pcnt_config.counter_l_lim = -limit;
+
+    ret = pcnt_unit_config(&pcnt_config);
+    if (ret != ESP_OK) return ret;
+
+    pcnt_config.pulse_gpio_num = pin_b;
+    pcnt_config.ctrl_gpio_num = pin_a;
+    pcnt_config.channel = PCNT_CHANNEL_1;
+    pcnt_config.pos_mode = PCNT_COUNT_INC;          // B rises while A is high - forwards
+    pcnt_config.neg_mode = PCNT_COUNT_DEC;
+
+    ret = pcnt_unit_config(&pcnt_config);
+    if (ret != ESP_OK) return ret;
+
+    pcnt_set_filter_value(unit, filter);
+    pcnt_filter_enable(unit);
+
+    pcnt_event_enable(unit, PCNT_EVT_H_LIM);
+    pcnt_event_enable(unit, PCNT_EVT_L_LIM);
+
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+
+    return ESP_OK;
+}
+
+int8_t IRAM_ATTR hal_counter_direction(uint8_t unit) {
+
+    uint32_t status = 0;
+
+    pcnt_get_event_status(unit, &status);
+
+    return (status & PCNT_EVT_H_LIM) ? 1 : -1;
+}
+
+esp_err_t hal_counter_isr_install() {
+    return pcnt_isr_service_install(ESP_INTR_FLAG_LEVEL3);
+}
+
+void hal_counter_isr_uninstall() {
+    pcnt_isr_service_uninstall();
+}
+
+esp_err_t hal_counter_isr_add(uint8_t unit, hal_isr_t handler, void *arg) {
+    return pcnt_isr_handler_add(unit, handler, arg);
+}
+
+void hal_counter_isr_remove(uint8_t unit) {
+    pcnt_isr_handler_remove(unit);
+}
+
+void hal_counter_start(uint8_t unit) {
+    pcnt_counter_resume(unit);
+}
+
+void hal_counter_clear(uint8_t unit) {
+    pcnt_counter_clear(unit);
+}
+
+int16_t hal_counter_get(uint8_t unit) {
+
+    int16_t count = 0;
+
+    pcnt_get_counter_value(unit, &count);
+
+    return count;
+}
+
+/*--------------------------------------Captures------------------------------------------------*/
+
+#define CAPTURE_CHANNELS    3
+
+static struct {
+    hal_capture_isr_t   handler;
+    void               *arg;
+    int                 pin;
+} captures[CAPTURE_CHANNELS];
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+
+static bool IRAM_ATTR capture_isr(mcpwm_unit_t unit, mcpwm_capture_channel_id_t channel,
+                                  const cap_event_data_t *edata, void *arg) {
+
+    return captures[channel].handler(edata->cap_value, captures[channel].arg);
+}
+
+#else
+
+/* no capture callback before IDF 4.4 - the rising edge timed in a GPIO isr, to the us */
+static void IRAM_ATTR capture_isr(void *arg) {
+
+    uint8_t channel = (uintptr_t)arg;
+    uint32_t ticks = esp_timer_get_time() * (HAL_CAPTURE_HZ / 1000000);
+
+    if (captures[channel].handler(ticks, captures[channel].arg)) portYIELD_FROM_ISR();
+}
+
+#endif
+
+esp_err_t hal_capture_init(uint8_t channel, int pin, hal_capture_isr_t handler, void *arg) {
+
+    esp_err_t ret;
+
+    if (channel >= CAPTURE_CHANNELS || handler == NULL) return ESP_ERR_INVALID_ARG;
+
+    captures[channel].handler = handler;
+    captures[channel].arg = arg;
+    captures[channel].pin = pin;
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+    mcpwm_capture_config_t cap_config;
+
+    ret = mcpwm_gpio_init(CAPTURE_UNIT, MCPWM_CAP_0 + channel, pin);
+    if (ret != ESP_OK) return ret;
+
+    memset(&cap_config, 0, sizeof(mcpwm_capture_config_t));
+    cap_config.cap_edge = MCPWM_POS_EDGE;
+    cap_config.cap_prescale = 1;
+    cap_config.capture_cb = capture_isr;
+    cap_config.user_data = NULL;
+
+    return mcpwm_capture_enable_channel(CAPTURE_UNIT, channel, &cap_config);
+#else
+    gpio_set_intr_type(pin, GPIO_INTR_POSEDGE);
+
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "GPIO isr service not installed. (%s:%u)", __FILE__, __LINE__);
+        return ret;
+    }
+
+    return gpio_isr_handler_add(pin, capture_isr, (void*)(uintptr_t)channel);
+#endif
+}
+
+void hal_capture_deinit(uint8_t channel) {
+
+    if (channel >= CAPTURE_CHANNELS || captures[channel].handler == NULL) return;
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+    mcpwm_capture_disable_channel(CAPTURE_UNIT, channel);
+#else
+    gpio_isr_handler_remove(captures[channel].pin);
+    gpio_set_intr_type(captures[channel].pin, GPIO_INTR_DISABLE);
+#endif
+    captures[channel].handler = NULL;
+}
+
+/*--------------------------------------Timers--------------------------------------------------*/
+
+esp_err_t hal_timer_create(hal_timer_t *timer, hal_isr_t callback, void *arg, const char *name) {
+
+    const esp_timer_create_args_t timer_args = {
+            .callback = callback,
+            .arg = arg,
+            .name = name
+    };
+
+    return esp_timer_create(&timer_args, (esp_timer_handle_t*)timer);
+}
+
+esp_err_t hal_timer_start_periodic(hal_timer_t timer, uint64_t period_us) {
+    return esp_timer_start_periodic(timer, period_us);
+}
+
+esp_err_t hal_timer_start_once(hal_timer_t timer, uint64_t timeout_us) {
+    return esp_timer_start_once(timer, timeout_us);
+}
+
+esp_err_t hal_timer_stop(hal_timer_t timer) {
+    return esp_timer_stop(timer);
+}
+
+esp_err_t hal_timer_delete(hal_timer_t timer) {
+    return esp_timer_delete(timer);
+}
+
+/*--------------------------------------Store---------------------------------------------------*/
+
+#define STORE_NAMESPACE     "robot_car"
+
+esp_err_t hal_store_get(const char *key, void *data, size_t size) {
+
+    nvs_handle_t handle;
+    size_t length = size;
+    esp_err_t ret;
+
+    ret = nvs_open(STORE_NAMESPACE, NVS_READONLY, &handle);
+    if (ret != ESP_OK) return ret == ESP_ERR_NVS_NOT_FOUND ? ESP_ERR_NOT_FOUND : ret;
+
+    ret = nvs_get_blob(handle, key, data, &length);
+    nvs_close(handle);
+
+    if (ret == ESP_ERR_NVS_NOT_FOUND || ret == ESP_ERR_NVS_INVALID_LENGTH || length != size) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ret;
+}
+
+esp_err_t hal_store_set(const char *key, const void *data, size_t size) {
+
+    nvs_handle_t handle;
+    esp_err_t ret;
+
+    ret = nvs_open(STORE_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret != ESP_OK) return ret;
+
+    ret = nvs_set_blob(handle, key, data, size);
+    if (ret == ESP_OK) ret = nvs_commit(handle);
+    nvs_close(handle);
+
+    return ret;
+}
+
+esp_err_t hal_store_erase(const char *key) {
+
+    nvs_handle_t handle;
+    esp_err_t ret;
+
+    ret = nvs_open(STORE_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret != ESP_OK) return ret;
+
+    ret = nvs_erase_key(handle, key);
+    if (ret == ESP_OK || ret == ESP_ERR_NVS_NOT_FOUND) ret = nvs_commit(handle);
+    nvs_close(handle);
+
+    return ret;
+}
@@ -18,8 +18,13 @@
 #include "soc/mcpwm_periph.h"
 
 #include "http.h"
+#include "hal.h"
 #include "utils.h"
 #include "driver.h"
+#include "autopilot.h"
+#include "mission.h"
+#include "latency.h"
+#include "tasks.h"
 
 /* Buffer for OTA and another load or read from spiffs */
 #define OTA_BUF_LEN	 1024
@@ -36,6 +41,8 @@
 #define UPLOAD      "/upload/*"
 #define CAR         "/car"
 #define GET_STATUS  "/car_status"
+#define GET_LATENCY "/car_latency"
+#define GET_CALIBRATION "/car_calibration"
 
 static char *TAG = "robot_car_http";
 
@@ -45,6 +52,8 @@ static esp_err_t webserver_response(httpd_req_t *req);
 static esp_err_t webserver_upload(httpd_req_t *req);
 static esp_err_t webserver_car(httpd_req_t *req);
 static esp_err_t webserver_get_car_status(httpd_req_t *req);
+static esp_err_t webserver_get_car_latency(httpd_req_t *req);
+static esp_err_t webserver_get_car_calibration(httpd_req_t *req);
 
 static const httpd_uri_t uri_html = {
         .uri = URL,
@@ -66,6 +75,37 @@ static const httpd_uri_t car_status = {
         .method = HTTP_GET,
         .handler = webserver_get_car_status };
 
+static const httpd_uri_t car_latency = {
+        .uri = GET_LATENCY,
+        .method = HTTP_GET,
+        .handler = webserver_get_car_latency };
+
+static const httpd_uri_t car_calibration = {
+        .uri = GET_CALIBRATION,
+        .method = HTTP_GET,
+        .handler = webserver_get_car_calibration };
+
+/* command type of the latency traces, the mission commands do not reach the driver */
+static const struct {
+    const char     *command;
+    latency_cmd_t   cmd;
+} latency_commands[] = {
+        { "forward_start",  latency_forward },
+        { "forward_stop",   latency_forward },
+        { "back_start",     latency_back },
+        { "back_stop",      latency_back },
+        { "stop",           latency_stop },
+        { "left_start",     latency_turn },
+        { "right_start",    latency_turn },
+        { "speed",          latency_speed },
+        { "left_stop",      latency_other },
+        { "right_stop",     latency_other },
+        { "reset_pose",     latency_other },
+        { "brake",          latency_other },
+        { "pwm",            latency_other },
+        { "auto",           latency_other },
+};
+
 
 static char* http_content_type(char *path) {
     char *ext = strrchr(path, '.');
@@ -80,8 +120,19 @@ static char* http_content_type(char *path) {
 }
 
 
+static latency_cmd_t http_latency_cmd(const char *command) {
+
+    for (size_t i = 0; i < sizeof(latency_commands)/sizeof(latency_commands[0]); i++) {
+        if (strcmp(latency_commands[i].command, command) == 0) return latency_commands[i].cmd;
+    }
+
+    return latency_none;
+}
+
 static esp_err_t webserver_car(httpd_req_t *req) {
-    char content[64] = {0};
+    uint32_t received = hal_time_us();
+    uint32_t parsed;
+    char content[96] = {0};
     const char *left_start =    "left_start";
     const char *left_stop =     "left_stop";
     const char *right_start =   "right_start";
@@ -94,6 +145,17 @@ static esp_err_t webserver_car(httpd_req_t *req) {
     const char *speed =         "speed";
     const char *value =         "value";
     const char *automatic =     "auto";
+    const char *reset_pose =    "reset_pose";
+    const char *reset_loop =    "reset_loop";
+    const char *calibrate =     "calibrate";
+    const char *calibration_clear = "calibration_clear";
+    const char *brake =         "brake";
+    const char *pwm =           "pwm";
+    const char *resolution =    "resolution";
+    const char *mission_record ="mission_record";
+    const char *mission_play =  "mission_play";
+    const char *mission_stop =  "mission_stop";
+    const char *name =          "name";
     const char *key =           "execute";
     char *err = NULL;
 
@@ -131,6 +193,8 @@ static esp_err_t webserver_car(httpd_req_t *req) {
         return ESP_FAIL;
     }
 
+    parsed = hal_time_us();
+
     cJSON *command_key = cJSON_GetObjectItem(root, key);
 
     if (command_key == NULL) {
@@ -151,24 +215,89 @@ static esp_err_t webserver_car(httpd_req_t *req) {
         return ESP_FAIL;
     }
 
+    latency_begin(http_latency_cmd(command), received, parsed);
+
+    esp_err_t car_ret = ESP_OK;
+
     if (strcmp(forward_start, command) == 0) {
-        forward_start_car();
+        car_ret = forward_start_car();
     } else if (strcmp(forward_stop, command) == 0) {
-        forward_stop_car();
+        car_ret = forward_stop_car();
     } else if (strcmp(left_start, command) == 0) {
-        turn_left_car();
+        car_ret = turn_left_car();
     } else if (strcmp(left_stop, command) == 0) {
-        turn_stop_car();
+        car_ret = turn_stop_car();
     } else if (strcmp(stop, command) == 0) {
-        stop_car();
+        car_ret = stop_car();
     } else if (strcmp(right_start, command) == 0) {
-        turn_right_car();
+        car_ret = turn_right_car();
     } else if (strcmp(right_stop, command) == 0) {
-        turn_stop_car();
+        car_ret = turn_stop_car();
     } else if (strcmp(back_start, command) == 0) {
-        back_start_car();
+        car_ret = back_start_car();
     } else if (strcmp(back_stop, command) == 0) {
-        back_stop_car();
+        car_ret = back_stop_car();
+    } else if (strcmp(reset_pose, command) == 0) {
+        car_ret = reset_pose_car();
+    } else if (strcmp(reset_loop, command) == 0) {
+        reset_loop_car();
+    } else if (strcmp(calibrate, command) == 0) {
+        calibrate_car();
+    } else if (strcmp(calibration_clear, command) == 0) {
+        clear_calibration_car();
+    } else if (strcmp(brake, command) == 0) {
+        command_key = cJSON_GetObjectItem(root, value);
+        if (command_key == NULL || isnan(cJSON_GetNumberValue(command_key))) {
+            cJSON_Delete(root);
+            err = "Value brake not found";
+            ESP_LOGE(TAG, "%s. (%s:%u)", err, __FILE__, __LINE__);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+            return ESP_FAIL;
+        }
+        car_ret = set_brake_car(cJSON_GetNumberValue(command_key));
+    } else if (strcmp(pwm, command) == 0) {
+        command_key = cJSON_GetObjectItem(root, value);
+        if (command_key == NULL || isnan(cJSON_GetNumberValue(command_key))) {
+            cJSON_Delete(root);
+            err = "Value pwm not found";
+            ESP_LOGE(TAG, "%s. (%s:%u)", err, __FILE__, __LINE__);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+            return ESP_FAIL;
+        }
+        double pwm_val = cJSON_GetNumberValue(command_key);
+        /* resolution is optional */
+        command_key = cJSON_GetObjectItem(root, resolution);
+        double res_val = command_key ? cJSON_GetNumberValue(command_key) : 0;
+        if (isnan(res_val)) res_val = 0;
+        if (!(pwm_val >= MOTOR_PWM_FREQUENCY_MIN && pwm_val <= MOTOR_PWM_FREQUENCY_MAX)
+                || (res_val && !(res_val >= MOTOR_PWM_RESOLUTION_MIN && res_val <= MOTOR_PWM_RESOLUTION_MAX))) {
+            cJSON_Delete(root);
+            err = "Value pwm out of range";
+            ESP_LOGE(TAG, "%s. (%s:%u)", err, __FILE__, __LINE__);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+            return ESP_FAIL;
+        }
+        car_ret = set_pwm_car(pwm_val, res_val);
+    } else if (strcmp(mission_record, command) == 0 || strcmp(mission_play, command) == 0) {
+        command_key = cJSON_GetObjectItem(root, name);
+        char *name_val = cJSON_GetStringValue(command_key);
+        if (name_val == NULL) {
+            cJSON_Delete(root);
+            err = "Mission name not found";
+            ESP_LOGE(TAG, "%s. (%s:%u)", err, __FILE__, __LINE__);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+            return ESP_FAIL;
+        }
+        esp_err_t mission_ret = strcmp(mission_record, command) == 0 ? record_mission(name_val) : play_mission(name_val);
+        if (mission_ret != ESP_OK) {
+            cJSON_Delete(root);
+            err = "Mission can not be started";
+            ESP_LOGE(TAG, "%s. (%s:%u)", err, __FILE__, __LINE__);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+            return ESP_FAIL;
+        }
+    } else if (strcmp(mission_stop, command) == 0) {
+        stop_mission();
     } else if (strcmp(automatic, command) == 0) {
         command_key = cJSON_GetObjectItem(root, value);
         if (command_key == NULL) {
@@ -179,7 +308,7 @@ static esp_err_t webserver_car(httpd_req_t *req) {
             return ESP_FAIL;
         }
         bool auto_val = cJSON_IsTrue(command_key);
-        automatic_car(auto_val);
+        car_ret = automatic_car(auto_val);
     } else if (strcmp(speed, command) == 0) {
         command_key = cJSON_GetObjectItem(root, value);
         if (command_key == NULL) {
@@ -206,6 +335,16 @@ static esp_err_t webserver_car(httpd_req_t *req) {
         return ESP_FAIL;
     }
 
+    /* the mailbox of the driver was full, the command is lost - the client may send it again */
+    if (car_ret == ESP_ERR_NO_MEM) {
+        cJSON_Delete(root);
+        err = "Driver busy";
+        ESP_LOGE(TAG, "%s. (%s:%u)", err, __FILE__, __LINE__);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, err, strlen(err));
+        return ESP_FAIL;
+    }
+
     sprintf(content, "{\"command\": \"%s\"}", command);
 
     cJSON_Delete(root);
@@ -232,6 +371,8 @@ static esp_err_t webserver_get_car_status(httpd_req_t *req) {
             return ESP_FAIL;
         }
     } else {
+        get_status_autopilot(root);
+        get_status_mission(root);
         str = cJSON_Print(root);
         if (str) {
             httpd_resp_set_type(req, "application/json");
@@ -247,6 +388,68 @@ static esp_err_t webserver_get_car_status(httpd_req_t *req) {
     return ESP_FAIL;
 }
 
+static esp_err_t webserver_get_car_latency(httpd_req_t *req) {
+
+    char *str;
+    cJSON *root = cJSON_CreateObject();
+
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No JSON object");
+        return ESP_FAIL;
+    }
+
+    if (get_status_latency(root) != ESP_OK) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No latency histograms");
+        return ESP_FAIL;
+    }
+
+    str = cJSON_Print(root);
+    cJSON_Delete(root);
+
+    if (str == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Extraction error from the JSON object");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, str, strlen(str));
+    free(str);
+
+    return ESP_OK;
+}
+
+static esp_err_t webserver_get_car_calibration(httpd_req_t *req) {
+
+    char *str;
+    cJSON *root = cJSON_CreateObject();
+
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No JSON object");
+        return ESP_FAIL;
+    }
+
+    if (get_calibration_car(root) != ESP_OK) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No calibration");
+        return ESP_FAIL;
+    }
+
+    str = cJSON_Print(root);
+    cJSON_Delete(root);
+
+    if (str == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Extraction error from the JSON object");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, str, strlen(str));
+    free(str);
+
+    return ESP_OK;
+}
+
 static esp_err_t webserver_read_file(httpd_req_t *req) {
 
     char buff[OTA_BUF_LEN];
@@ -685,7 +888,9 @@ static httpd_handle_t webserver_start(void) {
     esp_err_t ret = ESP_FAIL;
 
     httpd_config_t http_config = HTTPD_DEFAULT_CONFIG();
-    http_config.stack_size = 8096;
+    http_config.stack_size = get_task_config(task_httpd)->stack;
+    http_config.task_priority = get_task_config(task_httpd)->priority;
+    http_config.core_id = get_task_core(task_httpd);
     http_config.uri_match_fn = httpd_uri_match_wildcard;
 //    http_config.max_uri_handlers = 16;
 
@@ -702,6 +907,10 @@ static httpd_handle_t webserver_start(void) {
     if (ret != ESP_OK) ESP_LOGE(TAG, "URL \"%s\" not registered. (%s:%u)", car.uri, __FILE__, __LINE__);
     ret = httpd_register_uri_handler(server, &car_status);
     if (ret != ESP_OK) ESP_LOGE(TAG, "URL \"%s\" not registered. (%s:%u)", car_status.uri, __FILE__, __LINE__);
+    ret = httpd_register_uri_handler(server, &car_latency);
+    if (ret != ESP_OK) ESP_LOGE(TAG, "URL \"%s\" not registered. (%s:%u)", car_latency.uri, __FILE__, __LINE__);
+    ret = httpd_register_uri_handler(server, &car_calibration);
+    if (ret != ESP_OK) ESP_LOGE(TAG, "URL \"%s\" not registered. (%s:%u)", car_calibration.uri, __FILE__, __LINE__);
     ret = httpd_register_uri_handler(server, &upload_html);
     if (ret != ESP_OK) ESP_LOGE(TAG, "URL \"%s\" not registered. (%s:%u)", upload_html.uri, __FILE__, __LINE__);
     ret = httpd_register_uri_handler(server, &uri_html);
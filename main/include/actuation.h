@@ -0,0 +1,95 @@
+#ifndef MAIN_INCLUDE_ACTUATION_H_
+#define MAIN_INCLUDE_ACTUATION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  Integer actuation layer.
+ *
+ *  Servo angle -> pulse width and speed 1-255 -> motor duty are lookup
+ *  tables generated by the preprocessor from the constants of config.h,
+ *  with the division rounded instead of truncated. Nothing is computed at
+ *  run time - the conversions are a clamp and a load.
+ *
+ *  Duty -> speed (only for the status) uses a Q16 reciprocal, a multiply
+ *  and a shift instead of a division.
+ */
+#define ACT_TABLE_SIZE      256
+
+/* x * num / den rounded to nearest, for compile-time constants */
+#define ACT_SCALE(x, num, den)  ((2 * (x) * (num) + (den)) / (2 * (den)))
+
+#define ACT_ANGLE_US(a)     (SERVO_MIN_US + ACT_SCALE(((a) > ANGLE_MAX ? ANGLE_MAX : (a)), \
+                                                      SERVO_MAX_US - SERVO_MIN_US, ANGLE_MAX))
+
+#define ACT_SPEED_DUTY(s)   (VAL_SPEED_MIN + ACT_SCALE(((s) < SPEED_MIN ? 0 : (s) - SPEED_MIN), \
+                                                       VAL_SPEED_MAX - VAL_SPEED_MIN, SPEED_MAX - SPEED_MIN))
+
+#define ACT_DUTY_SPEED_Q16  ((((SPEED_MAX - SPEED_MIN) << 16) + (VAL_SPEED_MAX - VAL_SPEED_MIN) / 2) \
+                             / (VAL_SPEED_MAX - VAL_SPEED_MIN))
+
+/* f(i), f(i+1) ... f(i+n-1) */
+#define ACT_T1(f, i)        f(i)
+#define ACT_T2(f, i)        ACT_T1(f, i), ACT_T1(f, (i) + 1)
+#define ACT_T4(f, i)        ACT_T2(f, i), ACT_T2(f, (i) + 2)
+#define ACT_T8(f, i)        ACT_T4(f, i), ACT_T4(f, (i) + 4)
+#define ACT_T16(f, i)       ACT_T8(f, i), ACT_T8(f, (i) + 8)
+#define ACT_T32(f, i)       ACT_T16(f, i), ACT_T16(f, (i) + 16)
+#define ACT_T64(f, i)       ACT_T32(f, i), ACT_T32(f, (i) + 32)
+#define ACT_T128(f, i)      ACT_T64(f, i), ACT_T64(f, (i) + 64)
+#define ACT_T256(f, i)      ACT_T128(f, i), ACT_T128(f, (i) + 128)
+
+extern const uint16_t act_angle_us[ACT_TABLE_SIZE];
+extern const uint16_t act_speed_duty[ACT_TABLE_SIZE];
+
+/* servo angle in degrees (0 - ANGLE_MAX) to pulse width in us */
+static inline uint16_t act_angle_to_us(int16_t angle) {
+
+    if (angle < 0) angle = 0;
+    if (angle > ANGLE_MAX) angle = ANGLE_MAX;
+
+    return act_angle_us[angle];
+}
+
+/* speed (SPEED_MIN - SPEED_MAX) to motor duty in us */
+static inline uint16_t act_speed_to_duty(int16_t speed) {
+
+    if (speed < SPEED_MIN) speed = SPEED_MIN;
+    if (speed > SPEED_MAX) speed = SPEED_MAX;
+
+    return act_speed_duty[speed];
+}
+
+/* motor duty in us to speed, below VAL_SPEED_MIN down to 0 */
+static inline int16_t act_duty_to_speed(int16_t duty) {
+
+    int32_t speed;
+
+    if (duty >= VAL_SPEED_MIN) {
+        speed = SPEED_MIN + (((int32_t)(duty - VAL_SPEED_MIN) * ACT_DUTY_SPEED_Q16 + 0x8000) >> 16);
+    } else {
+        speed = SPEED_MIN - (((int32_t)(VAL_SPEED_MIN - duty) * ACT_DUTY_SPEED_Q16 + 0x8000) >> 16);
+    }
+
+    if (speed < 0) speed = 0;
+    if (speed > SPEED_MAX) speed = SPEED_MAX;
+
+    return speed;
+}
+
+/* clock ticks per conversion, the old arithmetic against the tables */
+typedef struct {
+    float   angle_legacy;
+    float   angle_table;
+    float   speed_legacy;
+    float   speed_table;
+    float   duty_legacy;
+    float   duty_fixed;
+} act_benchmark_t;
+
+void act_benchmark(act_benchmark_t *bench, uint32_t (*clock)(void), uint32_t rounds);
+
+#endif /* MAIN_INCLUDE_ACTUATION_H_ */
@@ -0,0 +1,10 @@
+#ifndef MAIN_INCLUDE_AUTOPILOT_H_
+#define MAIN_INCLUDE_AUTOPILOT_H_
+
+#include "config.h"
+
+esp_err_t init_autopilot();
+void deinit_autopilot();
+esp_err_t get_status_autopilot(cJSON *root);
+
+#endif /* MAIN_INCLUDE_AUTOPILOT_H_ */
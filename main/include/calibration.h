@@ -0,0 +1,71 @@
+#ifndef MAIN_INCLUDE_CALIBRATION_H_
+#define MAIN_INCLUDE_CALIBRATION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  Duty -> wheel speed curves of the motors.
+ *
+ *  A sweep drives both motors through CAL_POINTS duties from 0 to
+ *  VAL_SPEED_MAX. It waits CAL_SETTLE_MS at every duty, then for
+ *  CAL_MEASURE_MS takes the speed of each wheel from its first to its last
+ *  new pulse count. Every motor gets its own curve, made monotonic. The
+ *  deadband edge is where the first segment that turns, extended down,
+ *  meets 0.
+ *
+ *  cal_duty() inverts a curve. It gives the duty for a wheel speed, so it
+ *  is the feed-forward of the speed controller.
+ *
+ *  Hardware independent - the caller passes the pulse counts and the time,
+ *  so it runs the same on the car and on a host.
+ */
+
+#define CAL_POINTS          17
+#define CAL_DUTY(i)         ((int32_t)(i) * VAL_SPEED_MAX / (CAL_POINTS - 1))
+#define CAL_MAGIC           0x43414c31      /* "CAL1", the layout of cal_table_t */
+#define CAL_STORE_KEY       "calibration"
+
+typedef struct {
+    float       rps[CAL_POINTS];    /* wheel speed at CAL_DUTY(i)   */
+    float       deadband_us;        /* below it the wheel stands    */
+} cal_curve_t;
+
+/* the stored record */
+typedef struct {
+    uint32_t    magic;
+    cal_curve_t left;
+    cal_curve_t right;
+} cal_table_t;
+
+/* speed of one wheel from its pulse counts */
+typedef struct {
+    uint32_t    pulses;             /* at the last update           */
+    bool        started;
+    uint32_t    first;              /* at the first change          */
+    uint64_t    first_us;
+    uint32_t    last;               /* at the last change           */
+    uint64_t    last_us;
+} cal_meter_t;
+
+typedef struct {
+    bool        running;
+    bool        measuring;          /* false - settling             */
+    uint8_t     point;
+    uint64_t    phase_us;           /* start of settling or measuring */
+    cal_meter_t meter_left;
+    cal_meter_t meter_right;
+    cal_table_t table;
+} cal_sweep_t;
+
+void cal_sweep_start(cal_sweep_t *sweep, uint64_t now_us);
+/* the duty for both motors, -1 when the sweep is over */
+int32_t cal_sweep_step(cal_sweep_t *sweep, uint64_t now_us, uint32_t pulses_left, uint32_t pulses_right);
+/* both curves turn the wheels up to WHEEL_RPS_MIN at least */
+bool cal_table_valid(const cal_table_t *table);
+/* duty in us that turns the wheel at rps, VAL_SPEED_MAX if it is too fast */
+int16_t cal_duty(const cal_curve_t *curve, float rps);
+
+#endif /* MAIN_INCLUDE_CALIBRATION_H_ */
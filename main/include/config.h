@@ -3,7 +3,9 @@
 
 #define LOW  0
 #define HIGH 1
-#define MOUNT_POINT_SPIFFS  "/spiffs"
+#ifndef MOUNT_POINT_SPIFFS
+#define MOUNT_POINT_SPIFFS  "/spiffs"          /* a directory in the host build */
+#endif
 #define DELIM               "/"
 #define DELIM_CHR           '/'
 
@@ -21,15 +23,33 @@
 /*--------------------------Pulse counter Zone----------------------------------*/
 #define INPUT_LEFT          4                   // Pulse Input GPIO left motor
 #define INPUT_RIGHT         5                   // Pulse Input GPIO right motor
-#define UNIT_LEFT           PCNT_UNIT_0         // Unit left
-#define UNIT_RIGHT          PCNT_UNIT_1         // Unit right
-#define CHANNEL             PCNT_CHANNEL_0      // Channel left and right
+#define UNIT_LEFT           0                   // PCNT unit left
+#define UNIT_RIGHT          1                   // PCNT unit right
 #define PULSE_PER_TURN      11                  // number of pulses per rotation
+#define ENCODER_GEAR_RATIO  1.0f                // encoder turns per wheel turn, the gear ratio for an encoder on the motor shaft
+#define PULSE_PER_WHEEL     (PULSE_PER_TURN*ENCODER_GEAR_RATIO) // pulses per wheel turn
 #define COUNT_TIMEOUT       1000                // timeout without pulse in ms
+#define PULSE_CAPTURE       true                // speed from the time of every pulse, false - of every turn
+#define CAPTURE_LEFT        0                   // MCPWM capture channel left
+#define CAPTURE_RIGHT       1                   // MCPWM capture channel right
+#define CAPTURE_UNIT        1                   // MCPWM unit of the captures, 0 drives the motors and the servo
+#define CAPTURE_GLITCH_US   500                 // shorter periods between pulses are noise
+#define CAPTURE_WINDOW      PULSE_PER_TURN      // pulses in the speed, one turn evens out the magnets
+#ifndef ENCODER_QUADRATURE
+#define ENCODER_QUADRATURE  false               // two channel encoders, A leads B while the wheel turns forward
+#endif
+#define INPUT_LEFT_B        25                  // channel B of the left encoder
+#define INPUT_RIGHT_B       26                  // channel B of the right encoder
+#define UNIT_QUAD_LEFT      2                   // PCNT unit of the left quadrature
+#define UNIT_QUAD_RIGHT     3                   // PCNT unit of the right quadrature
+#define ENCODER_TICKS       (4*PULSE_PER_TURN)  // quadrature ticks per turn, every edge of A and B
 
 /*--------------------------Ultrasonic HC-SR04 zone-----------------------------*/
-#define TRIG_GPIO           GPIO_NUM_13
-#define ECHO_GPIO           GPIO_NUM_12
+#define TRIG_GPIO           13
+#define ECHO_GPIO           12
+#define GUARD_DIST_MIN      10              /* distance always kept to an obstacle in cm */
+#define GUARD_REACTION_MS   60              /* age of an echo - one period of the sensor */
+#define GUARD_DECEL         1500            /* braking deceleration of the car in mm/s^2 */
 
 /*--------------------------Driver (motors and servo steering) Zone-------------*/
 #define ANGLE_MIN           0
@@ -40,23 +60,88 @@
 #define SERVO_MIN_US        504
 #define SERVO_MAX_US        2360
 #define STEERING_DELAY      5               /* turning speed steering servo         */
+#define SERVO_HOLD_MS       30              /* PWM kept on after the target is reached */
 #define STEERING_STEP       5
+#define STEERING_RATIO      1.0             /* degrees of the front wheels per degree of the servo */
 #define STEERING_CENTER     0               /* correction for straight of steering in degrees . Example -5 or 10 */
-#define SERVO_PWM_GPIO      GPIO_NUM_21     /* channel steering                     */
+#define SERVO_PWM_GPIO      21              /* channel steering                     */
 
-#define LEFT_MOTOR_GPIO_1   GPIO_NUM_16     /* First power GPIO of left motor       */
-#define LEFT_MOTOR_GPIO_2   GPIO_NUM_17     /* Second power GPIO of left motor      */
-#define RIGHT_MOTOR_GPIO_1  GPIO_NUM_18     /* First power GPIO of right motor      */
-#define RIGHT_MOTOR_GPIO_2  GPIO_NUM_19     /* Second power GPIO of right motor     */
-#define LEFT_SPD_PWM_GPIO   GPIO_NUM_22     /* GPIO for left motor speed variation  */
-#define RIGHT_SPD_PWM_GPIO  GPIO_NUM_23     /* GPIO for right motor speed variation */
+#define LEFT_MOTOR_GPIO_1   16              /* First power GPIO of left motor       */
+#define LEFT_MOTOR_GPIO_2   17              /* Second power GPIO of left motor      */
+#define RIGHT_MOTOR_GPIO_1  18              /* First power GPIO of right motor      */
+#define RIGHT_MOTOR_GPIO_2  19              /* Second power GPIO of right motor     */
+#define LEFT_SPD_PWM_GPIO   22              /* GPIO for left motor speed variation  */
+#define RIGHT_SPD_PWM_GPIO  23              /* GPIO for right motor speed variation */
 
 #define SPEED_MIN           1               /* speed 1-255 map to 700-5000 */
 #define SPEED_MAX           255
 #define VAL_SPEED_MIN       700
 #define VAL_SPEED_MAX       5000
-#define SPEED_TURN_STEP     70
-#define SPEEDUP_STEP        100
+#define SPEED_TURN_STEP     70              /* inner wheel duty cut per STEERING_STEP of the old turn split */
+#define MOTOR_PWM_FREQUENCY 200             /* Hz of the speed PWM at start            */
+#define MOTOR_PWM_FREQUENCY_MIN 50
+#define MOTOR_PWM_FREQUENCY_MAX 40000
+#define MOTOR_PWM_RESOLUTION 1000000        /* Hz of the PWM timer clock, IDF 4.4 and later */
+#define MOTOR_PWM_RESOLUTION_MIN 40000      /* the timer divides the 10 MHz MCPWM clock by 1-256 */
+#define MOTOR_PWM_RESOLUTION_MAX 10000000
+#define BRAKE_MODE          brake_short     /* brake_coast, brake_short or brake_reverse   */
+#define BRAKE_REVERSE_MS    150             /* reverse pulse from full speed           */
+#define SPEED_ACCEL_MAX     2000            /* max change of the speed duty in us/s            */
+#define SPEED_JERK_MAX      10000           /* max change of SPEED_ACCEL in us/s^2, 0 - linear */
+#define CONTROL_RATE_HZ     200             /* rate of the driver control loop         */
+#define ACT_BENCHMARK_ROUNDS 0             /* conversions per actuation benchmark at start, 0 - off */
+
+#define WHEEL_BASE          145             /* distance between the front and rear axles in mm */
+#define TRACK_WIDTH         130             /* distance between the rear wheels in mm          */
+#define WHEEL_DIAMETER      65              /* diameter of the rear wheels in mm               */
+#define WHEEL_CIRCUMFERENCE (3.14159265f * WHEEL_DIAMETER) /* mm rolled per wheel turn, the measured one is better */
+#define WHEEL_RPS_MIN       0.5             /* wheel speed at VAL_SPEED_MIN in rev/s (feed-forward map) */
+#define WHEEL_RPS_MAX       3.5             /* wheel speed at VAL_SPEED_MAX in rev/s (feed-forward map) */
+#define SPEED_PID_PERIOD_MS 50              /* period of the wheel speed controller */
+#define SPEED_PID_KP        400.0           /* us of duty per rev/s of error        */
+#define SPEED_PID_KI        1200.0
+#define SPEED_PID_KD        0.0
+#define STALL_PULSES        4               /* expected pulse intervals without a pulse - a stall */
+#define STALL_TIMEOUT_MIN_MS 100            /* a stall is never found faster        */
+#define STALL_SPINUP_MS     300             /* more for the first pulse from rest   */
+#define CAL_SETTLE_MS       500             /* calibration - wait at every duty     */
+#define CAL_MEASURE_MS      1000            /* then measure the wheel speed         */
+#define VELOCITY_WINDOW_MS  200             /* wheel speed - pulses counted over that time  */
+#define VELOCITY_COUNT_PULSES 4             /* from that many in the window the count alone */
+#define VELOCITY_STOP_MS    250             /* no pulse for that long - the wheel stands    */
+#define VELOCITY_FILTER     true            /* alpha-beta filter on the wheel speed         */
+#define VELOCITY_ALPHA      0.5
+#define VELOCITY_BETA       0.05
+
+/*--------------------------Mission Zone----------------------------------------*/
+#define MISSION_PREFIX      MOUNT_POINT_SPIFFS DELIM "mission_"
+#define MISSION_NAME_LEN    16              /* max length of a mission name         */
+#define MISSION_STEPS_MAX   1024            /* steps of one mission, 8 bytes each   */
+
+/*--------------------------Task Zone-------------------------------------------*/
+#define TASK_PINNING        true            /* false - all tasks float, the table in tasks.h   */
+#define CORE_PROTOCOL       0               /* Wi-Fi, lwIP, esp_timer and the webserver     */
+#define CORE_APP            1               /* control loop, encoders, ultrasonic, steering */
+#define CONTROL_JITTER_LATE 500             /* a control tick later than that in us is late */
+
+/*--------------------------Latency Zone----------------------------------------*/
+#define LATENCY_TIMEOUT_MS  2000            /* a web command not actuated by then is dropped from the stats */
+
+/*--------------------------Odometry Zone---------------------------------------*/
+#define ODOM_PERIOD_MS      20              /* period of the pose update            */
+#define ODOM_WHEEL_NOISE    0.5             /* variance of a wheel in mm^2 per mm   */
+#define ODOM_CURVATURE_NOISE 0.0005         /* deviation of the steering curvature in 1/mm */
+#define ODOMETER_STORE_MM   10000           /* odometer into NVS after that many mm, once the car stands */
+
+/*--------------------------Autopilot Zone--------------------------------------*/
+#define AUTO_DIST_SLOW      80              /* slow down closer than that in cm     */
+#define AUTO_DIST_TURN      45              /* turn away closer than that in cm     */
+#define AUTO_DIST_REVERSE   20              /* back up and turn closer than that    */
+#define AUTO_SPEED_CRUISE   160             /* speed 1-255 on a free way            */
+#define AUTO_SPEED_SLOW     60              /* speed 1-255 near obstacles           */
+#define AUTO_REVERSE_MS     700             /* time of backing up                   */
+#define AUTO_TURN_MAX_MS    3000            /* turning longer - back up             */
+#define AUTO_ECHO_TIMEOUT   200             /* no echo for that long in ms - stop   */
 
 
 #endif /* MAIN_INCLUDE_CONFIG_H_ */
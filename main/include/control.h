@@ -0,0 +1,40 @@
+#ifndef MAIN_INCLUDE_CONTROL_H_
+#define MAIN_INCLUDE_CONTROL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  Fixed-rate control loop scheduler.
+ *
+ *  Keeps the tick deadlines and the timing statistics of a periodic loop.
+ *  Does not depend on a time source - the caller passes the current time
+ *  in us, so the same code runs on the timer driven driver_task and can be
+ *  replayed on a host against a simulated clock.
+ */
+typedef struct {
+    uint32_t    rate_hz;
+    uint32_t    period_us;
+    uint64_t    deadline_us;        /* expected time of the next tick       */
+    uint64_t    tick_start_us;      /* start of the current tick            */
+    uint32_t    ticks;              /* ticks executed                       */
+    uint32_t    overruns;           /* ticks that ran longer than a period  */
+    uint32_t    missed;             /* periods skipped entirely             */
+    uint32_t    jitter_us;          /* jitter of the last tick              */
+    uint32_t    jitter_max_us;
+    uint64_t    jitter_sum_us;
+    uint32_t    jitter_late;        /* ticks with jitter over CONTROL_JITTER_LATE */
+    uint32_t    samples;            /* ticks since the statistics were reset */
+    uint32_t    exec_us;            /* execution time of the last tick      */
+    uint32_t    exec_max_us;
+} control_loop_t;
+
+void control_loop_init(control_loop_t *loop, uint32_t rate_hz, uint64_t now_us);
+uint32_t control_loop_tick(control_loop_t *loop, uint64_t now_us);
+void control_loop_done(control_loop_t *loop, uint64_t now_us);
+uint32_t control_loop_jitter_avg(const control_loop_t *loop);
+void control_loop_reset_stats(control_loop_t *loop);
+
+#endif /* MAIN_INCLUDE_CONTROL_H_ */
@@ -3,19 +3,109 @@
 
 #include "config.h"
 
+/*
+ *  How the motors are stopped
+ *
+ *      brake_coast   - the motors run free
+ *      brake_short   - the motor windings are shorted
+ *      brake_reverse - a short reverse pulse, then shorted
+ */
+typedef enum {
+    brake_coast = 0,
+    brake_short,
+    brake_reverse
+} brake_mode_t;
+
+/* pose of the odometry, x and y in mm, heading in rad counter clockwise */
+typedef struct {
+    float       x;
+    float       y;
+    float       heading;
+    float       var_x;
+    float       var_y;
+    float       var_heading;
+    float       distance;               /* path length in mm        */
+} car_pose_t;
+
+/*
+ *  State of the car published by the control loop once per tick.
+ *  Read with get_state_car() - always a coherent copy of one tick.
+ */
+typedef struct {
+    uint32_t    version;
+    bool        forward;
+    bool        back;
+    bool        stop;
+    bool        automatic;
+    int16_t     turn;
+    int16_t     steering_position;
+    int16_t     new_speed_left;         /* commanded duty in us     */
+    int16_t     new_speed_right;
+    int16_t     speed_left;             /* ramped duty in us        */
+    int16_t     speed_right;
+    int16_t     correction_left;        /* speed controller output  */
+    int16_t     correction_right;
+    uint32_t    loop_jitter_max_us;
+    uint32_t    loop_jitter_avg_us;
+    uint32_t    loop_jitter_late;       /* ticks later than CONTROL_JITTER_LATE */
+    uint32_t    loop_samples;           /* ticks since reset_loop_car() */
+    uint32_t    loop_overruns;
+    uint32_t    loop_missed;
+    uint32_t    steering_latency_us;
+    uint32_t    steering_latency_max_us;
+    uint32_t    cmd_latency_us;
+    uint32_t    cmd_latency_max_us;
+    uint32_t    cmd_coalesced;
+    uint32_t    cmd_dropped;
+    brake_mode_t brake_mode;
+    uint32_t    pwm_frequency;
+    uint32_t    pwm_resolution;
+    uint32_t    guard_threshold_cm;     /* brake closer than that   */
+    uint32_t    guard_trips;
+    uint32_t    guard_latency_us;       /* from the echo to the brake */
+    uint32_t    guard_latency_max_us;
+    uint32_t    stall_left;             /* stalls of the wheel          */
+    uint32_t    stall_right;
+    bool        stalled;                /* the last drive ended in a stall */
+    bool        calibrating;            /* a calibration sweep runs     */
+    bool        calibrated;             /* the motors use their own curves */
+    float       wheel_rps_left;         /* signed, < 0 turning back     */
+    float       wheel_rps_right;
+    int32_t     ticks_left;             /* signed quadrature ticks since start */
+    int32_t     ticks_right;
+    float       wheel_mm_s_left;        /* signed, WHEEL_CIRCUMFERENCE per turn */
+    float       wheel_mm_s_right;
+    float       distance_left;          /* mm rolled since start, either way */
+    float       distance_right;
+    double      odometer;               /* mm over the life of the car, kept in NVS */
+    car_pose_t  pose;
+} car_state_t;
+
 esp_err_t init_driver();
 void deinit_driver();
 
-void automatic_car(bool automatic);
-void turn_left_car();
-void turn_right_car();
-void turn_stop_car();
-void forward_start_car();
-void forward_stop_car();
-void back_start_car();
-void back_stop_car();
-void stop_car();
+esp_err_t automatic_car(bool automatic);
+void pilot_car(int8_t direction, int16_t speed, int16_t degree);
+esp_err_t turn_left_car();
+esp_err_t turn_right_car();
+esp_err_t turn_stop_car();
+esp_err_t forward_start_car();
+esp_err_t forward_stop_car();
+esp_err_t back_start_car();
+esp_err_t back_stop_car();
+esp_err_t stop_car();
 void set_speed_car(int16_t speed);
+esp_err_t set_brake_car(brake_mode_t mode);
+esp_err_t set_pwm_car(uint32_t frequency, uint32_t resolution);
+void set_turn_ackermann_car(bool ackermann);
+esp_err_t reset_pose_car();
+void reset_loop_car();
+void calibrate_car();
+void clear_calibration_car();
+esp_err_t get_calibration_car(cJSON *root);
+esp_err_t get_pose_car(car_pose_t *pose);
+esp_err_t get_state_car(car_state_t *state);
+void guard_car_isr(int16_t distance, uint64_t echo_time);
 esp_err_t get_status_car(cJSON **root);
 
 #endif /* MAIN_INCLUDE_DRIVER_H_ */
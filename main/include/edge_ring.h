@@ -0,0 +1,47 @@
+#ifndef MAIN_INCLUDE_EDGE_RING_H_
+#define MAIN_INCLUDE_EDGE_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define EDGE_RING_SIZE      16          /* must be a power of 2 */
+
+/*
+ *  Lock-free ring of edge times between one producer (the isr of an
+ *  encoder) and one consumer (its pulse task).
+ *
+ *  The producer writes the time into the slot at head and then publishes
+ *  it by moving head on. The consumer reads the slot at tail and then frees
+ *  it by moving tail on. A slot is only written while the consumer cannot
+ *  see it and only read while the producer cannot reuse it, so the 64 bit
+ *  times are never torn although only the 32 bit head and tail are atomic -
+ *  lock-free on the ESP32. When the ring is full the new edge is dropped
+ *  and counted as an overflow, the isr never waits.
+ *
+ *  The producer also adds up the cycles it spent per edge.
+ */
+typedef struct {
+    uint64_t            time[EDGE_RING_SIZE];
+    _Atomic uint32_t    head;               /* producer */
+    _Atomic uint32_t    tail;               /* consumer */
+    _Atomic uint32_t    edges;              /* all edges, the dropped ones too */
+    _Atomic uint32_t    overflows;
+    _Atomic uint32_t    isr_cycles;         /* sum, wraps */
+    _Atomic uint32_t    isr_cycles_max;
+} edge_ring_t;
+
+typedef struct {
+    uint32_t    edges;
+    uint32_t    overflows;
+    uint32_t    isr_cycles_avg;
+    uint32_t    isr_cycles_max;
+} edge_ring_stats_t;
+
+void edge_ring_init(edge_ring_t *ring);
+bool edge_ring_push(edge_ring_t *ring, uint64_t time);
+void edge_ring_isr_time(edge_ring_t *ring, uint32_t cycles);
+bool edge_ring_pop(edge_ring_t *ring, uint64_t *time);
+void edge_ring_get_stats(edge_ring_t *ring, edge_ring_stats_t *stats);
+
+#endif /* MAIN_INCLUDE_EDGE_RING_H_ */
@@ -0,0 +1,105 @@
+#ifndef MAIN_INCLUDE_HAL_H_
+#define MAIN_INCLUDE_HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_attr.h"
+
+#include "config.h"
+
+/*
+ *  Thin layer under the hardware calls of driver, pulse and usonic.
+ *
+ *  hal_esp.c maps it 1:1 to ESP-IDF (gpio, mcpwm, pcnt, esp_timer, nvs), the host
+ *  backend in host/ simulates the pins, PWMs, counters and captures on a virtual clock
+ *  so that the same code builds and runs on Linux.
+ *
+ *  Pins are GPIO numbers. Handlers run in interrupt context on the car.
+ */
+
+typedef void (*hal_isr_t)(void *arg);
+typedef bool (*hal_capture_isr_t)(uint32_t ticks, void *arg);
+typedef void *hal_timer_t;
+
+/* PWM channel - unit, timer and generator (0 - A, 1 - B) of the MCPWM */
+typedef struct {
+    int         gpio_num;
+    uint8_t     unit;
+    uint8_t     timer;
+    uint8_t     gen;
+} hal_pwm_t;
+
+/* clock */
+uint64_t hal_time_us();
+void hal_delay_us(uint32_t us);
+uint32_t hal_cycles();                  /* CPU cycles on the car, ns on the host */
+
+/* pins */
+esp_err_t hal_pin_output(int pin);
+esp_err_t hal_pin_input(int pin);
+void hal_pin_reset(int pin);
+void hal_pin_set(int pin, uint32_t level);
+int hal_pin_get(int pin);
+void hal_pin_set_mask(uint32_t mask);   /* GPIO0-31 high all at once */
+esp_err_t hal_pin_isr_add(int pin, hal_isr_t handler, void *arg);
+void hal_pin_isr_remove(int pin);
+
+/* PWM, duty in us of the period or in percent */
+esp_err_t hal_pwm_init(const hal_pwm_t *pwm, uint32_t frequency);
+esp_err_t hal_pwm_set_us(const hal_pwm_t *pwm, uint32_t us);
+esp_err_t hal_pwm_set_duty(const hal_pwm_t *pwm, float duty);
+esp_err_t hal_pwm_set_frequency(const hal_pwm_t *pwm, uint32_t frequency);
+esp_err_t hal_pwm_set_resolution(const hal_pwm_t *pwm, uint32_t resolution);
+void hal_pwm_on(const hal_pwm_t *pwm);
+void hal_pwm_low(const hal_pwm_t *pwm);
+void hal_pwm_stop(const hal_pwm_t *pwm);
+
+/*
+ *  Pulse counters count the rising edges of pin down from 0 to -limit, then
+ *  start over from 0 and call the handler.
+ */
+esp_err_t hal_counter_init(uint8_t unit, int pin, int16_t limit, uint16_t filter);
+/*
+ *  A quadrature counter decodes both channels 4x - every edge of A and B,
+ *  up while A leads B - from 0 to +-limit. hal_counter_direction() tells its
+ *  handler which limit it hit, +1 or -1.
+ */
+esp_err_t hal_counter_init_quadrature(uint8_t unit, int pin_a, int pin_b, int16_t limit, uint16_t filter);
+int8_t hal_counter_direction(uint8_t unit);
+esp_err_t hal_counter_isr_install();
+void hal_counter_isr_uninstall();
+esp_err_t hal_counter_isr_add(uint8_t unit, hal_isr_t handler, void *arg);
+void hal_counter_isr_remove(uint8_t unit);
+void hal_counter_start(uint8_t unit);
+void hal_counter_clear(uint8_t unit);
+int16_t hal_counter_get(uint8_t unit);
+
+/*
+ *  Capture channels latch a free running timer on every rising edge of pin
+ *  and call the handler with it - HAL_CAPTURE_HZ ticks, wrapping at 32 bit.
+ *  The time is taken by the hardware, the interrupt latency does not add to
+ *  it. Before IDF 4.4 a GPIO isr takes it instead, to the us and with the
+ *  latency. A handler returns true when it woke a task of a higher priority.
+ */
+#define HAL_CAPTURE_HZ      80000000    /* APB clock, 12.5 ns */
+
+esp_err_t hal_capture_init(uint8_t channel, int pin, hal_capture_isr_t handler, void *arg);
+void hal_capture_deinit(uint8_t channel);
+
+/* timers, the callbacks run in a task */
+esp_err_t hal_timer_create(hal_timer_t *timer, hal_isr_t callback, void *arg, const char *name);
+esp_err_t hal_timer_start_periodic(hal_timer_t timer, uint64_t period_us);
+esp_err_t hal_timer_start_once(hal_timer_t timer, uint64_t timeout_us);
+esp_err_t hal_timer_stop(hal_timer_t timer);
+esp_err_t hal_timer_delete(hal_timer_t timer);
+
+/*
+ *  Small records that survive a reset, by key (15 chars at most). A record
+ *  of another size than asked for is ESP_ERR_NOT_FOUND.
+ */
+esp_err_t hal_store_get(const char *key, void *data, size_t size);
+esp_err_t hal_store_set(const char *key, const void *data, size_t size);
+esp_err_t hal_store_erase(const char *key);
+
+#endif /* MAIN_INCLUDE_HAL_H_ */
@@ -0,0 +1,35 @@
+#ifndef MAIN_INCLUDE_KINEMATICS_H_
+#define MAIN_INCLUDE_KINEMATICS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+#define KINEMATICS_ANGLES   (STEERING_ANGLE_MAX - STEERING_ANGLE_MIN + 1)
+
+/*
+ *  Ackermann steering with a driven rear axle.
+ *
+ *  For a steering angle the rear axle turns around a point at
+ *  R = wheel_base / tan(delta), the inner rear wheel rolls on R - track/2
+ *  and the outer one on R + track/2. The table holds the speed ratio of the
+ *  inner to the outer wheel and the curvature 1/R for every servo degree
+ *  from STEERING_ANGLE_MIN to STEERING_ANGLE_MAX, so the control loop only
+ *  does a lookup.
+ *
+ *  Angles below STEERING_STRAIGHT turn left, above turn right.
+ *  Hardware independent - runs the same on the car and on a host.
+ */
+typedef struct {
+    float   wheel_base;                 /* mm                               */
+    float   track_width;                /* mm                               */
+    float   ratio[KINEMATICS_ANGLES];   /* inner / outer wheel speed, <= 1  */
+    float   curvature[KINEMATICS_ANGLES];   /* 1/mm, > 0 to the left        */
+} kinematics_t;
+
+void kinematics_init(kinematics_t *kinematics, float wheel_base, float track_width, float steering_ratio);
+void kinematics_wheel_ratio(const kinematics_t *kinematics, int16_t angle, float *left, float *right);
+float kinematics_curvature(const kinematics_t *kinematics, int16_t angle);
+
+#endif /* MAIN_INCLUDE_KINEMATICS_H_ */
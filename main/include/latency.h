@@ -0,0 +1,61 @@
+#ifndef MAIN_INCLUDE_LATENCY_H_
+#define MAIN_INCLUDE_LATENCY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  End-to-end latency of the web commands.
+ *
+ *  webserver_car() starts a trace per command type with the time the request
+ *  came in, every later stage is stamped once with its time since then:
+ *
+ *      parse    - JSON parsed
+ *      dispatch - the driver call made
+ *      queue    - the command in the mailbox of the control loop
+ *      pickup   - the control loop took it
+ *      pwm      - the first PWM write for it
+ *      servo    - the steering servo at its target
+ *
+ *  Motor commands end with the pwm stage, turns with the servo stage, the
+ *  others with the pickup. A newer command of the same type restarts the
+ *  trace, one not finished in LATENCY_TIMEOUT_MS is dropped and counted.
+ *
+ *  Stages go into fixed histograms - 8 exact buckets below 8 us, then 4 per
+ *  power of two. Nothing is allocated after init_latency(), a stamp is a
+ *  few atomics and an add. Each stage of a type is stamped by one task
+ *  only, so the histograms need no lock.
+ */
+
+#define LATENCY_BUCKETS     84          /* up to 4 s, longer ones land in the last */
+
+typedef enum {
+    latency_forward = 0,
+    latency_back,
+    latency_stop,
+    latency_turn,
+    latency_speed,
+    latency_other,
+    latency_cmds,
+    latency_none = latency_cmds         /* not traced */
+} latency_cmd_t;
+
+typedef enum {
+    latency_parse = 0,
+    latency_dispatch,
+    latency_queue,
+    latency_pickup,
+    latency_pwm,
+    latency_servo,
+    latency_stages
+} latency_stage_t;
+
+esp_err_t init_latency();
+void deinit_latency();
+void latency_begin(latency_cmd_t cmd, uint32_t received, uint32_t parsed);
+void latency_stamp(latency_cmd_t cmd, latency_stage_t stage);
+esp_err_t get_status_latency(cJSON *root);
+
+#endif /* MAIN_INCLUDE_LATENCY_H_ */
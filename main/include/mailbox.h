@@ -0,0 +1,72 @@
+#ifndef MAIN_INCLUDE_MAILBOX_H_
+#define MAIN_INCLUDE_MAILBOX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "config.h"
+
+#define MAILBOX_EVENTS      16          /* must be a power of 2 */
+#define MAILBOX_SETPOINTS   4
+
+/*
+ *  Lock-free command mailbox between any number of producers (http, auto
+ *  pilot ...) and one consumer (the control loop).
+ *
+ *  Discrete events (start, stop, direction change ...) go through a bounded
+ *  ring and are delivered in order. When the ring is full the new event is
+ *  dropped and counted, the producer never waits.
+ *
+ *  Events that must never be lost (stop ...) are single bits. They go
+ *  through the ring as well and are latched in a word when it is full -
+ *  any number of them are one bit. The consumer takes the latched ones
+ *  after the ring, everything in it was posted before.
+ *
+ *  Continuous setpoints (speed, steering) are single words - a new value
+ *  overwrites a pending one and the overwrite is counted as coalesced.
+ *
+ *  Only 32 bit atomics are used, they are lock-free on the ESP32.
+ *  Times are the low 32 bits of the us clock.
+ */
+typedef struct {
+    int16_t     event;
+    int16_t     value;
+    uint32_t    time;
+} mailbox_event_t;
+
+typedef struct {
+    struct {
+        _Atomic uint32_t    seq;
+        mailbox_event_t     event;
+    } slot[MAILBOX_EVENTS];
+    _Atomic uint32_t    head;                           /* producers */
+    uint32_t            tail;                           /* consumer  */
+
+    _Atomic uint32_t    latched;                        /* events that found the ring full */
+    _Atomic uint32_t    latched_time;
+
+    _Atomic uint32_t    setpoint[MAILBOX_SETPOINTS];    /* pending flag | value */
+    _Atomic uint32_t    setpoint_time[MAILBOX_SETPOINTS];
+
+    _Atomic uint32_t    coalesced;
+    _Atomic uint32_t    dropped;
+
+    /* enqueue to actuation latency, updated by the consumer */
+    uint32_t            latency_us;
+    uint32_t            latency_max_us;
+    uint64_t            latency_sum_us;
+    uint32_t            latency_count;
+} mailbox_t;
+
+void mailbox_init(mailbox_t *mailbox);
+bool mailbox_post_event(mailbox_t *mailbox, int16_t event, int16_t value, uint32_t time);
+bool mailbox_get_event(mailbox_t *mailbox, mailbox_event_t *event);
+void mailbox_post_latched(mailbox_t *mailbox, uint16_t event, int16_t value, uint32_t time);
+uint32_t mailbox_get_latched(mailbox_t *mailbox, uint32_t *time);
+void mailbox_post_setpoint(mailbox_t *mailbox, uint8_t index, int16_t value, uint32_t time);
+bool mailbox_get_setpoint(mailbox_t *mailbox, uint8_t index, int16_t *value, uint32_t *time);
+void mailbox_actuated(mailbox_t *mailbox, uint32_t time, uint32_t now);
+uint32_t mailbox_latency_avg(const mailbox_t *mailbox);
+
+#endif /* MAIN_INCLUDE_MAILBOX_H_ */
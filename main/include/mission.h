@@ -0,0 +1,28 @@
+#ifndef MAIN_INCLUDE_MISSION_H_
+#define MAIN_INCLUDE_MISSION_H_
+
+#include "config.h"
+
+/* driver commands of a mission, they map 1:1 to the public driver calls */
+typedef enum {
+    mission_none = 0,
+    mission_forward_start,
+    mission_forward_stop,
+    mission_back_start,
+    mission_back_stop,
+    mission_left,
+    mission_right,
+    mission_turn_stop,
+    mission_stop,
+    mission_speed
+} mission_cmd_t;
+
+esp_err_t init_mission();
+void deinit_mission();
+esp_err_t record_mission(const char *name);
+esp_err_t play_mission(const char *name);
+void stop_mission();
+void record_step_mission(mission_cmd_t cmd, int16_t value);
+esp_err_t get_status_mission(cJSON *root);
+
+#endif /* MAIN_INCLUDE_MISSION_H_ */
@@ -0,0 +1,38 @@
+#ifndef MAIN_INCLUDE_ODOMETRY_H_
+#define MAIN_INCLUDE_ODOMETRY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  Dead-reckoning odometry.
+ *
+ *  Integrates the distances of both rear wheels and the curvature of the
+ *  commanded steering angle into a pose (x, y in mm, heading in rad,
+ *  counter clockwise) with its 3x3 covariance.
+ *
+ *  The heading change is measured twice - by the difference of the wheels
+ *  and by the arc length times the steering curvature. Both are fused by
+ *  their variances: the wheel noise grows with the distance rolled
+ *  (ODOM_WHEEL_NOISE), the steering noise with the arc length
+ *  (ODOM_CURVATURE_NOISE).
+ *
+ *  Hardware independent - runs the same on the car and on a host.
+ */
+typedef struct {
+    float       x;
+    float       y;
+    float       heading;
+    float       cov[3][3];          /* x, y, heading                    */
+    float       distance;           /* total path length in mm          */
+    float       track_width;        /* mm                               */
+    uint32_t    updates;
+} odometry_t;
+
+void odometry_init(odometry_t *odometry, float track_width);
+void odometry_reset(odometry_t *odometry, float x, float y, float heading);
+void odometry_update(odometry_t *odometry, float left, float right, float curvature);
+
+#endif /* MAIN_INCLUDE_ODOMETRY_H_ */
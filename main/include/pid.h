@@ -0,0 +1,37 @@
+#ifndef MAIN_INCLUDE_PID_H_
+#define MAIN_INCLUDE_PID_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  PID controller with feed-forward and anti-windup.
+ *
+ *  The output is feed_forward + P + I + D, clamped to [out_min, out_max].
+ *  The integral only accumulates while the output is not saturated in the
+ *  direction of the error (conditional integration), so it never winds up
+ *  while a motor is at its duty limit. The derivative acts on the measurement
+ *  to avoid a kick when the setpoint changes.
+ *
+ *  Hardware independent - the caller passes dt, so it runs the same on the
+ *  car and on a host against a plant model.
+ */
+typedef struct {
+    float   kp;
+    float   ki;
+    float   kd;
+    float   out_min;
+    float   out_max;
+    float   integral;
+    float   prev_measured;
+    float   output;
+    bool    started;
+} pid_ctrl_t;
+
+void pid_init(pid_ctrl_t *pid, float kp, float ki, float kd, float out_min, float out_max);
+void pid_reset(pid_ctrl_t *pid);
+float pid_update(pid_ctrl_t *pid, float setpoint, float measured, float feed_forward, float dt);
+
+#endif /* MAIN_INCLUDE_PID_H_ */
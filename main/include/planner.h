@@ -0,0 +1,55 @@
+#ifndef MAIN_INCLUDE_PLANNER_H_
+#define MAIN_INCLUDE_PLANNER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  Reactive obstacle avoidance planner of the autopilot.
+ *
+ *  Takes one distance sample of the ultrasonic sensor at a time and maps
+ *  the median of the last three to a command:
+ *
+ *      plan_cruise  - free way, straight at AUTO_SPEED_CRUISE
+ *      plan_slow    - closer than AUTO_DIST_SLOW, straight at AUTO_SPEED_SLOW
+ *      plan_turn    - closer than AUTO_DIST_TURN, full lock to one side
+ *                     until the way is free again
+ *      plan_reverse - closer than AUTO_DIST_REVERSE or turning for too
+ *                     long, back up with the wheels to the other side for
+ *                     AUTO_REVERSE_MS and then turn
+ *      plan_stop    - no valid echo
+ *
+ *  Every reverse flips the side of the next turns, so the car does not get
+ *  stuck in a corner. Hardware independent - runs the same on the car and
+ *  on a host against a simulated room.
+ */
+typedef enum {
+    plan_stop = 0,
+    plan_cruise,
+    plan_slow,
+    plan_turn,
+    plan_reverse
+} plan_mode_t;
+
+typedef struct {
+    int8_t      direction;          /* 1 forward, -1 back, 0 stop       */
+    int16_t     speed;              /* SPEED_MIN - SPEED_MAX            */
+    int16_t     steering;           /* degrees of the steering servo    */
+} plan_cmd_t;
+
+typedef struct {
+    plan_mode_t mode;
+    uint64_t    mode_time;          /* us, when the mode was entered    */
+    int16_t     sample[3];
+    uint8_t     count;
+    int16_t     distance;           /* filtered distance in cm          */
+    int16_t     turn;               /* steering of the turns            */
+    plan_cmd_t  cmd;
+} planner_t;
+
+void planner_init(planner_t *planner);
+bool planner_step(planner_t *planner, int16_t distance, uint64_t now, plan_cmd_t *cmd);
+
+#endif /* MAIN_INCLUDE_PLANNER_H_ */
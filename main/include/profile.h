@@ -0,0 +1,33 @@
+#ifndef MAIN_INCLUDE_PROFILE_H_
+#define MAIN_INCLUDE_PROFILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  Motion profile generator for speed setpoints.
+ *
+ *  Moves value towards a target with the rate of change limited to accel_max
+ *  (units per second) and the change of that rate limited to jerk_max (units
+ *  per second^2). With jerk_max = 0 the profile is trapezoidal, otherwise it
+ *  is an S-curve. Everything is driven by dt, so a ramp takes the same time
+ *  whatever the caller's rate is.
+ *
+ *  Hardware independent - runs the same on the car and on a host.
+ */
+typedef struct {
+    float   accel_max;
+    float   jerk_max;
+    float   value;          /* current setpoint         */
+    float   accel;          /* current rate of change   */
+} profile_t;
+
+void profile_init(profile_t *profile, float accel_max, float jerk_max, float value);
+void profile_reset(profile_t *profile, float value);
+float profile_update(profile_t *profile, float target, float dt);
+float profile_stop_point(const profile_t *profile);
+float profile_duration(float distance, float accel_max, float jerk_max);
+
+#endif /* MAIN_INCLUDE_PROFILE_H_ */
@@ -2,9 +2,56 @@
 #define MAIN_INCLUDE_PULSE_H_
 
 #include "config.h"
+#include "edge_ring.h"
+
+/*
+ *  Wheel speed from the encoders.
+ *
+ *  A PCNT unit per wheel counts the pulses and interrupts once per turn. An
+ *  MCPWM capture channel on the same pin latches the time of every pulse in
+ *  hardware. The isrs of both wheels only queue the times and wake the one
+ *  pulse task. With PULSE_CAPTURE the speed is the mean period of the last
+ *  CAPTURE_WINDOW pulses and new with every pulse, else the time of the last
+ *  turn, taken in the isr and new once per turn.
+ *
+ *  get_speed_time() is us per encoder turn either way, 0 for a wheel without
+ *  a pulse in COUNT_TIMEOUT, get_wheel_speed_time() the same per wheel turn
+ *  through ENCODER_GEAR_RATIO. It has no sign and get_pulse_count() only grows.
+ *  get_pulse_edge() hands out the timed pulses themselves, for an estimate
+ *  of the speed of its own (velocity.h).
+ *
+ *  With ENCODER_QUADRATURE a second PCNT unit per wheel decodes both
+ *  channels of the encoder 4x into signed ticks, and the direction the
+ *  wheel turned last comes from them - also while it is pushed or still
+ *  rolls the old way after a reversal.
+ */
+
+/* the last timed pulse, 0 - none yet */
+typedef struct {
+    uint32_t            pulses;         /* timed since start, only grows    */
+    uint64_t            time_us;        /* of the last one                  */
+    uint32_t            period_us;      /* before it, 0 - not known         */
+} pulse_edge_t;
+
+typedef struct {
+    edge_ring_stats_t   turns;          /* the counter isr, once per turn   */
+    edge_ring_stats_t   pulses;         /* the capture isr, once per pulse  */
+    edge_ring_stats_t   quadrature;     /* the quadrature isr, once per turn, no ring */
+    uint32_t            updates;        /* of the speed                     */
+    uint32_t            glitches;       /* pulses dropped as noise          */
+    uint32_t            wakeups;        /* of the pulse task, both sides    */
+} pulse_stats_t;
 
 esp_err_t init_pulse();
 void deinit_pulse();
 void get_speed_time(uint64_t *speed_left, uint64_t *speed_right);
+void get_wheel_speed_time(uint64_t *speed_left, uint64_t *speed_right);
+void get_pulse_count(uint32_t *pulse_left, uint32_t *pulse_right);
+void get_pulse_edge(pulse_edge_t *left, pulse_edge_t *right);
+void get_pulse_stats(pulse_stats_t *stats_left, pulse_stats_t *stats_right);
+void get_tick_count(int32_t *ticks_left, int32_t *ticks_right);
+void get_wheel_direction(int8_t *left, int8_t *right);
+void set_pulse_capture(bool capture);
+bool get_pulse_capture();
 
 #endif /* MAIN_INCLUDE_PULSE_H_ */
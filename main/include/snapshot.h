@@ -0,0 +1,31 @@
+#ifndef MAIN_INCLUDE_SNAPSHOT_H_
+#define MAIN_INCLUDE_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "config.h"
+
+/*
+ *  Double-buffered seqlock for one writer and any number of readers.
+ *
+ *  The writer fills the buffer that readers are not pointed at and then
+ *  flips the sequence, so it never waits. A reader copies the current
+ *  buffer and retries only if the sequence moved meanwhile - it never sees
+ *  a torn copy and never takes a lock.
+ */
+typedef struct {
+    _Atomic uint32_t    seq;
+    _Atomic uint32_t    retries;        /* reads that had to be repeated */
+    size_t              size;
+    uint8_t            *buffer[2];
+} snapshot_t;
+
+bool snapshot_init(snapshot_t *snapshot, size_t size);
+void snapshot_free(snapshot_t *snapshot);
+void snapshot_publish(snapshot_t *snapshot, const void *data);
+uint32_t snapshot_read(snapshot_t *snapshot, void *data);
+
+#endif /* MAIN_INCLUDE_SNAPSHOT_H_ */
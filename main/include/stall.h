@@ -0,0 +1,39 @@
+#ifndef MAIN_INCLUDE_STALL_H_
+#define MAIN_INCLUDE_STALL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+/*
+ *  Stall detection of a wheel.
+ *
+ *  While a motor is driven, its encoder must bring a new pulse within
+ *  STALL_PULSES pulse intervals of the wheel speed its duty should give -
+ *  a few ms at full speed, a few hundred near VAL_SPEED_MIN, never less
+ *  than STALL_TIMEOUT_MIN_MS. The first pulse from rest gets STALL_SPINUP_MS
+ *  more. A blocked wheel is found that fast, not after COUNT_TIMEOUT of
+ *  pulse.c.
+ *
+ *  Below WHEEL_RPS_MIN the motor may not turn at all, so it is not watched.
+ *
+ *  Hardware independent - the caller passes the pulse count, the expected
+ *  speed and the time, so it runs the same on the car and on a host.
+ */
+typedef struct {
+    bool        armed;              /* the motor is driven              */
+    bool        moving;             /* a pulse came since armed         */
+    bool        stalled;            /* the last drive ended in a stall  */
+    uint32_t    pulses;             /* count at the last pulse          */
+    uint64_t    progress_us;        /* time of the last pulse or of the arming */
+    uint32_t    stalls;
+} stall_t;
+
+void stall_init(stall_t *stall);
+/* wheel speed in rev/s the duty should give, 0 - not driven */
+uint32_t stall_timeout_us(float expected_rps);
+/* true once when the wheel stalls, the detector is disarmed then */
+bool stall_update(stall_t *stall, uint32_t pulses, float expected_rps, uint64_t now_us);
+
+#endif /* MAIN_INCLUDE_STALL_H_ */
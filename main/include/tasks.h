@@ -0,0 +1,61 @@
+#ifndef MAIN_INCLUDE_TASKS_H_
+#define MAIN_INCLUDE_TASKS_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "config.h"
+
+/*
+ *  Every task of the car in one table - stack, priority and core.
+ *
+ *  The network stack owns the protocol core, what moves the car owns the
+ *  app core, so a burst of web requests never stands between a control
+ *  tick and its PWM write.
+ *
+ *  CORE_PROTOCOL (0), above all from ESP-IDF itself:
+ *
+ *      23  wifi            ESP-IDF
+ *      22  esp_timer       ESP-IDF, fires the control timer
+ *      18  tiT (lwIP)      ESP-IDF
+ *       5  httpd
+ *       3  wifi_check_task
+ *
+ *  CORE_APP (1), highest first:
+ *
+ *      20  driver_task     control loop, wakes on every control tick
+ *      19  pulse_task      wheel speed of both wheels from the encoder isrs
+ *      18  usonic_task     echo times, feeds the obstacle guard
+ *      17  steering_task   servo slew
+ *      10  autopilot_task  planner, may take a whole tick
+ *
+ *  The control timer callback only notifies driver_task across the cores.
+ *  With TASK_PINNING false every task floats like before - to compare the
+ *  loop jitter on /car_status with and without the pinning.
+ */
+
+typedef enum {
+    task_driver = 0,
+    task_pulse,
+    task_usonic,
+    task_steering,
+    task_autopilot,
+    task_httpd,
+    task_wifi_check,
+    tasks_count
+} task_id_t;
+
+typedef struct {
+    const char     *name;
+    uint32_t        stack;
+    UBaseType_t     priority;
+    BaseType_t      core;
+} task_config_t;
+
+const task_config_t *get_task_config(task_id_t id);
+/* the core of the task, tskNO_AFFINITY without TASK_PINNING */
+BaseType_t get_task_core(task_id_t id);
+/* name NULL - the name in the table */
+BaseType_t create_task(task_id_t id, TaskFunction_t code, const char *name, void *param, TaskHandle_t *handle);
+
+#endif /* MAIN_INCLUDE_TASKS_H_ */
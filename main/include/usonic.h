@@ -6,5 +6,6 @@
 esp_err_t init_usonic();
 void deinit_usonic();
 int16_t get_distance();
+int16_t wait_distance(uint64_t *time, uint32_t timeout_ms);
 
 #endif /* MAIN_INCLUDE_USONIC_H_ */
@@ -0,0 +1,61 @@
+#ifndef MAIN_INCLUDE_VELOCITY_H_
+#define MAIN_INCLUDE_VELOCITY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+#define VELOCITY_HISTORY    16          /* pulses kept for the window, must be a power of 2 */
+
+/*
+ *  Wheel speed estimate, new every control period.
+ *
+ *  Two measurements are blended by the number of pulses in the last
+ *  VELOCITY_WINDOW_MS:
+ *
+ *      counts  - pulses over the time between the first and the last of
+ *                them in the window, smooth at speed
+ *      period  - the time between the last two pulses, the only one with
+ *                something new at a crawl
+ *
+ *  The period weighs alone with one pulse in the window, the counts alone
+ *  from VELOCITY_COUNT_PULSES on.
+ *
+ *  Between pulses the measurement is bounded by the time since the last
+ *  one - a wheel that should have brought a pulse by now is slower than
+ *  that. Without a pulse for VELOCITY_STOP_MS it stands, so a stop is
+ *  known after that at the latest, not after COUNT_TIMEOUT. Pulses timed
+ *  only once per turn come PULSE_PER_TURN at a time, the bound and the
+ *  stop scale with them.
+ *
+ *  With VELOCITY_FILTER an alpha-beta filter (VELOCITY_ALPHA, VELOCITY_BETA)
+ *  follows the measurement and its rate of change.
+ *
+ *  Hardware independent - the caller passes the timed pulses and the time,
+ *  so it runs the same on the car and on a host.
+ */
+typedef struct {
+    float       rps;                /* estimate in rev/s, no sign       */
+    float       rate;               /* its change in rev/s^2            */
+    float       measured;           /* the blend before the filter      */
+    bool        standing;
+    uint32_t    pulses;             /* at the last pulse                */
+    uint64_t    pulse_us;
+    uint32_t    period_us;          /* before the last pulse, 0 - none  */
+    uint32_t    step;               /* pulses that came with it         */
+    struct {
+        uint32_t    pulses;
+        uint64_t    time_us;
+    } history[VELOCITY_HISTORY];
+    uint8_t     head;
+    uint8_t     count;
+    uint32_t    stops;
+} velocity_t;
+
+void velocity_init(velocity_t *velocity);
+/* pulses timed since start, the time of the last one and its period - every control period */
+float velocity_update(velocity_t *velocity, uint32_t pulses, uint64_t pulse_us, uint32_t period_us,
+                      uint64_t now_us, float dt);
+
+#endif /* MAIN_INCLUDE_VELOCITY_H_ */
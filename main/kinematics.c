@@ -0,0 +1,55 @@
+#include <string.h>
+#include <math.h>
+
+#include "kinematics.h"
+
+static int16_t angle_index(int16_t angle) {
+
+    if (angle < STEERING_ANGLE_MIN) angle = STEERING_ANGLE_MIN;
+    if (angle > STEERING_ANGLE_MAX) angle = STEERING_ANGLE_MAX;
+
+    return angle - STEERING_ANGLE_MIN;
+}
+
+/* steering_ratio - degrees of the road wheels per degree of the servo */
+void kinematics_init(kinematics_t *kinematics, float wheel_base, float track_width, float steering_ratio) {
+
+    float delta, curvature, ratio;
+
+    memset(kinematics, 0, sizeof(kinematics_t));
+
+    kinematics->wheel_base = wheel_base;
+    kinematics->track_width = track_width;
+
+    for (int16_t i = 0; i < KINEMATICS_ANGLES; i++) {
+        /* left turn is positive */
+        delta = (STEERING_STRAIGHT - (STEERING_ANGLE_MIN + i)) * steering_ratio * (float)M_PI / 180;
+        curvature = tanf(delta) / wheel_base;
+
+        /* (R - T/2) / (R + T/2) with R = 1/|curvature| */
+        ratio = (1 - fabsf(curvature) * track_width / 2) / (1 + fabsf(curvature) * track_width / 2);
+        if (ratio < 0) ratio = 0;   /* the turn center is inside the track */
+
+        kinematics->curvature[i] = curvature;
+        kinematics->ratio[i] = ratio;
+    }
+}
+
+/* speed factors of the wheels for angle, the outer wheel keeps 1 */
+void kinematics_wheel_ratio(const kinematics_t *kinematics, int16_t angle, float *left, float *right) {
+
+    int16_t i = angle_index(angle);
+
+    if (angle < STEERING_STRAIGHT) {
+        *left = kinematics->ratio[i];
+        *right = 1;
+    } else {
+        *left = 1;
+        *right = kinematics->ratio[i];
+    }
+}
+
+float kinematics_curvature(const kinematics_t *kinematics, int16_t angle) {
+
+    return kinematics->curvature[angle_index(angle)];
+}
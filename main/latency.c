@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "hal.h"
+#include "latency.h"
+
+#define LATENCY_ARMED   0x80000000      /* in stages - a trace is running */
+#define STAGE_BIT(s)    (1UL << (s))
+
+typedef struct {
+    uint32_t    count;
+    uint32_t    max_us;
+    uint32_t    bucket[LATENCY_BUCKETS];
+} latency_hist_t;
+
+typedef struct {
+    _Atomic uint32_t    received;       /* low 32 bits of the us clock */
+    _Atomic uint32_t    stages;         /* LATENCY_ARMED | stamped stages */
+} latency_trace_t;
+
+typedef struct {
+    latency_trace_t     trace[latency_cmds];
+    latency_hist_t      hist[latency_cmds][latency_stages];
+    _Atomic uint32_t    expired;
+} latency_t;
+
+static const char *TAG = "robot_car_latency";
+static latency_t *latency = NULL;
+
+static const char *cmd_names[latency_cmds] = {
+        "forward", "back", "stop", "turn", "speed", "other"
+};
+
+static const char *stage_names[latency_stages] = {
+        "parse", "dispatch", "queue", "pickup", "pwm", "servo"
+};
+
+/* the last stage of every command type */
+static const latency_stage_t cmd_end[latency_cmds] = {
+        latency_pwm, latency_pwm, latency_pwm, latency_servo, latency_pwm, latency_pickup
+};
+
+/* exact below 8 us, then 4 buckets per power of two */
+static uint32_t bucket_index(uint32_t us) {
+
+    uint32_t exp, index;
+
+    if (us < 8) return us;
+
+    exp = 31 - __builtin_clz(us);
+    index = 8 + (exp - 3) * 4 + ((us >> (exp - 2)) & 3);
+
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+/* the longest time in the bucket */
+static uint32_t bucket_limit(uint32_t index) {
+
+    uint32_t exp, sub;
+
+    if (index < 8) return index;
+
+    exp = 3 + (index - 8) / 4;
+    sub = (index - 8) % 4;
+
+    return ((4 + sub) << (exp - 2)) + (1UL << (exp - 2)) - 1;
+}
+
+static void hist_add(latency_hist_t *hist, uint32_t us) {
+
+    hist->bucket[bucket_index(us)]++;
+    if (us > hist->max_us) hist->max_us = us;
+    hist->count++;
+}
+
+/* upper limit of the bucket that holds the percentile, never above the max */
+static uint32_t hist_percentile(const latency_hist_t *hist, uint32_t percent) {
+
+    uint32_t rank, sum = 0, limit;
+
+    if (hist->count == 0) return 0;
+
+    rank = (hist->count * percent + 99) / 100;
+
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        sum += hist->bucket[i];
+        if (sum >= rank) {
+            limit = bucket_limit(i);
+            return limit < hist->max_us ? limit : hist->max_us;
+        }
+    }
+
+    return hist->max_us;
+}
+
+/* ============================================================================================= */
+
+esp_err_t init_latency() {
+
+    latency_t *lat;
+
+    ESP_LOGI(TAG, "Initialize latency histograms");
+
+    if (latency) {
+        ESP_LOGE(TAG, "Latency histograms already exist");
+        return ESP_FAIL;
+    }
+
+    lat = malloc(sizeof(latency_t));
+
+    if (lat == NULL) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    memset(lat, 0, sizeof(latency_t));
+
+    latency = lat;
+
+    return ESP_OK;
+}
+
+void deinit_latency() {
+
+    if (latency) {
+        free(latency);
+        latency = NULL;
+    }
+}
+
+/* called by webserver_car() right before the driver call */
+void latency_begin(latency_cmd_t cmd, uint32_t received, uint32_t parsed) {
+
+    latency_trace_t *trace;
+    uint32_t now = hal_time_us();
+
+    if (latency == NULL || cmd >= latency_cmds) return;
+
+    trace = &(latency->trace[cmd]);
+
+    /* disarmed while the time changes, a stamp meanwhile is lost */
+    atomic_store(&(trace->stages), 0);
+    atomic_store(&(trace->received), received);
+
+    hist_add(&(latency->hist[cmd][latency_parse]), parsed - received);
+    hist_add(&(latency->hist[cmd][latency_dispatch]), now - received);
+
+    atomic_store(&(trace->stages), LATENCY_ARMED | STAGE_BIT(latency_parse) | STAGE_BIT(latency_dispatch));
+}
+
+void latency_stamp(latency_cmd_t cmd, latency_stage_t stage) {
+
+    latency_trace_t *trace;
+    uint32_t stages, elapsed;
+
+    if (latency == NULL || cmd >= latency_cmds) return;
+
+    trace = &(latency->trace[cmd]);
+
+    stages = atomic_load(&(trace->stages));
+
+    if (!(stages & LATENCY_ARMED) || (stages & STAGE_BIT(stage))) return;
+    /* the actuation stages only for a command the control loop has seen */
+    if (stage > latency_pickup && !(stages & STAGE_BIT(latency_pickup))) return;
+
+    elapsed = hal_time_us() - atomic_load(&(trace->received));
+
+    if (elapsed > LATENCY_TIMEOUT_MS * 1000) {
+        if (atomic_compare_exchange_strong(&(trace->stages), &stages, 0)) {
+            atomic_fetch_add(&(latency->expired), 1);
+        }
+        return;
+    }
+
+    stages = atomic_fetch_or(&(trace->stages), STAGE_BIT(stage));
+    if (!(stages & LATENCY_ARMED) || (stages & STAGE_BIT(stage))) return;
+
+    hist_add(&(latency->hist[cmd][stage]), elapsed);
+
+    if (stage == cmd_end[cmd]) atomic_fetch_and(&(trace->stages), ~LATENCY_ARMED);
+}
+
+esp_err_t get_status_latency(cJSON *root) {
+
+    cJSON *cmd_root, *stage_root;
+    const latency_hist_t *hist;
+
+    if (latency == NULL) {
+        ESP_LOGE(TAG, "No latency histograms created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    for (int cmd = 0; cmd < latency_cmds; cmd++) {
+        if (latency->hist[cmd][latency_parse].count == 0) continue;
+
+        cmd_root = cJSON_AddObjectToObject(root, cmd_names[cmd]);
+        if (cmd_root == NULL) return ESP_FAIL;
+
+        for (int stage = 0; stage < latency_stages; stage++) {
+            hist = &(latency->hist[cmd][stage]);
+            if (hist->count == 0) continue;
+
+            stage_root = cJSON_AddObjectToObject(cmd_root, stage_names[stage]);
+            if (stage_root == NULL) return ESP_FAIL;
+
+            cJSON_AddNumberToObject(stage_root, "count", hist->count);
+            cJSON_AddNumberToObject(stage_root, "p50", hist_percentile(hist, 50));
+            cJSON_AddNumberToObject(stage_root, "p99", hist_percentile(hist, 99));
+            cJSON_AddNumberToObject(stage_root, "max", hist->max_us);
+        }
+    }
+
+    cJSON_AddNumberToObject(root, "expired", atomic_load(&(latency->expired)));
+
+    return ESP_OK;
+}
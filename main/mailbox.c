@@ -0,0 +1,144 @@
+#include <string.h>
+
+#include "mailbox.h"
+
+#define SETPOINT_PENDING    0x80000000
+#define SETPOINT_VALUE      0x0000ffff
+
+void mailbox_init(mailbox_t *mailbox) {
+
+    memset(mailbox, 0, sizeof(mailbox_t));
+
+    for (uint32_t i = 0; i < MAILBOX_EVENTS; i++) {
+        atomic_init(&(mailbox->slot[i].seq), i);
+    }
+}
+
+/*
+ *  Bounded ring with a sequence number per slot. A producer reserves a slot
+ *  by moving head with compare-and-swap, fills it and then publishes it by
+ *  writing seq = position + 1. The consumer frees the slot for the next lap
+ *  with seq = position + MAILBOX_EVENTS.
+ */
+static bool ring_post(mailbox_t *mailbox, int16_t event, int16_t value, uint32_t time) {
+
+    uint32_t pos, seq;
+    int32_t diff;
+
+    pos = atomic_load_explicit(&(mailbox->head), memory_order_relaxed);
+
+    while(1) {
+        seq = atomic_load_explicit(&(mailbox->slot[pos & (MAILBOX_EVENTS-1)].seq), memory_order_acquire);
+        diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&(mailbox->head), &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* full */
+            return false;
+        } else {
+            pos = atomic_load_explicit(&(mailbox->head), memory_order_relaxed);
+        }
+    }
+
+    mailbox->slot[pos & (MAILBOX_EVENTS-1)].event.event = event;
+    mailbox->slot[pos & (MAILBOX_EVENTS-1)].event.value = value;
+    mailbox->slot[pos & (MAILBOX_EVENTS-1)].event.time = time;
+
+    atomic_store_explicit(&(mailbox->slot[pos & (MAILBOX_EVENTS-1)].seq), pos + 1, memory_order_release);
+
+    return true;
+}
+
+bool mailbox_post_event(mailbox_t *mailbox, int16_t event, int16_t value, uint32_t time) {
+
+    if (ring_post(mailbox, event, value, time)) return true;
+
+    atomic_fetch_add_explicit(&(mailbox->dropped), 1, memory_order_relaxed);
+
+    return false;
+}
+
+/* consumer only */
+bool mailbox_get_event(mailbox_t *mailbox, mailbox_event_t *event) {
+
+    uint32_t pos = mailbox->tail;
+    uint32_t seq;
+
+    seq = atomic_load_explicit(&(mailbox->slot[pos & (MAILBOX_EVENTS-1)].seq), memory_order_acquire);
+
+    if (seq != pos + 1) return false;
+
+    *event = mailbox->slot[pos & (MAILBOX_EVENTS-1)].event;
+
+    atomic_store_explicit(&(mailbox->slot[pos & (MAILBOX_EVENTS-1)].seq), pos + MAILBOX_EVENTS, memory_order_release);
+    mailbox->tail = pos + 1;
+
+    return true;
+}
+
+/* event is a single bit, a full ring latches it - the value is lost then */
+void mailbox_post_latched(mailbox_t *mailbox, uint16_t event, int16_t value, uint32_t time) {
+
+    if (ring_post(mailbox, event, value, time)) return;
+
+    atomic_store_explicit(&(mailbox->latched_time), time, memory_order_relaxed);
+    atomic_fetch_or_explicit(&(mailbox->latched), event, memory_order_release);
+}
+
+/* consumer only, after the ring - the latched events, 0 - none */
+uint32_t mailbox_get_latched(mailbox_t *mailbox, uint32_t *time) {
+
+    uint32_t latched = atomic_exchange_explicit(&(mailbox->latched), 0, memory_order_acquire);
+
+    if (latched) *time = atomic_load_explicit(&(mailbox->latched_time), memory_order_relaxed);
+
+    return latched;
+}
+
+void mailbox_post_setpoint(mailbox_t *mailbox, uint8_t index, int16_t value, uint32_t time) {
+
+    uint32_t old;
+
+    atomic_store_explicit(&(mailbox->setpoint_time[index]), time, memory_order_relaxed);
+
+    old = atomic_exchange_explicit(&(mailbox->setpoint[index]),
+                                   SETPOINT_PENDING | (uint16_t)value, memory_order_release);
+
+    if (old & SETPOINT_PENDING) {
+        atomic_fetch_add_explicit(&(mailbox->coalesced), 1, memory_order_relaxed);
+    }
+}
+
+/* consumer only, returns true and the value if a new setpoint is pending */
+bool mailbox_get_setpoint(mailbox_t *mailbox, uint8_t index, int16_t *value, uint32_t *time) {
+
+    uint32_t old;
+
+    old = atomic_fetch_and_explicit(&(mailbox->setpoint[index]), ~SETPOINT_PENDING, memory_order_acquire);
+
+    if (!(old & SETPOINT_PENDING)) return false;
+
+    *value = (int16_t)(old & SETPOINT_VALUE);
+    *time = atomic_load_explicit(&(mailbox->setpoint_time[index]), memory_order_relaxed);
+
+    return true;
+}
+
+/* consumer only, the command posted at time took effect at now */
+void mailbox_actuated(mailbox_t *mailbox, uint32_t time, uint32_t now) {
+
+    mailbox->latency_us = now - time;
+    if (mailbox->latency_us > mailbox->latency_max_us) mailbox->latency_max_us = mailbox->latency_us;
+    mailbox->latency_sum_us += mailbox->latency_us;
+    mailbox->latency_count++;
+}
+
+uint32_t mailbox_latency_avg(const mailbox_t *mailbox) {
+
+    if (mailbox->latency_count == 0) return 0;
+
+    return mailbox->latency_sum_us / mailbox->latency_count;
+}
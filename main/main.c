@@ -16,6 +16,9 @@
 #include "utils.h"
 #include "pulse.h"
 #include "usonic.h"
+#include "autopilot.h"
+#include "mission.h"
+#include "latency.h"
 #include "http.h"
 #include "wifi.h"
 
@@ -53,9 +56,12 @@ void app_main(void) {
 #endif
 
     init_spiffs();
+    init_latency();
     init_usonic();
     init_driver();
     init_pulse();
+    init_autopilot();
+    init_mission();
     vTaskDelay(1000/portTICK_PERIOD_MS);
 //    deinit_pulse();
 //    deinit_pulse();
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "cJSON.h"
+
+#include "hal.h"
+#include "mission.h"
+#include "driver.h"
+#include "utils.h"
+
+#define MISSION_MAGIC   0x314e534d      /* "MSN1" */
+
+/*
+ *  File: mission_header_t, then steps mission_step_t. Times are ms from the
+ *  start of the recording.
+ */
+typedef struct {
+    uint32_t    magic;
+    uint32_t    steps;
+} mission_header_t;
+
+typedef struct {
+    uint32_t    time_ms;
+    uint8_t     cmd;
+    uint8_t     reserved;
+    int16_t     value;
+} mission_step_t;
+
+typedef enum {
+    mission_idle = 0,
+    mission_recording,
+    mission_playing
+} mission_state_t;
+
+typedef struct {
+    _Atomic uint32_t    state;
+    char                name[MISSION_NAME_LEN+1];
+    mission_step_t     *steps;
+    _Atomic uint32_t    count;          /* steps recorded or loaded */
+    uint32_t            next;           /* next step to play        */
+    uint64_t            start_us;
+    hal_timer_t         timer;
+    /* playback timing error, late is positive */
+    int32_t             error_us;
+    uint32_t            error_max_us;
+    int64_t             error_sum_us;
+    uint32_t            error_count;
+} mission_t;
+
+static const char *TAG = "robot_car_mission";
+static mission_t *mission = NULL;
+
+static bool check_name(const char *name) {
+
+    size_t len = strlen(name);
+
+    if (len == 0 || len > MISSION_NAME_LEN) return false;
+
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-') return false;
+    }
+
+    return true;
+}
+
+static void file_name(char *buff, const char *name) {
+    sprintf(buff, "%s%s", MISSION_PREFIX, name);
+}
+
+static void play_step(const mission_step_t *step) {
+
+    switch (step->cmd) {
+        case mission_forward_start:
+            forward_start_car();
+            break;
+        case mission_forward_stop:
+            forward_stop_car();
+            break;
+        case mission_back_start:
+            back_start_car();
+            break;
+        case mission_back_stop:
+            back_stop_car();
+            break;
+        case mission_left:
+            turn_left_car();
+            break;
+        case mission_right:
+            turn_right_car();
+            break;
+        case mission_turn_stop:
+            turn_stop_car();
+            break;
+        case mission_stop:
+            stop_car();
+            break;
+        case mission_speed:
+            set_speed_car(step->value);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ *  Runs in the timer task with us resolution - the FreeRTOS tick is
+ *  too coarse for ms timing. Plays every step that is due, then arms the
+ *  timer for the next one.
+ */
+static void mission_timer_callback(void *arg) {
+
+    mission_t *msn = (mission_t*)arg;
+    mission_step_t *step;
+    uint64_t now, due;
+    int64_t error;
+
+    if (atomic_load(&(msn->state)) != mission_playing) return;
+
+    now = hal_time_us();
+
+    while (msn->next < msn->count) {
+        step = &(msn->steps[msn->next]);
+        due = msn->start_us + step->time_ms * 1000ULL;
+        if (due > now) break;
+
+        error = now - due;
+        msn->error_us = error;
+        if (error > msn->error_max_us) msn->error_max_us = error;
+        msn->error_sum_us += error;
+        msn->error_count++;
+
+        play_step(step);
+        msn->next++;
+        now = hal_time_us();
+    }
+
+    if (msn->next >= msn->count) {
+        atomic_store(&(msn->state), mission_idle);
+        ESP_LOGI(TAG, "Mission \"%s\" played, timing error avg %d us, max %u us", msn->name,
+                 msn->error_count ? (int)(msn->error_sum_us / msn->error_count) : 0, msn->error_max_us);
+        return;
+    }
+
+    hal_timer_start_once(msn->timer, msn->start_us + msn->steps[msn->next].time_ms * 1000ULL - now);
+}
+
+static esp_err_t save_mission(mission_t *msn) {
+
+    char buff[64];
+    mission_header_t header;
+    FILE *f;
+
+    header.magic = MISSION_MAGIC;
+    header.steps = MIN(atomic_load(&(msn->count)), MISSION_STEPS_MAX);
+
+    file_name(buff, msn->name);
+
+    f = fopen(buff, "wb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Cannot open file %s. (%s:%u)", buff, __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(msn->steps, sizeof(mission_step_t), header.steps, f) != header.steps) {
+        ESP_LOGE(TAG, "Cannot write file %s. (%s:%u)", buff, __FILE__, __LINE__);
+        fclose(f);
+        return ESP_FAIL;
+    }
+
+    fclose(f);
+
+    ESP_LOGI(TAG, "Mission \"%s\" saved, %u steps", msn->name, header.steps);
+
+    return ESP_OK;
+}
+
+static esp_err_t load_mission(mission_t *msn) {
+
+    char buff[64];
+    mission_header_t header;
+    FILE *f;
+
+    file_name(buff, msn->name);
+
+    f = fopen(buff, "rb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Cannot open file %s. (%s:%u)", buff, __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != MISSION_MAGIC ||
+        header.steps > MISSION_STEPS_MAX ||
+        fread(msn->steps, sizeof(mission_step_t), header.steps, f) != header.steps) {
+        ESP_LOGE(TAG, "File %s is not a mission. (%s:%u)", buff, __FILE__, __LINE__);
+        fclose(f);
+        return ESP_FAIL;
+    }
+
+    fclose(f);
+
+    atomic_store(&(msn->count), header.steps);
+
+    return ESP_OK;
+}
+
+/* ============================================================================================= */
+
+esp_err_t init_mission() {
+
+    esp_err_t ret = ESP_FAIL;
+    mission_t *msn;
+
+    ESP_LOGI(TAG, "Initialize mission");
+
+    if (mission) {
+        ESP_LOGE(TAG, "Mission already exist");
+        return ret;
+    }
+
+    msn = malloc(sizeof(mission_t));
+
+    if (msn == NULL) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        return ret;
+    }
+
+    memset(msn, 0, sizeof(mission_t));
+
+    msn->steps = malloc(sizeof(mission_step_t) * MISSION_STEPS_MAX);
+
+    if (msn->steps == NULL) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        free(msn);
+        return ret;
+    }
+
+    ret = hal_timer_create(&(msn->timer), &mission_timer_callback, msn, "mission_timer");
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Create mission timer failed. (%s:%u)", __FILE__, __LINE__);
+        free(msn->steps);
+        free(msn);
+        return ret;
+    }
+
+    mission = msn;
+
+    return ESP_OK;
+}
+
+void deinit_mission() {
+
+    if (mission) {
+        ESP_LOGI(TAG, "Deinitialize mission");
+        stop_mission();
+        hal_timer_delete(mission->timer);
+        free(mission->steps);
+        free(mission);
+        mission = NULL;
+    } else {
+        ESP_LOGE(TAG, "Mission was not initialized");
+    }
+}
+
+/* every driver command from now on goes into the mission name */
+esp_err_t record_mission(const char *name) {
+
+    if (mission == NULL) {
+        ESP_LOGE(TAG, "No mission created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if (!get_status_spiffs() || !check_name(name)) {
+        ESP_LOGE(TAG, "Mission \"%s\" can not be recorded. (%s:%d)", name, __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if (atomic_load(&(mission->state)) != mission_idle) {
+        ESP_LOGE(TAG, "Mission \"%s\" is still running. (%s:%d)", mission->name, __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    strcpy(mission->name, name);
+    atomic_store(&(mission->count), 0);
+    mission->start_us = hal_time_us();
+    atomic_store(&(mission->state), mission_recording);
+
+    ESP_LOGI(TAG, "Recording mission \"%s\"", name);
+
+    return ESP_OK;
+}
+
+esp_err_t play_mission(const char *name) {
+
+    if (mission == NULL) {
+        ESP_LOGE(TAG, "No mission created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if (!get_status_spiffs() || !check_name(name)) {
+        ESP_LOGE(TAG, "Mission \"%s\" can not be played. (%s:%d)", name, __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    if (atomic_load(&(mission->state)) != mission_idle) {
+        ESP_LOGE(TAG, "Mission \"%s\" is still running. (%s:%d)", mission->name, __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    strcpy(mission->name, name);
+
+    if (load_mission(mission) != ESP_OK) return ESP_FAIL;
+
+    mission->next = 0;
+    mission->error_us = 0;
+    mission->error_max_us = 0;
+    mission->error_sum_us = 0;
+    mission->error_count = 0;
+    mission->start_us = hal_time_us();
+    atomic_store(&(mission->state), mission_playing);
+
+    ESP_LOGI(TAG, "Playing mission \"%s\", %u steps", name, mission->count);
+
+    mission_timer_callback(mission);
+
+    return ESP_OK;
+}
+
+/* ends a recording (and saves it) or a playback */
+void stop_mission() {
+
+    uint32_t state;
+
+    if (mission == NULL) {
+        ESP_LOGE(TAG, "No mission created. (%s:%d)", __FILE__, __LINE__);
+        return;
+    }
+
+    state = atomic_exchange(&(mission->state), mission_idle);
+
+    if (state == mission_recording) {
+        save_mission(mission);
+    } else if (state == mission_playing) {
+        hal_timer_stop(mission->timer);
+        ESP_LOGI(TAG, "Mission \"%s\" stopped", mission->name);
+    }
+}
+
+/* called by the driver for every command it accepts */
+void record_step_mission(mission_cmd_t cmd, int16_t value) {
+
+    uint32_t i;
+
+    if (mission == NULL || atomic_load(&(mission->state)) != mission_recording) return;
+
+    i = atomic_fetch_add(&(mission->count), 1);
+
+    if (i >= MISSION_STEPS_MAX) {
+        if (i == MISSION_STEPS_MAX) ESP_LOGE(TAG, "Mission \"%s\" is full. (%s:%d)", mission->name, __FILE__, __LINE__);
+        return;
+    }
+
+    mission->steps[i].time_ms = (hal_time_us() - mission->start_us) / 1000;
+    mission->steps[i].cmd = cmd;
+    mission->steps[i].reserved = 0;
+    mission->steps[i].value = value;
+}
+
+/* adds the mission keys to the status of the car */
+esp_err_t get_status_mission(cJSON *root) {
+
+    const char *state_str[] = {"idle", "recording", "playing"};
+
+    if (mission == NULL) {
+        ESP_LOGE(TAG, "No mission created. (%s:%d)", __FILE__, __LINE__);
+        return ESP_FAIL;
+    }
+
+    cJSON_AddStringToObject(root, "mission", state_str[atomic_load(&(mission->state))]);
+    cJSON_AddStringToObject(root, "mission_name", mission->name);
+    cJSON_AddNumberToObject(root, "mission_steps", MIN(atomic_load(&(mission->count)), MISSION_STEPS_MAX));
+    cJSON_AddNumberToObject(root, "mission_error", mission->error_us);
+    cJSON_AddNumberToObject(root, "mission_error_avg", mission->error_count ? mission->error_sum_us / mission->error_count : 0);
+    cJSON_AddNumberToObject(root, "mission_error_max", mission->error_max_us);
+
+    return ESP_OK;
+}
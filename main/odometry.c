@@ -0,0 +1,112 @@
+#include <string.h>
+#include <math.h>
+
+#include "odometry.h"
+
+void odometry_init(odometry_t *odometry, float track_width) {
+
+    memset(odometry, 0, sizeof(odometry_t));
+
+    odometry->track_width = track_width;
+}
+
+/* the pose is known exactly afterwards */
+void odometry_reset(odometry_t *odometry, float x, float y, float heading) {
+
+    odometry->x = x;
+    odometry->y = y;
+    odometry->heading = heading;
+    memset(odometry->cov, 0, sizeof(odometry->cov));
+}
+
+/*
+ *  left and right - distances in mm rolled by the wheels since the last
+ *  update, negative when reversing. curvature - 1/mm of the steering, > 0
+ *  to the left.
+ */
+void odometry_update(odometry_t *odometry, float left, float right, float curvature) {
+
+    float ds, var_wheels, var_ds;
+    float dh_wheels, var_wheels_h, dh_steer, var_steer_h, dh, var_h;
+    float mid, c, s;
+    float f02, f12, g00, g01, g10, g11;
+    float p[3][3];
+
+    if (left == 0 && right == 0) return;
+
+    ds = (left + right) / 2;
+
+    /* variance of each wheel grows with its distance */
+    var_wheels = ODOM_WHEEL_NOISE * (fabsf(left) + fabsf(right));
+    var_ds = var_wheels / 4;
+
+    dh_wheels = (right - left) / odometry->track_width;
+    var_wheels_h = var_wheels / (odometry->track_width * odometry->track_width);
+
+    dh_steer = ds * curvature;
+    var_steer_h = ds * ODOM_CURVATURE_NOISE * ds * ODOM_CURVATURE_NOISE;
+
+    /* inverse variance weighting, either estimate may be exact */
+    if (var_wheels_h <= 0 || ds == 0) {
+        /* the steering tells nothing without an arc */
+        dh = dh_wheels;
+        var_h = var_wheels_h;
+    } else if (var_steer_h <= 0) {
+        dh = dh_steer;
+        var_h = 0;
+    } else {
+        var_h = 1 / (1 / var_wheels_h + 1 / var_steer_h);
+        dh = var_h * (dh_wheels / var_wheels_h + dh_steer / var_steer_h);
+    }
+
+    /* move along the chord at the mean heading */
+    mid = odometry->heading + dh / 2;
+    c = cosf(mid);
+    s = sinf(mid);
+
+    odometry->x += ds * c;
+    odometry->y += ds * s;
+    odometry->heading += dh;
+    if (odometry->heading > (float)M_PI) odometry->heading -= 2 * (float)M_PI;
+    if (odometry->heading < -(float)M_PI) odometry->heading += 2 * (float)M_PI;
+
+    /*
+     *  P = F P F' + G Q G', F - jacobian by the pose, G - by (ds, dh),
+     *  Q = diag(var_ds, var_h). Only the non constant entries are kept.
+     *
+     *      F = | 1 0 f02 |     G = | g00 g01 |
+     *          | 0 1 f12 |         | g10 g11 |
+     *          | 0 0  1  |         |  0   1  |
+     */
+    f02 = -ds * s;
+    f12 = ds * c;
+    g00 = c;
+    g01 = -ds / 2 * s;
+    g10 = s;
+    g11 = ds / 2 * c;
+
+    memcpy(p, odometry->cov, sizeof(p));
+
+    /* F P F' */
+    odometry->cov[0][0] = p[0][0] + 2 * f02 * p[0][2] + f02 * f02 * p[2][2];
+    odometry->cov[0][1] = p[0][1] + f02 * p[1][2] + f12 * p[0][2] + f02 * f12 * p[2][2];
+    odometry->cov[0][2] = p[0][2] + f02 * p[2][2];
+    odometry->cov[1][1] = p[1][1] + 2 * f12 * p[1][2] + f12 * f12 * p[2][2];
+    odometry->cov[1][2] = p[1][2] + f12 * p[2][2];
+    odometry->cov[2][2] = p[2][2];
+
+    /* + G Q G' */
+    odometry->cov[0][0] += g00 * g00 * var_ds + g01 * g01 * var_h;
+    odometry->cov[0][1] += g00 * g10 * var_ds + g01 * g11 * var_h;
+    odometry->cov[0][2] += g01 * var_h;
+    odometry->cov[1][1] += g10 * g10 * var_ds + g11 * g11 * var_h;
+    odometry->cov[1][2] += g11 * var_h;
+    odometry->cov[2][2] += var_h;
+
+    odometry->cov[1][0] = odometry->cov[0][1];
+    odometry->cov[2][0] = odometry->cov[0][2];
+    odometry->cov[2][1] = odometry->cov[1][2];
+
+    odometry->distance += fabsf(ds);
+    odometry->updates++;
+}
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "pid.h"
+
+void pid_init(pid_ctrl_t *pid, float kp, float ki, float kd, float out_min, float out_max) {
+
+    memset(pid, 0, sizeof(pid_ctrl_t));
+
+    pid->kp = kp;
+    pid->ki = ki;
+    pid->kd = kd;
+    pid->out_min = out_min;
+    pid->out_max = out_max;
+}
+
+void pid_reset(pid_ctrl_t *pid) {
+
+    pid->integral = 0;
+    pid->prev_measured = 0;
+    pid->output = 0;
+    pid->started = false;
+}
+
+float pid_update(pid_ctrl_t *pid, float setpoint, float measured, float feed_forward, float dt) {
+
+    float error = setpoint - measured;
+    float derivative = 0;
+    float integral;
+    float output;
+
+    if (dt <= 0) return pid->output;
+
+    if (pid->started) {
+        derivative = -(measured - pid->prev_measured) / dt;
+    }
+
+    pid->prev_measured = measured;
+    pid->started = true;
+
+    integral = pid->integral + pid->ki * error * dt;
+
+    output = feed_forward + pid->kp * error + integral + pid->kd * derivative;
+
+    if (output > pid->out_max) {
+        output = pid->out_max;
+        /* saturated high - integrate only if the error pulls the output down */
+        if (error < 0) pid->integral = integral;
+    } else if (output < pid->out_min) {
+        output = pid->out_min;
+        /* saturated low - integrate only if the error pulls the output up */
+        if (error > 0) pid->integral = integral;
+    } else {
+        pid->integral = integral;
+    }
+
+    pid->output = output;
+
+    return output;
+}
@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "planner.h"
+
+void planner_init(planner_t *planner) {
+
+    memset(planner, 0, sizeof(planner_t));
+
+    planner->mode = plan_stop;
+    planner->distance = -1;
+    planner->turn = STEERING_ANGLE_MIN;
+    planner->cmd.steering = STEERING_STRAIGHT;
+}
+
+/* median of the samples so far - one bad echo does not steer the car */
+static int16_t planner_filter(planner_t *planner, int16_t distance) {
+
+    int16_t a, b, c;
+
+    planner->sample[planner->count % 3] = distance;
+    planner->count++;
+
+    if (planner->count < 3) return distance;
+
+    a = planner->sample[0];
+    b = planner->sample[1];
+    c = planner->sample[2];
+
+    if ((a <= b && b <= c) || (c <= b && b <= a)) return b;
+    if ((b <= a && a <= c) || (c <= a && a <= b)) return a;
+    return c;
+}
+
+static void planner_mode(planner_t *planner, plan_mode_t mode, uint64_t now) {
+
+    if (planner->mode == mode) return;
+
+    /* every back up tries the other side */
+    if (mode == plan_reverse) {
+        planner->turn = STEERING_STRAIGHT * 2 - planner->turn;
+    }
+
+    planner->mode = mode;
+    planner->mode_time = now;
+}
+
+/* returns true if the command has changed */
+bool planner_step(planner_t *planner, int16_t distance, uint64_t now, plan_cmd_t *cmd) {
+
+    plan_cmd_t new_cmd;
+    int16_t d;
+    uint64_t elapsed;
+
+    d = planner->distance = planner_filter(planner, distance);
+    elapsed = now - planner->mode_time;
+
+    if (d < 0) {
+        planner_mode(planner, plan_stop, now);
+    } else if (planner->mode == plan_reverse) {
+        /* back up for the whole time whatever the sensor says */
+        if (elapsed >= AUTO_REVERSE_MS * 1000ULL) planner_mode(planner, plan_turn, now);
+    } else if (d < AUTO_DIST_REVERSE) {
+        planner_mode(planner, plan_reverse, now);
+    } else if (planner->mode == plan_turn) {
+        if (elapsed >= AUTO_TURN_MAX_MS * 1000ULL) {
+            planner_mode(planner, plan_reverse, now);
+        } else if (d >= AUTO_DIST_SLOW) {
+            /* turn until the way is free, not just until the turn distance */
+            planner_mode(planner, plan_cruise, now);
+        }
+    } else if (d < AUTO_DIST_TURN) {
+        planner_mode(planner, plan_turn, now);
+    } else if (d < AUTO_DIST_SLOW) {
+        planner_mode(planner, plan_slow, now);
+    } else {
+        planner_mode(planner, plan_cruise, now);
+    }
+
+    switch (planner->mode) {
+        case plan_cruise:
+            new_cmd.direction = 1;
+            new_cmd.speed = AUTO_SPEED_CRUISE;
+            new_cmd.steering = STEERING_STRAIGHT;
+            break;
+        case plan_slow:
+            new_cmd.direction = 1;
+            new_cmd.speed = AUTO_SPEED_SLOW;
+            new_cmd.steering = STEERING_STRAIGHT;
+            break;
+        case plan_turn:
+            new_cmd.direction = 1;
+            new_cmd.speed = AUTO_SPEED_SLOW;
+            new_cmd.steering = planner->turn;
+            break;
+        case plan_reverse:
+            new_cmd.direction = -1;
+            new_cmd.speed = AUTO_SPEED_SLOW;
+            new_cmd.steering = STEERING_STRAIGHT * 2 - planner->turn;
+            break;
+        case plan_stop:
+        default:
+            new_cmd.direction = 0;
+            new_cmd.speed = SPEED_MIN;
+            new_cmd.steering = planner->cmd.steering;
+            break;
+    }
+
+    *cmd = new_cmd;
+
+    if (new_cmd.direction == planner->cmd.direction && new_cmd.speed == planner->cmd.speed &&
+        new_cmd.steering == planner->cmd.steering) {
+        return false;
+    }
+
+    planner->cmd = new_cmd;
+
+    return true;
+}
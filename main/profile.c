@@ -0,0 +1,86 @@
+#include <string.h>
+#include <math.h>
+
+#include "profile.h"
+
+static float sign(float x) {
+    return (x > 0) - (x < 0);
+}
+
+void profile_init(profile_t *profile, float accel_max, float jerk_max, float value) {
+
+    memset(profile, 0, sizeof(profile_t));
+
+    profile->accel_max = accel_max;
+    profile->jerk_max = jerk_max;
+    profile->value = value;
+}
+
+/* jump to value and stop there, e.g. after an emergency stop */
+void profile_reset(profile_t *profile, float value) {
+
+    profile->value = value;
+    profile->accel = 0;
+}
+
+float profile_update(profile_t *profile, float target, float dt) {
+
+    float distance = target - profile->value;
+    float dir = sign(distance);
+    float stop;
+
+    if (dt <= 0 || (distance == 0 && profile->accel == 0)) return profile->value;
+
+    if (profile->jerk_max <= 0) {
+        profile->accel = dir * profile->accel_max;
+    } else {
+        /* distance covered while the rate is brought back to zero */
+        stop = profile->accel * fabsf(profile->accel) / (2 * profile->jerk_max);
+
+        if ((distance - stop) * dir > 0) {
+            profile->accel += dir * profile->jerk_max * dt;
+            if (profile->accel > profile->accel_max) profile->accel = profile->accel_max;
+            if (profile->accel < -profile->accel_max) profile->accel = -profile->accel_max;
+        } else if (profile->accel > 0) {
+            profile->accel -= profile->jerk_max * dt;
+            if (profile->accel < 0) profile->accel = 0;
+        } else if (profile->accel < 0) {
+            profile->accel += profile->jerk_max * dt;
+            if (profile->accel > 0) profile->accel = 0;
+        }
+    }
+
+    profile->value += profile->accel * dt;
+
+    /* reached or crossed the target */
+    if ((target - profile->value) * dir <= 0) {
+        profile->value = target;
+        profile->accel = 0;
+    }
+
+    return profile->value;
+}
+
+/* the value where the profile comes to rest if the rate is brought to zero now */
+float profile_stop_point(const profile_t *profile) {
+
+    if (profile->jerk_max <= 0) return profile->value;
+
+    return profile->value + profile->accel * fabsf(profile->accel) / (2 * profile->jerk_max);
+}
+
+/* time in seconds of a ramp over distance starting and ending at rest */
+float profile_duration(float distance, float accel_max, float jerk_max) {
+
+    distance = fabsf(distance);
+
+    if (accel_max <= 0) return 0;
+
+    if (jerk_max <= 0) return distance / accel_max;
+
+    if (distance >= accel_max * accel_max / jerk_max) {
+        return distance / accel_max + accel_max / jerk_max;
+    }
+
+    return 2 * sqrtf(distance / jerk_max);
+}
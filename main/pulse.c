@@ -1,71 +1,279 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include "esp_log.h"
-#include "driver/pcnt.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 
+#include "hal.h"
 #include "pulse.h"
+#include "edge_ring.h"
+#include "snapshot.h"
+#include "tasks.h"
+
+#define PULSE_FILTER    100             /* APB clock cycles, shorter glitches are ignored */
+#define COUNT_REREADS   16              /* reads of a counter caught between its limit and the isr */
 
 typedef struct {
-    uint64_t        time_previous;
-    uint64_t        time_current;
-    uint64_t        speed;
-    pcnt_config_t   pcnt_config;
-    QueueHandle_t   queue;
-    TaskHandle_t    handler;
+    edge_ring_t     edges;                  /* turn times from the counter isr  */
+    edge_ring_t     pulses;                 /* us << 32 | ticks of every pulse from the capture isr */
+    uint64_t        time_last;              /* pulse task only from here on     */
+    uint32_t        ticks_last;
+    bool            ticks_valid;
+    uint32_t        period[CAPTURE_WINDOW]; /* ticks between the last pulses    */
+    uint32_t        window;                 /* their sum                        */
+    uint8_t         index;
+    uint8_t         periods;
+    pulse_edge_t    edge_last;              /* the last timed pulse ...         */
+    snapshot_t      edge;                   /* ... published for the control loop */
+    uint64_t        moved_us;               /* the last pulse the pulse task saw */
+    int32_t         position_last;          /* quadrature ticks at the last look of the control loop */
+    _Atomic uint32_t speed;                 /* us per turn, 0 - standing        */
+    _Atomic uint32_t updates;
+    _Atomic uint32_t glitches;
+    _Atomic int32_t turns;                  /* signed, from the quadrature isr  */
+    _Atomic uint32_t quad_isrs;             /* runs of the quadrature isr ...   */
+    _Atomic uint32_t quad_cycles;           /* ... the cycles they took, wraps  */
+    _Atomic uint32_t quad_cycles_max;
+    _Atomic uint32_t pulses_read;           /* the highest pulse count handed out */
+    _Atomic int32_t ticks_read;             /* the last tick count handed out   */
+    int8_t          direction;              /* 1 forward, -1 back, 0 unknown    */
+    int             pin;
+    int             pin_b;
+    uint8_t         unit;
+    uint8_t         unit_quad;
+    uint8_t         channel;
+    TaskHandle_t    handler;                /* the pulse task of both sides     */
 } speed_sensor_side_t;
 
 typedef struct {
     speed_sensor_side_t *sensor_left;
     speed_sensor_side_t *sensor_right;
+    TaskHandle_t    handler;
+    _Atomic uint32_t wakeups;
 } speed_sensor_t;
 
 static const char *TAG = "robot_car_pulse";
 static speed_sensor_t *speed_sensor = NULL;
+static _Atomic bool pulse_capture = PULSE_CAPTURE;
 
-static void pulse_task(void *pvParameter) {
+static void set_speed(speed_sensor_side_t *sensor, uint32_t speed) {
 
-    speed_sensor_side_t *sensor = (speed_sensor_side_t*)pvParameter;
+    atomic_store(&(sensor->speed), speed);
+    atomic_fetch_add(&(sensor->updates), 1);
+}
 
-    int16_t unit;
-    uint64_t start;
+static void capture_reset(speed_sensor_side_t *sensor) {
 
+    memset(sensor->period, 0, sizeof(sensor->period));
+    sensor->window = 0;
+    sensor->index = 0;
+    sensor->periods = 0;
+    sensor->ticks_valid = false;
+}
 
-    start = esp_timer_get_time();
-    while(1) {
-        if (xQueueReceive(sensor->queue, &unit, 100/portTICK_PERIOD_MS) == pdTRUE) {
-            sensor->speed  = sensor->time_current - sensor->time_previous;
-            pcnt_counter_clear(sensor->pcnt_config.unit);
-        } else {
-            if (esp_timer_get_time() - start > COUNT_TIMEOUT*1000) {
-                sensor->speed = 0;
-                start = esp_timer_get_time();
-            }
+/* the period since the last pulse into the window, 0 for the first one - false for a glitch */
+static bool capture_pulse(speed_sensor_side_t *sensor, uint32_t ticks, uint32_t *period_ticks) {
+
+    uint32_t period;
+
+    *period_ticks = 0;
+
+    if (!sensor->ticks_valid) {
+        sensor->ticks_last = ticks;
+        sensor->ticks_valid = true;
+        return true;
+    }
+
+    /* wraps every 53 s, far longer than COUNT_TIMEOUT */
+    period = ticks - sensor->ticks_last;
+
+    /* noise between two pulses, the next one is measured from the last good one */
+    if (period < CAPTURE_GLITCH_US * (HAL_CAPTURE_HZ / 1000000)) {
+        atomic_fetch_add(&(sensor->glitches), 1);
+        return false;
+    }
+
+    sensor->ticks_last = ticks;
+    sensor->window += period - sensor->period[sensor->index];
+    sensor->period[sensor->index] = period;
+    sensor->index = (sensor->index + 1) % CAPTURE_WINDOW;
+    if (sensor->periods < CAPTURE_WINDOW) sensor->periods++;
+
+    *period_ticks = period;
+
+    return true;
+}
+
+/* us per turn from the pulses of the window */
+static uint32_t capture_speed(speed_sensor_side_t *sensor) {
+
+    return (uint64_t)sensor->window * PULSE_PER_TURN / sensor->periods / (HAL_CAPTURE_HZ / 1000000);
+}
+
+/* whole signed turns from the isr plus the ticks of the current turn */
+static int32_t read_tick_count(speed_sensor_side_t *sensor) {
+
+    int32_t turns;
+    int16_t count;
+
+    do {
+        turns = atomic_load(&(sensor->turns));
+        count = hal_counter_get(sensor->unit_quad);
+    } while (turns != atomic_load(&(sensor->turns)));
+
+    return turns * ENCODER_TICKS + count;
+}
+
+/*
+ *  The counter is back at 0 a moment before the isr counts the turn, a
+ *  read in between is a whole turn off. Nothing turns half a turn between
+ *  two reads of the control loop, so such a jump is read again until the
+ *  isr has run.
+ */
+static int32_t get_tick_count_side(speed_sensor_side_t *sensor) {
+
+    int32_t ticks, last = atomic_load(&(sensor->ticks_read));
+
+    for (int i = 0; i < COUNT_REREADS; i++) {
+        ticks = read_tick_count(sensor);
+        if (abs(ticks - last) <= ENCODER_TICKS / 2) break;
+    }
+
+    atomic_store(&(sensor->ticks_read), ticks);
+
+    return ticks;
+}
+
+/* the way the wheel moved since the last look, kept while it stands */
+static void quadrature_direction(speed_sensor_side_t *sensor) {
+
+    int32_t position = get_tick_count_side(sensor);
+
+    if (position == sensor->position_last) return;
+
+    sensor->direction = position > sensor->position_last ? 1 : -1;
+    sensor->position_last = position;
+}
+
+/* pulses more timed, the last of them at time_us, period_us after the one before */
+static void edge_pulse(speed_sensor_side_t *sensor, uint32_t pulses, uint64_t time_us, uint32_t period_us) {
+
+    sensor->edge_last.pulses += pulses;
+    sensor->edge_last.time_us = time_us;
+    sensor->edge_last.period_us = period_us;
+}
+
+/* the new edges of one side */
+static void pulse_side(speed_sensor_side_t *sensor, bool capture) {
+
+    uint64_t time, now;
+    uint32_t period;
+    bool moved = false;
+
+    while (edge_ring_pop(&(sensor->edges), &time)) {
+        if (!capture) {
+            if (sensor->time_last) set_speed(sensor, time - sensor->time_last);
+            edge_pulse(sensor, PULSE_PER_TURN, time,
+                       sensor->time_last ? (time - sensor->time_last) / PULSE_PER_TURN : 0);
+        }
+        sensor->time_last = time;
+        moved = true;
+    }
+
+    now = hal_time_us();
+    while (edge_ring_pop(&(sensor->pulses), &time)) {
+        if (capture_pulse(sensor, (uint32_t)time, &period) && capture) {
+            if (period) set_speed(sensor, capture_speed(sensor));
+            /* the low 32 bits of the isr time, it was a moment ago */
+            edge_pulse(sensor, 1, now - (uint32_t)((uint32_t)now - (uint32_t)(time >> 32)),
+                       period / (HAL_CAPTURE_HZ / 1000000));
         }
+        moved = true;
+    }
+
+    /* the counter starts over at the limit by itself, a clear here would lose pulses */
+    if (moved) {
+        snapshot_publish(&(sensor->edge), &(sensor->edge_last));
+        sensor->moved_us = now;
+    } else if (now - sensor->moved_us > COUNT_TIMEOUT*1000) {
+        atomic_store(&(sensor->speed), 0);
+        capture_reset(sensor);
+        sensor->moved_us = now;
+    }
+}
+
+/*
+ *  One task for both wheels, every isr of either side wakes it. Notifies
+ *  that come while it runs add up to a single wake up. A side is only
+ *  looked at once init_pulse() has it.
+ */
+static void pulse_task(void *pvParameter) {
+
+    speed_sensor_t *sensor = (speed_sensor_t*)pvParameter;
+    bool capture;
+
+    while(1) {
+        ulTaskNotifyTake(pdTRUE, 100/portTICK_PERIOD_MS);
+        atomic_fetch_add(&(sensor->wakeups), 1);
+
+        capture = atomic_load(&pulse_capture);
+
+        if (sensor->sensor_left) pulse_side(sensor->sensor_left, capture);
+        if (sensor->sensor_right) pulse_side(sensor->sensor_right, capture);
     }
 }
 
-static void IRAM_ATTR speed_intr_handler_left(void *arg) {
+/* a wheel turn - the time into the ring and a wake up for the pulse task */
+static void IRAM_ATTR speed_intr_handler(void *arg) {
+
     speed_sensor_side_t *sensor = (speed_sensor_side_t*)arg;
-    sensor->time_previous = sensor->time_current;
-    sensor->time_current = esp_timer_get_time();
-    xQueueSendFromISR(sensor->queue, &(sensor->pcnt_config.unit), NULL);
+    uint32_t cycles = hal_cycles();
+    BaseType_t woken = pdFALSE;
+
+    edge_ring_push(&(sensor->edges), hal_time_us());
+    vTaskNotifyGiveFromISR(sensor->handler, &woken);
+
+    edge_ring_isr_time(&(sensor->edges), hal_cycles() - cycles);
+
+    if (woken) portYIELD_FROM_ISR();
 }
 
-static void IRAM_ATTR speed_intr_handler_right(void *arg) {
+/* the quadrature counter hit +-ENCODER_TICKS - a turn in that direction */
+static void IRAM_ATTR quadrature_intr_handler(void *arg) {
+
     speed_sensor_side_t *sensor = (speed_sensor_side_t*)arg;
-    sensor->time_previous = sensor->time_current;
-    sensor->time_current = esp_timer_get_time();
-    xQueueSendFromISR(sensor->queue, &(sensor->pcnt_config.unit), NULL);
+    uint32_t cycles = hal_cycles();
+
+    atomic_store(&(sensor->turns), atomic_load(&(sensor->turns)) + hal_counter_direction(sensor->unit_quad));
+
+    cycles = hal_cycles() - cycles;
+    atomic_store(&(sensor->quad_isrs), atomic_load(&(sensor->quad_isrs)) + 1);
+    atomic_store(&(sensor->quad_cycles), atomic_load(&(sensor->quad_cycles)) + cycles);
+    if (cycles > atomic_load(&(sensor->quad_cycles_max))) atomic_store(&(sensor->quad_cycles_max), cycles);
 }
 
+/* a pulse - its capture time into the ring and a wake up for the pulse task */
+static bool IRAM_ATTR capture_intr_handler(uint32_t ticks, void *arg) {
+
+    speed_sensor_side_t *sensor = (speed_sensor_side_t*)arg;
+    uint32_t cycles = hal_cycles();
+    BaseType_t woken = pdFALSE;
+
+    edge_ring_push(&(sensor->pulses), (uint64_t)(uint32_t)hal_time_us() << 32 | ticks);
+    vTaskNotifyGiveFromISR(sensor->handler, &woken);
 
-static speed_sensor_side_t *create_sensor_side(int pin, uint8_t pcnt_unit, uint8_t pcnt_channel) {
+    edge_ring_isr_time(&(sensor->pulses), hal_cycles() - cycles);
+
+    return woken == pdTRUE;
+}
+
+static speed_sensor_side_t *create_sensor_side(int pin, int pin_b, uint8_t unit, uint8_t unit_quad, uint8_t channel,
+                                               TaskHandle_t handler) {
     esp_err_t ret = ESP_FAIL;
     speed_sensor_side_t *sensor;
-    char task_name[16];
 
     if (speed_sensor) {
         if (speed_sensor->sensor_left && speed_sensor->sensor_right) {
@@ -83,68 +291,78 @@ static speed_sensor_side_t *create_sensor_side(int pin, uint8_t pcnt_unit, uint8
 
     memset(sensor, 0, sizeof(speed_sensor_side_t));
 
-    sensor->pcnt_config.pulse_gpio_num = pin;
-    sensor->pcnt_config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
-    sensor->pcnt_config.channel = pcnt_channel;
-    sensor->pcnt_config.unit = pcnt_unit;
-    // What to do on the positive / negative edge of pulse input?
-    sensor->pcnt_config.pos_mode = PCNT_COUNT_INC;          // Count up on the positive edge
-    sensor->pcnt_config.neg_mode = PCNT_COUNT_DIS;          // Keep the counter value on the negative edge
-    sensor->pcnt_config.lctrl_mode = PCNT_MODE_REVERSE;     // Reverse counting direction if low
-    sensor->pcnt_config.hctrl_mode = PCNT_MODE_KEEP;        // Keep the primary counter mode if high
-    sensor->pcnt_config.counter_l_lim = - PULSE_PER_TURN;
+    sensor->pin = pin;
+    sensor->pin_b = pin_b;
+    sensor->unit = unit;
+    sensor->unit_quad = unit_quad;
+    sensor->channel = channel;
+    sensor->handler = handler;
+    sensor->moved_us = hal_time_us();
 
-    /* Initialize PCNT unit */
-    ret = pcnt_unit_config(&(sensor->pcnt_config));
+    /* Initialize PCNT unit, counts down to -PULSE_PER_TURN and starts paused */
+    ret = hal_counter_init(sensor->unit, sensor->pin, PULSE_PER_TURN, PULSE_FILTER);
 
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Error set pcnt config. (%s:%u)", __FILE__, __LINE__);
-        gpio_reset_pin(sensor->pcnt_config.pulse_gpio_num);
+        hal_pin_reset(sensor->pin);
         free(sensor);
         return NULL;
     }
 
-    sensor->queue = xQueueCreate(10, sizeof(int16_t));
+    /* both channels on a unit of its own, the one above keeps the plain pulse count */
+    if (ENCODER_QUADRATURE) {
+        ret = hal_counter_init_quadrature(sensor->unit_quad, sensor->pin, sensor->pin_b, ENCODER_TICKS, PULSE_FILTER);
 
-    if (!sensor->queue) {
-        ESP_LOGE(TAG, "Create queue failed. (%s:%u)", __FILE__, __LINE__);
-        gpio_reset_pin(sensor->pcnt_config.pulse_gpio_num);
-        free(sensor);
-        return NULL;
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Error set quadrature pcnt config. (%s:%u)", __FILE__, __LINE__);
+            hal_pin_reset(sensor->pin);
+            hal_pin_reset(sensor->pin_b);
+            free(sensor);
+            return NULL;
+        }
     }
 
-    sprintf(task_name, "pulse_task_%u", sensor->pcnt_config.unit);
-    xTaskCreate(&pulse_task, task_name, 2048, sensor, 5, &(sensor->handler));
-    if (!sensor->handler) {
-        ESP_LOGE(TAG, "Create task \"%s\" failed. (%s:%u)", task_name, __FILE__, __LINE__);
-        vQueueDelete(sensor->queue);
-        gpio_reset_pin(sensor->pcnt_config.pulse_gpio_num);
+    if (!snapshot_init(&(sensor->edge), sizeof(pulse_edge_t))) {
+        ESP_LOGE(TAG, "Error allocation memory. (%s:%u)", __FILE__, __LINE__);
+        hal_pin_reset(sensor->pin);
         free(sensor);
         return NULL;
     }
 
-    /* Configure and enable the input filter */
-    pcnt_set_filter_value(sensor->pcnt_config.unit, 100);
-    pcnt_filter_enable(sensor->pcnt_config.unit);
-
-//    pcnt_event_enable(sensor->pcnt_config.unit, PCNT_EVT_H_LIM);
-    pcnt_event_enable(sensor->pcnt_config.unit, PCNT_EVT_L_LIM);
-
-
-    /* Initialize PCNT's counter */
-    pcnt_counter_pause(sensor->pcnt_config.unit);
-    pcnt_counter_clear(sensor->pcnt_config.unit);
+    edge_ring_init(&(sensor->edges));
+    edge_ring_init(&(sensor->pulses));
+    atomic_init(&(sensor->speed), 0);
+    atomic_init(&(sensor->updates), 0);
+    atomic_init(&(sensor->glitches), 0);
+    atomic_init(&(sensor->turns), 0);
+    atomic_init(&(sensor->quad_isrs), 0);
+    atomic_init(&(sensor->quad_cycles), 0);
+    atomic_init(&(sensor->quad_cycles_max), 0);
+    atomic_init(&(sensor->pulses_read), 0);
+    atomic_init(&(sensor->ticks_read), 0);
+
+    /* the same pin through the GPIO matrix, every pulse with its own time */
+    ret = hal_capture_init(sensor->channel, sensor->pin, capture_intr_handler, sensor);
 
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error set capture config. (%s:%u)", __FILE__, __LINE__);
+        snapshot_free(&(sensor->edge));
+        hal_pin_reset(sensor->pin);
+        free(sensor);
+        return NULL;
+    }
 
     return sensor;
 }
 
 static void delete_sensor_side(speed_sensor_side_t *sensor) {
 
-    vTaskDelete(sensor->handler);
-    vQueueDelete(sensor->queue);
-    pcnt_isr_handler_remove(sensor->pcnt_config.unit);
-    gpio_reset_pin(sensor->pcnt_config.pulse_gpio_num);
+    hal_capture_deinit(sensor->channel);
+    hal_counter_isr_remove(sensor->unit);
+    if (ENCODER_QUADRATURE) hal_counter_isr_remove(sensor->unit_quad);
+    hal_pin_reset(sensor->pin);
+    if (ENCODER_QUADRATURE) hal_pin_reset(sensor->pin_b);
+    snapshot_free(&(sensor->edge));
 
     free(sensor);
 
@@ -172,10 +390,19 @@ esp_err_t init_pulse() {
     }
 
     memset(sensor, 0, sizeof(speed_sensor_t));
+    atomic_init(&(sensor->wakeups), 0);
 
-    sensor_side = create_sensor_side(INPUT_LEFT, UNIT_LEFT, CHANNEL);
+    create_task(task_pulse, &pulse_task, NULL, sensor, &(sensor->handler));
+    if (!sensor->handler) {
+        ESP_LOGE(TAG, "Create task \"%s\" failed. (%s:%u)", get_task_config(task_pulse)->name, __FILE__, __LINE__);
+        free(sensor);
+        return ret;
+    }
+
+    sensor_side = create_sensor_side(INPUT_LEFT, INPUT_LEFT_B, UNIT_LEFT, UNIT_QUAD_LEFT, CAPTURE_LEFT, sensor->handler);
     if (sensor_side == NULL) {
         ESP_LOGE(TAG, "Left speed sensor not created. (%s:%u)", __FILE__, __LINE__);
+        vTaskDelete(sensor->handler);
         free(sensor);
         return ret;
     }
@@ -184,17 +411,20 @@ esp_err_t init_pulse() {
     ESP_LOGI(TAG, "Speed sensor left side created");
 
     /* Install interrupt service and add isr callback handler */
-    pcnt_isr_service_install(ESP_INTR_FLAG_LEVEL3);
-//    pcnt_isr_service_install(0);
-    pcnt_isr_handler_add(sensor_side->pcnt_config.unit, speed_intr_handler_left, sensor_side);
+    hal_counter_isr_install();
+    hal_counter_isr_add(sensor_side->unit, speed_intr_handler, sensor_side);
+    if (ENCODER_QUADRATURE) hal_counter_isr_add(sensor_side->unit_quad, quadrature_intr_handler, sensor_side);
     /* Everything is set up, now go to counting */
-    pcnt_counter_resume(sensor_side->pcnt_config.unit);
+    hal_counter_start(sensor_side->unit);
+    if (ENCODER_QUADRATURE) hal_counter_start(sensor_side->unit_quad);
 
-    sensor_side = create_sensor_side(INPUT_RIGHT, UNIT_RIGHT, CHANNEL);
+    sensor_side = create_sensor_side(INPUT_RIGHT, INPUT_RIGHT_B, UNIT_RIGHT, UNIT_QUAD_RIGHT, CAPTURE_RIGHT,
+                                     sensor->handler);
     if (sensor_side == NULL) {
         ESP_LOGE(TAG, "Right speed sensor not created. (%s:%u)", __FILE__, __LINE__);
+        vTaskDelete(sensor->handler);
         delete_sensor_side(sensor->sensor_left);
-        pcnt_isr_service_uninstall();
+        hal_counter_isr_uninstall();
         free(sensor);
         return ret;
     }
@@ -202,9 +432,14 @@ esp_err_t init_pulse() {
     sensor->sensor_right = sensor_side;
     ESP_LOGI(TAG, "Speed sensor right side created");
 
-    pcnt_isr_handler_add(sensor_side->pcnt_config.unit, speed_intr_handler_right, sensor_side);
+    hal_counter_isr_add(sensor_side->unit, speed_intr_handler, sensor_side);
+    if (ENCODER_QUADRATURE) hal_counter_isr_add(sensor_side->unit_quad, quadrature_intr_handler, sensor_side);
     /* Everything is set up, now go to counting */
-    pcnt_counter_resume(sensor_side->pcnt_config.unit);
+    hal_counter_start(sensor_side->unit);
+    if (ENCODER_QUADRATURE) hal_counter_start(sensor_side->unit_quad);
+
+    /* a task of its own per wheel took as much again */
+    ESP_LOGI(TAG, "One pulse task for both wheels, %u bytes of stack", get_task_config(task_pulse)->stack);
 
     vTaskDelay(500/portTICK_PERIOD_MS);
 
@@ -216,6 +451,7 @@ esp_err_t init_pulse() {
 void deinit_pulse() {
     if (speed_sensor) {
         ESP_LOGI(TAG, "Deinitialize speed sensor");
+        vTaskDelete(speed_sensor->handler);
         if (speed_sensor->sensor_left) {
             delete_sensor_side(speed_sensor->sensor_left);
             ESP_LOGI(TAG, "Speed sensor left side deleted");
@@ -224,7 +460,7 @@ void deinit_pulse() {
             delete_sensor_side(speed_sensor->sensor_right);
             ESP_LOGI(TAG, "Speed sensor right side deleted");
         }
-        pcnt_isr_service_uninstall();
+        hal_counter_isr_uninstall();
         free(speed_sensor);
         speed_sensor = NULL;
     } else {
@@ -232,6 +468,55 @@ void deinit_pulse() {
     }
 }
 
+/* whole turns from the isr plus the pulses of the current turn, the counter counts down */
+static uint32_t read_pulse_count(speed_sensor_side_t *sensor) {
+
+    uint32_t turns;
+    int16_t count;
+
+    do {
+        turns = atomic_load(&(sensor->edges.edges));
+        count = hal_counter_get(sensor->unit);
+    } while (turns != atomic_load(&(sensor->edges.edges)));
+
+    return turns * PULSE_PER_TURN - count;
+}
+
+/*
+ *  The count only grows - one below the last means the counter was caught
+ *  back at 0 before the isr counted the turn. It is read again until the
+ *  isr has run, else the last count stands.
+ */
+static uint32_t get_pulse_count_side(speed_sensor_side_t *sensor) {
+
+    uint32_t pulses, last = atomic_load(&(sensor->pulses_read));
+
+    for (int i = 0; i < COUNT_REREADS; i++) {
+        pulses = read_pulse_count(sensor);
+        if ((int32_t)(pulses - last) >= 0) break;
+    }
+
+    if ((int32_t)(pulses - last) < 0) return last;
+
+    /* any task reads, the highest count wins */
+    while ((int32_t)(pulses - last) > 0 && !atomic_compare_exchange_weak(&(sensor->pulses_read), &last, pulses));
+
+    return pulses;
+}
+
+/* pulses since start, they only grow - the direction is not known */
+void get_pulse_count(uint32_t *pulse_left, uint32_t *pulse_right) {
+
+    if (speed_sensor == NULL) {
+       *pulse_left  = 0;
+       *pulse_right = 0;
+       return;
+    }
+
+    *pulse_left  = get_pulse_count_side(speed_sensor->sensor_left);
+    *pulse_right = get_pulse_count_side(speed_sensor->sensor_right);
+}
+
 void get_speed_time(uint64_t *speed_left, uint64_t *speed_right) {
 
     if (speed_sensor == NULL) {
@@ -240,9 +525,101 @@ void get_speed_time(uint64_t *speed_left, uint64_t *speed_right) {
        return;
     }
 
-    *speed_left  = speed_sensor->sensor_left->speed;
-    *speed_right = speed_sensor->sensor_right->speed;
+    *speed_left  = atomic_load(&(speed_sensor->sensor_left->speed));
+    *speed_right = atomic_load(&(speed_sensor->sensor_right->speed));
+
+}
+
+/* us per wheel turn - an encoder on the motor shaft turns ENCODER_GEAR_RATIO times for one */
+void get_wheel_speed_time(uint64_t *speed_left, uint64_t *speed_right) {
+
+    get_speed_time(speed_left, speed_right);
+
+    *speed_left  = *speed_left * ENCODER_GEAR_RATIO + 0.5f;
+    *speed_right = *speed_right * ENCODER_GEAR_RATIO + 0.5f;
+}
+
+/*
+ *  The pulses timed so far and the time and period of the last one, in
+ *  the mode of set_pulse_capture() - per pulse or per turn. Any task, the
+ *  pulse task publishes them as one.
+ */
+void get_pulse_edge(pulse_edge_t *left, pulse_edge_t *right) {
+
+    if (speed_sensor == NULL) {
+        memset(left, 0, sizeof(pulse_edge_t));
+        memset(right, 0, sizeof(pulse_edge_t));
+        return;
+    }
+
+    snapshot_read(&(speed_sensor->sensor_left->edge), left);
+    snapshot_read(&(speed_sensor->sensor_right->edge), right);
+}
 
+static void get_pulse_stats_side(speed_sensor_side_t *sensor, pulse_stats_t *stats) {
+
+    edge_ring_get_stats(&(sensor->edges), &(stats->turns));
+    edge_ring_get_stats(&(sensor->pulses), &(stats->pulses));
+    stats->quadrature.edges = atomic_load(&(sensor->quad_isrs));
+    stats->quadrature.overflows = 0;
+    stats->quadrature.isr_cycles_avg = stats->quadrature.edges ?
+            atomic_load(&(sensor->quad_cycles)) / stats->quadrature.edges : 0;
+    stats->quadrature.isr_cycles_max = atomic_load(&(sensor->quad_cycles_max));
+    stats->updates = atomic_load(&(sensor->updates));
+    stats->glitches = atomic_load(&(sensor->glitches));
+    stats->wakeups = atomic_load(&(speed_sensor->wakeups));
 }
 
+void get_pulse_stats(pulse_stats_t *stats_left, pulse_stats_t *stats_right) {
 
+    if (speed_sensor == NULL) {
+        memset(stats_left, 0, sizeof(pulse_stats_t));
+        memset(stats_right, 0, sizeof(pulse_stats_t));
+        return;
+    }
+
+    get_pulse_stats_side(speed_sensor->sensor_left, stats_left);
+    get_pulse_stats_side(speed_sensor->sensor_right, stats_right);
+}
+
+/* signed ticks since start, ENCODER_TICKS per turn - 0 without ENCODER_QUADRATURE */
+void get_tick_count(int32_t *ticks_left, int32_t *ticks_right) {
+
+    if (speed_sensor == NULL || !ENCODER_QUADRATURE) {
+       *ticks_left  = 0;
+       *ticks_right = 0;
+       return;
+    }
+
+    *ticks_left  = get_tick_count_side(speed_sensor->sensor_left);
+    *ticks_right = get_tick_count_side(speed_sensor->sensor_right);
+}
+
+/*
+ *  The way the wheels turned last, 1 forward, -1 back - 0 while not known
+ *  or without ENCODER_QUADRATURE. One caller only, the control loop - a
+ *  tick backwards is seen at its next period.
+ */
+void get_wheel_direction(int8_t *left, int8_t *right) {
+
+    if (speed_sensor == NULL || !ENCODER_QUADRATURE) {
+       *left  = 0;
+       *right = 0;
+       return;
+    }
+
+    quadrature_direction(speed_sensor->sensor_left);
+    quadrature_direction(speed_sensor->sensor_right);
+
+    *left  = speed_sensor->sensor_left->direction;
+    *right = speed_sensor->sensor_right->direction;
+}
+
+/* takes effect with the next pulse */
+void set_pulse_capture(bool capture) {
+    atomic_store(&pulse_capture, capture);
+}
+
+bool get_pulse_capture() {
+    return atomic_load(&pulse_capture);
+}
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+bool snapshot_init(snapshot_t *snapshot, size_t size) {
+
+    memset(snapshot, 0, sizeof(snapshot_t));
+
+    snapshot->buffer[0] = calloc(2, size);
+
+    if (snapshot->buffer[0] == NULL) return false;
+
+    snapshot->buffer[1] = snapshot->buffer[0] + size;
+    snapshot->size = size;
+
+    return true;
+}
+
+void snapshot_free(snapshot_t *snapshot) {
+
+    free(snapshot->buffer[0]);
+    snapshot->buffer[0] = snapshot->buffer[1] = NULL;
+}
+
+/* writer only */
+void snapshot_publish(snapshot_t *snapshot, const void *data) {
+
+    uint32_t seq = atomic_load_explicit(&(snapshot->seq), memory_order_relaxed);
+
+    /* the last move of seq before the new data, a reader late on this buffer sees it moved */
+    atomic_thread_fence(memory_order_release);
+
+    /* readers use buffer[seq & 1], the other one is free */
+    memcpy(snapshot->buffer[(seq + 1) & 1], data, snapshot->size);
+
+    atomic_store_explicit(&(snapshot->seq), seq + 1, memory_order_release);
+}
+
+/*
+ *  The writer only touches buffer[seq & 1] after it has moved seq on, so the
+ *  copy is consistent if seq did not change while it was taken.
+ *  Returns the version of the copy.
+ */
+uint32_t snapshot_read(snapshot_t *snapshot, void *data) {
+
+    uint32_t seq, check;
+
+    seq = atomic_load_explicit(&(snapshot->seq), memory_order_acquire);
+
+    while(1) {
+        memcpy(data, snapshot->buffer[seq & 1], snapshot->size);
+        atomic_thread_fence(memory_order_acquire);
+        check = atomic_load_explicit(&(snapshot->seq), memory_order_acquire);
+        if (check == seq) break;
+        atomic_fetch_add_explicit(&(snapshot->retries), 1, memory_order_relaxed);
+        seq = check;
+    }
+
+    return seq;
+}
@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "stall.h"
+
+void stall_init(stall_t *stall) {
+
+    memset(stall, 0, sizeof(stall_t));
+}
+
+uint32_t stall_timeout_us(float expected_rps) {
+
+    uint32_t timeout;
+
+    if (expected_rps < WHEEL_RPS_MIN) return 0;
+
+    timeout = STALL_PULSES * 1000000.0f / (expected_rps * PULSE_PER_WHEEL);
+
+    return timeout > STALL_TIMEOUT_MIN_MS * 1000 ? timeout : STALL_TIMEOUT_MIN_MS * 1000;
+}
+
+bool stall_update(stall_t *stall, uint32_t pulses, float expected_rps, uint64_t now_us) {
+
+    uint64_t timeout = stall_timeout_us(expected_rps);
+
+    if (timeout == 0) {
+        stall->armed = false;
+        return false;
+    }
+
+    if (!stall->armed) {
+        stall->armed = true;
+        stall->moving = false;
+        stall->stalled = false;
+        stall->pulses = pulses;
+        stall->progress_us = now_us;
+        return false;
+    }
+
+    /* the count only grows, a step back is no progress */
+    if ((int32_t)(pulses - stall->pulses) > 0) {
+        stall->moving = true;
+        stall->pulses = pulses;
+        stall->progress_us = now_us;
+        return false;
+    }
+
+    if (!stall->moving) timeout += STALL_SPINUP_MS * 1000;
+
+    if (now_us - stall->progress_us <= timeout) return false;
+
+    stall->armed = false;
+    stall->stalled = true;
+    stall->stalls++;
+
+    return true;
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include "esp_log.h"
+
+#include "tasks.h"
+
+static const char *TAG = "robot_car_tasks";
+
+static const task_config_t task_table[tasks_count] = {
+    /* name                 stack   priority    core            */
+    { "driver_task",        4096,   20,         CORE_APP        },
+    { "pulse_task",         2048,   19,         CORE_APP        },
+    { "usonic_task",        2048,   18,         CORE_APP        },
+    { "steering_task",      2048,   17,         CORE_APP        },
+    { "autopilot_task",     3072,   10,         CORE_APP        },
+    { "httpd",              8096,   5,          CORE_PROTOCOL   },
+    { "wifi_check_task",    4096,   3,          CORE_PROTOCOL   },
+};
+
+const task_config_t *get_task_config(task_id_t id) {
+
+    if (id >= tasks_count) return NULL;
+
+    return &(task_table[id]);
+}
+
+BaseType_t get_task_core(task_id_t id) {
+
+    if (!TASK_PINNING || id >= tasks_count) return tskNO_AFFINITY;
+
+    return task_table[id].core;
+}
+
+BaseType_t create_task(task_id_t id, TaskFunction_t code, const char *name, void *param, TaskHandle_t *handle) {
+
+    const task_config_t *task = get_task_config(id);
+    BaseType_t ret;
+
+    if (task == NULL) {
+        ESP_LOGE(TAG, "Unknown task %d. (%s:%u)", id, __FILE__, __LINE__);
+        return pdFAIL;
+    }
+
+    if (name == NULL) name = task->name;
+
+    ret = xTaskCreatePinnedToCore(code, name, task->stack, param, task->priority, handle, get_task_core(id));
+
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Create task \"%s\" failed. (%s:%u)", name, __FILE__, __LINE__);
+    }
+
+    return ret;
+}
@@ -3,25 +3,37 @@
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "driver/gpio.h"
+#include "freertos/queue.h"
+#include "cJSON.h"
 
+#include "hal.h"
 #include "usonic.h"
+#include "driver.h"
+#include "tasks.h"
 
 #define TRIG_LOW_DELAY  4
 #define TRIG_HIGH_DELAY 10
 #define BUFF_SIZE       8
-#define ECHO_TIMEOUT    10000
-#define TIME_MEASURE    50000
+#define ECHO_WAIT_MS    60              /* longer than the echo of the max range */
 #define ROUNDUP         58
 
 static char *TAG = "robot_car_usonic";
 
+typedef struct {
+    int16_t distance;
+    uint64_t time;
+} usonic_echo_t;
+
 typedef struct {
     int trig_gpio;
     int echo_gpio;
     uint32_t trig_low_delay;
     uint32_t trig_high_delay;
     uint64_t echo_resp_time[BUFF_SIZE];
+    volatile uint64_t echo_start;           /* rising edge of the echo, set in the isr   */
+    volatile uint64_t echo_time;            /* falling edge of the echo, set in the isr  */
+    volatile uint32_t echo_us;
+    QueueHandle_t echo_queue;               /* holds only the latest echo */
     TaskHandle_t handler_usonic_task;
 } usonic_t;
 
@@ -50,49 +62,94 @@ int16_t get_distance() {
     return  (value / ROUNDUP);
 }
 
-static void usonic_task(void *param) {
+/*
+ *  Waits for the next measurement and returns it unfiltered - at the full
+ *  rate of the sensor. time is when the echo ended. -1 if there was no echo
+ *  or none came within timeout_ms. For one reader only.
+ */
+int16_t wait_distance(uint64_t *time, uint32_t timeout_ms) {
+
+    usonic_echo_t echo;
+
+    if (usonic == NULL) {
+        ESP_LOGE(TAG, "No ultrasonic device created. (%s:%d)", __FILE__, __LINE__);
+        return -1;
+    }
+
+    if (xQueueReceive(usonic->echo_queue, &echo, timeout_ms/portTICK_PERIOD_MS) != pdTRUE) {
+        *time = hal_time_us();
+        return -1;
+    }
+
+    *time = echo.time;
+
+    return echo.distance;
+}
+
+/*
+ *  Both edges of the echo. The falling edge is the end of the measurement -
+ *  the collision guard of the driver gets the distance right here, before
+ *  any task is scheduled.
+ */
+static void IRAM_ATTR echo_intr_handler(void *arg) {
+
+    usonic_t *sonic = (usonic_t*)arg;
+    uint64_t now = hal_time_us();
+    BaseType_t woken = pdFALSE;
+
+    if (hal_pin_get(sonic->echo_gpio)) {
+        sonic->echo_start = now;
+        return;
+    }
+
+    if (sonic->echo_start == 0) return;
 
-    uint64_t start, finish;
+    sonic->echo_us = now - sonic->echo_start;
+    sonic->echo_time = now;
+    sonic->echo_start = 0;
+
+    guard_car_isr(sonic->echo_us / ROUNDUP, now);
+
+    vTaskNotifyGiveFromISR(sonic->handler_usonic_task, &woken);
+    if (woken) portYIELD_FROM_ISR();
+}
+
+static void usonic_task(void *param) {
 
     usonic_t *sonic = (usonic_t*)param;
 
-    int level;
     uint8_t count = 0;
-    bool set_dist;
+    usonic_echo_t echo;
 
     while(1) {
 
-        gpio_set_level(sonic->trig_gpio, LOW);
-        ets_delay_us(sonic->trig_low_delay);
-        /* impulse of 10 us */
-        gpio_set_level(sonic->trig_gpio, HIGH);
-        ets_delay_us(sonic->trig_high_delay);
-        gpio_set_level(sonic->trig_gpio, LOW);
-
-        if (gpio_get_level(sonic->echo_gpio)) {
+        if (hal_pin_get(sonic->echo_gpio)) {
             vTaskDelay(50/portTICK_PERIOD_MS);
             continue;
         }
 
-        set_dist = false;
-        /* read distance in us */
-        for(int i = 0; i < ECHO_TIMEOUT; i++) {
-            level = gpio_get_level(sonic->echo_gpio);
-            if (level) {
-                start = esp_timer_get_time();
-                for(uint16_t i = 0; i < TIME_MEASURE && level; i++) {
-                    level = gpio_get_level(sonic->echo_gpio);
-                }
-                finish = esp_timer_get_time();
-                sonic->echo_resp_time[count++&(BUFF_SIZE-1)] = finish - start;
-                set_dist = true;
-                break;
-            }
-        }
+        sonic->echo_start = 0;
+        ulTaskNotifyTake(pdTRUE, 0);
 
-        if (!set_dist) {
+        hal_pin_set(sonic->trig_gpio, LOW);
+        hal_delay_us(sonic->trig_low_delay);
+        /* impulse of 10 us */
+        hal_pin_set(sonic->trig_gpio, HIGH);
+        hal_delay_us(sonic->trig_high_delay);
+        hal_pin_set(sonic->trig_gpio, LOW);
+
+        /* the echo is measured by echo_intr_handler() */
+        if (ulTaskNotifyTake(pdTRUE, ECHO_WAIT_MS/portTICK_PERIOD_MS)) {
+            sonic->echo_resp_time[count++&(BUFF_SIZE-1)] = sonic->echo_us;
+            echo.distance = sonic->echo_us / ROUNDUP;
+            echo.time = sonic->echo_time;
+        } else {
             sonic->echo_resp_time[count++&(BUFF_SIZE-1)] = -1;
+            echo.distance = -1;
+            echo.time = hal_time_us();
         }
+
+        xQueueOverwrite(sonic->echo_queue, &echo);
         vTaskDelay(20/portTICK_PERIOD_MS);
     }
 }
@@ -113,12 +170,21 @@ static usonic_t *create_usonic() {
 
     sonic->trig_low_delay = TRIG_LOW_DELAY;
     sonic->trig_high_delay = TRIG_HIGH_DELAY;
+    sonic->echo_start = 0;
 
     memset(&(sonic->echo_resp_time), -1, sizeof(uint64_t)*BUFF_SIZE);
 
-    xTaskCreate(&usonic_task, "usonic_task", 2048, sonic, 0, &(sonic->handler_usonic_task));
+    sonic->echo_queue = xQueueCreate(1, sizeof(usonic_echo_t));
+    if (!sonic->echo_queue) {
+        ESP_LOGE(TAG, "Create echo queue failed. (%s:%u)", __FILE__, __LINE__);
+        free(sonic);
+        return NULL;
+    }
+
+    create_task(task_usonic, &usonic_task, NULL, sonic, &(sonic->handler_usonic_task));
     if (!sonic->handler_usonic_task) {
         ESP_LOGE(TAG, "Create ultrasonic task failed. (%s:%u)", __FILE__, __LINE__);
+        vQueueDelete(sonic->echo_queue);
         free(sonic);
         return NULL;
     }
@@ -131,9 +197,11 @@ static usonic_t *create_usonic() {
 static void delete_usonic(usonic_t *sonic) {
 
     if (sonic) {
-        gpio_reset_pin(sonic->trig_gpio);
-        gpio_reset_pin(sonic->echo_gpio);
+        hal_pin_isr_remove(sonic->echo_gpio);
+        hal_pin_reset(sonic->trig_gpio);
+        hal_pin_reset(sonic->echo_gpio);
         vTaskDelete(sonic->handler_usonic_task);
+        vQueueDelete(sonic->echo_queue);
         free(sonic);
         ESP_LOGI(TAG, "Ultrasonic device deleted.");
     } else {
@@ -163,11 +231,11 @@ esp_err_t init_usonic() {
         return ret;
     }
 
-    gpio_reset_pin(sonic->trig_gpio);
-    gpio_reset_pin(sonic->echo_gpio);
+    hal_pin_reset(sonic->trig_gpio);
+    hal_pin_reset(sonic->echo_gpio);
 
     /* Configure gpio for trigger's output of HC-SR04 */
-    ret = gpio_set_direction(sonic->trig_gpio, GPIO_MODE_OUTPUT);
+    ret = hal_pin_output(sonic->trig_gpio);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Trigger GPIO_NUM%d set failure. (%s:%u)", sonic->trig_gpio, __FILE__, __LINE__);
         ESP_LOGE(TAG, "Could not init ultrasonic. (%s:%u)", __FILE__, __LINE__);
@@ -175,10 +243,10 @@ esp_err_t init_usonic() {
         return ret;
     }
 
-    gpio_set_level(sonic->trig_gpio, LOW);
+    hal_pin_set(sonic->trig_gpio, LOW);
 
     /* Configure gpio for echo's input of HC-SR04 */
-    ret = gpio_set_direction(sonic->echo_gpio, GPIO_MODE_INPUT);
+    ret = hal_pin_input(sonic->echo_gpio);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Echo GPIO_NUM%d set failure. (%s:%u)", sonic->echo_gpio, __FILE__, __LINE__);
         ESP_LOGE(TAG, "Could not init ultrasonic. (%s:%u)", __FILE__, __LINE__);
@@ -186,6 +254,14 @@ esp_err_t init_usonic() {
         return ret;
     }
 
+    ret = hal_pin_isr_add(sonic->echo_gpio, echo_intr_handler, sonic);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Echo GPIO_NUM%d interrupt set failure. (%s:%u)", sonic->echo_gpio, __FILE__, __LINE__);
+        ESP_LOGE(TAG, "Could not init ultrasonic. (%s:%u)", __FILE__, __LINE__);
+        delete_usonic(sonic);
+        return ret;
+    }
+
     vTaskDelay(200/portTICK_PERIOD_MS);
 
     usonic = sonic;
@@ -0,0 +1,98 @@
+#include <string.h>
+
+#include "velocity.h"
+
+void velocity_init(velocity_t *velocity) {
+
+    memset(velocity, 0, sizeof(velocity_t));
+    velocity->standing = true;
+}
+
+static void velocity_stop(velocity_t *velocity) {
+
+    if (!velocity->standing) velocity->stops++;
+
+    velocity->rps = 0;
+    velocity->rate = 0;
+    velocity->measured = 0;
+    velocity->count = 0;
+    velocity->standing = true;
+}
+
+/* rev/s of the pulses in the window before the last pulse, n - how many periods it spans */
+static float velocity_counts(const velocity_t *velocity, uint32_t *n) {
+
+    uint8_t index, oldest = velocity->head;
+    uint32_t span;
+
+    for (uint8_t i = 1; i < velocity->count; i++) {
+        index = (velocity->head - i) & (VELOCITY_HISTORY-1);
+        if (velocity->pulse_us - velocity->history[index].time_us > VELOCITY_WINDOW_MS * 1000) break;
+        oldest = index;
+    }
+
+    *n = velocity->pulses - velocity->history[oldest].pulses;
+    span = velocity->pulse_us - velocity->history[oldest].time_us;
+
+    if (*n == 0 || span == 0) return 0;
+
+    return *n * 1000000.0f / ((float)span * PULSE_PER_WHEEL);
+}
+
+float velocity_update(velocity_t *velocity, uint32_t pulses, uint64_t pulse_us, uint32_t period_us,
+                      uint64_t now_us, float dt) {
+
+    float period, counts, weight, bound, predicted, residual;
+    uint32_t n;
+
+    if (pulses != velocity->pulses) {
+        velocity->step = pulses - velocity->pulses;
+        velocity->pulses = pulses;
+        velocity->pulse_us = pulse_us;
+        /* a period over a stop says nothing of the speed */
+        velocity->period_us = period_us <= VELOCITY_STOP_MS * 1000 ? period_us : 0;
+        velocity->head = (velocity->head + 1) & (VELOCITY_HISTORY-1);
+        velocity->history[velocity->head].pulses = pulses;
+        velocity->history[velocity->head].time_us = pulse_us;
+        if (velocity->count < VELOCITY_HISTORY) velocity->count++;
+        velocity->standing = false;
+    }
+
+    if (velocity->standing) return 0;
+
+    if (now_us - velocity->pulse_us > VELOCITY_STOP_MS * 1000 * velocity->step) {
+        velocity_stop(velocity);
+        return 0;
+    }
+
+    period = velocity->period_us ? 1000000.0f / ((float)velocity->period_us * PULSE_PER_WHEEL) : 0;
+    counts = velocity_counts(velocity, &n);
+
+    if (n <= 1) weight = 0;
+    else if (n >= VELOCITY_COUNT_PULSES) weight = 1;
+    else weight = (float)(n - 1) / (VELOCITY_COUNT_PULSES - 1);
+
+    velocity->measured = weight * counts + (1 - weight) * period;
+
+    /* the next step is late - the wheel is slower than one that brings it now */
+    bound = velocity->step * 1000000.0f / ((float)(now_us - velocity->pulse_us + 1) * PULSE_PER_WHEEL);
+    if (velocity->measured > bound) velocity->measured = bound;
+
+    if (!VELOCITY_FILTER || dt <= 0) {
+        velocity->rps = velocity->measured;
+        return velocity->rps;
+    }
+
+    predicted = velocity->rps + velocity->rate * dt;
+    residual = velocity->measured - predicted;
+
+    velocity->rps = predicted + VELOCITY_ALPHA * residual;
+    velocity->rate += VELOCITY_BETA * residual / dt;
+
+    if (velocity->rps < 0) {
+        velocity->rps = 0;
+        velocity->rate = 0;
+    }
+
+    return velocity->rps;
+}
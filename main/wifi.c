@@ -8,6 +8,7 @@
 #include "esp_log.h"
 
 #include "wifi.h"
+#include "tasks.h"
 
 #define WIFI_CONNECTED_BIT 		BIT0
 #define WIFI_FAIL_BIT      		BIT1
@@ -111,7 +112,7 @@ void wifi_check_task(void *pvParameter) {
 void wifi_init() {
 
     s_wifi_event_group = xEventGroupCreate();
-    xTaskCreate(&wifi_check_task, "wifi_check_task", 4096, NULL, 5, NULL);
+    create_task(task_wifi_check, &wifi_check_task, NULL, NULL, NULL);
 
     ESP_ERROR_CHECK(esp_netif_init());
 